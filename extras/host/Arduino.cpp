@@ -0,0 +1,123 @@
+/**********************************************************************************************************************************/
+#include "Arduino.h"
+
+HostSerial Serial;
+
+static unsigned long long now_us = 0;
+static unsigned long long idle_us = 0;
+
+#define HOST_PINS	64
+
+static uint8_t pin_state[HOST_PINS];
+static void (*pin_isr[HOST_PINS])(void);
+static int pin_isr_mode[HOST_PINS];
+static HostPinHook pin_hook = NULL;
+static HostTickHook tick_hook = NULL;
+static HostDelayHook delay_hook = NULL;
+static bool interrupts_on = true;
+/**********************************************************************************************************************************/
+unsigned long millis() {
+	return (unsigned long)(now_us / 1000);
+}
+
+unsigned long micros() {
+	return (unsigned long)now_us;
+}
+
+void delay(unsigned long ms) {
+	if (delay_hook) {
+		delay_hook(ms);
+		return;
+	}
+	hostIdle(ms);
+}
+
+void hostIdle(unsigned long ms) {
+	if (!tick_hook) {
+		now_us += (unsigned long long)ms * 1000;
+		idle_us += (unsigned long long)ms * 1000;
+		return;
+	}
+	for (unsigned long i = 0; i < ms; i++) {
+		now_us += 1000;
+		idle_us += 1000;
+		tick_hook();
+	}
+}
+
+void delayMicroseconds(unsigned int us) {
+	now_us += us;
+	idle_us += us;
+}
+
+void yield() {
+}
+
+unsigned long long hostIdleMicros() {
+	return idle_us;
+}
+
+void hostAdvanceMicros(unsigned long long us) {
+	now_us += us;
+}
+
+void hostSetDelayHook(HostDelayHook hook) {
+	delay_hook = hook;
+}
+/**********************************************************************************************************************************/
+void pinMode(uint8_t pin, uint8_t mode) {
+	if ((pin < HOST_PINS) && (mode == INPUT_PULLUP)) {
+		pin_state[pin] = HIGH;
+	}
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+	if (pin >= HOST_PINS) return;
+	pin_state[pin] = value;
+	if (pin_hook) {
+		pin_hook(pin, value);
+	}
+}
+
+int digitalRead(uint8_t pin) {
+	return (pin < HOST_PINS) ? pin_state[pin] : LOW;
+}
+
+void attachInterrupt(uint8_t interrupt, void (*isr)(void), int mode) {
+	if (interrupt >= HOST_PINS) return;
+	pin_isr[interrupt] = isr;
+	pin_isr_mode[interrupt] = mode;
+}
+
+void detachInterrupt(uint8_t interrupt) {
+	if (interrupt >= HOST_PINS) return;
+	pin_isr[interrupt] = NULL;
+}
+
+void noInterrupts() {
+	interrupts_on = false;
+}
+
+void interrupts() {
+	interrupts_on = true;
+}
+
+void hostSetPinHook(HostPinHook hook) {
+	pin_hook = hook;
+}
+
+void hostSetTickHook(HostTickHook hook) {
+	tick_hook = hook;
+}
+
+void hostDrivePin(uint8_t pin, uint8_t value) {
+	if (pin >= HOST_PINS) return;
+	uint8_t old = pin_state[pin];
+	pin_state[pin] = value;
+	if ((old == value) || !pin_isr[pin] || !interrupts_on) return;
+
+	int mode = pin_isr_mode[pin];
+	if ((mode == CHANGE) || ((mode == FALLING) && (value == LOW)) || ((mode == RISING) && (value == HIGH))) {
+		pin_isr[pin]();
+	}
+}
@@ -0,0 +1,224 @@
+/**********************************************************************************************************************************/
+// Host (Linux) replacement of the parts of the Arduino core used by ASIM.
+// Time is virtual: millis() only moves when the code calls delay(), so a 20 second
+// modem timeout costs no wall time and every run is reproducible.
+/**********************************************************************************************************************************/
+#ifndef ASIM_HOST_ARDUINO_H
+#define ASIM_HOST_ARDUINO_H
+
+// C++ headers first, the min/max macros below would break them
+#include <string>
+#include <deque>
+#include <functional>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#define ARDUINO				100
+#define ASIM_HOST
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+// pgmspace: flash and RAM are the same on the host
+class __FlashStringHelper;
+#define PROGMEM
+#define PSTR(s)				(s)
+#define F(s)				(reinterpret_cast<const __FlashStringHelper *>(PSTR(s)))
+#define PGM_P				const char *
+typedef char prog_char;
+#define pgm_read_byte(a)	(*(const uint8_t *)(a))
+#define pgm_read_word(a)	(*(const uint16_t *)(a))
+#define pgm_read_dword(a)	(*(const uint32_t *)(a))
+#define pgm_read_ptr(a)		(*(void * const *)(a))
+#define strcmp_P			strcmp
+#define strncmp_P			strncmp
+#define strstr_P			strstr
+#define strlen_P			strlen
+#define strcpy_P			strcpy
+#define strncpy_P			strncpy
+#define memcpy_P			memcpy
+
+#define HIGH				1
+#define LOW					0
+#define INPUT				0
+#define OUTPUT				1
+#define INPUT_PULLUP		2
+#define CHANGE				1
+#define FALLING				2
+#define RISING				3
+
+#define DEC					10
+#define HEX					16
+#define OCT					8
+#define BIN					2
+
+#define min(a, b)			((a) < (b) ? (a) : (b))
+#define max(a, b)			((a) > (b) ? (a) : (b))
+#define constrain(x, lo, hi)	((x) < (lo) ? (lo) : ((x) > (hi) ? (hi) : (x)))
+
+/**********************************************************************************************************************************/
+// Virtual time
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+// Host helpers: total virtual time spent inside delay()
+unsigned long long hostIdleMicros();
+void hostAdvanceMicros(unsigned long long us);
+// Host helpers: let virtual time pass as delay() does without a hook, and replace delay() (the FreeRTOS
+// shim makes it vTaskDelay() once a task exists, as the ESP32 core does)
+typedef void (*HostDelayHook)(unsigned long ms);
+void hostIdle(unsigned long ms);
+void hostSetDelayHook(HostDelayHook hook);
+
+/**********************************************************************************************************************************/
+// GPIO
+typedef void (*HostPinHook)(uint8_t pin, uint8_t value);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+#define digitalPinToInterrupt(p)	(p)
+#define NOT_AN_INTERRUPT			-1
+void attachInterrupt(uint8_t interrupt, void (*isr)(void), int mode);
+void detachInterrupt(uint8_t interrupt);
+void noInterrupts();
+void interrupts();
+
+// Host helpers: observe pin writes and drive input pins (an input change fires its interrupt)
+void hostSetPinHook(HostPinHook hook);
+void hostDrivePin(uint8_t pin, uint8_t value);
+// Host helper: called every virtual ms inside delay(), e.g. to let a device raise an interrupt
+typedef void (*HostTickHook)(void);
+void hostSetTickHook(HostTickHook hook);
+
+/**********************************************************************************************************************************/
+class String {
+	public:
+		String(const char *text = "") : _text(text ? text : "") {}
+		String(const std::string &text) : _text(text) {}
+		String(long value) : _text(std::to_string(value)) {}
+		String &operator+=(const String &other) { _text += other._text; return *this; }
+		String &operator+=(const char *other) { _text += other; return *this; }
+		String &operator+=(char c) { _text += c; return *this; }
+		String operator+(const String &other) const { return String(_text + other._text); }
+		bool operator==(const String &other) const { return _text == other._text; }
+		unsigned int length() const { return _text.size(); }
+		char charAt(unsigned int i) const { return (i < _text.size()) ? _text[i] : 0; }
+		int indexOf(char c) const { size_t i = _text.find(c); return (i == std::string::npos) ? -1 : (int)i; }
+		const char *c_str() const { return _text.c_str(); }
+		void toCharArray(char *buffer, unsigned int size) const {
+			if (!size) return;
+			strncpy(buffer, _text.c_str(), size - 1);
+			buffer[size - 1] = 0;
+		}
+	private:
+		std::string _text;
+};
+
+/**********************************************************************************************************************************/
+class Print {
+	public:
+		virtual ~Print() {}
+		virtual size_t write(uint8_t c) = 0;
+		virtual size_t write(const uint8_t *buffer, size_t size) {
+			size_t n = 0;
+			while (size--) n += write(*buffer++);
+			return n;
+		}
+		size_t write(const char *text) { return text ? write((const uint8_t *)text, strlen(text)) : 0; }
+		size_t write(const char *buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+
+		size_t print(const __FlashStringHelper *text) { return write((const char *)text); }
+		size_t print(const String &text) { return write(text.c_str()); }
+		size_t print(const char text[]) { return write(text); }
+		size_t print(char c) { return write((uint8_t)c); }
+		size_t print(unsigned char n, int base = DEC) { return printNumber(n, base); }
+		size_t print(int n, int base = DEC) { return print((long)n, base); }
+		size_t print(unsigned int n, int base = DEC) { return printNumber(n, base); }
+		size_t print(long n, int base = DEC) {
+			if ((base == DEC) && (n < 0)) return print('-') + printNumber(-(unsigned long)n, base);
+			return printNumber((unsigned long)n, base);
+		}
+		size_t print(unsigned long n, int base = DEC) { return printNumber(n, base); }
+		size_t print(double n, int digits = 2) {
+			char text[48];
+			snprintf(text, sizeof(text), "%.*f", digits, n);
+			return write(text);
+		}
+
+		size_t println() { return write("\r\n"); }
+		template<typename T> size_t println(const T &value) { size_t n = print(value); return n + println(); }
+		template<typename T> size_t println(const T &value, int base) { size_t n = print(value, base); return n + println(); }
+
+	private:
+		size_t printNumber(unsigned long n, int base) {
+			char text[8 * sizeof(long) + 1];
+			char *p = &text[sizeof(text) - 1];
+			*p = 0;
+			if (base < 2) base = DEC;
+			do {
+				char d = n % base;
+				*--p = (d < 10) ? ('0' + d) : ('A' + d - 10);
+				n /= base;
+			} while (n);
+			return write(p);
+		}
+};
+
+class Stream : public Print {
+	public:
+		virtual int available() = 0;
+		virtual int read() = 0;
+		virtual int peek() = 0;
+		virtual void flush() {}
+		void setTimeout(unsigned long timeout) { _timeout = timeout; }
+		size_t readBytes(char *buffer, size_t length) {
+			size_t count = 0;
+			unsigned long start = millis();
+			while (count < length) {
+				if (available()) {
+					buffer[count++] = read();
+				}
+				else if ((millis() - start) >= _timeout) {
+					break;
+				}
+				else {
+					delay(1);
+				}
+			}
+			return count;
+		}
+	protected:
+		unsigned long _timeout = 1000;
+};
+
+// Serial prints to stdout, quiet() silences it (the debug output of the library goes here)
+class HostSerial : public Stream {
+	public:
+		void begin(unsigned long baud) { (void)baud; }
+		void quiet(bool on) { _quiet = on; }
+		size_t write(uint8_t c) {
+			if (!_quiet) fputc(c, stdout);
+			return 1;
+		}
+		using Print::write;
+		int available() { return 0; }
+		int read() { return -1; }
+		int peek() { return -1; }
+		void flush() { fflush(stdout); }
+	private:
+		bool _quiet = false;
+};
+
+extern HostSerial Serial;
+/**********************************************************************************************************************************/
+#endif
@@ -0,0 +1,309 @@
+/**********************************************************************************************************************************/
+// Host (Linux) FreeRTOS: tasks, queues, recursive mutexes and notifications on virtual time, see rtos/Arduino_FreeRTOS.h
+/**********************************************************************************************************************************/
+// C++ headers first, the min/max macros of Arduino.h would break them
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "Arduino.h"
+#include "rtos/Arduino_FreeRTOS.h"
+#include "rtos/queue.h"
+#include "rtos/semphr.h"
+
+#define TASK_READY		0
+#define TASK_BLOCKED	1
+#define TASK_DELETED	2
+
+#define FOREVER			(~0ULL)
+
+struct HostTask {
+	const char *name;
+	UBaseType_t priority;
+	uint8_t state;
+	const void *waiting;				// the queue, mutex or notification a blocked task waits for, NULL for a delay
+	unsigned long long wake_at;			// virtual us at which a blocked task gives up, FOREVER without a timeout
+	uint32_t notified;
+	TaskFunction_t code;
+	void *arg;
+	std::condition_variable run;		// signalled when the task gets the CPU
+};
+
+struct HostQueue {
+	std::deque<std::vector<uint8_t> > items;
+	UBaseType_t length;
+	UBaseType_t item_size;
+	bool mutex;
+	HostTask *owner;
+	UBaseType_t count;
+};
+
+// never destroyed: tasks still wait on it when main() returns
+static std::mutex &baton = *new std::mutex();
+static std::vector<HostTask *> tasks;
+static HostTask *current = NULL;
+static bool ticking = false;
+/**********************************************************************************************************************************/
+// the running task, the first caller becomes the loop task
+static HostTask *self() {
+	if (!current) {
+		current = new HostTask();
+		current->name = "loopTask";
+		current->priority = 1;
+		current->state = TASK_READY;
+		tasks.push_back(current);
+	}
+	return current;
+}
+
+static unsigned long long deadline(TickType_t ticks) {
+	return (ticks == portMAX_DELAY) ? FOREVER : micros() + (unsigned long long)ticks * portTICK_PERIOD_MS * 1000;
+}
+
+// the highest priority ready task, the first one after a task among equals
+static HostTask *highest(HostTask *after) {
+	HostTask *best = NULL;
+	size_t start = 0;
+	for (size_t i = 0; i < tasks.size(); i++) {
+		if (tasks[i] == after) {
+			start = i + 1;
+		}
+	}
+	for (size_t i = 0; i < tasks.size(); i++) {
+		HostTask *task = tasks[(start + i) % tasks.size()];
+		if ((task->state == TASK_READY) && (!best || (task->priority > best->priority))) {
+			best = task;
+		}
+	}
+	return best;
+}
+
+// give the CPU to the highest ready task, virtual time moves on while none is ready
+static void schedule() {
+	HostTask *me = current;
+	HostTask *next;
+	for (;;) {
+		for (size_t i = 0; i < tasks.size(); i++) {
+			if ((tasks[i]->state == TASK_BLOCKED) && (micros() >= tasks[i]->wake_at)) {
+				tasks[i]->state = TASK_READY;
+			}
+		}
+		next = highest(me);
+		if (next) {
+			break;
+		}
+		// a device ticked here may wake a task, like an interrupt
+		ticking = true;
+		hostIdle(1);
+		ticking = false;
+	}
+	if (next == me) {
+		return;
+	}
+	std::unique_lock<std::mutex> lock(baton);
+	current = next;
+	next->run.notify_one();
+	me->run.wait(lock, [me] { return (current == me) && (me->state != TASK_DELETED); });
+}
+
+static void block(HostTask *me, const void *waiting, unsigned long long until) {
+	me->state = TASK_BLOCKED;
+	me->waiting = waiting;
+	me->wake_at = until;
+	schedule();
+	me->waiting = NULL;
+}
+
+// a task of a higher priority than the running one was woken: it runs now, or after the tick that woke it
+static void preempt() {
+	if (ticking) {
+		return;
+	}
+	HostTask *me = self();
+	for (size_t i = 0; i < tasks.size(); i++) {
+		if ((tasks[i]->state == TASK_READY) && (tasks[i]->priority > me->priority)) {
+			schedule();
+			return;
+		}
+	}
+}
+
+static void wakeWaiting(const void *waiting) {
+	for (size_t i = 0; i < tasks.size(); i++) {
+		if ((tasks[i]->state == TASK_BLOCKED) && (tasks[i]->waiting == waiting)) {
+			tasks[i]->state = TASK_READY;
+		}
+	}
+	preempt();
+}
+
+static void taskDelay(unsigned long ms) {
+	vTaskDelay(pdMS_TO_TICKS(ms));
+}
+
+static void taskEntry(HostTask *task) {
+	{
+		std::unique_lock<std::mutex> lock(baton);
+		task->run.wait(lock, [task] { return current == task; });
+	}
+	task->code(task->arg);
+	vTaskDelete(NULL);
+}
+/**********************************************************************************************************************************/
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack, void *arg, UBaseType_t priority,
+	TaskHandle_t *handle) {
+	(void)stack;
+	self();
+	HostTask *task = new HostTask();
+	task->name = name;
+	task->priority = priority;
+	task->state = TASK_READY;
+	task->code = code;
+	task->arg = arg;
+	tasks.push_back(task);
+	if (handle) {
+		*handle = task;
+	}
+	// delay() blocks the calling task from now on
+	hostSetDelayHook(taskDelay);
+	std::thread(taskEntry, task).detach();
+	preempt();
+	return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+	HostTask *me = self();
+	if (!task) {
+		task = me;
+	}
+	task->state = TASK_DELETED;
+	// a deleted task never gets the CPU back, its thread waits until the process ends
+	if (task == me) {
+		schedule();
+	}
+}
+
+void vTaskDelay(TickType_t ticks) {
+	HostTask *me = self();
+	if (!ticks) {
+		schedule();
+		return;
+	}
+	block(me, NULL, deadline(ticks));
+}
+
+TickType_t xTaskGetTickCount() {
+	return (TickType_t)(millis() / portTICK_PERIOD_MS);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+	return self();
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+	task->notified++;
+	wakeWaiting(&task->notified);
+	return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken) {
+	bool was_ticking = ticking;
+	ticking = true;
+	xTaskNotifyGive(task);
+	ticking = was_ticking;
+	if (woken) {
+		*woken = (task->state == TASK_READY) && (task->priority > self()->priority);
+	}
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks) {
+	HostTask *me = self();
+	unsigned long long until = deadline(ticks);
+	while (!me->notified) {
+		if (!ticks || (micros() >= until)) {
+			return 0;
+		}
+		block(me, &me->notified, until);
+	}
+	uint32_t value = me->notified;
+	me->notified = clear ? 0 : value - 1;
+	return value;
+}
+/**********************************************************************************************************************************/
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+	HostQueue *queue = new HostQueue();
+	queue->length = length;
+	queue->item_size = item_size;
+	return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+	delete queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks) {
+	HostTask *me = self();
+	unsigned long long until = deadline(ticks);
+	while (queue->items.size() >= queue->length) {
+		if (!ticks || (micros() >= until)) {
+			return pdFALSE;
+		}
+		block(me, queue, until);
+	}
+	queue->items.push_back(std::vector<uint8_t>((const uint8_t *)item, (const uint8_t *)item + queue->item_size));
+	wakeWaiting(queue);
+	return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks) {
+	HostTask *me = self();
+	unsigned long long until = deadline(ticks);
+	while (queue->items.empty()) {
+		if (!ticks || (micros() >= until)) {
+			return pdFALSE;
+		}
+		block(me, queue, until);
+	}
+	memcpy(item, queue->items.front().data(), queue->item_size);
+	queue->items.pop_front();
+	wakeWaiting(queue);
+	return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+	return queue->items.size();
+}
+/**********************************************************************************************************************************/
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex() {
+	HostQueue *mutex = new HostQueue();
+	mutex->mutex = true;
+	return mutex;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t mutex) {
+	delete mutex;
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t mutex, TickType_t ticks) {
+	HostTask *me = self();
+	unsigned long long until = deadline(ticks);
+	while (mutex->owner && (mutex->owner != me)) {
+		if (!ticks || (micros() >= until)) {
+			return pdFALSE;
+		}
+		block(me, mutex, until);
+	}
+	mutex->owner = me;
+	mutex->count++;
+	return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t mutex) {
+	if (mutex->owner != self()) {
+		return pdFALSE;
+	}
+	if (!--mutex->count) {
+		mutex->owner = NULL;
+		wakeWaiting(mutex);
+	}
+	return pdTRUE;
+}
@@ -0,0 +1,1085 @@
+/**********************************************************************************************************************************/
+#include "SimEmulator.h"
+
+#define TIMER_TEXT			0
+#define TIMER_DOWNLOAD		1
+#define TIMER_PDP_DEACT		2
+#define TIMER_SMS			3
+#define TIMER_NMEA			4
+
+#define ST_IP_INITIAL		0
+#define ST_IP_START			1
+#define ST_IP_GPRSACT		3
+#define ST_IP_STATUS		4
+#define ST_CONNECTED		6
+#define ST_CLOSED			8
+#define ST_PDP_DEACT		9
+
+#define CTRL_Z				0x1A
+#define ESC					0x1B
+
+// AT+CSCLK=2: the modem sleeps after this UART silence
+#define AUTO_SLEEP_US		5000000ULL
+
+// GNSS: time to the first fix and the position in millionths of a degree
+#define GNSS_TTFF_US		3000000ULL
+#define GNSS_LAT			35689197L
+#define GNSS_LON			51388974L
+
+static std::vector<SimEmulator *> wired_emulators;
+/**********************************************************************************************************************************/
+/**
+ * @brief Construct a new emulator
+ *
+ * @param sim808 true: answer ATI as a SIM808, false: as a SIM800
+ * @param baud The UART baudrate used to pace the answers
+*/
+SimEmulator::SimEmulator(bool sim808, unsigned long baud) {
+	_sim808 = sim808;
+	_processing_ms = 10;
+	_latency_ms = 300;
+	_mode = LINE;
+	_body_len = 0;
+	_last_out = 0;
+	setBaud(baud);
+
+	_echo = true;
+	_verbose = true;
+	_cmee = 0;
+	_cmgf = 0;
+	_creg_mode = 0;
+	_cgreg_mode = 0;
+	_cs_stat = 1;
+	_ps_stat = 1;
+	_lac = 0x1A2B;
+	_ci = 0x3C4D;
+	_rssi = 18;
+	_ber = 0;
+	_cops_numeric = false;
+	_op_numeric = "43235";
+	_op_name = "43235";
+	_ip_state = ST_IP_INITIAL;
+	_bearer = false;
+	_http = false;
+	_http_ssl = false;
+	_tcp_ssl = false;
+	_http_method = 0;
+	_http_status = 200;
+	_http_body = "{\"ok\":true}";
+	_tcp_reply = "PONG";
+	_sms_ref = 0;
+	_csclk = 0;
+	_dtr_pin = 0;
+	_ri_pin = 0;
+	_cfgri = false;
+	_ceng = 0;
+	_gnss_power = false;
+	_gnss_stream = false;
+	_gnss_fix_at = 0;
+	_wake_us = 50000;
+	_awake_at = 0;
+	_last_in = 0;
+	_sleep_since = 0;
+	_sleep_us = 0;
+
+	resetCounters();
+}
+
+SimEmulator::~SimEmulator() {
+	for (size_t i = 0; i < wired_emulators.size(); i++) {
+		if (wired_emulators[i] == this) {
+			wired_emulators.erase(wired_emulators.begin() + i);
+			break;
+		}
+	}
+}
+
+/**
+ * @brief Add a scripted answer
+ *
+ * @param command The command prefix to match, e.g. "AT+CSQ"
+ * @param response The raw answer, e.g. "\r\n+CME ERROR: 10\r\n"
+ * @param delay_ms The time before the answer starts
+*/
+void SimEmulator::on(const char *command, const char *response, unsigned long delay_ms) {
+	Rule rule = { command, response, delay_ms };
+	_rules.push_back(rule);
+}
+
+void SimEmulator::clearRules() {
+	_rules.clear();
+}
+
+/**
+ * @brief Send unsolicited text at a virtual time
+ *
+ * @param at_ms The virtual time in ms
+ * @param text The raw text, e.g. "\r\nRING\r\n"
+*/
+void SimEmulator::inject(unsigned long at_ms, const char *text) {
+	Timer timer = { (unsigned long long)at_ms * 1000, TIMER_TEXT, text };
+	_timers.push_back(timer);
+}
+
+void SimEmulator::setBaud(unsigned long baud) {
+	// 8N1: 10 bits per byte
+	_byte_us = 10000000ULL / baud;
+}
+
+void SimEmulator::setProcessing(unsigned long ms) {
+	_processing_ms = ms;
+}
+
+void SimEmulator::setLatency(unsigned long ms) {
+	_latency_ms = ms;
+}
+
+void SimEmulator::setOperator(const char *numeric, const char *name) {
+	_op_numeric = numeric;
+	_op_name = name;
+}
+
+void SimEmulator::setSignal(uint8_t rssi, uint8_t ber) {
+	_rssi = rssi;
+	_ber = ber;
+}
+
+/**
+ * @brief Change the registration state, sends +CREG/+CGREG URCs when they are enabled
+ *
+ * @param cs_stat The circuit switched state (1: home, 5: roaming, 2: searching, ...)
+ * @param ps_stat The packet switched state
+*/
+void SimEmulator::setRegistration(uint8_t cs_stat, uint8_t ps_stat) {
+	char text[64];
+	if ((cs_stat != _cs_stat) && _creg_mode) {
+		if (_creg_mode == 2) snprintf(text, sizeof(text), "+CREG: %u,\"%04X\",\"%04X\"", cs_stat, _lac, _ci);
+		else snprintf(text, sizeof(text), "+CREG: %u", cs_stat);
+		urc(text);
+	}
+	if ((ps_stat != _ps_stat) && _cgreg_mode) {
+		if (_cgreg_mode == 2) snprintf(text, sizeof(text), "+CGREG: %u,\"%04X\",\"%04X\"", ps_stat, _lac, _ci);
+		else snprintf(text, sizeof(text), "+CGREG: %u", ps_stat);
+		urc(text);
+	}
+	_cs_stat = cs_stat;
+	_ps_stat = ps_stat;
+}
+
+void SimEmulator::setCell(uint16_t lac, uint16_t ci) {
+	char text[64];
+	bool changed = (lac != _lac) || (ci != _ci);
+	_lac = lac;
+	_ci = ci;
+	// in mode 2 a cell change is reported like a registration change
+	if (changed && (_creg_mode == 2)) {
+		snprintf(text, sizeof(text), "+CREG: %u,\"%04X\",\"%04X\"", _cs_stat, _lac, _ci);
+		urc(text);
+	}
+	if (changed && (_cgreg_mode == 2)) {
+		snprintf(text, sizeof(text), "+CGREG: %u,\"%04X\",\"%04X\"", _ps_stat, _lac, _ci);
+		urc(text);
+	}
+}
+
+void SimEmulator::addSMS(const char *sender, const char *body) {
+	SMS sms = { sender, body };
+	_sms.push_back(sms);
+}
+
+void SimEmulator::setHttpResponse(uint16_t status, const char *body, const char *headers) {
+	_http_status = status;
+	_http_body = body;
+	_http_headers = headers;
+}
+
+void SimEmulator::setTcpReply(const char *reply) {
+	_tcp_reply = reply;
+}
+
+/**
+ * @brief Drop the PDP context at a virtual time (+PDP: DEACT)
+ *
+ * @param at_ms The virtual time in ms
+*/
+void SimEmulator::dropContext(unsigned long at_ms) {
+	Timer timer = { (unsigned long long)at_ms * 1000, TIMER_PDP_DEACT, "" };
+	_timers.push_back(timer);
+}
+
+/**
+ * @brief Receive an SMS at a virtual time, the modem stores it and sends +CMTI
+ *
+ * @param at_ms The virtual time in ms
+ * @param sender The sender number
+ * @param body The text
+*/
+void SimEmulator::deliverSMS(unsigned long at_ms, const char *sender, const char *body) {
+	Timer timer = { (unsigned long long)at_ms * 1000, TIMER_SMS, std::string(sender) + '\n' + body };
+	_timers.push_back(timer);
+}
+
+void SimEmulator::resetCounters() {
+	bytesToModem = 0;
+	bytesFromModem = 0;
+	commands = 0;
+	bytesDropped = 0;
+	tlsHandshakes = 0;
+	_sleep_us = 0;
+	if (_sleep_since) {
+		_sleep_since = micros();
+	}
+}
+
+/**
+ * @brief Wire a host pin to DTR, with AT+CSCLK=1 the modem sleeps while it is high
+ *
+ * @param pin The pin the library drives (the dtr pin of the ASIM constructor)
+*/
+void SimEmulator::setDtrPin(uint8_t pin) {
+	_dtr_pin = pin;
+	wire();
+}
+
+/**
+ * @brief Wire a host pin to RI, it falls for a moment when the modem sends a URC
+ *
+ * The emulator then runs during delay() too, so a URC at a virtual time pulses RI while the host idles.
+ *
+ * @param pin The pin the library listens to (the ri pin of the ASIM constructor)
+*/
+void SimEmulator::setRiPin(uint8_t pin) {
+	_ri_pin = pin;
+	hostDrivePin(_ri_pin, HIGH);
+	wire();
+}
+
+/**
+ * @brief Call a function while the UART holds data, like the receive callback of an ESP32 UART
+ *
+ * The emulator then runs during delay() too, so the data of a URC raises the event while the host idles.
+ *
+ * @param callback The function, empty to stop
+*/
+void SimEmulator::onReceive(std::function<void()> callback) {
+	_on_receive = callback;
+	wire();
+}
+
+void SimEmulator::wire() {
+	for (size_t i = 0; i < wired_emulators.size(); i++) {
+		if (wired_emulators[i] == this) {
+			return;
+		}
+	}
+	wired_emulators.push_back(this);
+	hostSetPinHook(pinChanged);
+	hostSetTickHook(tick);
+}
+
+void SimEmulator::tick() {
+	for (size_t i = 0; i < wired_emulators.size(); i++) {
+		SimEmulator *emulator = wired_emulators[i];
+		if (emulator->_ri_pin) {
+			emulator->service();
+		}
+		if (emulator->_on_receive && emulator->available()) {
+			emulator->_on_receive();
+		}
+	}
+}
+
+void SimEmulator::setWakeDelay(unsigned long ms) {
+	_wake_us = (unsigned long long)ms * 1000;
+}
+
+void SimEmulator::pinChanged(uint8_t pin, uint8_t value) {
+	for (size_t i = 0; i < wired_emulators.size(); i++) {
+		if (wired_emulators[i]->_dtr_pin == pin) {
+			wired_emulators[i]->dtrChanged(value);
+		}
+	}
+}
+
+void SimEmulator::dtrChanged(uint8_t value) {
+	unsigned long long now = micros();
+	if (_csclk != 1) {
+		return;
+	}
+	if ((value == HIGH) && (!_sleep_since)) {
+		_sleep_since = now;
+	}
+	else if ((value == LOW) && _sleep_since) {
+		_sleep_us += now - _sleep_since;
+		_sleep_since = 0;
+		_awake_at = now + _wake_us;
+	}
+}
+
+/**
+ * @brief Check if the modem sleeps or is still waking up, its UART drops what it receives
+ *
+ * @return true: sleeping, false: awake
+*/
+bool SimEmulator::sleeping() {
+	unsigned long long now = micros();
+	if (_sleep_since || (now < _awake_at)) {
+		return true;
+	}
+	// AT+CSCLK=2: asleep once the UART was quiet long enough
+	unsigned long long last = (_last_in > _last_out) ? _last_in : _last_out;
+	if ((_csclk == 2) && (now >= last + AUTO_SLEEP_US)) {
+		_sleep_since = last + AUTO_SLEEP_US;
+		return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Get the time the modem slept
+ *
+ * @return unsigned long The time in ms since the last resetCounters()
+*/
+unsigned long SimEmulator::sleepMs() {
+	unsigned long long total = _sleep_us;
+	if (sleeping() && _sleep_since) {
+		total += micros() - _sleep_since;
+	}
+	return (unsigned long)(total / 1000);
+}
+/**********************************************************************************************************************************/
+int SimEmulator::available() {
+	service();
+	unsigned long long now = micros();
+	int count = 0;
+	for (std::deque<Pending>::const_iterator it = _out.begin(); (it != _out.end()) && (it->ready <= now); ++it) {
+		count++;
+	}
+	return count;
+}
+
+int SimEmulator::read() {
+	service();
+	if (_out.empty() || (_out.front().ready > micros())) {
+		return -1;
+	}
+	uint8_t c = _out.front().c;
+	_out.pop_front();
+	bytesFromModem++;
+	return c;
+}
+
+int SimEmulator::peek() {
+	service();
+	if (_out.empty() || (_out.front().ready > micros())) {
+		return -1;
+	}
+	return _out.front().c;
+}
+
+/**
+ * @brief A byte from the host; the UART is blocking so the byte time passes on the virtual clock
+ *
+ * @param c The byte
+ * @return size_t 1
+*/
+size_t SimEmulator::write(uint8_t c) {
+	hostAdvanceMicros(_byte_us);
+	bytesToModem++;
+	service();
+
+	if (sleeping()) {
+		// AT+CSCLK=2: the first byte wakes the modem up
+		if ((_csclk == 2) && _sleep_since) {
+			_sleep_us += micros() - _sleep_since;
+			_sleep_since = 0;
+			_awake_at = micros() + _wake_us;
+			_last_in = micros();
+		}
+		bytesDropped++;
+		return 1;
+	}
+	_last_in = micros();
+
+	if (_mode == SMS_BODY || _mode == TCP_BODY) {
+		if (c == ESC) {
+			_mode = LINE;
+			_body.clear();
+			result("OK", proc());
+		}
+		else if (c == CTRL_Z) {
+			bodyDone();
+		}
+		else {
+			_body += (char)c;
+		}
+		return 1;
+	}
+
+	if (_mode == HTTP_DATA) {
+		// the LF after the CR that ended AT+HTTPDATA is not data
+		if (_body.empty() && (c == '\n')) {
+			return 1;
+		}
+		_body += (char)c;
+		if (_body.size() >= _body_len) {
+			bodyDone();
+		}
+		return 1;
+	}
+
+	if (_echo) {
+		emit(std::string(1, (char)c));
+	}
+	if (c == '\r') {
+		if (!_line.empty()) {
+			command(_line);
+		}
+		_line.clear();
+	}
+	else if (c != '\n') {
+		_line += (char)c;
+	}
+	return 1;
+}
+/**********************************************************************************************************************************/
+/**
+ * @brief Fire the timers that are due
+ *
+*/
+void SimEmulator::service() {
+	char text[48];
+	unsigned long long now = micros();
+	for (size_t i = 0; i < _timers.size(); ) {
+		if (_timers[i].at > now) {
+			i++;
+			continue;
+		}
+		Timer timer = _timers[i];
+		_timers.erase(_timers.begin() + i);
+
+		if (timer.kind == TIMER_TEXT) {
+			ringIndicator(strstr(timer.text.c_str(), "RING") || strstr(timer.text.c_str(), "+CMTI"));
+			emit(timer.text);
+		}
+		else if (timer.kind == TIMER_SMS) {
+			size_t split = timer.text.find('\n');
+			addSMS(timer.text.substr(0, split).c_str(), timer.text.substr(split + 1).c_str());
+			snprintf(text, sizeof(text), "+CMTI: \"SM\",%u", (unsigned)_sms.size());
+			urc(text, true);
+		}
+		else if ((timer.kind == TIMER_DOWNLOAD) && (_mode == HTTP_DATA)) {
+			bodyDone();
+		}
+		else if (timer.kind == TIMER_PDP_DEACT) {
+			_bearer = false;
+			_ip_state = ST_PDP_DEACT;
+			urc("+PDP: DEACT", true);
+		}
+		else if ((timer.kind == TIMER_NMEA) && _gnss_stream && _gnss_power) {
+			nmea();
+			Timer next = { timer.at + 1000000ULL, TIMER_NMEA, "" };
+			_timers.push_back(next);
+		}
+	}
+}
+
+/**
+ * @brief Queue answer bytes, paced at the baudrate
+ *
+ * @param text The raw bytes
+ * @param delay_us The time from now before the first byte
+*/
+void SimEmulator::emit(const std::string &text, unsigned long long delay_us) {
+	unsigned long long t = micros() + delay_us;
+	if (t < _last_out) {
+		t = _last_out;
+	}
+	for (size_t i = 0; i < text.size(); i++) {
+		t += _byte_us;
+		Pending p = { t, (uint8_t)text[i] };
+		_out.push_back(p);
+	}
+	_last_out = t;
+}
+
+/**
+ * @brief Pulse RI for a URC
+ *
+ * @param ring true: an incoming call or SMS, RI falls even without AT+CFGRI=1
+*/
+void SimEmulator::ringIndicator(bool ring) {
+	if (_ri_pin && (ring || _cfgri)) {
+		// the pulse takes no virtual time, the interrupt sees it while the pin is low
+		hostDrivePin(_ri_pin, LOW);
+		hostDrivePin(_ri_pin, HIGH);
+	}
+}
+
+void SimEmulator::urc(const std::string &text, bool ring) {
+	ringIndicator(ring);
+	info(text);
+}
+
+// an NMEA angle, (d)ddmm.mmmmm and its hemisphere
+static std::string nmeaAngle(long micro, uint8_t width, char positive, char negative) {
+	char text[24];
+	unsigned long a = (micro < 0) ? -micro : micro;
+	unsigned long minutes = (a % 1000000UL) * 6;
+	snprintf(text, sizeof(text), "%0*lu%02lu.%05lu,%c", width, a / 1000000UL, minutes / 100000UL, minutes % 100000UL,
+		(micro < 0) ? negative : positive);
+	return text;
+}
+
+// a sentence with its checksum
+static std::string nmeaSentence(const std::string &body) {
+	char text[8];
+	uint8_t sum = 0;
+	for (size_t i = 0; i < body.size(); i++) {
+		sum ^= (uint8_t)body[i];
+	}
+	snprintf(text, sizeof(text), "*%02X\r\n", sum);
+	return "$" + body + text;
+}
+
+/**
+ * @brief Send the RMC and GGA sentences of one second of AT+CGNSTST=1
+ *
+*/
+void SimEmulator::nmea() {
+	char time[16], text[96];
+	bool fix = micros() >= _gnss_fix_at;
+	unsigned long s = millis() / 1000;
+	snprintf(time, sizeof(time), "09%02lu%02lu.000", (s / 60) % 60, s % 60);
+	std::string lat = fix ? nmeaAngle(GNSS_LAT, 2, 'N', 'S') : ",";
+	std::string lon = fix ? nmeaAngle(GNSS_LON, 3, 'E', 'W') : ",";
+	snprintf(text, sizeof(text), "GPRMC,%s,%c,%s,%s,0.00,0.00,070324,,,A", time, fix ? 'A' : 'V', lat.c_str(), lon.c_str());
+	std::string out = nmeaSentence(text);
+	snprintf(text, sizeof(text), "GPGGA,%s,%s,%s,%u,%u,%s,%s,M,-28.0,M,,", time, lat.c_str(), lon.c_str(), fix ? 1 : 0,
+		fix ? 8 : 0, fix ? "0.90" : "", fix ? "1200.5" : "");
+	emit(out + nmeaSentence(text));
+}
+
+// the value of a header line of the answer, empty without it
+static std::string headerValue(const std::string &headers, const std::string &name) {
+	size_t start = (headers.compare(0, name.size() + 2, name + ": ") == 0) ? 0 : headers.find("\r\n" + name + ": ");
+	if (start == std::string::npos) {
+		return "";
+	}
+	start = headers.find(": ", start) + 2;
+	return headers.substr(start, headers.find("\r\n", start) - start);
+}
+
+// ATV1 puts a CR LF in front of every answer line, ATV0 does not
+std::string SimEmulator::head() const {
+	return _verbose ? "\r\n" : "";
+}
+
+void SimEmulator::info(const std::string &text, unsigned long long delay_us) {
+	emit(head() + text + "\r\n", delay_us);
+}
+
+void SimEmulator::result(const char *code, unsigned long long delay_us) {
+	// ATV0 sends the V.250 result codes as a digit and a CR, the TCP/IP and +CME results stay text
+	static const char *numeric[] = { "OK", "CONNECT", "RING", "NO CARRIER", "ERROR", "", "NO DIALTONE", "BUSY", "NO ANSWER" };
+	if (!_verbose) {
+		for (unsigned i = 0; i < sizeof(numeric) / sizeof(numeric[0]); i++) {
+			if (!strcmp(code, numeric[i])) {
+				emit(std::string(1, (char)('0' + i)) + "\r", delay_us);
+				return;
+			}
+		}
+	}
+	info(code, delay_us);
+}
+
+void SimEmulator::error(uint16_t cme, unsigned long long delay_us) {
+	if (_cmee) {
+		char text[32];
+		snprintf(text, sizeof(text), "+CME ERROR: %u", cme);
+		result(text, delay_us);
+	}
+	else {
+		result("ERROR", delay_us);
+	}
+}
+
+std::string SimEmulator::tcpState() const {
+	switch (_ip_state) {
+		case ST_IP_START:	return "IP START";
+		case ST_IP_GPRSACT:	return "IP GPRSACT";
+		case ST_IP_STATUS:	return "IP STATUS";
+		case ST_CONNECTED:	return "CONNECT OK";
+		case ST_CLOSED:		return "TCP CLOSED";
+		case ST_PDP_DEACT:	return "PDP DEACT";
+		default:			return "IP INITIAL";
+	}
+}
+/**********************************************************************************************************************************/
+/**
+ * @brief Handle one received command line
+ *
+ * @param line The command without CR/LF
+*/
+void SimEmulator::command(const std::string &line) {
+	commands++;
+	_last_command = line;
+
+	for (size_t i = 0; i < _rules.size(); i++) {
+		if (line.compare(0, _rules[i].command.size(), _rules[i].command) == 0) {
+			emit(_rules[i].response, (unsigned long long)_rules[i].delay_ms * 1000);
+			return;
+		}
+	}
+
+	if (!builtin(line)) {
+		error(100, proc());
+	}
+}
+
+/**
+ * @brief The end of an SMS, TCP or HTTP body
+ *
+*/
+void SimEmulator::bodyDone() {
+	char text[64];
+	Mode mode = _mode;
+	_mode = LINE;
+
+	if (mode == SMS_BODY) {
+		snprintf(text, sizeof(text), "+CMGS: %lu", ++_sms_ref);
+		info(text, net());
+		result("OK");
+	}
+	else if (mode == TCP_BODY) {
+		if (_ip_state != ST_CONNECTED) {
+			result("SEND FAIL", proc());
+		}
+		else {
+			result("SEND OK", net());
+			emit(_tcp_reply, 2 * net());
+		}
+	}
+	else if (mode == HTTP_DATA) {
+		_http_data = _body;
+		result("OK", proc());
+	}
+	_body.clear();
+}
+
+/**
+ * @brief The built in SIM800/SIM808 behaviour
+ *
+ * @param line The command
+ * @return bool false for an unknown command
+*/
+bool SimEmulator::builtin(const std::string &line) {
+	char text[160];
+	const char *c = line.c_str();
+	#define IS(prefix)	(strncmp(c, prefix, strlen(prefix)) == 0)
+	#define ARG(prefix)	atoi(c + strlen(prefix))
+
+	if (line == "AT") {
+		result("OK", proc());
+	}
+	else if (IS("ATE")) {
+		_echo = (ARG("ATE") != 0);
+		result("OK", proc());
+	}
+	else if (line == "ATI") {
+		info(_sim808 ? "SIM808 R14.18" : "SIM800 R14.18", proc());
+		result("OK");
+	}
+	else if (line == "AT+CGSN") {
+		info("867857039291234", proc());
+		result("OK");
+	}
+	else if (IS("ATV")) {
+		_verbose = (ARG("ATV") != 0);
+		result("OK", proc());
+	}
+	else if (IS("AT+CMEE=")) {
+		_cmee = ARG("AT+CMEE=");
+		result("OK", proc());
+	}
+	else if (line == "AT+COPS?") {
+		snprintf(text, sizeof(text), "+COPS: 0,%d,\"%s\"", _cops_numeric ? 2 : 0, (_cops_numeric ? _op_numeric : _op_name).c_str());
+		info(text, 2 * proc());
+		result("OK");
+	}
+	else if (IS("AT+COPS=3,")) {
+		_cops_numeric = (ARG("AT+COPS=3,") == 2);
+		result("OK", proc());
+	}
+	else if (line == "AT+CPIN?") {
+		info("+CPIN: READY", proc());
+		result("OK");
+	}
+	else if (line == "AT+CSQ") {
+		snprintf(text, sizeof(text), "+CSQ: %u,%u", _rssi, _ber);
+		info(text, proc());
+		result("OK");
+	}
+	else if (line == "AT+CREG?" || line == "AT+CGREG?") {
+		bool ps = (line == "AT+CGREG?");
+		uint8_t mode = ps ? _cgreg_mode : _creg_mode;
+		uint8_t stat = ps ? _ps_stat : _cs_stat;
+		if (mode == 2) snprintf(text, sizeof(text), "%s %u,%u,\"%04X\",\"%04X\"", ps ? "+CGREG:" : "+CREG:", mode, stat, _lac, _ci);
+		else snprintf(text, sizeof(text), "%s %u,%u", ps ? "+CGREG:" : "+CREG:", mode, stat);
+		info(text, proc());
+		result("OK");
+	}
+	else if (IS("AT+CREG=")) {
+		_creg_mode = ARG("AT+CREG=");
+		result("OK", proc());
+	}
+	else if (IS("AT+CGREG=")) {
+		_cgreg_mode = ARG("AT+CGREG=");
+		result("OK", proc());
+	}
+	else if (IS("AT+CMGF=")) {
+		_cmgf = ARG("AT+CMGF=");
+		result("OK", proc());
+	}
+	else if (line == "AT+CMGF?") {
+		snprintf(text, sizeof(text), "+CMGF: %u", _cmgf);
+		info(text, proc());
+		result("OK");
+	}
+	else if (IS("AT+CMGDA=")) {
+		_sms.clear();
+		result("OK", 20 * proc());
+	}
+	else if (IS("AT+CMGD=")) {
+		size_t index = ARG("AT+CMGD=");
+		if ((index > 0) && (index <= _sms.size())) {
+			_sms.erase(_sms.begin() + index - 1);
+		}
+		result("OK", 5 * proc());
+	}
+	else if (IS("AT+CMGS=")) {
+		if (_cs_stat != 1 && _cs_stat != 5) {
+			error(331, proc());
+			return true;
+		}
+		_mode = SMS_BODY;
+		_body.clear();
+		emit(head() + "> ", proc());
+	}
+	else if (IS("AT+CMGR=")) {
+		size_t index = ARG("AT+CMGR=");
+		if ((index > 0) && (index <= _sms.size())) {
+			snprintf(text, sizeof(text), "+CMGR: \"REC UNREAD\",\"%s\",\"\",\"24/03/07,09:05:00+14\"", _sms[index - 1].sender.c_str());
+			emit(head() + std::string(text) + "\r\n" + _sms[index - 1].body + "\r\n", 5 * proc());
+		}
+		result("OK", proc());
+	}
+	else if (line == "AT+CPMS?") {
+		unsigned n = _sms.size();
+		snprintf(text, sizeof(text), "+CPMS: \"SM\",%u,30,\"SM\",%u,30,\"SM\",%u,30", n, n, n);
+		info(text, proc());
+		result("OK");
+	}
+	else if (IS("AT+CUSD=1,")) {
+		result("OK", proc());
+		info("+CUSD: 0,\"Your balance is 1000\",15", 3 * net());
+	}
+	else if (line == "AT+CGATT?") {
+		snprintf(text, sizeof(text), "+CGATT: %u", (_ps_stat == 1 || _ps_stat == 5) ? 1 : 0);
+		info(text, proc());
+		result("OK");
+	}
+	else if (IS("AT+CGATT=")) {
+		result("OK", net());
+	}
+	else if (line == "AT+CIPSHUT") {
+		_ip_state = ST_IP_INITIAL;
+		result("SHUT OK", 10 * proc());
+	}
+	else if (IS("AT+CSTT=")) {
+		_apn = line.substr(strlen("AT+CSTT="));
+		_ip_state = ST_IP_START;
+		result("OK", proc());
+	}
+	else if (line == "AT+CIICR") {
+		if (_ip_state != ST_IP_START) {
+			error(3, proc());
+			return true;
+		}
+		_ip_state = ST_IP_GPRSACT;
+		result("OK", 3 * net());
+	}
+	else if (line == "AT+CIFSR") {
+		if (_ip_state == ST_IP_GPRSACT) _ip_state = ST_IP_STATUS;
+		info("10.45.3.7", proc());
+	}
+	else if (line == "AT+CIPSTATUS") {
+		result("OK", proc());
+		info("STATE: " + tcpState());
+	}
+	else if (IS("AT+CIPSSL=")) {
+		_tcp_ssl = ARG("AT+CIPSSL=") != 0;
+		result("OK", proc());
+	}
+	else if (IS("AT+CIPSTART=")) {
+		if (_ip_state == ST_CONNECTED) {
+			result("ALREADY CONNECT", proc());
+			return true;
+		}
+		result("OK", proc());
+		if ((_ps_stat != 1) && (_ps_stat != 5)) {
+			result("CONNECT FAIL", 2 * net());
+			return true;
+		}
+		_ip_state = ST_CONNECTED;
+		// the TLS handshake takes two more round trips
+		if (_tcp_ssl) {
+			tlsHandshakes++;
+		}
+		result("CONNECT OK", (_tcp_ssl ? 4 : 2) * net());
+	}
+	else if (line == "AT+CIPSEND") {
+		if (_ip_state != ST_CONNECTED) {
+			result("ERROR", proc());
+			return true;
+		}
+		_mode = TCP_BODY;
+		_body.clear();
+		emit(head() + "> ", proc());
+	}
+	else if (line == "AT+CIPCLOSE") {
+		_ip_state = ST_CLOSED;
+		result("CLOSE OK", proc());
+	}
+	else if (IS("AT+CIPGSMLOC=")) {
+		if (!_bearer) {
+			info("+CIPGSMLOC: 601", 2 * net());
+		}
+		else {
+			info("+CIPGSMLOC: 0,51.389000,35.689200,2024/03/07,09:05:00", 3 * net());
+		}
+		result("OK");
+	}
+	else if (IS("AT+SAPBR=1,")) {
+		if (_bearer) {
+			error(3, proc());
+			return true;
+		}
+		_bearer = true;
+		result("OK", 4 * net());
+	}
+	else if (IS("AT+SAPBR=0,")) {
+		_bearer = false;
+		result("OK", net());
+	}
+	else if (IS("AT+SAPBR=2,")) {
+		snprintf(text, sizeof(text), "+SAPBR: 1,%u,\"%s\"", _bearer ? 1 : 3, _bearer ? "10.45.3.7" : "0.0.0.0");
+		info(text, proc());
+		result("OK");
+	}
+	else if (IS("AT+SAPBR=") || IS("AT+CIPMUX=") || IS("AT+IPR=") || IS("AT+CSCS=") || IS("AT+CLIP=") || IS("AT+CSMP=") ||
+			 IS("AT+CSDH=") || line == "AT+CUSD=1" || IS("AT+CFUN=") || IS("AT+CLTS=") || line == "AT&W" || IS("AT+CCLK=") ||
+			 IS("AT+CNTPCID=") || IS("AT+CNTP=") || IS("AT+SPWM=") || IS("ATD") || IS("ATH") || IS("AT+CREC=") ||
+			 IS("AT+SSLOPT=") || IS("AT+CDNSCFG=")) {
+		result("OK", proc());
+	}
+	else if (IS("AT+CENG=")) {
+		_ceng = ARG("AT+CENG=");
+		result("OK", proc());
+	}
+	else if (line == "AT+CENG?") {
+		// serving cell and two neighbours, the levels follow the RSSI
+		uint8_t rxl = (_rssi == 99) ? 0 : 2 * _rssi - 3;
+		snprintf(text, sizeof(text), "+CENG: %u,0", _ceng);
+		info(text, proc());
+		if (_ceng) {
+			snprintf(text, sizeof(text), "+CENG: 0,\"0046,%u,00,%.3s,%s,39,%04x,%u,05,%04x,0\"", rxl,
+				_op_numeric.c_str(), _op_numeric.c_str() + 3, _ci, rxl, _lac);
+			info(text);
+			snprintf(text, sizeof(text), "+CENG: 1,\"0052,%u,21,%04x,%.3s,%s,%04x\"", rxl > 8 ? rxl - 8 : 0,
+				_ci + 1, _op_numeric.c_str(), _op_numeric.c_str() + 3, _lac);
+			info(text);
+			snprintf(text, sizeof(text), "+CENG: 2,\"0061,%u,17,%04x,%.3s,%s,%04x\"", rxl > 14 ? rxl - 14 : 0,
+				_ci + 2, _op_numeric.c_str(), _op_numeric.c_str() + 3, _lac);
+			info(text);
+		}
+		result("OK");
+	}
+	else if (IS("AT+CIPPING=")) {
+		// needs the context of AT+CIICR, the reply time is in 100 ms
+		if ((_ip_state < ST_IP_GPRSACT) || (_ip_state == ST_PDP_DEACT)) {
+			error(3, proc());
+			return true;
+		}
+		unsigned long rtt = 2 * _latency_ms;
+		std::string host = line.substr(strlen("AT+CIPPING="));
+		host = host.substr(0, host.find(','));
+		snprintf(text, sizeof(text), "+CIPPING: 1,%s,%lu,51", host.c_str(), rtt / 100);
+		info(text, 2 * net());
+		result("OK");
+	}
+	else if (_sim808 && IS("AT+CGNSPWR=")) {
+		bool on = (ARG("AT+CGNSPWR=") == 1);
+		if (on && !_gnss_power) {
+			_gnss_fix_at = micros() + GNSS_TTFF_US;
+		}
+		_gnss_power = on;
+		result("OK", proc());
+	}
+	else if (_sim808 && (line == "AT+CGNSINF")) {
+		if (!_gnss_power) {
+			snprintf(text, sizeof(text), "+CGNSINF: 0,,,,,,,,,,,,,,,,,,,,");
+		}
+		else if (micros() < _gnss_fix_at) {
+			snprintf(text, sizeof(text), "+CGNSINF: 1,0,,,,,,,,,,,,,,,,,,,");
+		}
+		else {
+			unsigned long s = millis() / 1000;
+			snprintf(text, sizeof(text), "+CGNSINF: 1,1,2024030709%02lu%02lu.000,%ld.%06ld,%ld.%06ld,1200.500,0.00,0.0,1,,0.9,1.2,0.8,,12,8,3,,42,,",
+				(s / 60) % 60, s % 60, GNSS_LAT / 1000000L, GNSS_LAT % 1000000L, GNSS_LON / 1000000L, GNSS_LON % 1000000L);
+		}
+		info(text, proc());
+		result("OK");
+	}
+	else if (_sim808 && IS("AT+CGNSTST=")) {
+		bool on = (ARG("AT+CGNSTST=") == 1);
+		result("OK", proc());
+		if (on && !_gnss_stream) {
+			Timer timer = { micros() + proc() + 1000000ULL, TIMER_NMEA, "" };
+			_timers.push_back(timer);
+		}
+		_gnss_stream = on;
+	}
+	else if (IS("AT+CFGRI=")) {
+		_cfgri = (ARG("AT+CFGRI=") == 1);
+		result("OK", proc());
+	}
+	else if (IS("AT+CSCLK=")) {
+		_csclk = ARG("AT+CSCLK=");
+		result("OK", proc());
+	}
+	else if (line == "AT+CCLK?") {
+		info("+CCLK: \"24/03/07,09:05:00+14\"", proc());
+		result("OK");
+	}
+	else if (line == "AT+CNTP") {
+		result("OK", proc());
+		info("+CNTP: 1", 2 * net());
+	}
+	else if (line == "AT+HTTPINIT") {
+		if (_http) {
+			error(3, proc());
+			return true;
+		}
+		_http = true;
+		_http_ssl = false;
+		result("OK", proc());
+	}
+	else if (line == "AT+HTTPTERM") {
+		if (!_http) {
+			error(3, proc());
+			return true;
+		}
+		_http = false;
+		_http_ssl = false;
+		result("OK", proc());
+	}
+	else if (IS("AT+HTTPPARA=")) {
+		// AT+HTTPPARA="<name>","<value>", like the modem a quoted value ends at the first quote after it
+		// and anything but that closing quote left on the line is an error
+		std::string para = line.substr(strlen("AT+HTTPPARA="));
+		size_t split = para.find("\",\"");
+		size_t end = (split == std::string::npos) ? split : para.find('"', split + 3);
+		bool ok = _http && ((split == std::string::npos) || ((end != std::string::npos) && (end + 1 == para.size())));
+		if (ok && (split != std::string::npos)) {
+			std::string name = para.substr(1, split - 1);
+			std::string value = para.substr(split + 3, end - split - 3);
+			if (name == "URL") _http_url = value;
+			else if (name == "USERDATA") _http_userdata = value;
+			else if (name == "CONTENT") _http_content = value;
+		}
+		result(ok ? "OK" : "ERROR", proc());
+	}
+	else if (IS("AT+HTTPSSL=")) {
+		if (!_http) {
+			error(3, proc());
+			return true;
+		}
+		_http_ssl = ARG("AT+HTTPSSL=") != 0;
+		result("OK", proc());
+	}
+	else if (IS("AT+SSLSETCERT=")) {
+		// AT+SSLSETCERT="<file>"[,"<password>"], an empty name is a file that does not exist
+		result("OK", proc());
+		info(IS("AT+SSLSETCERT=\"\"") ? "+SSLSETCERT: 1" : "+SSLSETCERT: 0", 10 * proc());
+	}
+	else if (IS("AT+HTTPDATA=")) {
+		unsigned long size = 0, wait = 0;
+		sscanf(c + strlen("AT+HTTPDATA="), "%lu,%lu", &size, &wait);
+		_mode = HTTP_DATA;
+		_body.clear();
+		_body_len = size;
+		result("DOWNLOAD", proc());
+		Timer timer = { micros() + proc() + (unsigned long long)wait * 1000, TIMER_DOWNLOAD, "" };
+		_timers.push_back(timer);
+	}
+	else if (IS("AT+HTTPACTION=")) {
+		if (!_http) {
+			error(3, proc());
+			return true;
+		}
+		_http_method = ARG("AT+HTTPACTION=");
+		result("OK", proc());
+		if (!_bearer) {
+			snprintf(text, sizeof(text), "+HTTPACTION: %u,601,0", _http_method);
+			info(text, net());
+			return true;
+		}
+		// an https URL without AT+HTTPSSL=1 gets a plain request the server drops
+		bool https = strncasecmp(_http_url.c_str(), "https://", 8) == 0;
+		if (https && !_http_ssl) {
+			snprintf(text, sizeof(text), "+HTTPACTION: %u,606,0", _http_method);
+			info(text, 2 * net());
+			return true;
+		}
+		if (_http_ssl) {
+			tlsHandshakes++;
+		}
+		// a GET with the ETag or the Last-Modified of the answer gets a 304 without a body
+		std::string etag = headerValue(_http_headers, "ETag");
+		std::string modified = headerValue(_http_headers, "Last-Modified");
+		if ((_http_method == 0) && (_http_status == 200) &&
+			((!etag.empty() && (_http_userdata.find("If-None-Match: " + etag) != std::string::npos)) ||
+			 (!modified.empty() && (_http_userdata.find("If-Modified-Since: " + modified) != std::string::npos)))) {
+			snprintf(text, sizeof(text), "+HTTPACTION: 0,304,0");
+			info(text, (_http_ssl ? 6 : 4) * net());
+			return true;
+		}
+		// HEAD: the length of the headers, read with AT+HTTPHEAD
+		snprintf(text, sizeof(text), "+HTTPACTION: %u,%u,%u", _http_method, _http_status,
+			(unsigned)((_http_method == 2) ? _http_headers.size() : _http_body.size()));
+		info(text, (_http_ssl ? 6 : 4) * net());
+	}
+	else if (IS("AT+HTTPREAD")) {
+		unsigned long offset = 0, size = _http_body.size();
+		if (IS("AT+HTTPREAD=")) {
+			sscanf(c + strlen("AT+HTTPREAD="), "%lu,%lu", &offset, &size);
+		}
+		if (offset > _http_body.size()) offset = _http_body.size();
+		std::string part = _http_body.substr(offset, size);
+		snprintf(text, sizeof(text), "+HTTPREAD: %u", (unsigned)part.size());
+		emit(head() + std::string(text) + "\r\n" + part + "\r\n", proc());
+		result("OK");
+	}
+	else if (line == "AT+HTTPHEAD") {
+		snprintf(text, sizeof(text), "+HTTPHEAD: %u", (unsigned)_http_headers.size());
+		emit(head() + std::string(text) + "\r\n" + _http_headers + "\r\n", proc());
+		result("OK");
+	}
+	else {
+		return false;
+	}
+	return true;
+	#undef IS
+	#undef ARG
+}
@@ -0,0 +1,178 @@
+/**********************************************************************************************************************************/
+// Scripted SIM800/SIM808 emulator for the host build.
+//
+// It is an in-memory Stream: pass it to ASIM::begin() in place of the modem UART. Answers leave the
+// emulator at the configured baud rate after a processing delay (local commands) or the network
+// latency (SMS, GPRS, HTTP, TCP), measured on the virtual clock of the host Arduino.h. As a SIM808 it has a
+// GNSS engine with a fixed position, that gets its fix 3 s after AT+CGNSPWR=1.
+/**********************************************************************************************************************************/
+#ifndef SIM_EMULATOR_H
+#define SIM_EMULATOR_H
+
+#include "Arduino.h"
+
+class SimEmulator : public Stream {
+	public:
+		SimEmulator(bool sim808 = false, unsigned long baud = 9600);
+		~SimEmulator();
+
+		// Script: a rule whose command prefix matches the received line replaces the built in answer
+		void on(const char *command, const char *response, unsigned long delay_ms = 0);
+		void clearRules();
+		// Unsolicited text (URCs) sent at an absolute virtual time in ms
+		void inject(unsigned long at_ms, const char *text);
+
+		// Timing model
+		void setBaud(unsigned long baud);
+		void setProcessing(unsigned long ms);
+		void setLatency(unsigned long ms);
+
+		// Modem state
+		void setOperator(const char *numeric, const char *name);
+		void setSignal(uint8_t rssi, uint8_t ber);
+		void setRegistration(uint8_t cs_stat, uint8_t ps_stat);
+		void setCell(uint16_t lac, uint16_t ci);
+		void addSMS(const char *sender, const char *body);
+		void setHttpResponse(uint16_t status, const char *body, const char *headers = "");
+		void setTcpReply(const char *reply);
+		void dropContext(unsigned long at_ms);
+		void deliverSMS(unsigned long at_ms, const char *sender, const char *body);
+
+		// Sleep (AT+CSCLK): the host pin wired to DTR, the time from the wake up to a working UART
+		void setDtrPin(uint8_t pin);
+		void setWakeDelay(unsigned long ms);
+		bool sleeping();
+		// Ring indicator: the host pin wired to RI, pulsed for RING, +CMTI and with AT+CFGRI=1 every URC
+		void setRiPin(uint8_t pin);
+		// Receive event, as HardwareSerial::onReceive() of the ESP32 core: called every virtual ms while
+		// the UART holds data, e.g. [&sim]() { sim.rxEvent(); } with SIM_RTOS
+		void onReceive(std::function<void()> callback);
+
+		// Counters
+		unsigned long bytesToModem;
+		unsigned long bytesFromModem;
+		unsigned long commands;
+		unsigned long bytesDropped;		// sent while the modem slept
+		unsigned long tlsHandshakes;	// HTTPS actions and connects after AT+CIPSSL=1
+		unsigned long sleepMs();
+		void resetCounters();
+		const std::string &lastCommand() const { return _last_command; }
+		const std::string &apn() const { return _apn; }
+		// the last HTTP request: AT+HTTPPARA="URL", "USERDATA" and "CONTENT", the data of AT+HTTPDATA
+		const std::string &httpUrl() const { return _http_url; }
+		const std::string &httpUserData() const { return _http_userdata; }
+		const std::string &httpContent() const { return _http_content; }
+		const std::string &httpData() const { return _http_data; }
+		uint8_t httpMethod() const { return _http_method; }
+
+		// Stream
+		int available();
+		int read();
+		int peek();
+		size_t write(uint8_t c);
+		using Print::write;
+
+	private:
+		struct Rule {
+			std::string command;
+			std::string response;
+			unsigned long delay_ms;
+		};
+		struct Pending {
+			unsigned long long ready;
+			uint8_t c;
+		};
+		struct Timer {
+			unsigned long long at;
+			uint8_t kind;
+			std::string text;
+		};
+		struct SMS {
+			std::string sender;
+			std::string body;
+		};
+		enum Mode { LINE, SMS_BODY, TCP_BODY, HTTP_DATA };
+
+		void service();
+		void command(const std::string &line);
+		bool builtin(const std::string &line);
+		void bodyDone();
+		void emit(const std::string &text, unsigned long long delay_us = 0);
+		void info(const std::string &text, unsigned long long delay_us = 0);
+		void result(const char *code, unsigned long long delay_us = 0);
+		std::string head() const;
+		void error(uint16_t cme, unsigned long long delay_us = 0);
+		unsigned long long proc() const { return (unsigned long long)_processing_ms * 1000; }
+		unsigned long long net() const { return (unsigned long long)_latency_ms * 1000; }
+		std::string tcpState() const;
+		void wire();
+		static void pinChanged(uint8_t pin, uint8_t value);
+		static void tick();
+		void dtrChanged(uint8_t value);
+		void ringIndicator(bool ring);
+		void urc(const std::string &text, bool ring = false);
+		void nmea();
+
+		std::vector<Rule> _rules;
+		std::vector<Timer> _timers;
+		std::deque<Pending> _out;
+		std::vector<SMS> _sms;
+		std::string _line;
+		std::string _body;
+		std::string _last_command;
+		std::string _apn;
+		unsigned long long _last_out;
+		unsigned long long _byte_us;
+		unsigned long _processing_ms;
+		unsigned long _latency_ms;
+		Mode _mode;
+		size_t _body_len;
+
+		bool _sim808;
+		bool _echo;
+		bool _verbose;
+		uint8_t _cmee;
+		uint8_t _cmgf;
+		uint8_t _creg_mode;
+		uint8_t _cgreg_mode;
+		uint8_t _cs_stat;
+		uint8_t _ps_stat;
+		uint16_t _lac;
+		uint16_t _ci;
+		uint8_t _rssi;
+		uint8_t _ber;
+		bool _cops_numeric;
+		std::string _op_numeric;
+		std::string _op_name;
+		uint8_t _ip_state;
+		bool _bearer;
+		bool _http;
+		bool _http_ssl;
+		bool _tcp_ssl;
+		uint8_t _http_method;
+		uint16_t _http_status;
+		std::string _http_body;
+		std::string _http_headers;
+		std::string _http_url;
+		std::string _http_userdata;
+		std::string _http_content;
+		std::string _http_data;
+		std::string _tcp_reply;
+		unsigned long _sms_ref;
+		uint8_t _csclk;
+		uint8_t _dtr_pin;
+		uint8_t _ri_pin;
+		std::function<void()> _on_receive;
+		bool _cfgri;
+		uint8_t _ceng;
+		bool _gnss_power;
+		bool _gnss_stream;
+		unsigned long long _gnss_fix_at;
+		unsigned long long _wake_us;
+		unsigned long long _awake_at;
+		unsigned long long _last_in;
+		unsigned long long _sleep_since;
+		unsigned long long _sleep_us;
+};
+/**********************************************************************************************************************************/
+#endif
@@ -0,0 +1,403 @@
+/**********************************************************************************************************************************/
+// Per API call benchmark of ASIM against the emulator.
+//
+//	make -C extras/host bench && ./extras/host/bench [-b 9600,115200] [-l 100,500] [-p 10] [-n] [-r] [-m 4] [-s 10000] [-c]
+//
+// -b baud rates, -l network latencies in ms, -p modem processing time in ms, -c CSV output.
+// For every API call it reports the virtual wall time, the bytes on the wire in both directions,
+// the AT round trips and the part of the wall time spent inside delay() (idle waiting).
+// -n runs the API calls with numeric result codes (ATV0).
+// -m N runs SMS and HTTP POST jobs through an ASIMPool of 1 and of N modems.
+// -s P wakes the modem every P ms for getSignalQuality() in each sleep mode: wake latency, call
+// time and the part of the time the modem was awake.
+// -r compares the replies of single commands in both result formats: bytes, wire time at the
+// first baud rate and the host CPU time of getReply() (send, read and classify, no waiting).
+/**********************************************************************************************************************************/
+#include "Arduino.h"
+#include "SimEmulator.h"
+#include "ASIM.h"
+#include "ASIMPool.h"
+#include <time.h>
+
+struct Sample {
+	const char *api;
+	bool ok;
+	unsigned long long wall_us;
+	unsigned long long idle_us;
+	unsigned long tx;
+	unsigned long rx;
+	unsigned long round_trips;
+};
+
+static bool csv = false;
+static bool numeric = false;
+
+class Meter {
+	public:
+		Meter(SimEmulator &modem) : _modem(modem) {}
+		void start() {
+			_modem.resetCounters();
+			_wall = micros();
+			_idle = hostIdleMicros();
+		}
+		Sample stop(const char *api, bool ok) {
+			Sample s = { api, ok, micros() - _wall, hostIdleMicros() - _idle, _modem.bytesToModem, _modem.bytesFromModem, _modem.commands };
+			return s;
+		}
+	private:
+		SimEmulator &_modem;
+		unsigned long long _wall;
+		unsigned long long _idle;
+};
+
+static void report(unsigned long baud, unsigned long latency, const Sample &s) {
+	if (csv) {
+		printf("%lu,%lu,%s,%d,%.1f,%.1f,%lu,%lu,%lu\n", baud, latency, s.api, s.ok ? 1 : 0,
+			s.wall_us / 1000.0, s.idle_us / 1000.0, s.tx, s.rx, s.round_trips);
+		return;
+	}
+	printf("%-18s %-4s %10.1f %10.1f %5.1f%% %6lu %6lu %4lu\n", s.api, s.ok ? "ok" : "FAIL",
+		s.wall_us / 1000.0, s.idle_us / 1000.0, s.wall_us ? (100.0 * s.idle_us / s.wall_us) : 0.0, s.tx, s.rx, s.round_trips);
+}
+
+static void run(unsigned long baud, unsigned long latency, unsigned long processing) {
+	SimEmulator modem(false, baud);
+	modem.setLatency(latency);
+	modem.setProcessing(processing);
+	modem.setHttpResponse(200, "{\"id\":42,\"status\":\"queued\"}");
+
+	ASIM sim(0, 0, 0);
+	Meter meter(modem);
+	Sample s;
+
+	if (!csv) {
+		printf("\n== %lu baud, %lu ms network latency, %lu ms processing%s ==\n", baud, latency, processing, numeric ? ", ATV0" : "");
+		printf("%-18s %-4s %10s %10s %6s %6s %6s %4s\n", "api", "", "wall ms", "idle ms", "idle", "tx", "rx", "rtt");
+	}
+
+	meter.start();
+	s = meter.stop("begin", sim.begin(modem, 0) && (!numeric || sim.setResultFormat(NUMERIC_RESULTS)));
+	report(baud, latency, s);
+
+	char number[] = "+989121234567";
+	char text[] = "benchmark message";
+	meter.start();
+	s = meter.stop("sendSMS", sim.sendSMS(number, text, false));
+	report(baud, latency, s);
+
+	modem.addSMS("+989121234567", "incoming benchmark message");
+	char sender[20], body[64];
+	uint16_t len;
+	meter.start();
+	s = meter.stop("readSMS", sim.readSMS(1, sender, body, &len, sizeof(body)));
+	report(baud, latency, s);
+
+	char response[SIM_REPLY_SIZE];
+	meter.start();
+	s = meter.stop("postHttpRequest", sim.postHttpRequest("http://example.com/api", "token", "{\"value\":1}", 10000, response));
+	report(baud, latency, s);
+
+	char server[] = "example.com";
+	meter.start();
+	s = meter.stop("startTCP", sim.startTCP(server, 80));
+	report(baud, latency, s);
+
+	char data[] = "PING";
+	meter.start();
+	s = meter.stop("sendTCPData", sim.sendTCPData(data, response));
+	report(baud, latency, s);
+	delay(2 * latency);
+
+	meter.start();
+	s = meter.stop("closeTCP", sim.closeTCP());
+	report(baud, latency, s);
+
+	uint16_t error;
+	float lat, lon;
+	meter.start();
+	s = meter.stop("getGPRSLocation", sim.getGPRSLocation(&error, &lat, &lon));
+	report(baud, latency, s);
+}
+
+// Answers single commands at once, in the result format selected by ATV
+class ReplayModem : public Stream {
+	public:
+		struct Answer {
+			const char *command;
+			const char *info;
+			const char *result;
+		};
+		ReplayModem(const Answer *answers, size_t count) : _answers(answers), _count(count), _verbose(true), _pos(0) {}
+		// the bytes of an answer in the current format
+		std::string answer(const Answer &a) const {
+			std::string text, head = _verbose ? "\r\n" : "";
+			if (a.info) text += head + a.info + "\r\n";
+			if (!_verbose && !strcmp(a.result, "OK")) return text + "0\r";
+			if (!_verbose && !strcmp(a.result, "ERROR")) return text + "4\r";
+			return text + head + a.result + "\r\n";
+		}
+		int available() { return _out.size() - _pos; }
+		int read() { return (_pos < _out.size()) ? (uint8_t)_out[_pos++] : -1; }
+		int peek() { return (_pos < _out.size()) ? (uint8_t)_out[_pos] : -1; }
+		size_t write(uint8_t c) {
+			if (c == '\r') {
+				Answer ok = { "", NULL, "OK" };
+				const Answer *a = &ok;
+				for (size_t i = 0; i < _count; i++) {
+					if (_line == _answers[i].command) a = &_answers[i];
+				}
+				if (!_line.compare(0, 3, "ATV")) _verbose = (_line[3] != '0');
+				_out = answer(*a);
+				_pos = 0;
+				_line.clear();
+			}
+			else if (c != '\n') {
+				_line += (char)c;
+			}
+			return 1;
+		}
+		using Print::write;
+	private:
+		const Answer *_answers;
+		size_t _count;
+		bool _verbose;
+		std::string _line;
+		std::string _out;
+		size_t _pos;
+};
+
+static double hostMicros() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+static void resultFormats(unsigned long baud) {
+	static const ReplayModem::Answer answers[] = {
+		{ "AT",				NULL,								"OK" },
+		{ "AT+CSQ",			"+CSQ: 18,0",						"OK" },
+		{ "AT+CREG?",		"+CREG: 0,1",						"OK" },
+		{ "AT+CMGF?",		"+CMGF: 1",							"OK" },
+		{ "AT+COPS?",		"+COPS: 0,0,\"43235\"",				"OK" },
+		{ "AT+CCLK?",		"+CCLK: \"24/03/07,09:05:00+14\"",	"OK" },
+		{ "AT+CMGD=9",		NULL,								"ERROR" },
+		{ "AT+CMGS=1",		NULL,								"+CMS ERROR: 304" },
+	};
+	const size_t count = sizeof(answers) / sizeof(answers[0]);
+	const int rounds = 20000;
+	ReplayModem modem(answers, count);
+	ASIM sim(0, 0, 0);
+	sim.begin(modem, 0);
+
+	if (!csv) {
+		printf("\n== result codes, wire time at %lu baud, host CPU per command ==\n", baud);
+		printf("%-12s %8s %8s %8s %9s %9s %9s %9s\n", "command", "ATV1 B", "ATV0 B", "saved", "ATV1 ms", "ATV0 ms", "ATV1 us", "ATV0 us");
+	}
+	for (size_t i = 0; i < count; i++) {
+		const ReplayModem::Answer &a = answers[i];
+		size_t bytes[2];
+		double cpu[2];
+		for (int v = 1; v >= 0; v--) {
+			sim.setResultFormat(v ? VERBOSE_RESULTS : NUMERIC_RESULTS);
+			bytes[v] = modem.answer(a).size();
+			double start = hostMicros();
+			for (int r = 0; r < rounds; r++) {
+				sim.getReply(DEFAULT_TIMOUT, a.command);
+			}
+			cpu[v] = (hostMicros() - start) / rounds;
+		}
+		double wire[2] = { bytes[0] * 10000.0 / baud, bytes[1] * 10000.0 / baud };
+		if (csv) {
+			printf("%lu,%s,%zu,%zu,%.2f,%.2f,%.3f,%.3f\n", baud, a.command, bytes[1], bytes[0], wire[1], wire[0], cpu[1], cpu[0]);
+		}
+		else {
+			printf("%-12s %8zu %8zu %8zu %9.2f %9.2f %9.3f %9.3f\n", a.command, bytes[1], bytes[0], bytes[1] - bytes[0],
+				wire[1], wire[0], cpu[1], cpu[0]);
+		}
+	}
+}
+
+static void poolRun(unsigned long baud, unsigned long latency, unsigned long processing, unsigned modems, unsigned jobs) {
+	std::vector<SimEmulator *> modem;
+	std::vector<ASIM *> sim;
+	std::vector<ASIMJob> job(jobs);
+	std::vector<std::string> response(jobs, std::string(64, 0));
+	char number[] = "+989121234567";
+	ASIMPool pool;
+
+	for (unsigned i = 0; i < modems; i++) {
+		modem.push_back(new SimEmulator(false, baud));
+		modem[i]->setLatency(latency);
+		modem[i]->setProcessing(processing);
+		modem[i]->setSignal(10 + 2 * i, 0);
+		modem[i]->setHttpResponse(200, "{\"id\":42,\"status\":\"queued\"}");
+		sim.push_back(new ASIM(0, 0, 0));
+		sim[i]->begin(*modem[i], 0);
+		pool.add(*sim[i]);
+	}
+
+	unsigned long start = millis();
+	pool.resetStats();
+	unsigned next = 0;
+	while ((next < jobs) || !pool.idle()) {
+		// keep the queue full
+		while ((next < jobs) && (pool.queued() < SIM_POOL_QUEUE)) {
+			if (next % 2) pool.httpPost(job[next], "http://example.com/api", "{\"value\":1}", &response[next][0], 64);
+			else pool.sendSMS(job[next], number, "benchmark message");
+			next++;
+		}
+		pool.poll();
+		delay(1);
+	}
+	unsigned long wall = millis() - start;
+
+	const ASIMPoolStats &s = pool.getStats();
+	unsigned long tx = 0, rx = 0;
+	for (unsigned i = 0; i < modems; i++) {
+		tx += modem[i]->bytesToModem;
+		rx += modem[i]->bytesFromModem;
+	}
+	if (csv) {
+		printf("%lu,%lu,pool,%u,%lu,%lu,%lu,%.1f\n", baud, latency, modems, (unsigned long)s.done, (unsigned long)s.failed, wall, 60000.0 * s.done / wall);
+	}
+	else {
+		printf("%-6u %6lu %6lu %10lu %10.1f %10lu %10lu %8lu %8lu\n", modems, (unsigned long)s.done, (unsigned long)s.failed, wall,
+			60000.0 * s.done / wall, s.done ? (unsigned long)(s.wait_ms / s.done) : 0UL, s.done ? (unsigned long)(s.run_ms / s.done) : 0UL, tx, rx);
+	}
+	for (unsigned i = 0; i < modems; i++) {
+		delete sim[i];
+		delete modem[i];
+	}
+}
+
+static void poolBench(unsigned long baud, unsigned long latency, unsigned long processing, unsigned modems) {
+	const unsigned jobs = 8 * modems;
+	if (!csv) {
+		printf("\n== pool, %u jobs (SMS and HTTP POST), %lu baud, %lu ms network latency ==\n", jobs, baud, latency);
+		printf("%-6s %6s %6s %10s %10s %10s %10s %8s %8s\n", "modems", "done", "failed", "wall ms", "jobs/min", "wait ms", "run ms", "tx", "rx");
+	}
+	poolRun(baud, latency, processing, 1, jobs);
+	if (modems > 1) {
+		poolRun(baud, latency, processing, modems, jobs);
+	}
+}
+
+static void sleepRun(unsigned long baud, unsigned long processing, uint8_t mode, unsigned long period, unsigned cycles) {
+	static const char *names[] = { "off", "dtr", "auto" };
+	SimEmulator modem(false, baud);
+	modem.setProcessing(processing);
+	modem.setDtrPin(4);
+	ASIM sim(0, 0, 0, 4);
+	bool ok = sim.begin(modem, 0) && sim.setSleepMode(mode);
+	unsigned long long call_us = 0;
+
+	sim.resetPowerStats();
+	modem.resetCounters();
+	unsigned long start = millis();
+	for (unsigned i = 0; i < cycles; i++) {
+		unsigned long long t = micros();
+		ok = (sim.getSignalQuality() > 0) && ok;
+		call_us += micros() - t;
+		unsigned long next = start + (i + 1) * period;
+		if (millis() < next) {
+			delay(next - millis());
+		}
+	}
+	unsigned long wall = millis() - start;
+	const ASIMPowerStats &p = sim.getPowerStats();
+	unsigned long awake = wall - modem.sleepMs();
+
+	if (csv) {
+		printf("%lu,%s,%d,%lu,%.1f,%.1f,%u,%.1f,%lu\n", baud, names[mode], ok ? 1 : 0, period, call_us / 1000.0 / cycles,
+			p.wakes ? (double)p.wake_total / p.wakes : 0.0, p.wake_max, 100.0 * awake / wall, modem.bytesDropped);
+		return;
+	}
+	printf("%-6s %-4s %10.1f %10.1f %10u %8lu %9.1f%% %8lu\n", names[mode], ok ? "ok" : "FAIL", call_us / 1000.0 / cycles,
+		p.wakes ? (double)p.wake_total / p.wakes : 0.0, p.wake_max, (unsigned long)p.wake_failures, 100.0 * awake / wall,
+		modem.bytesDropped);
+}
+
+static void sleepBench(unsigned long baud, unsigned long processing, unsigned long period) {
+	const unsigned cycles = 20;
+	if (!csv) {
+		printf("\n== sleep, getSignalQuality() every %lu ms, %u cycles, %lu baud ==\n", period, cycles, baud);
+		printf("%-6s %-4s %10s %10s %10s %8s %10s %8s\n", "mode", "", "call ms", "wake ms", "wake max", "no wake", "awake", "dropped");
+	}
+	sleepRun(baud, processing, SLEEP_OFF, period, cycles);
+	sleepRun(baud, processing, SLEEP_DTR, period, cycles);
+	sleepRun(baud, processing, SLEEP_AUTO, period, cycles);
+}
+
+static std::vector<unsigned long> parseList(const char *text) {
+	std::vector<unsigned long> list;
+	char *end;
+	while (*text) {
+		list.push_back(strtoul(text, &end, 10));
+		if (*end != ',') break;
+		text = end + 1;
+	}
+	return list;
+}
+
+int main(int argc, char **argv) {
+	std::vector<unsigned long> bauds = parseList("9600,115200");
+	std::vector<unsigned long> latencies = parseList("100,500");
+	unsigned long processing = 10;
+	bool formats = false;
+	unsigned modems = 0;
+	unsigned long period = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-c")) csv = true;
+		else if (!strcmp(argv[i], "-b") && (i + 1 < argc)) bauds = parseList(argv[++i]);
+		else if (!strcmp(argv[i], "-l") && (i + 1 < argc)) latencies = parseList(argv[++i]);
+		else if (!strcmp(argv[i], "-p") && (i + 1 < argc)) processing = strtoul(argv[++i], NULL, 10);
+		else if (!strcmp(argv[i], "-n")) numeric = true;
+		else if (!strcmp(argv[i], "-r")) formats = true;
+		else if (!strcmp(argv[i], "-m") && (i + 1 < argc)) modems = strtoul(argv[++i], NULL, 10);
+		else if (!strcmp(argv[i], "-s") && (i + 1 < argc)) period = strtoul(argv[++i], NULL, 10);
+		else {
+			fprintf(stderr, "usage: %s [-b baud,...] [-l latency_ms,...] [-p processing_ms] [-n] [-r] [-m modems] [-s period_ms] [-c]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	// the library debug output would be measured as well, keep it off the console
+	Serial.quiet(true);
+	if (formats) {
+		if (csv) {
+			printf("baud,command,atv1_bytes,atv0_bytes,atv1_wire_ms,atv0_wire_ms,atv1_cpu_us,atv0_cpu_us\n");
+		}
+		resultFormats(bauds.empty() ? 9600 : bauds[0]);
+		return 0;
+	}
+	if (period) {
+		if (csv) {
+			printf("baud,mode,ok,period_ms,call_ms,wake_ms,wake_max_ms,awake_pct,dropped\n");
+		}
+		for (size_t b = 0; b < bauds.size(); b++) {
+			sleepBench(bauds[b], processing, period);
+		}
+		return 0;
+	}
+	if (modems) {
+		if (csv) {
+			printf("baud,latency_ms,pool,modems,done,failed,wall_ms,jobs_per_min\n");
+		}
+		for (size_t b = 0; b < bauds.size(); b++) {
+			for (size_t l = 0; l < latencies.size(); l++) {
+				poolBench(bauds[b], latencies[l], processing, modems);
+			}
+		}
+		return 0;
+	}
+	if (csv) {
+		printf("baud,latency_ms,api,ok,wall_ms,idle_ms,tx_bytes,rx_bytes,round_trips\n");
+	}
+	for (size_t b = 0; b < bauds.size(); b++) {
+		for (size_t l = 0; l < latencies.size(); l++) {
+			run(bauds[b], latencies[l], processing);
+		}
+	}
+	return 0;
+}
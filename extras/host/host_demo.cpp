@@ -0,0 +1,639 @@
+/**********************************************************************************************************************************/
+// Runs the ASIM API against the emulator on the host.
+//
+//	make -C extras/host && ./extras/host/host_demo [-q]
+//
+// -q hides the library debug output. Built with DEFS=-std=c++20 it also awaits jobs in a coroutine.
+/**********************************************************************************************************************************/
+#include "Arduino.h"
+#include "SimEmulator.h"
+#include "ASIM.h"
+#include "ASIMPool.h"
+#include "ASIMLink.h"
+#include "ASIMScheduler.h"
+#include "ASIMGNSS.h"
+#include "ASIMLocation.h"
+#include "ASIMHttp.h"
+
+static int failures = 0;
+
+static void check(const char *name, bool ok) {
+	printf("[%s] %s\n", ok ? " OK " : "FAIL", name);
+	if (!ok) failures++;
+}
+
+static ASIMJob tcp_jobs[3];
+
+// chained to the POST job: a TCP exchange once the server answered
+static void afterPost(ASIMJob &job, void *arg) {
+	ASIMAsync &async = *(ASIMAsync *)arg;
+	if (!job.ok()) return;
+	async.startTCPAsync(tcp_jobs[0], "example.com", 80);
+	async.sendTCPDataAsync(tcp_jobs[1], "PING");
+	async.closeTCPAsync(tcp_jobs[2]);
+}
+
+#if defined(__cpp_impl_coroutine)
+static ASIMTask flow(ASIMAsync &async, const char *number, bool *ok) {
+	ASIMJob job;
+	char response[32];
+	*ok = false;
+	if (!co_await async.sendSMSAsync(job, number, "coroutine")) co_return;
+	if (!co_await async.httpGetAsync(job, "http://example.com/api", response, sizeof(response))) co_return;
+	*ok = (strcmp(response, "{\"id\":42}") == 0);
+}
+#endif
+
+#ifdef SIM_RTOS
+struct RtosShared {
+	ASIM *sim;
+	int answered;
+	volatile bool done;
+};
+
+// a task that asks for the signal while the loop task sends an SMS through the same modem
+static void signalTask(void *arg) {
+	RtosShared &shared = *(RtosShared *)arg;
+	for (int i = 0; i < 3; i++) {
+		if (shared.sim->getSignalQuality() > 0) {
+			shared.answered++;
+		}
+	}
+	shared.done = true;
+}
+#endif
+
+static uint8_t last_urc = 0;
+
+static void urcHook(uint8_t urc, const char *line, void *arg) {
+	last_urc = urc;
+	*(int *)arg = atoi(strchr(line, ',') + 1);
+}
+
+// the slots of an ASIMHttpCache, standing in for an EEPROM
+static bool cacheStorage(uint8_t slot, ASIMHttpCacheEntry &entry, bool save, void *arg) {
+	ASIMHttpCacheEntry *eeprom = (ASIMHttpCacheEntry *)arg;
+	if (save) {
+		eeprom[slot] = entry;
+		return true;
+	}
+	entry = eeprom[slot];
+	return entry.key != 0;
+}
+
+static void runAsync(ASIMAsync &async) {
+	unsigned long start = millis();
+	while ((!async.idle()) && ((millis() - start) < 60000)) {
+		async.poll();
+		delay(1);
+	}
+}
+
+int main(int argc, char **argv) {
+	bool quiet = (argc > 1) && (strcmp(argv[1], "-q") == 0);
+
+	SimEmulator modem(true, 115200);
+	modem.setLatency(200);
+	modem.setHttpResponse(200, "{\"id\":42}");
+	modem.setDtrPin(4);
+	modem.setRiPin(5);
+
+	ASIM sim(0, 0, 0, 4, 5);
+	Serial.quiet(quiet);
+	bool ok = sim.begin(modem, 0);
+	Serial.quiet(false);
+	check("begin", ok);
+
+	Serial.quiet(quiet);
+	int8_t signal = sim.getSignalQuality();
+	Serial.quiet(false);
+	check("getSignalQuality", signal > 0);
+
+	// the operator table gives the APN of the network, setAPN() replaces it
+	ok = (strcmp(sim.getOperator(), "43235") == 0) && sim.getAPN().flash && (strcmp_P("mtnirancell", sim.getAPN().apn) == 0) &&
+		(sim._sim_type == IRANCELL);
+	Serial.quiet(quiet);
+	ok = ok && sim.setAPN("iot.example", "user", "secret", APN_QUIRK_DNS) && sim.enableGPRS();
+	ok = ok && (modem.apn() == "\"iot.example\",\"user\",\"secret\"") && sim.setAPN(NULL) && sim.getAPN().flash;
+	Serial.quiet(false);
+	check("operator table/setAPN", ok);
+
+	char number[] = "+989121234567";
+	char text[] = "ping";
+	Serial.quiet(quiet);
+	ok = sim.sendSMS(number, text, false);
+	Serial.quiet(false);
+	check("sendSMS", ok);
+
+	// begin() clears the inbox, the message arrives afterwards
+	modem.addSMS("+989121234567", "Hello from the emulator");
+	char sender[20], body[64];
+	uint16_t len = 0;
+	Serial.quiet(quiet);
+	ok = sim.readSMS(1, sender, body, &len, sizeof(body));
+	Serial.quiet(false);
+	check("readSMS", ok && (strcmp(body, "Hello from the emulator") == 0));
+
+	char ussd[] = "*140#";
+	char balance[40];
+	Serial.quiet(quiet);
+	ok = sim.sendUSSD(ussd, balance, &len, sizeof(balance));
+	Serial.quiet(false);
+	check("sendUSSD", ok && (strcmp(balance, "Your balance is 1000") == 0));
+
+	// a rejected command fails at once and tells why
+	modem.on("AT+CUSD=1,", "\r\n+CME ERROR: 30\r\n", 20);
+	unsigned long start = millis();
+	Serial.quiet(quiet);
+	ok = sim.sendUSSD(ussd, balance, &len, sizeof(balance));
+	Serial.quiet(false);
+	check("sendUSSD +CME ERROR", !ok && (sim.getLastError().result == FINAL_CME_ERROR) &&
+		(sim.getLastError().code == 30) && ((millis() - start) < 250));
+	modem.clearRules();
+
+	char response[64];
+	Serial.quiet(quiet);
+	ok = sim.postHttpRequest("http://example.com/api", "token", "{\"a\":1}", 10000, response);
+	Serial.quiet(false);
+	check("postHttpRequest", ok && (strcmp(response, "{\"id\":42}") == 0) &&
+		(modem.httpUserData() == "Authorization: Bearer token") && (modem.httpContent() == "application/json") &&
+		(modem.httpData() == "{\"a\":1}"));
+
+	// the session stays open: a second AT+HTTPINIT would fail. The body is read in pieces, line breaks included
+	modem.setHttpResponse(200, "line 1\r\nline 2\r\n");
+	modem.on("AT+HTTPINIT", "\r\nERROR\r\n", 20);
+	char device[] = "42";
+	char piece[8];
+	std::string received;
+	ASIMHttpRequest get(HTTPACTION_GET, F("http://example.com/config"));
+	get.header(F("X-Device: "), device).header("Accept: text/plain");
+	ASIMHttpResponse answer;
+	Serial.quiet(quiet);
+	ok = sim.httpRequest(get, answer) && answer.ok() && (answer.length() == 16);
+	uint16_t got;
+	while ((got = answer.read(piece, sizeof(piece))) > 0) {
+		received.append(piece, got);
+	}
+	ok = ok && (received == "line 1\r\nline 2\r\n") && (modem.httpUrl() == "http://example.com/config") &&
+		(modem.httpUserData() == "X-Device: 42\\r\\nAccept: text/plain") && (modem.httpMethod() == HTTPACTION_GET);
+	ASIMHttpRequest post(HTTPACTION_POST, "http://example.com/log");
+	post.body(F("{\"boot\":1}"));
+	ok = ok && sim.httpRequest(post, answer) && (modem.httpData() == "{\"boot\":1}") && (modem.httpContent() == "text/plain") &&
+		(modem.httpUserData() == "");
+	for (uint8_t i = 0; i <= SIM_HTTP_HEADERS; i++) {
+		post.header(F("X-Extra: 1"));
+	}
+	ok = ok && !sim.httpRequest(post, answer) && sim.httpClose();
+	Serial.quiet(false);
+	modem.clearRules();
+	modem.setHttpResponse(200, "{\"id\":42}");
+	check("httpRequest", ok);
+
+	// a polled configuration: the first GET keeps Last-Modified, the next one gets a 304 without AT+HTTPREAD.
+	// The ETag is not kept, its quotes can not go through USERDATA. The entries are saved through the storage
+	// hook and loaded again after a restart
+	modem.setHttpResponse(200, "{\"interval\":300}",
+		"Content-Type: application/json\r\nETag: \"v1\"\r\nLast-Modified: Thu, 07 Mar 2024 09:05:00 GMT");
+	ASIMHttpCacheEntry eeprom[SIM_HTTP_CACHE];
+	memset(eeprom, 0, sizeof(eeprom));
+	ASIMHttpCache cache;
+	cache.setStorage(cacheStorage, eeprom);
+	ASIMHttpRequest config(HTTPACTION_GET, F("http://example.com/config"));
+	config.cache(cache);
+	Serial.quiet(quiet);
+	ok = sim.httpRequest(config, answer) && answer.ok() && (answer.length() == 16) && (modem.httpUserData() == "");
+	ok = ok && sim.httpRequest(config, answer) && answer.notModified() && !answer.available() &&
+		(modem.lastCommand() == "AT+HTTPACTION=0") &&
+		(modem.httpUserData() == "If-Modified-Since: Thu, 07 Mar 2024 09:05:00 GMT");
+	ASIMHttpCache restarted;
+	restarted.setStorage(cacheStorage, eeprom);
+	config.cache(restarted);
+	ok = ok && restarted.find(F("http://example.com/config")) && sim.httpRequest(config, answer) && answer.notModified();
+	// a new version is downloaded and its date replaces the old one
+	modem.setHttpResponse(200, "{\"interval\":60}", "Last-Modified: Fri, 08 Mar 2024 10:00:00 GMT");
+	ok = ok && sim.httpRequest(config, answer) && answer.ok() && (answer.read(piece, sizeof(piece)) == sizeof(piece));
+	const ASIMHttpCacheEntry *cached = restarted.find("http://example.com/config");
+	ok = ok && cached && (strcmp(cached->modified, "Fri, 08 Mar 2024 10:00:00 GMT") == 0) && (eeprom[0].length == 15);
+	ok = ok && sim.httpRequest(config, answer) && answer.notModified();
+	// an answer with only an ETag leaves nothing to send, the URL leaves the cache
+	modem.setHttpResponse(200, "{\"interval\":30}", "ETag: \"v3\"");
+	ok = ok && sim.httpRequest(config, answer) && answer.ok() && (answer.read(piece, sizeof(piece)) == sizeof(piece));
+	ok = ok && !restarted.find("http://example.com/config");
+	ok = ok && sim.httpClose();
+	Serial.quiet(false);
+	modem.setHttpResponse(200, "{\"id\":42}");
+	const ASIMHttpCacheStats &cs = restarted.getStats();
+	check("HTTP cache", ok && (cache.getStats().hits == 1) && (cs.lookups == 4) && (cs.conditional == 4) && (cs.hits == 2) &&
+		(cs.stores == 1) && (cs.saved == 31));
+
+	uint16_t error = 0;
+	float lat = 0, lon = 0;
+	Serial.quiet(quiet);
+	ok = sim.getGPRSLocation(&error, &lat, &lon) && (error == 0) && (lat > 35) && (lon > 51);
+	int32_t micro_lat = 0, micro_lon = 0;
+	ok = ok && sim.getGPRSLocation(&error, &micro_lat, &micro_lon) && (micro_lat == 35689200) && (micro_lon == 51389000);
+	Serial.quiet(false);
+	check("getGPRSLocation", ok);
+
+	// the GNSS engine of the SIM808: AT+CGNSINF polled once a second up to the first fix, then the NMEA output
+	// parsed as it arrives
+	ASIMGNSS gnss;
+	const ASIMGNSSFix &fix = gnss.fix();
+	Serial.quiet(quiet);
+	ok = sim.setGNSSPower(true) && sim.getGNSSInfo(gnss) && !fix.valid;
+	for (int i = 0; (i < 10) && !fix.valid; i++) {
+		delay(1000);
+		ok = sim.getGNSSInfo(gnss) && ok;
+	}
+	bool polled = ok && fix.valid && (fix.lat == 35689197) && (fix.lon == 51388974) && (fix.alt == 120050) &&
+		(fix.hdop == 90) && (fix.sats_used == 8) && (fix.sats_view == 12) && (fix.year == 24) && (fix.month == 3);
+	uint16_t sentences = gnss.sentences();
+	ok = sim.setGNSSStream(true);
+	unsigned long gnss_start = millis();
+	while ((millis() - gnss_start) < 3500) {
+		sim.readGNSS(gnss);
+		delay(1);
+	}
+	sentences = gnss.sentences() - sentences;
+	ok = sim.setGNSSStream(false) && sim.setGNSSPower(false) && ok;
+	Serial.quiet(false);
+	check("GNSS", polled && ok && (sentences >= 6) && (gnss.errors() == 0) && fix.valid && (fix.lat == 35689197) &&
+		(fix.lon == 51388974) && (fix.alt == 120050));
+	if (!quiet) {
+		printf("gnss %ld.%06ld %ld.%06ld, %ld cm, %u sentences\n", (long)fix.lat / 1000000, (long)fix.lat % 1000000,
+			(long)fix.lon / 1000000, (long)fix.lon % 1000000, (long)fix.alt, sentences);
+	}
+
+	char server[] = "example.com";
+	char data[] = "PING";
+	Serial.quiet(quiet);
+	ok = sim.startTCP(server, 80) && sim.sendTCPData(data, response);
+	Serial.quiet(false);
+	check("startTCP/sendTCPData", ok);
+
+	// the server answer arrives after SEND OK as unsolicited data, closeTCP() flushes it
+	delay(1000);
+
+	Serial.quiet(quiet);
+	ok = sim.closeTCP();
+	Serial.quiet(false);
+	check("closeTCP", ok);
+
+	// HTTPS sends AT+HTTPSSL=1 once for the session, yet every request is a new handshake. A TLS connection
+	// still open is kept without one
+	unsigned long handshakes = modem.tlsHandshakes;
+	ASIMHttpRequest secure_get(HTTPACTION_GET, F("HTTPS://example.com/config"));
+	ASIMHttpRequest plain_get(HTTPACTION_GET, "http://example.com/config");
+	Serial.quiet(quiet);
+	ok = secure_get.secure() && !plain_get.secure() && sim.setTLSOption(TLS_IGNORE_INVALID_CERT, true) &&
+		sim.setTLSCertificate(F("C:\\USER\\client.p12"), F("secret")) && !sim.setTLSCertificate("");
+	ok = ok && sim.httpRequest(secure_get, answer) && answer.ok() && sim.httpRequest(secure_get, answer) &&
+		sim.httpRequest(plain_get, answer) && sim.httpClose();
+	ok = ok && sim.startTCP(server, 443, true) && sim.startTCP(server, 443, true) && sim.closeTCP();
+	ok = ok && sim.startTCP(server, 80) && sim.closeTCP();
+	Serial.quiet(false);
+	const ASIMTLSStats &ts = sim.getTLSStats();
+	check("TLS", ok && (ts.connects == 1) && (ts.reuses == 1) && (ts.requests == 2) && (ts.failures == 0) &&
+		(modem.tlsHandshakes - handshakes == ts.connects + ts.requests) && (ts.connect_last > 0) && (ts.request_last > 0) &&
+		(ts.request_max >= ts.request_last) && (ts.request_total > ts.request_max));
+
+	// the context is still active and reused, a dropped one comes back after a failed try and the backoff
+	sim.resetBearerStats();
+	Serial.quiet(quiet);
+	ok = sim.enableGPRS() && (sim.getBearerStats().reuses == 1) && (sim.getBearerStats().bringups == 0);
+	modem.dropContext(millis() + 500);
+	modem.on("AT+CIICR", "\r\nERROR\r\n", 20);
+	start = millis();
+	while ((sim.getBearerStats().failures == 0) && ((millis() - start) < 5000)) {
+		sim.maintainGPRS();
+		delay(10);
+	}
+	unsigned long failed_at = millis();
+	modem.clearRules();
+	while ((!sim.maintainGPRS()) && ((millis() - start) < 10000)) {
+		delay(10);
+	}
+	const ASIMBearerStats &bs = sim.getBearerStats();
+	ok = ok && (bs.deacts == 1) && (bs.failures == 1) && (bs.reconnects == 1) && (bs.bringups == 1) &&
+		((millis() - failed_at) >= SIM_BEARER_BACKOFF) && (bs.up_max >= bs.up_last) && sim.getGPRSLocation(&error, &lat, &lon);
+	Serial.quiet(false);
+	check("bearer reuse/reconnect", ok);
+
+	// the modem sleeps between the calls, the next call wakes it through DTR
+	Serial.quiet(quiet);
+	ok = sim.setSleepMode(SLEEP_DTR);
+	delay(2000);
+	bool slept = modem.sleeping();
+	signal = sim.getSignalQuality();
+	ok = ok && slept && (signal > 0) && sim.asleep() && (sim.getPowerStats().wakes == 1);
+	ok = sim.setSleepMode(SLEEP_OFF) && ok;
+	Serial.quiet(false);
+	check("sleep/wake", ok && !modem.sleeping() && (modem.sleepMs() >= 2000));
+
+	// the loop idles without touching the UART until RI falls for the +CMTI of a new SMS
+	int sms_index = 0;
+	sim.onURC(urcHook, &sms_index);
+	modem.deliverSMS(millis() + 3000, "+989127654321", "Woken by RI");
+	unsigned long idle_start = millis();
+	unsigned long read_before = modem.bytesFromModem;
+	while ((!sim.pending()) && ((millis() - idle_start) < 10000)) {
+		delay(10);
+	}
+	bool untouched = (modem.bytesFromModem == read_before) && ((millis() - idle_start) >= 3000);
+	Serial.quiet(quiet);
+	ok = (sim.dispatchEvents() == 1) && (last_urc == URC_CMTI) && !sim.pending();
+	ok = ok && sim.readSMS(sms_index, sender, body, &len, sizeof(body));
+	Serial.quiet(false);
+	check("RI wake/dispatchEvents", ok && untouched && (strcmp(body, "Woken by RI") == 0));
+
+	// SIM_RI_MODEMS is 2: the third modem with an RI pin gets no slot and checks the UART instead
+	SimEmulator ri_modem[2] = { SimEmulator(false, 115200), SimEmulator(false, 115200) };
+	ASIM ri_sim[2] = { ASIM(0, 0, 0, 0, 6), ASIM(0, 0, 0, 0, 7) };
+	Serial.quiet(quiet);
+	for (int i = 0; i < 2; i++) {
+		ri_modem[i].setRiPin(6 + i);
+		ok = ri_sim[i].begin(ri_modem[i], 0) && ok;
+	}
+	ri_modem[1].deliverSMS(millis() + 1000, "+989127654321", "No RI slot");
+	idle_start = millis();
+	while ((!ri_sim[1].pending()) && ((millis() - idle_start) < 10000)) {
+		delay(10);
+	}
+	ok = ok && (ri_sim[1].dispatchEvents() == 1) && (last_urc == URC_CMTI) && !ri_sim[1].pending();
+	Serial.quiet(false);
+	check("RI slots full", ok);
+
+	#ifdef SIM_RTOS
+		// an API call before begin() takes the mutex made by the constructor. The modem of this test raises
+		// receive events, so its reader task sleeps until data arrives. At this baud rate a whole HTTPREAD
+		// answer arrives at once, many more lines than the queue holds, and has to come through intact
+		ASIM rtos_sim(0, 0, 0);
+		SimEmulator rtos_modem(false, 115200);
+		rtos_modem.onReceive([&rtos_sim]() { rtos_sim.rxEvent(); });
+		std::string lines;
+		for (int i = 0; i < 40; i++) {
+			lines += "line " + std::to_string(100 + i) + " of the configuration\n";
+		}
+		rtos_modem.setHttpResponse(200, lines.c_str());
+		Serial.quiet(quiet);
+		ok = !rtos_sim.setSleepMode(SLEEP_DTR) && rtos_sim.begin(rtos_modem, 0);
+		rtos_modem.setBaud(100000000);
+		static char long_body[1400];
+		ASIMHttpRequest lines_get(HTTPACTION_GET, "http://example.com/lines");
+		ok = ok && rtos_sim.httpRequest(lines_get, answer) && (answer.length() == lines.size()) &&
+			(answer.read(long_body, sizeof(long_body)) == lines.size()) &&
+			(memcmp(long_body, lines.data(), lines.size()) == 0);
+		// a second task of a higher priority shares the modem with the loop task
+		RtosShared shared = { &rtos_sim, 0, 0 };
+		xTaskCreate(signalTask, "signal", 4096, &shared, 2, NULL);
+		ok = ok && rtos_sim.sendSMS(number, text, false);
+		unsigned long rtos_start = millis();
+		while ((!shared.done) && ((millis() - rtos_start) < 10000)) {
+			delay(10);
+		}
+		Serial.quiet(false);
+		check("RTOS", ok && shared.done && (shared.answered == 3));
+	#endif
+
+	// jobs run while the caller keeps polling, a callback queues the next ones. The TCP answer ends
+	// with a line end, in ATV0 a bare one would run into the CLOSE OK of the next job
+	modem.setTcpReply("PONG\r\n");
+	ASIMAsync async(sim);
+	ASIMJob sms_job, post_job;
+	char async_response[32];
+	Serial.quiet(quiet);
+	async.sendSMSAsync(sms_job, number, "async");
+	async.postHttpAsync(post_job, "http://example.com/api", "{\"a\":2}", async_response, sizeof(async_response)).then(afterPost, &async);
+	runAsync(async);
+	Serial.quiet(false);
+	ok = sms_job.ok() && post_job.ok() && (post_job.http_status == 200) && (strcmp(async_response, "{\"id\":42}") == 0);
+	for (int i = 0; i < 3; i++) {
+		ok = ok && tcp_jobs[i].ok();
+	}
+	check("ASIMAsync", ok);
+
+	// an HTTP job runs on the session of httpRequest(), a second AT+HTTPINIT would fail, with the HTTPS and the
+	// headers of its request. A body longer than a reply line comes in pieces, one too long for the buffer fails
+	// the job. A GET through a cache keeps Last-Modified and is answered 304 the next time
+	std::string page;
+	for (int i = 0; i < 13; i++) {
+		page += "row " + std::to_string(10 + i) + " of the async page....\r\n";
+	}
+	modem.setHttpResponse(200, page.c_str());
+	modem.on("AT+HTTPINIT", "\r\nERROR\r\n", 20);
+	static char page_buffer[512];
+	char short_buffer[64];
+	ASIMJob page_job, short_job, secure_job, cached_jobs[2];
+	ASIMHttpRequest secure_page(HTTPACTION_GET, F("https://example.com/page"));
+	secure_page.header(F("X-Device: "), device);
+	handshakes = modem.tlsHandshakes;
+	Serial.quiet(quiet);
+	async.httpGetAsync(page_job, "http://example.com/page", page_buffer, sizeof(page_buffer));
+	async.httpGetAsync(short_job, "http://example.com/page", short_buffer, sizeof(short_buffer));
+	async.httpAsync(secure_job, secure_page, NULL, 0);
+	runAsync(async);
+	ok = page_job.ok() && (page_job.length == page.size()) && (page_job.received == page.size()) && (page == page_buffer) &&
+		!short_job.ok() && (short_job.length == page.size()) && (short_job.received == sizeof(short_buffer) - 1) &&
+		(page.compare(0, sizeof(short_buffer) - 1, short_buffer) == 0) && secure_job.ok() &&
+		(modem.httpUrl() == "https://example.com/page") && (modem.httpUserData() == "X-Device: 42") &&
+		(modem.tlsHandshakes - handshakes == 1);
+	modem.setHttpResponse(200, "{\"interval\":300}", "Last-Modified: Thu, 07 Mar 2024 09:05:00 GMT");
+	ASIMHttpCache async_cache;
+	ASIMHttpRequest cached_get(HTTPACTION_GET, "http://example.com/config");
+	cached_get.cache(async_cache);
+	async.httpAsync(cached_jobs[0], cached_get, page_buffer, sizeof(page_buffer));
+	async.httpAsync(cached_jobs[1], cached_get, page_buffer, sizeof(page_buffer));
+	runAsync(async);
+	Serial.quiet(false);
+	modem.clearRules();
+	modem.setHttpResponse(200, "{\"id\":42}");
+	ok = ok && cached_jobs[0].ok() && (cached_jobs[0].http_status == 200) && (strcmp(page_buffer, "{\"interval\":300}") == 0) &&
+		cached_jobs[1].ok() && (cached_jobs[1].http_status == 304) && (cached_jobs[1].received == 0) &&
+		(modem.httpUserData() == "If-Modified-Since: Thu, 07 Mar 2024 09:05:00 GMT") &&
+		(async_cache.getStats().stores == 1) && (async_cache.getStats().hits == 1);
+	check("ASIMAsync HTTP", ok);
+
+	#if defined(__cpp_impl_coroutine)
+		Serial.quiet(quiet);
+		flow(async, number, &ok);
+		runAsync(async);
+		Serial.quiet(false);
+		check("ASIMAsync co_await", ok);
+	#endif
+
+	// the link monitor samples signal, cells and ping round trip between the jobs of the runner
+	ASIMLink link(async);
+	link.setPeriod(5000, 10000);
+	Serial.quiet(quiet);
+	unsigned long link_start = millis();
+	while ((millis() - link_start) < 21000) {
+		link.poll();
+		async.poll();
+		delay(1);
+	}
+	Serial.quiet(false);
+	const ASIMLinkQuality &q = link.quality();
+	check("ASIMLink", (link.historyCount() == 5) && (q.rssi_avg == 18) && (q.serving.ci == 0x3C4D) &&
+		(q.serving.lac == 0x1A2B) && (q.neighbour_count == 2) && (q.pings == 3) && (q.rtt_avg == 400) && (link.score() > 50));
+	if (!quiet) {
+		printf("link score %u, rssi %u, ber %u, rtt %u ms, serving rxl %u, %u neighbours\n", link.score(), q.rssi_avg, q.ber_avg,
+			q.rtt_avg, q.serving.rxl, q.neighbour_count);
+	}
+
+	// lost pings (a reply time of 2 s or more) pull the average up instead of leaving the last good round trip
+	modem.on("AT+CIPPING", "\r\n+CIPPING: 1,\"8.8.8.8\",20,255\r\n\r\nOK\r\n", 600);
+	link.setPeriod(5000, 0);
+	Serial.quiet(quiet);
+	link_start = millis();
+	while ((millis() - link_start) < 11000) {
+		link.poll();
+		async.poll();
+		delay(1);
+	}
+	Serial.quiet(false);
+	modem.clearRules();
+	check("ASIMLink lost pings", (q.ping_lost >= 2) && (q.ping_failures == q.ping_lost) && (q.rtt == 400) && (q.rtt_avg > 700));
+
+	// a bulk transfer is not released on a link whose last ping was lost, it waits for its deadline
+	ASIMScheduler lossy(async, link);
+	ASIMJob lossy_job;
+	char lossy_response[32];
+	Serial.quiet(quiet);
+	lossy.httpPost(lossy_job, "http://example.com/log", "{\"a\":6}", lossy_response, sizeof(lossy_response), TRANSFER_BULK, 2000);
+	link_start = millis();
+	while ((!lossy_job.done()) && ((millis() - link_start) < 20000)) {
+		lossy.poll();
+		delay(1);
+	}
+	Serial.quiet(false);
+	check("ASIMScheduler lossy link", lossy_job.ok() && (lossy.getStats().forced == 1) && (lossy.getStats().released == 0));
+
+	// a job waits while the modem searches for the network and runs once the +CREG URC says it is back
+	modem.setRegistration(REG_SEARCHING, REG_SEARCHING);
+	ASIMJob reg_job;
+	Serial.quiet(quiet);
+	async.sendSMSAsync(reg_job, number, "registered again");
+	for (int i = 0; i < 1000; i++) {
+		async.poll();
+		delay(1);
+	}
+	bool waited = (reg_job.status == JOB_QUEUED) && !sim.registered();
+	modem.setRegistration(REG_ROAMING, REG_ROAMING);
+	runAsync(async);
+	ok = waited && reg_job.ok() && (sim.getRegistration().cs == REG_ROAMING) && (sim.getRegistration().lac == 0x1A2B) &&
+		sim.checkregistration();
+	Serial.quiet(false);
+	check("registration tracker", ok);
+
+	// on a weak signal the bulk upload waits and the urgent one runs, the bulk one goes once the signal is back
+	// or when its deadline passed
+	modem.setSignal(6, 0);
+	ASIMLink sched_link(async);
+	sched_link.setPeriod(2000, 60000);
+	ASIMScheduler sched(async, sched_link);
+	ASIMJob urgent_job, bulk_job;
+	char sched_response[2][32];
+	Serial.quiet(quiet);
+	sched.httpPost(urgent_job, "http://example.com/alarm", "{\"a\":3}", sched_response[0], sizeof(sched_response[0]), TRANSFER_URGENT);
+	sched.httpPost(bulk_job, "http://example.com/log", "{\"a\":4}", sched_response[1], sizeof(sched_response[1]));
+	unsigned long sched_start = millis();
+	while ((millis() - sched_start) < 8000) {
+		sched.poll();
+		delay(1);
+	}
+	bool held = urgent_job.ok() && (bulk_job.status == JOB_QUEUED) && (sched.held() == 1);
+	modem.setSignal(20, 0);
+	while ((!bulk_job.done()) && ((millis() - sched_start) < 60000)) {
+		sched.poll();
+		delay(1);
+	}
+	ok = held && bulk_job.ok() && (sched.getStats().released == 1) && (sched.getStats().deferred == 1);
+	sched.setThresholds(25, 1500);
+	sched.httpPost(bulk_job, "http://example.com/log", "{\"a\":5}", sched_response[1], sizeof(sched_response[1]),
+		TRANSFER_BULK, 5000);
+	while ((!bulk_job.done()) && ((millis() - sched_start) < 60000)) {
+		sched.poll();
+		delay(1);
+	}
+	Serial.quiet(false);
+	const ASIMSchedulerStats &ss = sched.getStats();
+	check("ASIMScheduler", ok && bulk_job.ok() && (ss.forced == 1) && (ss.defer_max >= 5000) && (sched.held() == 0));
+	if (!quiet) {
+		printf("scheduler urgent %lu, bulk %lu, released %lu, forced %lu, deferred %lu, defer max %lu ms\n",
+			(unsigned long)ss.urgent, (unsigned long)ss.bulk, (unsigned long)ss.released, (unsigned long)ss.forced,
+			(unsigned long)ss.deferred, (unsigned long)ss.defer_max);
+	}
+
+	// the cell location is served from the cache and refreshed in the background when it expires or the cell changes
+	ASIMLocation where(async);
+	where.setTTL(20000);
+	int32_t where_lat = 0, where_lon = 0;
+	Serial.quiet(quiet);
+	unsigned long where_start = millis();
+	while ((!where.location().valid) && ((millis() - where_start) < 30000)) {
+		where.poll();
+		async.poll();
+		delay(1);
+	}
+	ok = where.get(&where_lat, &where_lon) && where.get(&where_lat, &where_lon) && (where_lat == 35689200) &&
+		(where_lon == 51389000) && (where.location().ci == 0x3C4D);
+	modem.setCell(0x1A2B, 0x3C4E);
+	where_start = millis();
+	for (int pass = 0; pass < 2; pass++) {
+		// the new cell within 5 s, then the expired location after the TTL
+		while ((millis() - where_start) < (pass ? 25000UL : 5000UL)) {
+			where.poll();
+			async.poll();
+			delay(1);
+		}
+		ok = ok && (where.location().ci == 0x3C4E) && where.fresh();
+	}
+	Serial.quiet(false);
+	const ASIMLocationStats &ls = where.getStats();
+	check("ASIMLocation", ok && (ls.hits == 2) && (ls.refreshes == 3) && (ls.cell_changes == 1) && (ls.failures == 0));
+
+	// two more modems run SMS and HTTP jobs side by side
+	SimEmulator pool_modem[2] = { SimEmulator(false, 115200), SimEmulator(false, 115200) };
+	ASIM pool_sim[2] = { ASIM(0, 0, 0), ASIM(0, 0, 0) };
+	ASIMPool pool;
+	Serial.quiet(quiet);
+	for (int i = 0; i < 2; i++) {
+		pool_modem[i].setLatency(200);
+		pool_modem[i].setHttpResponse(200, "{\"id\":7}");
+		ok = pool_sim[i].begin(pool_modem[i], 0) && pool.add(pool_sim[i]);
+	}
+	ASIMJob jobs[4];
+	char pool_response[2][32];
+	pool.sendSMS(jobs[0], number, "pool 1");
+	pool.httpPost(jobs[1], "http://example.com/api", "{\"a\":1}", pool_response[0], sizeof(pool_response[0]));
+	pool.sendSMS(jobs[2], number, "pool 2");
+	pool.httpGet(jobs[3], "http://example.com/api", pool_response[1], sizeof(pool_response[1]));
+	unsigned long pool_start = millis();
+	while ((!pool.idle()) && ((millis() - pool_start) < 60000)) {
+		pool.poll();
+		delay(1);
+	}
+	Serial.quiet(false);
+	ok = ok && pool.idle() && (jobs[0].modem != jobs[1].modem);
+	for (int i = 0; i < 4; i++) {
+		ok = ok && (jobs[i].status == JOB_DONE);
+	}
+	check("ASIMPool", ok && (jobs[1].http_status == 200) && (strcmp(pool_response[0], "{\"id\":7}") == 0) &&
+		(strcmp(pool_response[1], "{\"id\":7}") == 0));
+	if (!quiet) {
+		pool.printStats(Serial);
+	}
+
+	#ifdef SIM_STATS
+		printf("\n");
+		sim.printStats(Serial);
+	#endif
+	#ifdef SIM_TRACE
+		printf("\n");
+		sim.dumpTrace(Serial);
+	#endif
+
+	printf("\n%lu ms virtual time, %lu commands, %lu bytes to the modem, %lu bytes from the modem\n",
+		millis(), modem.commands, modem.bytesToModem, modem.bytesFromModem);
+	return failures ? 1 : 0;
+}
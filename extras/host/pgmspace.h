@@ -0,0 +1,2 @@
+// Host build: the pgmspace macros live in Arduino.h
+#include "Arduino.h"
@@ -0,0 +1,43 @@
+/**********************************************************************************************************************************/
+// Host (Linux) replacement of the parts of FreeRTOS used by ASIM with SIM_RTOS (make DEFS=-DSIM_RTOS).
+// A task is a thread and only one of them runs at a time: the highest priority ready task runs until it blocks
+// or a task of a higher priority becomes ready, there is no time slicing. While no task is ready virtual time
+// moves on one tick (1 ms) at a time, as in delay(). The thread that calls first is the loop task, priority 1.
+/**********************************************************************************************************************************/
+#ifndef ASIM_HOST_FREERTOS_H
+#define ASIM_HOST_FREERTOS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef void (*TaskFunction_t)(void *);
+typedef struct HostTask *TaskHandle_t;
+typedef struct HostQueue *QueueHandle_t;
+
+#define pdFALSE				0
+#define pdTRUE				1
+#define pdPASS				pdTRUE
+#define pdFAIL				pdFALSE
+#define portMAX_DELAY		((TickType_t)0xffffffffUL)
+#define configTICK_RATE_HZ	1000
+#define portTICK_PERIOD_MS	(1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms)	((TickType_t)(((uint64_t)(ms) * configTICK_RATE_HZ) / 1000))
+// the task woken from an "interrupt" runs once the tick that raised it is over
+#define portYIELD_FROM_ISR()
+
+/**********************************************************************************************************************************/
+// Tasks and direct to task notifications
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack, void *arg, UBaseType_t priority,
+	TaskHandle_t *handle);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount();
+TaskHandle_t xTaskGetCurrentTaskHandle();
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken);
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks);
+/**********************************************************************************************************************************/
+#endif
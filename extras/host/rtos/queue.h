@@ -0,0 +1,15 @@
+/**********************************************************************************************************************************/
+// Host (Linux) replacement of the FreeRTOS queues, see Arduino_FreeRTOS.h
+/**********************************************************************************************************************************/
+#ifndef ASIM_HOST_QUEUE_H
+#define ASIM_HOST_QUEUE_H
+
+#include "Arduino_FreeRTOS.h"
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+void vQueueDelete(QueueHandle_t queue);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+/**********************************************************************************************************************************/
+#endif
@@ -0,0 +1,16 @@
+/**********************************************************************************************************************************/
+// Host (Linux) replacement of the FreeRTOS recursive mutex, see Arduino_FreeRTOS.h
+/**********************************************************************************************************************************/
+#ifndef ASIM_HOST_SEMPHR_H
+#define ASIM_HOST_SEMPHR_H
+
+#include "queue.h"
+
+typedef QueueHandle_t SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex();
+void vSemaphoreDelete(SemaphoreHandle_t mutex);
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t mutex, TickType_t ticks);
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t mutex);
+/**********************************************************************************************************************************/
+#endif
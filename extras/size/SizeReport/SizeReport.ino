@@ -0,0 +1,25 @@
+/**********************************************************************************************************************************/
+// The calls whose command buffers user-027 replaced, built by size.sh to compare the flash and RAM of two
+// versions of the library. Only API present in every version is used.
+/**********************************************************************************************************************************/
+#include <ASIM.h>
+
+ASIM sim(4, 5, 6);
+char number[] = "+989121234567";
+char text[] = "Hello";
+char ussd[] = "*140*11#";
+char response[SIM_REPLY_SIZE];
+uint16_t length;
+
+void setup() {
+	Serial.begin(9600);
+	sim.begin(Serial, 1000);
+	sim.sendSMS(number, text, false);
+	sim.sendUSSD(ussd, response, &length, sizeof(response));
+	sim.makeCall(number);
+	sim.setRTC(24, 3, 7, 9, 5, 0, 14);
+	sim.postHttpRequest("http://example.com/api", "token", "{\"a\":1}", 10000, response);
+}
+
+void loop() {
+}
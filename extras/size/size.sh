@@ -0,0 +1,37 @@
+#!/bin/sh
+# Flash and RAM of SizeReport on AVR and ESP32, for the library of this tree and of a git revision.
+#
+#	extras/size/size.sh [revision]		e.g. the commit before the command builder:
+#	extras/size/size.sh "$(git log -1 --format=%h --grep='variadic builder')^"
+#
+# Needs arduino-cli with the arduino:avr and esp32:esp32 cores installed.
+set -e
+
+if ! command -v arduino-cli >/dev/null; then
+	echo "arduino-cli not found" >&2
+	exit 1
+fi
+
+BOARDS="arduino:avr:uno arduino:avr:mega esp32:esp32:esp32"
+HERE=$(cd "$(dirname "$0")" && pwd)
+ROOT=$(cd "$HERE/../.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# size <label> <library directory>
+size() {
+	for board in $BOARDS; do
+		printf '%-8s %-20s ' "$1" "$board"
+		arduino-cli compile --fqbn "$board" --library "$2" --build-path "$WORK/build" "$HERE/SizeReport" 2>&1 |
+			sed -n 's/^Sketch uses \([0-9]*\) bytes.*/flash \1/p; s/^Global variables use \([0-9]*\) bytes.*/ram \1/p' | tr '\n' ' '
+		echo
+		rm -rf "$WORK/build"
+	done
+}
+
+if [ -n "$1" ]; then
+	mkdir "$WORK/before"
+	git -C "$ROOT" archive "$1" src library.properties | tar -x -C "$WORK/before"
+	size before "$WORK/before"
+fi
+size after "$ROOT"
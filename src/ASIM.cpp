@@ -1,21 +1,52 @@
 /**********************************************************************************************************************************/
 #include "ASIM.h"
+#include "ASIMGNSS.h"
+#include "ASIMHttp.h"
+#include "ASIMOperator.h"
+
+// modems woken by the RI interrupt
+static ASIM *ri_modems[SIM_RI_MODEMS];
 
-char replybuffer[255];
 /*************************************************************************************************************/
 /**
  * @brief Construct a new Ario_SIM object
  *
  * @param port The serial port of GSM
 */
-ASIM::ASIM(byte in_pwr, byte pwr_key, byte rst) {
+ASIM::ASIM(byte in_pwr, byte pwr_key, byte rst, byte dtr, byte ri) {
 	_in_pwr_pin = in_pwr;
 	_pwr_key_pin = pwr_key;
 	_rst_pin = rst;
+	_dtr_pin = dtr;
+	_ri_pin = ri;
 
 	simSerial = 0;
 
 	ok_reply = F("OK");
+	resetTimeouts();
+
+	#ifdef SIM_RTOS
+		// an API call before begin() already takes the mutex
+		_mutex = xSemaphoreCreateRecursiveMutex();
+		_rx_queue = xQueueCreate(SIM_RTOS_QUEUE, sizeof(ASIMLine));
+		_rx_line.length = 0;
+	#endif
+}
+
+ASIM::~ASIM() {
+	for (uint8_t i = 0; i < SIM_RI_MODEMS; i++) {
+		if (ri_modems[i] == this) {
+			detachInterrupt(digitalPinToInterrupt(_ri_pin));
+			ri_modems[i] = NULL;
+		}
+	}
+	#ifdef SIM_RTOS
+		if (_reader) {
+			vTaskDelete(_reader);
+		}
+		vQueueDelete(_rx_queue);
+		vSemaphoreDelete(_mutex);
+	#endif
 }
 
 /**
@@ -26,6 +57,10 @@ ASIM::ASIM(byte in_pwr, byte pwr_key, byte rst) {
 */
 bool ASIM::begin(ASIMStreamType &port, int setup_wait) {
 	simSerial = &port;
+	#ifdef SIM_RTOS
+		rtosBegin();
+	#endif
+	SIM_API("begin");
 
 	if(_in_pwr_pin > 0) {
 		pinMode(_in_pwr_pin, OUTPUT);
@@ -45,50 +80,80 @@ bool ASIM::begin(ASIMStreamType &port, int setup_wait) {
 		digitalWrite(_pwr_key_pin, LOW);
 	}
 
+	// DTR low keeps the modem awake
+	if(_dtr_pin > 0) {
+		pinMode(_dtr_pin, OUTPUT);
+		digitalWrite(_dtr_pin, LOW);
+	}
+	resetPowerStats();
+
+	if(_ri_pin > 0) {
+		ringBegin();
+	}
+
 	delay(setup_wait);
-	DEBUG_PRINTLN(F("================= ESTABLIS COMMUNICATON ================="));
-	DEBUG_PRINTLN(F("Try communicate with modem (May take 10 seconds to find cellular network)"));
+	INFO_PRINTLN(F("================= ESTABLIS COMMUNICATON ================="));
+	INFO_PRINTLN(F("Try communicate with modem (May take 10 seconds to find cellular network)"));
+
+	// a modem left in ATV0 answers with numbers, accept both until the format is set
+	_numeric_results = true;
 
 	// give 7 seconds to reboot
 	uint16_t timeout = DEFUALT_INIT_WAIT;
 
 	while (timeout > 0) {
-		while (simSerial->available())
-		 	simSerial->read();
-		if (sendVerifyedCommand(F("AT"), F("ATOK"), 500)) {
+		discardInput();
+		if (sendVerifyedCommand(F("AT"), F("ATOK"), timeoutFor(SIM_TIMEOUT_LOCAL))) {
 			break;
 		}
-		if (sendVerifyedCommand(F("AT"), ok_reply, 500)) {
+		if (sendVerifyedCommand(F("AT"), ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL))) {
 			break;
 		}
-		while (simSerial->available())
-			simSerial->read();
-		if (sendVerifyedCommand(F("AT"), F("AT"), 500))
+		discardInput();
+		if (sendVerifyedCommand(F("AT"), F("AT"), timeoutFor(SIM_TIMEOUT_LOCAL)))
 		  	break;
 		delay(500);
 		timeout -= 500;
 	}
 
 	if(timeout <= 0) {
-		DEBUG_PRINTLN("Timeout: No response to AT... last attempt.");
-		sendVerifyedCommand(F("AT"), F("ATOK"), 500);
+		ERROR_PRINTLN(F("Timeout: No response to AT... last attempt."));
+		sendVerifyedCommand(F("AT"), F("ATOK"), timeoutFor(SIM_TIMEOUT_LOCAL));
 		delay(1000);
 	}
 
-	if(!sendVerifyedCommand(F("AT"), F("ATOK"), 500)) {
-		if(!sendVerifyedCommand(F("AT"), ok_reply, 500)) {
+	if(!sendVerifyedCommand(F("AT"), F("ATOK"), timeoutFor(SIM_TIMEOUT_LOCAL))) {
+		if(!sendVerifyedCommand(F("AT"), ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL))) {
 			return SIM_FAILED;
 		}
 	}
 
-	DEBUG_PRINTLN(F("================= INIT MODEM ================="));
-	DEBUG_PRINTLN(F("The connection with the modem was successfully established"));
-	DEBUG_PRINTLN(F("Initializing....(May take 10 seconds)"));
+	INFO_PRINTLN(F("================= INIT MODEM ================="));
+	INFO_PRINTLN(F("The connection with the modem was successfully established"));
+	INFO_PRINTLN(F("Initializing....(May take 10 seconds)"));
 
 	// Turn of echo
 	sendVerifyedCommand(F("ATE0"), F("ATE0OK"));
 	delay(100);
 
+	// Result codes as numbers or text
+	#ifdef SIM_NUMERIC_RESULTS
+		setResultFormat(NUMERIC_RESULTS);
+	#else
+		setResultFormat(VERBOSE_RESULTS);
+	#endif
+
+	// Report +CME ERROR: <n> instead of a bare ERROR
+	sendVerifyedCommand(F("AT+CMEE=1"), ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL));
+
+	// RI pulses for every URC, not only for calls and SMS
+	if(_ri_pin > 0) {
+		sendVerifyedCommand(F("AT+CFGRI=1"), ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL));
+	}
+
+	// Registration state, LAC and cell from the URCs
+	trackRegistration();
+
 	// Get modem type
 	_modem_type = getModemType();
 
@@ -145,7 +210,14 @@ bool ASIM::begin(ASIMStreamType &port, int setup_wait) {
  * @return int
 */
 int ASIM::available(void) { 
-	return simSerial->available(); 
+	#ifdef SIM_RTOS
+		if (!rxAvailable()) {
+			return 0;
+		}
+		return _rx_line.length - _rx_pos;
+	#else
+		return simSerial->available(); 
+	#endif
 } 
 
 /**
@@ -164,7 +236,7 @@ size_t ASIM::write(uint8_t x) {
  * @return int
 */
 int ASIM::read(void) { 
-	return simSerial->read(); 
+	return rxRead(); 
 }
 
 /**
@@ -173,7 +245,23 @@ int ASIM::read(void) {
  * @return size_t
  */
 size_t ASIM::readBytes(char * buffer, uint16_t sizeOfBuffer) {
-	return simSerial->readBytes(buffer, sizeOfBuffer);
+	#ifdef SIM_RTOS
+		// up to the Stream timeout of one second between bytes
+		size_t n = 0;
+		uint32_t start = millis();
+		while (n < sizeOfBuffer) {
+			if (rxAvailable()) {
+				buffer[n++] = rxRead();
+				start = millis();
+			}
+			else if (!rxWait(start, 1000)) {
+				break;
+			}
+		}
+		return n;
+	#else
+		return simSerial->readBytes(buffer, sizeOfBuffer);
+	#endif
 }
 
 /**
@@ -182,7 +270,14 @@ size_t ASIM::readBytes(char * buffer, uint16_t sizeOfBuffer) {
  * @return int
 */
 int ASIM::peek(void) { 
-	return simSerial->peek(); 
+	#ifdef SIM_RTOS
+		if (!rxAvailable()) {
+			return -1;
+		}
+		return (uint8_t)_rx_line.data[_rx_pos];
+	#else
+		return simSerial->peek(); 
+	#endif
 } 
 
 /**
@@ -198,376 +293,735 @@ void ASIM::flush() {
  *
 */
 void ASIM::flushInput() {
-	uint16_t timeoutloop = 0;
-	while (timeoutloop++ < 40) {
-		while (available()) {
-			read();
-			timeoutloop = 0; // If char was received reset the timer
+	uint32_t quiet = millis();
+	SIM_READ(false);
+	do {
+		while (rxAvailable()) {
+			rxRead();
+			SIM_RX();
+			quiet = millis(); // If char was received reset the timer
 		}
-		delay(1);
+	} while (rxWait(quiet, 40));
+}
+
+/**
+ * @brief Check if received data is waiting, on the UART or in the queue of the reader task
+ *
+ * @return true: rxRead() returns a byte, false: nothing received
+*/
+bool ASIM::rxAvailable() {
+	#ifdef SIM_RTOS
+		if (_rx_pos < _rx_line.length) {
+			return true;
+		}
+		if (xQueueReceive(_rx_queue, &_rx_line, 0) != pdTRUE) {
+			return false;
+		}
+		_rx_pos = 0;
+		return _rx_line.length > 0;
+	#else
+		return simSerial->available() > 0;
+	#endif
+}
+
+/**
+ * @brief Read one received byte
+ *
+ * @return int The byte, -1 if nothing was received
+*/
+int ASIM::rxRead() {
+	#ifdef SIM_RTOS
+		if (!rxAvailable()) {
+			return -1;
+		}
+		return (uint8_t)_rx_line.data[_rx_pos++];
+	#else
+		return simSerial->read();
+	#endif
+}
+
+/**
+ * @brief Wait for more data until a deadline
+ *
+ * Without an RTOS it sleeps one ms. With SIM_RTOS the task blocks on the queue of the reader
+ * task and wakes up when a line arrives or the time is over.
+ *
+ * @param start Start of the wait in ms
+ * @param timeout Length of the wait in ms
+ * @return true: wait again, false: the time is over
+*/
+bool ASIM::rxWait(uint32_t start, uint16_t timeout) {
+	uint32_t elapsed = millis() - start;
+	if (elapsed >= timeout) {
+		return false;
 	}
+	#ifdef SIM_RTOS
+		TickType_t ticks = pdMS_TO_TICKS(timeout - elapsed);
+		if (xQueueReceive(_rx_queue, &_rx_line, ticks ? ticks : 1) == pdTRUE) {
+			_rx_pos = 0;
+		}
+	#else
+		delay(1);
+	#endif
+	return true;
 }
 
 /**
- * @brief Read a single line or up to 254 bytes without new line
+ * @brief Read the answer of a command up to its final result code, without new lines
+ *
+ * The lines are concatenated, every complete line is checked against the final result
+ * codes (OK, ERROR, +CME ERROR: <n>, SEND OK, DOWNLOAD, ...) and the first one ends the read.
  *
  * @param timeout Reply timeout
- * @param multiline true: read the maximum amount. false: read up to the second
- * newline
  * @return uint8_t the number of bytes read
  */
-uint8_t ASIM::readAnswer(uint16_t timeout, bool multiline) {
-	uint16_t replyidx = 0, o_index = 255;
-	bool wiat_for_ok = false;
+uint8_t ASIM::readAnswer(uint16_t timeout) {
 	bool end_flag = false;
+	uint32_t start = millis();
+	bool full = false;
+	answerBegin(0);
+	SIM_READ(true);
 
-	while (timeout--) {
-
-		while (simSerial->available()) {
-			char c = simSerial->read();
-			if ((c == '\r') || (c == '\n')) continue;
-			if (c == 0xA) {
-				if (replyidx == 0) continue; // the first 0x0A is ignored
-	
-				if (!multiline) {
-				  timeout = 0; // the second 0x0A is the end of the line
-				  break;
-				}
-			}
-
-			replybuffer[replyidx] = c;
-			replyidx++;
+	do {
 
-			if(c == 'O') {
-				o_index = replyidx;
-				wiat_for_ok = true;
-			}
-			if((wiat_for_ok) && (o_index != replyidx)) {
-				if(c == 'K') {
-					end_flag = true;
-				}
-				else {
-					wiat_for_ok = false;
-				}
-			}
+		while (rxAvailable()) {
+			char c = rxRead();
+			SIM_RX();
+			end_flag = answerFeed(c);
 
 			if(end_flag) {
-				timeout = 0;
+				SIM_READ_DONE();
 				break;
 			}
 
-			if (replyidx > 253) {
-				timeout = 0;
+			if (_reply_idx > (SIM_REPLY_SIZE - 2)) {
+				SIM_READ_DONE();
+				full = true;
 				break;
 			}
 		}
 
-		if (timeout == 0) break;
-		delay(1);
-	}
-	replybuffer[replyidx] = 0; // null term
-	return replyidx;
+	} while ((!end_flag) && (!full) && rxWait(start, timeout));
+	replybuffer[_reply_idx] = 0; // null term
+	timeoutSample(millis() - start, end_flag, _reply_idx > 0);
+	return _reply_idx;
 }
 
 /**
- * @brief Read a single line or up to 254 bytes with new line
+ * @brief Start collecting an answer in the reply buffer
  *
- * @param timeout Reply timeout
- * @param multiline true: read the maximum amount. false: read up to the second
- * newline
- * @return uint8_t the number of bytes read
- */
-uint8_t ASIM::readAnswerLn(uint16_t timeout, bool multiline) {
-	uint16_t replyidx = 0;
-	while (timeout--) {
-		while (simSerial->available()) {
-			char c = simSerial->read();
-			replybuffer[replyidx] = c;
-			replyidx++;
-			if (replyidx > 253) {
-				timeout = 0;
-				break;
-			}
-		}
-		if (timeout == 0) break;
-		delay(1);
-	}
-	replybuffer[replyidx] = 0; // null term
-	return replyidx;
+ * @param urc 0: collect up to the final result code, URC_*: wait for this URC and keep only its line
+*/
+void ASIM::answerBegin(uint8_t urc) {
+	_reply_idx = 0;
+	_line_start = 0;
+	_wait_urc = urc;
+	_last_error.result = 0;
+	_last_error.code = 0;
+	_data_prefix = NULL;
+	_data_left = 0;
+	replybuffer[0] = 0;
 }
 
 /**
- * @brief Send data and verify the response matches an expected response
+ * @brief Add one received character to the answer, the lines are concatenated without CR/LF
  *
- * @param send Pointer to the buffer of data to send
- * @param reply Buffer with the expected reply
- * @param timeout Read timeout
- * @return true: success, false: failure
+ * @param c The character
+ * @return true: the answer is complete (final result code, prompt or the awaited URC), false: otherwise
 */
-bool ASIM::sendVerifyedCommand(char *send, char *reply, uint16_t timeout) {
-	if (!getReply(send, timeout)) {
+bool ASIM::answerFeed(char c) {
+	uint8_t rsp_value;
+	bool done = false;
+
+	// the data announced by the last line, line breaks included, never goes to the reply buffer
+	if (_data_left) {
+		if (_data_got < _data_size) {
+			_data_buffer[_data_got++] = c;
+		}
+		_data_left--;
 		return false;
 	}
+	if (c == '\r') {
+		// ATV0: a result code is a digit ended by a CR alone
+		switch (numericResult(_line_start, &_reply_idx)) {
+			case RSP_FINAL:
+				done = true;
+				break;
+			case RSP_URC:
+				_line_start = _reply_idx;
+				break;
+		}
+	}
+	else if (c == '\n') {
+		replybuffer[_reply_idx] = 0;
+		if (_wait_urc) {
+			if ((classifyResponse(replybuffer + _line_start, &rsp_value) == RSP_URC) && (rsp_value == _wait_urc)) {
+				memmove(replybuffer, replybuffer + _line_start, _reply_idx - _line_start + 1);
+				_reply_idx -= _line_start;
+				return true;
+			}
+			// other lines are dropped
+			_reply_idx = _line_start;
+			return false;
+		}
+		done = finalResult(replybuffer + _line_start);
+		if (_data_prefix && (strncmp_P(replybuffer + _line_start, _data_prefix, strlen_P(_data_prefix)) == 0)) {
+			_data_left = atoi(replybuffer + _line_start + strlen_P(_data_prefix));
+		}
+		_line_start = _reply_idx;
+	}
+	else {
+		replybuffer[_reply_idx] = c;
+		_reply_idx++;
+		// the data prompt ("> ") is not followed by a new line
+		if ((c == ' ') && (_reply_idx - _line_start == 2) && (replybuffer[_line_start] == '>')) {
+			replybuffer[_reply_idx] = 0;
+			done = finalResult(replybuffer + _line_start);
+		}
+	}
 
-	return (strcmp(replybuffer, reply) == 0);
+	if (done && _wait_urc) {
+		// a final result while waiting for a URC belongs to nothing
+		_reply_idx = _line_start = 0;
+		return false;
+	}
+	return done;
 }
 
 /**
- * @brief Send data and verify the response matches an expected response
+ * @brief Start waiting for the answer of a command without blocking, see pollAnswer()
  *
- * @param send Pointer to the buffer of data to send
- * @param reply Pointer to a buffer with the expected reply
- * @param timeout Read timeout
- * @return true: success, false: failure
+ * @param timeout The timeout in ms, from timeoutFor() to learn it
+ * @param urc 0: wait for the final result code, URC_*: wait for this URC
 */
-bool ASIM::sendVerifyedCommand(ASIMFlashString send, ASIMFlashString reply, uint16_t timeout) {
-	if (!getReply(send, timeout)) {
-		return false;
-	}
-
-	return (prog_char_strcmp(replybuffer, (prog_char *)reply) == 0);
+void ASIM::startAnswer(uint16_t timeout, uint8_t urc) {
+	answerBegin(urc);
+	_poll_timeout = timeout;
+	_poll_class = _timeout_class;
+	_timeout_class = SIM_TIMEOUT_NONE;
+	_poll_start = millis();
+	_polling = true;
 }
 
 /**
- * @brief Send data and verify the response matches an expected response
+ * @brief Take the data announced by a line of the answer started last, e.g. +HTTPREAD: <length>, into a buffer
  *
- * @param send Pointer to the buffer of data to send
- * @param reply Pointer to a buffer with the expected reply
- * @param timeout Read timeout
- * @return true: success, false: failure
+ * Call it right after startCommand(). The data goes to the buffer as it comes, line breaks included, what
+ * does not fit is dropped and _data_got counts what was taken. The reply buffer keeps the lines around it.
+ *
+ * @param prefix The line before the data up to its length, in flash, e.g. PSTR("+HTTPREAD: ")
+ * @param buffer The buffer
+ * @param size Its size
 */
-bool ASIM::sendVerifyedCommand(char *send, ASIMFlashString reply, uint16_t timeout) {
-	if (!getReply(send, timeout)) {
-		return false;
-	}
-	return (prog_char_strcmp(replybuffer, (prog_char *)reply) == 0);
+void ASIM::expectData(const char *prefix, char *buffer, uint16_t size) {
+	_data_prefix = prefix;
+	_data_buffer = buffer;
+	_data_size = size;
+	_data_got = 0;
+	_data_left = 0;
 }
 
 /**
- * @brief Send data and verify the response matches an expected response
+ * @brief Drop what is waiting in the UART without blocking
  *
- * @param prefix Pointer to a buffer with the prefix send
- * @param suffix Pointer to a buffer with the suffix send
- * @param reply Pointer to a buffer with the expected reply
- * @param timeout Read timeout
- * @return true: success, false: failure
 */
-bool ASIM::sendVerifyedCommand(ASIMFlashString prefix, char *suffix, ASIMFlashString reply, uint16_t timeout) {
-	getReply(prefix, suffix, timeout);
-	return (prog_char_strcmp(replybuffer, (prog_char *)reply) == 0);
+void ASIM::discardInput() {
+	while (rxAvailable()) {
+		rxRead();
+		SIM_RX();
+	}
 }
 
 /**
- * @brief Send data and verify the response matches an expected response
+ * @brief Send data after a "> " or DOWNLOAD prompt and start waiting for the result without blocking
  *
- * @param prefix Pointer to a buffer with the prefix to send
- * @param suffix The suffix to send
- * @param reply Pointer to a buffer with the expected reply
- * @param timeout Read timeout
- * @return true: success, false: failure
+ * @param data The data to send
+ * @param ctrl_z true: end the data with ^Z (SMS body, AT+CIPSEND), false: send it as it is (AT+HTTPDATA)
+ * @param cls The timeout class of the answer
 */
-bool ASIM::sendVerifyedCommand(ASIMFlashString prefix, int32_t suffix, ASIMFlashString reply, uint16_t timeout) {
-	getReply(prefix, suffix, timeout);
-	return (prog_char_strcmp(replybuffer, (prog_char *)reply) == 0);
+void ASIM::startData(const char *data, bool ctrl_z, uint8_t cls) {
+	SIM_HOLD();
+	SIM_COMMAND("DATA>");
+	discardInput();
+	SIM_SENT(simSerial->print(data));
+	if (ctrl_z) {
+		SIM_SENT(simSerial->write(0x1A));
+	}
+	startAnswer(timeoutFor(cls), 0);
 }
 
 /**
- * @brief Send data and verify the response matches an expected response
+ * @brief Send the body of an AT+HTTPDATA after its DOWNLOAD prompt and start waiting for the result without blocking
  *
- * @param prefix Ponter to a buffer with the prefix to send
- * @param suffix1 The first suffix to send
- * @param suffix2 The second suffix to send
- * @param reply Pointer to a buffer with the expected reply
- * @param timeout Read timeout
- * @return true: success, false: failure
+ * @param data The data, in RAM or in flash
+ * @param length The number of bytes to send
+ * @param cls The timeout class of the answer
 */
-bool ASIM::sendVerifyedCommand(ASIMFlashString prefix, int32_t suffix1, int32_t suffix2, ASIMFlashString reply, uint16_t timeout) {
-	getReply(prefix, suffix1, suffix2, timeout);
-	return (prog_char_strcmp(replybuffer, (prog_char *)reply) == 0);
+void ASIM::startData(ASIMText data, uint16_t length, uint8_t cls) {
+	SIM_HOLD();
+	SIM_COMMAND("DATA>");
+	discardInput();
+	writeData(data, length);
+	startAnswer(timeoutFor(cls), 0);
 }
 
 /**
- * @brief Send data and verify the response matches an expected response
+ * @brief Start waiting for one more final result code without blocking, e.g. CONNECT OK after the OK of AT+CIPSTART
  *
- * @param prefix Pointer to a buffer with the prefix to send
- * @param suffix Pointer to a buffer with the suffix to send
- * @param reply Pointer to a buffer with the expected response
- * @param timeout Read timeout
- * @return true: success, false: failure
+ * @param cls The timeout class
 */
-bool ASIM::sendVerifyedCommandQuoted(ASIMFlashString prefix, ASIMFlashString suffix, ASIMFlashString reply, uint16_t timeout) {
-	getReplyQuoted(prefix, suffix, timeout);
-	return (prog_char_strcmp(replybuffer, (prog_char *)reply) == 0);
+void ASIM::startResult(uint8_t cls) {
+	SIM_HOLD();
+	startAnswer(timeoutFor(cls), 0);
 }
 
 /**
- * @brief Send a command and return the reply
+ * @brief Start waiting for an unsolicited result code without blocking, e.g. +HTTPACTION: after AT+HTTPACTION
  *
- * @param send The char* command to send
- * @param timeout Timeout for reading a  response
- * @return uint8_t The response length
+ * @param urc The URC to wait for (URC_HTTPACTION, URC_CUSD, ...)
+ * @param timeout The timeout in ms, it depends on the server and is not learned
 */
-uint8_t ASIM::getReply(char *send, uint16_t timeout) {
-	flushInput();
-
-	DEBUG_PRINT(F("\t ---> "));
-	DEBUG_PRINTLN(send);
-
-	simSerial->println(send);
-
-	uint8_t l = readAnswer(timeout);
-
-	DEBUG_PRINT("\t");
-	DEBUG_PRINT(replybuffer);
-	DEBUG_PRINTLN(F(" <--- \n"));
-	
-
-	return l;
+void ASIM::startURC(uint8_t urc, uint16_t timeout) {
+	SIM_HOLD();
+	_timeout_class = SIM_TIMEOUT_NONE;
+	startAnswer(timeout, urc);
 }
 
 /**
- * @brief Send a command and return the reply
+ * @brief Collect the received part of the answer started by startCommand(), startData() or startURC()
  *
- * @param send The ASIMFlashString command to send
- * @param timeout Timeout for reading a response
- * @return uint8_t The response length
+ * Never waits: it reads what the UART holds and returns. Call it from the main loop.
+ *
+ * @return uint8_t SIM_PENDING while waiting, SIM_OK when the answer is complete and not an error,
+ * SIM_FAILED on an error (see getLastError()) or a timeout
 */
-uint8_t ASIM::getReply(ASIMFlashString send, uint16_t timeout) {
-	flushInput();
-
-	DEBUG_PRINT(F("\t ---> "));
-	DEBUG_PRINTLN(send);
-
-	simSerial->println(send);
-
-	uint8_t l = readAnswer(timeout);
+uint8_t ASIM::pollAnswer() {
+	bool complete = false;
 
-	DEBUG_PRINT("\t");
-	DEBUG_PRINT(replybuffer);
-	DEBUG_PRINTLN(F(" <--- \n"));
+	if (!_polling) {
+		return SIM_FAILED;
+	}
+	while (rxAvailable()) {
+		char c = rxRead();
+		SIM_RX();
+		if (answerFeed(c) || (_reply_idx > (SIM_REPLY_SIZE - 2))) {
+			complete = true;
+			break;
+		}
+	}
+	if ((!complete) && ((millis() - _poll_start) < _poll_timeout)) {
+		return SIM_PENDING;
+	}
 
-	return l;
+	replybuffer[_reply_idx] = 0; // null term
+	_polling = false;
+	SIM_RELEASE();
+	_timeout_class = _poll_class;
+	timeoutSample(millis() - _poll_start, complete, _reply_idx > 0);
+	#ifdef SIM_INSTRUMENT
+		readDone(_poll_start, true, complete);
+	#endif
+	if ((!complete) || _last_error.failed()) {
+		return SIM_FAILED;
+	}
+	return SIM_OK;
 }
 
 /**
- * @brief Send a command as prefix and suffix
+ * @brief Check if a command started by startCommand() is still waiting for its answer
  *
- * @param prefix Pointer to a buffer with the command prefix
- * @param suffix Pointer to a buffer with the command suffix
- * @param timeout Timeout for reading a response
- * @return uint8_t The response length
+ * @return true: waiting, false: idle
 */
-uint8_t ASIM::getReply(ASIMFlashString prefix, char *suffix, uint16_t timeout) {
-	flushInput();
-
-	DEBUG_PRINT(F("\t ---> "));
-	DEBUG_PRINT(prefix);
-	DEBUG_PRINTLN(suffix);
-
-	simSerial->print(prefix);
-	simSerial->println(suffix);
-
-	uint8_t l = readAnswer(timeout);
+bool ASIM::busy() {
+	return _polling;
+}
 
-	DEBUG_PRINT("\t");
-	DEBUG_PRINT(replybuffer);
-	DEBUG_PRINTLN(F(" <--- \n"));
+/**
+ * @brief Read the answer of a command up to its final result code, with new lines
+ *
+ * @param timeout Reply timeout
+ * @return uint8_t the number of bytes read
+ */
+uint8_t ASIM::readAnswerLn(uint16_t timeout) {
+	uint16_t replyidx = 0, line_start = 0;
+	uint32_t start = millis();
+	bool done = false;
+	_last_error.result = 0;
+	_last_error.code = 0;
+	SIM_READ(true);
+	do {
+		while (rxAvailable()) {
+			char c = rxRead();
+			SIM_RX();
+			// ATV0: a result code is a digit ended by a CR alone
+			if ((c == '\r') && (numericResult(line_start, &replyidx) == RSP_FINAL)) {
+				SIM_READ_DONE();
+				done = true;
+				break;
+			}
+			replybuffer[replyidx] = c;
+			replyidx++;
+			if (c == '\n') {
+				// classifyResponse() stops at the CR/LF of the line
+				if (finalResult(replybuffer + line_start)) {
+					SIM_READ_DONE();
+					done = true;
+					break;
+				}
+				line_start = replyidx;
+			}
+			if (replyidx > (SIM_REPLY_SIZE - 2)) {
+				SIM_READ_DONE();
+				done = true;
+				break;
+			}
+		}
+	} while ((!done) && rxWait(start, timeout));
+	replybuffer[replyidx] = 0; // null term
+	return replyidx;
+}
 
-	return l;
+/**
+ * @brief Read one non empty line, without the CR/LF, into the reply buffer
+ *
+ * @param timeout Reply timeout
+ * @return uint8_t the number of bytes read, 0 on timeout
+ */
+uint8_t ASIM::readLine(uint16_t timeout) {
+	uint16_t replyidx = 0;
+	uint32_t start = millis();
+	_last_error.result = 0;
+	_last_error.code = 0;
+	SIM_READ(true);
+	do {
+		while (rxAvailable()) {
+			char c = rxRead();
+			SIM_RX();
+			if (c == '\r') {
+				// ATV0: a result code is a digit ended by a CR alone
+				if (numericResult(0, &replyidx) == RSP_UNKNOWN) continue;
+				SIM_READ_DONE();
+				timeoutSample(millis() - start, true, true);
+				return replyidx;
+			}
+			if (c == '\n') {
+				if (replyidx == 0) continue; // skip empty lines
+				replybuffer[replyidx] = 0;
+				finalResult(replybuffer);
+				SIM_READ_DONE();
+				timeoutSample(millis() - start, true, true);
+				return replyidx;
+			}
+			replybuffer[replyidx] = c;
+			replyidx++;
+			if (replyidx > (SIM_REPLY_SIZE - 2)) {
+				replybuffer[replyidx] = 0;
+				SIM_READ_DONE();
+				timeoutSample(millis() - start, true, true);
+				return replyidx;
+			}
+		}
+	} while (rxWait(start, timeout));
+	replybuffer[replyidx] = 0; // null term
+	timeoutSample(millis() - start, false, replyidx > 0);
+	return replyidx;
 }
 
 /**
- * @brief Send a command with
+ * @brief Check if a received line is a final result code and keep it as the last result
  *
- * @param prefix Pointer to a buffer with the command prefix
- * @param suffix The command suffix
- * @param timeout Timeout for reading a response
- * @return uint8_t The response length
+ * @param line Pointer to a null (or CR/LF) terminated line
+ * @return true: the line ends the command, false: an information line or a URC
 */
-uint8_t ASIM::getReply(ASIMFlashString prefix, int32_t suffix, uint16_t timeout) {
-	flushInput();
-
-	DEBUG_PRINT(F("\t ---> "));
-	DEBUG_PRINT(prefix);
-	DEBUG_PRINTLN(suffix, DEC);
-
-	simSerial->print(prefix);
-	simSerial->println(suffix, DEC);
-
-	uint8_t l = readAnswer(timeout);
-
-	DEBUG_PRINT("\t");
-	DEBUG_PRINT(replybuffer);
-	DEBUG_PRINTLN(F(" <--- \n"));
-
-	return l;
+bool ASIM::finalResult(const char *line) {
+	uint8_t value, length;
+	uint8_t cls = classifyResponse(line, &value, &length);
+	// registration changes and a dropped context are picked up from any answer
+	if ((cls == RSP_URC) && ((value == URC_CREG) || (value == URC_CGREG))) {
+		registrationLine(line + length, value == URC_CGREG);
+		return false;
+	}
+	if ((cls == RSP_URC) && (value == URC_PDP_DEACT)) {
+		bearerLost();
+		return false;
+	}
+	if (cls != RSP_FINAL) {
+		return false;
+	}
+	_last_error.result = value;
+	_last_error.code = 0;
+	if ((value == FINAL_CME_ERROR) || (value == FINAL_CMS_ERROR)) {
+		_last_error.code = atoi(line + length);
+	}
+	return true;
 }
 
 /**
- * @brief Send command with prefix and two suffixes
+ * @brief Replace a numeric result code (ATV0) at the end of the reply buffer by its text
  *
- * @param prefix Pointer to a buffer with the command prefix
- * @param suffix1 The comannd first suffix
- * @param suffix2 The command second suffix
- * @param timeout Timeout for reading a response
- * @return uint8_t The response length
+ * @param line_start The start of the current line in the reply buffer
+ * @param replyidx Pointer to the end of the reply, moved to the end of the text
+ * @return uint8_t RSP_FINAL or RSP_URC for a result code, RSP_UNKNOWN if the line is not one
 */
-uint8_t ASIM::getReply(ASIMFlashString prefix, int32_t suffix1, int32_t suffix2, uint16_t timeout) {
-	flushInput();
-
-	DEBUG_PRINT(F("\t ---> "));
-	DEBUG_PRINT(prefix);
-	DEBUG_PRINT(suffix1);
-	DEBUG_PRINT(",");
-	DEBUG_PRINTLN(suffix2);
-
-	simSerial->print(prefix);
-	simSerial->print(suffix1);
-	simSerial->print(',');
-	simSerial->println(suffix2, DEC);
-
-	uint8_t l = readAnswer(timeout);
-
-	DEBUG_PRINT("\t");
-	DEBUG_PRINT(replybuffer);
-	DEBUG_PRINTLN(F(" <--- \n"));
-
-	return l;
+uint8_t ASIM::numericResult(uint16_t line_start, uint16_t *replyidx) {
+	uint8_t cls, value, len;
+	PGM_P text;
+	if ((!_numeric_results) || ((*replyidx - line_start) != 1)) {
+		return RSP_UNKNOWN;
+	}
+	cls = classifyNumeric(replybuffer[line_start], &value, &text);
+	if (cls == RSP_UNKNOWN) {
+		return RSP_UNKNOWN;
+	}
+	len = min(strlen_P(text), (size_t)(SIM_REPLY_SIZE - 2 - line_start));
+	memcpy_P(replybuffer + line_start, text, len);
+	*replyidx = line_start + len;
+	replybuffer[*replyidx] = 0;
+	if (cls == RSP_FINAL) {
+		_last_error.result = value;
+		_last_error.code = 0;
+	}
+	return cls;
 }
 
 /**
- * @brief Send command prefix and suffix, returning the response length
+ * @brief Get the final result of the last command
  *
- * @param prefix Pointer to a buffer with the command prefix
- * @param suffix Pointer to a buffer with the command suffix
- * @param timeout Timeout for reading a response
- * @return uint8_t The response length
+ * @return const ASIMError& The result code and the +CME/+CMS error number
 */
-uint8_t ASIM::getReplyQuoted(ASIMFlashString prefix, ASIMFlashString suffix, uint16_t timeout) {
-	flushInput();
-
-	DEBUG_PRINT(F("\t ---> "));
-	DEBUG_PRINT(prefix);
-	DEBUG_PRINT("\"");
-	DEBUG_PRINT(suffix);
-	DEBUG_PRINTLN("\"");
-
-	simSerial->print(prefix);
-	simSerial->print('"');
-	simSerial->print(suffix);
-	simSerial->println('"');
-
-	uint8_t l = readAnswer(timeout);
-
-	DEBUG_PRINT(F("\t"));
-	DEBUG_PRINT(replybuffer);
-	DEBUG_PRINTLN(F(" <--- \n"));
-
-	return l;
+const ASIMError &ASIM::getLastError() {
+	return _last_error;
 }
 
 /**
- * @brief Parse a string in the response fields using a designated separator
+ * @brief Check if the modem rejected the command
+ *
+ * @return true: ERROR, +CME ERROR, +CMS ERROR, SEND FAIL, CONNECT FAIL or a failed call, false: otherwise
+*/
+bool ASIMError::failed() const {
+	switch (result) {
+		case FINAL_ERROR:
+		case FINAL_CME_ERROR:
+		case FINAL_CMS_ERROR:
+		case FINAL_SEND_FAIL:
+		case FINAL_CONNECT_FAIL:
+		case FINAL_NO_CARRIER:
+		case FINAL_BUSY:
+		case FINAL_NO_ANSWER:
+		case FINAL_NO_DIALTONE:
+			return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Wait for an unsolicited result code, e.g. +HTTPACTION: after AT+HTTPACTION
+ *
+ * Other lines are skipped. The line of the URC is left in the reply buffer.
+ *
+ * @param urc The URC to wait for (URC_HTTPACTION, URC_CUSD, ...)
+ * @param timeout Timeout in ms
+ * @return true: received, false: timeout
+*/
+bool ASIM::waitURC(uint8_t urc, uint16_t timeout) {
+	uint8_t rsp_value;
+	uint8_t cls = _timeout_class;
+	uint32_t start = millis();
+	uint16_t elapsed = 0;
+	bool found = false;
+
+	// the whole wait is one sample of the armed class, not its first line
+	_timeout_class = SIM_TIMEOUT_NONE;
+	while (elapsed < timeout) {
+		if (!readLine(timeout - elapsed)) {
+			break;
+		}
+		DEBUG_PRINT(F("\t"));
+		DEBUG_PRINT(replybuffer);
+		DEBUG_PRINTLN(F(" <--- "));
+		if ((classifyResponse(replybuffer, &rsp_value) == RSP_URC) && (rsp_value == urc)) {
+			found = true;
+			break;
+		}
+		elapsed = millis() - start;
+	}
+	_timeout_class = cls;
+	timeoutSample(millis() - start, found, found);
+	return found;
+}
+
+/**
+ * @brief Make a quoted command part from a RAM string
+ *
+ * @param text Pointer to the string to send between quotes
+ * @return ASIMQuoted The command part
+*/
+ASIMQuoted ASIM::quoted(const char *text) {
+	ASIMQuoted part = { text, false };
+	return part;
+}
+
+/**
+ * @brief Make a quoted command part from a flash string
+ *
+ * @param text The flash string to send between quotes
+ * @return ASIMQuoted The command part
+*/
+ASIMQuoted ASIM::quoted(ASIMFlashString text) {
+	ASIMQuoted part = { (const char *)text, true };
+	return part;
+}
+
+/**
+ * @brief Make a zero padded number command part
+ *
+ * @param value The number to send
+ * @param width The minimum number of digits
+ * @return ASIMPadded The command part
+*/
+ASIMPadded ASIM::padded(uint32_t value, uint8_t width) {
+	ASIMPadded part = { value, width };
+	return part;
+}
+
+/**
+ * @brief Write a quoted command part
+ *
+ * @param out The output stream
+ * @param part The part to write
+ * @return size_t The number of bytes written
+*/
+size_t ASIM::writePart(Print &out, const ASIMQuoted &part) {
+	size_t n = out.print('"');
+	if (part.flash) {
+		n += out.print((ASIMFlashString)part.text);
+	}
+	else {
+		n += out.print(part.text);
+	}
+	return n + out.print('"');
+}
+
+/**
+ * @brief Write a zero padded number command part
+ *
+ * @param out The output stream
+ * @param part The part to write
+ * @return size_t The number of bytes written
+*/
+size_t ASIM::writePart(Print &out, const ASIMPadded &part) {
+	uint32_t limit = 1;
+	size_t n = 0;
+	for (uint8_t i = 1; i < part.width; i++) {
+		limit *= 10;
+		if (part.value < limit) {
+			n += out.print('0');
+		}
+	}
+	return n + out.print(part.value);
+}
+
+/**
+ * @brief Write a text command part as it is
+ *
+ * @param out The output stream
+ * @param part The part to write
+ * @return size_t The number of bytes written
+*/
+size_t ASIM::writePart(Print &out, const ASIMText &part) {
+	if (part.flash) {
+		return out.print((ASIMFlashString)part.text);
+	}
+	return out.print(part.text);
+}
+
+/**
+ * @brief Write the header lines of an HTTP request, the value of AT+HTTPPARA="USERDATA"
+ *
+ * @param out The output stream
+ * @param part The request and the cache entry of its URL, NULL if none
+ * @return size_t The number of bytes written
+*/
+size_t ASIM::writePart(Print &out, const ASIMHttpHeaders &part) {
+	size_t n = 0;
+	uint8_t lines = 0;
+	// the modem turns the escaped \r\n between the lines into a line break
+	for (uint8_t i = 0; i < part.request->_header_count; i++) {
+		if (lines++) {
+			n += out.print(F("\\r\\n"));
+		}
+		n += writePart(out, part.request->_names[i]);
+		n += writePart(out, part.request->_values[i]);
+	}
+	if (!part.cached) {
+		return n;
+	}
+	if (part.cached->modified[0]) {
+		if (lines++) {
+			n += out.print(F("\\r\\n"));
+		}
+		n += out.print(F("If-Modified-Since: "));
+		n += out.print(part.cached->modified);
+	}
+	return n;
+}
+
+/**
+ * @brief Check if a text is empty
+ *
+ * @return true: no character before the terminating zero, false: otherwise
+*/
+bool ASIMText::empty() const {
+	return !(flash ? pgm_read_byte(text) : *text);
+}
+
+/**
+ * @brief Get the length of a text
+ *
+ * @return uint16_t The number of characters before the terminating zero
+*/
+uint16_t ASIMText::length() const {
+	return flash ? strlen_P(text) : strlen(text);
+}
+
+/**
+ * @brief Read the reply of a command that was just sent
+ *
+ * @param timeout Timeout for reading a response
+ * @return uint8_t The response length
+*/
+uint8_t ASIM::readReply(uint16_t timeout) {
+	uint8_t l = readAnswer(timeout);
+
+	DEBUG_PRINT(F("\t"));
+	DEBUG_PRINT(replybuffer);
+	DEBUG_PRINTLN(F(" <--- \n"));
+
+	return l;
+}
+
+/**
+ * @brief Verify the last reply matches an expected response
+ *
+ * @param reply Pointer to a buffer with the expected reply
+ * @return true: match, false: otherwise
+*/
+bool ASIM::replyIs(const char *reply) {
+	return (strcmp(replybuffer, reply) == 0);
+}
+
+/**
+ * @brief Verify the last reply matches an expected response
+ *
+ * @param reply The expected reply
+ * @return true: match, false: otherwise
+*/
+bool ASIM::replyIs(ASIMFlashString reply) {
+	return (prog_char_strcmp(replybuffer, (prog_char *)reply) == 0);
+}
+
+/**
+ * @brief Parse a string in the response fields using a designated separator
  * and copy the value at the specified index in to the supplied buffer.
  *
  * @param toreply Pointer to a buffer with reply with the field being parsed
@@ -690,12 +1144,13 @@ bool ASIM::parseReplyQuoted(char *buffer, ASIMFlashString toreply, char *v, int
  * @return true: success, false: failure
 */
 bool ASIM::sendParseReply(ASIMFlashString tosend, ASIMFlashString toreply, uint16_t *v, char divider, uint8_t index) {
-  getReply(tosend);
+  getReply(DEFAULT_TIMOUT, tosend);
 
   if (!parseReply(toreply, v, divider, index))
     return false;
 
-  readAnswer(); // remove 'OK'
+  if (!_last_error.result)
+    readAnswer(); // remove 'OK'
 
   return true;
 }
@@ -706,32 +1161,34 @@ bool ASIM::sendParseReply(ASIMFlashString tosend, ASIMFlashString toreply, uint1
  * @return uint8_t The type of modem
 */
 uint8_t ASIM::getModemType() {
-	DEBUG_PRINTLN(F("================= CHECK MODEM TYPE ================="));
-	DEBUG_PRINT(F("\t---> "));
-  	DEBUG_PRINTLN("ATI");
-
-	simSerial->println("ATI");
-	readAnswer(500, true);
-	
-	DEBUG_PRINT("\t");
-	DEBUG_PRINT(replybuffer);
-	DEBUG_PRINTLN(F(" <--- \n"));
+	SIM_API("getModemType");
+	uint8_t rsp_class, rsp_value;
+	uint8_t type = UNKNOWN_TYPE;
 
-	if(prog_char_strstr(replybuffer, (prog_char *)F("SIM808 R14"))) {
-		DEBUG_PRINTLN(F("Modem type is SIM808 V2"));
-		return SIM808_V2;
-	}
-	else if(prog_char_strstr(replybuffer, (prog_char *)F("SIM808 R13"))) {
-		DEBUG_PRINTLN(F("Modem type is SIM808 V1"));
-		return SIM808_V1;
-	}
-	else if(prog_char_strstr(replybuffer, (prog_char *)F("SIM800"))) {
-		DEBUG_PRINTLN(F("Modem type is SIM800x"));
-		return SIM800;
-	}
-	else {
-		return UNKNOWN_TYPE;
+	INFO_PRINTLN(F("================= CHECK MODEM TYPE ================="));
+	DEBUG_PRINT(F("\t---> "));
+  	DEBUG_PRINTLN(F("ATI"));
+
+	SIM_COMMAND("ATI");
+	SIM_SENT(simSerial->println("ATI"));
+	while (readLine(getTimeout(SIM_TIMEOUT_LOCAL))) {
+		DEBUG_PRINT(F("\t"));
+		DEBUG_PRINT(replybuffer);
+		DEBUG_PRINTLN(F(" <--- "));
+
+		rsp_class = classifyResponse(replybuffer, &rsp_value);
+		if(rsp_class == RSP_MODEM) {
+			INFO_PRINT(F("Modem type is "));
+			INFO_PRINTLN(replybuffer);
+			type = rsp_value;
+		}
+		// read up to the final result, so it is not left for the next command
+		if(rsp_class == RSP_FINAL) {
+			break;
+		}
 	}
+
+	return type;
 }
 
 /**
@@ -739,60 +1196,139 @@ uint8_t ASIM::getModemType() {
  *
 */
 uint8_t ASIM::getIMEI() {
+	SIM_API("getIMEI");
 	char *endpoint;
-	DEBUG_PRINTLN(F("================= CHECK MODEM IMEI ================="));
+	INFO_PRINTLN(F("================= CHECK MODEM IMEI ================="));
 	DEBUG_PRINT(F("\t---> "));
-  	DEBUG_PRINTLN("AT+CGSN");
+  	DEBUG_PRINTLN(F("AT+CGSN"));
 
 
-	simSerial->println("AT+CGSN");
-	readAnswer(500, true);
+	SIM_COMMAND("AT+CGSN");
+	SIM_SENT(simSerial->println("AT+CGSN"));
+	readAnswer(timeoutFor(SIM_TIMEOUT_LOCAL));
 	
 	
 	endpoint = strstr(replybuffer, "OK");
 	if(endpoint) {
 		*endpoint = NULL;
 	}
-	DEBUG_PRINT("\t");
+	DEBUG_PRINT(F("\t"));
 	DEBUG_PRINT(replybuffer);
 	DEBUG_PRINTLN(F(" <--- \n"));
 
-	strcpy(_imei, replybuffer);
-	DEBUG_PRINT(F("MODEM IEMI is "));
-	DEBUG_PRINTLN(_imei);
+	strncpy(_imei, replybuffer, sizeof(_imei) - 1);
+	_imei[sizeof(_imei) - 1] = 0;
+	INFO_PRINT(F("MODEM IEMI is "));
+	INFO_PRINTLN(_imei);
+	return SIM_OK;
 }
 
 /**
  * @brief Get type of SIM card
  *
+ * Reads the numeric MCC and MNC of the network (AT+COPS=3,2) and looks it up in the operator table,
+ * which also selects the APN of enableGPRS() unless setAPN() was called.
+ *
  * @return uint8_t The type of sim card
 */
 int8_t ASIM::getSimType() {
-	DEBUG_PRINTLN(F("================= CHECK SIM TYPE ================="));
+	SIM_API("getSimType");
+	uint8_t rsp_value;
+	char *name, *endpoint;
+	bool replied = false;
+	ASIMAPN entry;
+
+	INFO_PRINTLN(F("================= CHECK SIM TYPE ================="));
+	sendVerifyedCommand(F("AT+COPS=3,2"), ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL));
 	DEBUG_PRINT(F("\t---> "));
-  	DEBUG_PRINTLN("AT+COPS?");
+  	DEBUG_PRINTLN(F("AT+COPS?"));
+
+	SIM_COMMAND("AT+COPS");
+	SIM_SENT(simSerial->println("AT+COPS?"));
+	while (readLine(getTimeout(SIM_TIMEOUT_LOCAL))) {
+		replied = true;
+		DEBUG_PRINT(F("\t"));
+		DEBUG_PRINT(replybuffer);
+		DEBUG_PRINTLN(F(" <--- "));
+
+		// read up to the final result, so it is not left for the next command
+		if(classifyResponse(replybuffer, &rsp_value) == RSP_FINAL) {
+			break;
+		}
+		// +COPS: 0,2,"43235"
+		if(strncmp_P(replybuffer, PSTR("+COPS:"), 6) != 0) {
+			continue;
+		}
+		name = strchr(replybuffer, '"');
+		if(!name) {
+			continue;
+		}
+		name++;
+		endpoint = strchr(name, '"');
+		if(endpoint) {
+			*endpoint = 0;
+		}
+		strncpy(_operator, name, sizeof(_operator) - 1);
+		_operator[sizeof(_operator) - 1] = 0;
+	}
 
-	simSerial->println("AT+COPS?");
-	if(readAnswer(500, true) <= 1) {
+	if(!replied) {
 		return -1;
-	} 
-	
-	DEBUG_PRINT("\t");
-	DEBUG_PRINT(replybuffer);
-	DEBUG_PRINTLN(F(" <--- \n"));
-
-	if(prog_char_strstr(replybuffer, (prog_char *)F("\"43235\""))) {
-		DEBUG_PRINTLN(F("SIM type is MTN IRANCELL"));
-		return IRANCELL;
 	}
-	else if(prog_char_strstr(replybuffer, (prog_char *)F("\"TCI\""))) {
-		DEBUG_PRINTLN(F("SIM type is HAMRAH-E AVVAL"));
-		return MCI;
+	entry.type = UNKNOWN_SIM;
+	if(findOperator(_operator, &entry)) {
+		INFO_PRINT(F("OPERATOR IS "));
+		INFO_PRINTLN(_operator);
+		if(!_apn_set) {
+			_apn = entry;
+		}
 	}
 	else {
-		DEBUG_PRINTLN(F("CAN NOT DETECT SIM TYPE"));
-		return UNKNOWN_SIM;
+		ERROR_PRINTLN(F("CAN NOT DETECT SIM TYPE"));
+	}
+	return entry.type;
+}
+
+/**
+ * @brief Get the network of the SIM card, read by begin()
+ *
+ * @return const char* The numeric MCC and MNC, e.g. "43235", empty if unknown
+*/
+const char *ASIM::getOperator() {
+	return _operator;
+}
+
+/**
+ * @brief Set the APN used by enableGPRS() instead of the one of the operator table
+ *
+ * @param apn The APN, the string must stay valid. NULL goes back to the operator table
+ * @param user The login, empty if none
+ * @param password The password, empty if none
+ * @param quirks APN_QUIRK_* flags
+ * @return bool true if an APN is set, false if NULL was given and the operator is not in the table
+*/
+bool ASIM::setAPN(const char *apn, const char *user, const char *password, uint8_t quirks) {
+	if(!apn) {
+		_apn_set = false;
+		_apn.apn = NULL;
+		return findOperator(_operator, &_apn);
 	}
+	_apn.apn = apn;
+	_apn.user = user ? user : "";
+	_apn.password = password ? password : "";
+	_apn.quirks = quirks;
+	_apn.flash = false;
+	_apn_set = true;
+	return SIM_OK;
+}
+
+/**
+ * @brief Get the APN used by enableGPRS()
+ *
+ * @return const ASIMAPN& The APN, apn is NULL for an unknown operator without setAPN()
+*/
+const ASIMAPN &ASIM::getAPN() {
+	return _apn;
 }
 
 /**
@@ -801,17 +1337,20 @@ int8_t ASIM::getSimType() {
  * @return bool true if simcard registerd, false otherwise
 */
 bool ASIM::checkregistration() {
+	SIM_API("checkregistration");
 	bool cmpr_result = false;
 
-	DEBUG_PRINTLN(F("================= CHECK REG ================="));
+	INFO_PRINTLN(F("================= CHECK REG ================="));
 
-	cmpr_result = sendVerifyedCommand(F("AT+CREG?"), F("+CREG: 0,1OK"), 500);
+	// the answer updates the registration state, home and roaming both count
+	getReply(timeoutFor(SIM_TIMEOUT_LOCAL), F("AT+CREG?"));
+	cmpr_result = (_last_error.result == FINAL_OK) && (_registration.cs != REG_UNTRACKED) && registered();
 
 	if(!cmpr_result) {
-		DEBUG_PRINTLN(F("SIM NOT REGISTERED"));
+		ERROR_PRINTLN(F("SIM NOT REGISTERED"));
 		return false;
 	}
-	DEBUG_PRINTLN(F("SIM REGISTERED"));
+	INFO_PRINTLN(F("SIM REGISTERED"));
 	return true;
 }
 
@@ -821,18 +1360,19 @@ bool ASIM::checkregistration() {
  * @return bool true if simcard has no PIN, false otherwise
 */
 bool ASIM::checkPIN() {
+	SIM_API("checkPIN");
 	int8_t cmpr_result = 1;
-	DEBUG_PRINTLN(F("================= CHECK REG ================="));
+	INFO_PRINTLN(F("================= CHECK REG ================="));
 
-	cmpr_result = sendVerifyedCommand(F("AT+CPIN?"), F("+CPIN: REDYOK"), 500);
+	cmpr_result = sendVerifyedCommand(F("AT+CPIN?"), F("+CPIN: REDYOK"), timeoutFor(SIM_TIMEOUT_LOCAL));
 
 	cmpr_result = strcmp(replybuffer, "+CPIN: REDY");
 
 	if(!cmpr_result) {
-		DEBUG_PRINTLN(F("SIM NOT REGISTERED"));
+		ERROR_PRINTLN(F("SIM NOT REGISTERED"));
 		return false;
 	}
-	DEBUG_PRINTLN(F("SIM HAS NO PIN & READY TO USE"));
+	INFO_PRINTLN(F("SIM HAS NO PIN & READY TO USE"));
 	return true;
 }
 
@@ -842,29 +1382,30 @@ bool ASIM::checkPIN() {
  * @return uint8_t signal status (WEAK, MARGINAL, GOOD or EXCELLENT)
 */
 int8_t ASIM::getSignalQuality() {
+	SIM_API("getSignalQuality");
 	uint16_t sgq;
-	DEBUG_PRINTLN(F("================= CHECK SIGNAL QUALITY ================="));
+	INFO_PRINTLN(F("================= CHECK SIGNAL QUALITY ================="));
 	if(!sendParseReply(F("AT+CSQ"), F("+CSQ: "), &sgq)) {
 		return -1;
 	}
 	if(sgq > 20) {
-		DEBUG_PRINT("SIGNAL STRENGTH : ");
-		DEBUG_PRINTLN(sgq);
+		INFO_PRINT(F("SIGNAL STRENGTH : "));
+		INFO_PRINTLN(sgq);
 		return EXCELLENT_SIGANL;
 	}
 	else if((sgq <= 20) && (sgq > 10)) {
-		DEBUG_PRINT("SIGNAL STRENGTH : ");
-		DEBUG_PRINTLN(sgq);
+		INFO_PRINT(F("SIGNAL STRENGTH : "));
+		INFO_PRINTLN(sgq);
 		return GOOD_SIGNAL;
 	}
 	else if((sgq <= 10) && (sgq > 4)) {
-		DEBUG_PRINT("SIGNAL STRENGTH : ");
-		DEBUG_PRINTLN(sgq);
+		INFO_PRINT(F("SIGNAL STRENGTH : "));
+		INFO_PRINTLN(sgq);
 		return MARGINAL_SIGNAL;
 	}
 
-	DEBUG_PRINT("SIGNAL STRENGTH : ");
-	DEBUG_PRINTLN(sgq);
+	INFO_PRINT(F("SIGNAL STRENGTH : "));
+	INFO_PRINTLN(sgq);
 	return WEAK_SIGNAL;
 }
 
@@ -874,9 +1415,10 @@ int8_t ASIM::getSignalQuality() {
  * @return bool true if success, false otherwise
  */
 bool ASIM::checkConnection(ASIMFlashString reply) {
+	SIM_API("checkConnection");
 	bool retVal = false;
-	DEBUG_PRINTLN(F("================= CHECK CONNECTION ================="));
-	if(sendVerifyedCommand(F("AT"), reply, 500)) {
+	INFO_PRINTLN(F("================= CHECK CONNECTION ================="));
+	if(sendVerifyedCommand(F("AT"), reply, timeoutFor(SIM_TIMEOUT_LOCAL))) {
 		retVal = true;
 	}else {
 		retVal = false;
@@ -890,8 +1432,9 @@ bool ASIM::checkConnection(ASIMFlashString reply) {
  * @return bool true if set successfully, false otherwise
  */
 bool ASIM::echoOff() {
-	DEBUG_PRINTLN(F("================= TURN OF ECHO ================="));
-	return sendVerifyedCommand(F("ATE0"), F("ATE0OK"), 500);	
+	SIM_API("echoOff");
+	INFO_PRINTLN(F("================= TURN OF ECHO ================="));
+	return sendVerifyedCommand(F("ATE0"), F("ATE0OK"), timeoutFor(SIM_TIMEOUT_LOCAL));	
 }
 
 /**
@@ -901,14 +1444,9 @@ bool ASIM::echoOff() {
  * @return bool true if set successfully, false otherwise
 */
 bool ASIM::setBaud(unsigned long baud) {
-	char _cmd[20];
-	bool is_set = false;
-	sprintf(_cmd, "AT+IPR=%lu", baud);
-
-	DEBUG_PRINTLN(F("================= SET BUADRATE ================="));
-
-	is_set = sendVerifyedCommand(_cmd, ok_reply, 500);
-	return is_set;
+	SIM_API("setBaud");
+	INFO_PRINTLN(F("================= SET BUADRATE ================="));
+	return sendCheckReply(ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL), F("AT+IPR="), baud);
 }
 
 /**
@@ -918,8 +1456,9 @@ bool ASIM::setBaud(unsigned long baud) {
  * @return bool true if set successfully, false otherwise
 */
 bool ASIM::setFunctionality(uint8_t mode) {
-	DEBUG_PRINTLN(F("================= SET FUNCTIONALITY ================="));
-	return sendVerifyedCommand(F("AT+CFUN="), mode, ok_reply, 500);
+	SIM_API("setFunctionality");
+	INFO_PRINTLN(F("================= SET FUNCTIONALITY ================="));
+	return sendCheckReply(ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL), F("AT+CFUN="), mode);
 }
 
 /**
@@ -929,8 +1468,9 @@ bool ASIM::setFunctionality(uint8_t mode) {
  * @return bool true if set successfully, false otherwise
 */
 bool ASIM::setMessageFormat(uint8_t format) {
-	DEBUG_PRINTLN(F("================= SET MESSAGE FORMAT ================="));
-	return sendVerifyedCommand(F("AT+CMGF="), format, ok_reply, 500);
+	SIM_API("setMessageFormat");
+	INFO_PRINTLN(F("================= SET MESSAGE FORMAT ================="));
+	return sendCheckReply(ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL), F("AT+CMGF="), format);
 }
 
 /**
@@ -940,8 +1480,9 @@ bool ASIM::setMessageFormat(uint8_t format) {
  * @return bool true if set successfully, false otherwise
 */
 bool ASIM::setCharSet(char *chs) {
-	DEBUG_PRINTLN(F("================= SET CHARACTER SET ================="));
-	return sendVerifyedCommandQuoted(F("AT+CSCS="), (ASIMFlashString)chs, ok_reply, 500);
+	SIM_API("setCharSet");
+	INFO_PRINTLN(F("================= SET CHARACTER SET ================="));
+	return sendCheckReply(ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL), F("AT+CSCS="), quoted(chs));
 }
 
 /**
@@ -950,8 +1491,9 @@ bool ASIM::setCharSet(char *chs) {
  * @return bool true if set successfully, false otherwise
 */
 bool ASIM::setCallerIdNotification() {
-	DEBUG_PRINTLN(F("================= SET CLIP ================="));
-	return sendVerifyedCommand(F("AT+CLIP=1"), ok_reply, 500);
+	SIM_API("setCallerIdNotification");
+	INFO_PRINTLN(F("================= SET CLIP ================="));
+	return sendVerifyedCommand(F("AT+CLIP=1"), ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL));
 }
 
 /**
@@ -964,11 +1506,9 @@ bool ASIM::setCallerIdNotification() {
  * @return bool true if set successfully, false otherwise
 */
 bool ASIM::setSMSParameters(uint8_t fo, uint16_t vp, uint8_t pid, uint8_t dcs) {
-	char _cmd[24];
-
-	DEBUG_PRINTLN(F("================= SET CLIP ================="));
-	sprintf(_cmd, "AT+CSMP=%d,%d,%d,%d", fo, vp, pid, dcs);
-	return sendVerifyedCommand(_cmd, ok_reply, 500);
+	SIM_API("setSMSParameters");
+	INFO_PRINTLN(F("================= SET CLIP ================="));
+	return sendCheckReply(ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL), F("AT+CSMP="), fo, ',', vp, ',', pid, ',', dcs);
 }
 
 /**
@@ -978,213 +1518,586 @@ bool ASIM::setSMSParameters(uint8_t fo, uint16_t vp, uint8_t pid, uint8_t dcs) {
  * @return bool true if set successfully, false otherwise
 */
 bool ASIM::setSIMLanguage(uint8_t lang) {
-	char result[512];
+	SIM_API("setSIMLanguage");
 	uint16_t result_len = 0;
 
-	DEBUG_PRINTLN(F("================= SET SIM LANGUAGE ================="));
+	INFO_PRINTLN(F("================= SET SIM LANGUAGE ================="));
 	if(_sim_type == MCI) {
-		DEBUG_PRINTLN("MCI DOES NOT SUPPORT CHANGE LANGUAGE");
+		ERROR_PRINTLN(F("MCI DOES NOT SUPPORT CHANGE LANGUAGE"));
 		return SIM_FAILED;
 	}
 
 	if((_sim_type != IRANCELL) && (lang == FARSI)) {
-		DEBUG_PRINTLN("YOUR SIMCARD DOES NOT SUPPORT FARSI LANGUAGE");
+		ERROR_PRINTLN(F("YOUR SIMCARD DOES NOT SUPPORT FARSI LANGUAGE"));
 		return SIM_FAILED;
 	}
 
 	if(lang == ENGLISH) {
 		if(_sim_type == IRANCELL) {
-			return(sendUSSD("*555*4*3*2#", result, &result_len, 512));
+			return(sendUSSD("*555*4*3*2#", NULL, &result_len, 0));
 		}
 	}
 
 	if(lang == FARSI) {
 		if(_sim_type == IRANCELL) {
-			return(sendUSSD("*555*4*3*1#", result, &result_len, 512));
+			return(sendUSSD("*555*4*3*1#", NULL, &result_len, 0));
 		}	
 	}
+	return SIM_FAILED;
 }
 
 /**
- * @brief Reset the modem by software
+ * @brief Set the format of the result codes
  *
+ * In numeric mode a final result is one digit and a CR ("0" for OK, "4" for ERROR), the
+ * replies are still written to the reply buffer as text, so every reply check works in
+ * both modes. +CME ERROR, SEND OK, SHUT OK, CONNECT OK and the other TCP/IP results stay text.
+ *
+ * @param format VERBOSE_RESULTS (ATV1) or NUMERIC_RESULTS (ATV0)
  * @return bool true if set successfully, false otherwise
 */
-bool ASIM::softReset() {
-	DEBUG_PRINTLN(F("================= SOFT RESET MODEM ================="));
-	return sendVerifyedCommand(F("AT+CFUN=1,1"), ok_reply);
-
+bool ASIM::setResultFormat(uint8_t format) {
+	SIM_API("setResultFormat");
+	bool numeric = _numeric_results;
+	INFO_PRINTLN(F("================= SET RESULT FORMAT ================="));
+	// the answer already comes in the new format
+	_numeric_results = true;
+	if (!sendCheckReply(ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL), F("ATV"), format)) {
+		_numeric_results = numeric;
+		return SIM_FAILED;
+	}
+	_numeric_results = (format == NUMERIC_RESULTS);
+	return SIM_OK;
 }
 
 /**
- * @brief Reset the modem by hardware
+ * @brief Let the modem sleep between the API calls (AT+CSCLK)
  *
+ * Once set, every API call wakes the modem with wake() and the outermost one puts it back to
+ * sleep() when it returns. Non-blocking commands wake it too, call sleep() when the jobs are done.
+ * A sleeping SIM800 draws about 1 mA instead of 20 mA, but it needs a few tens of ms to wake up.
+ *
+ * @param mode SLEEP_DTR: the modem sleeps while the DTR pin is high, needs the dtr pin of the constructor.
+ * SLEEP_AUTO: the modem sleeps after 5 s without UART activity and drops the byte that wakes it.
+ * SLEEP_OFF: always awake
  * @return bool true if set successfully, false otherwise
 */
-bool ASIM::hardReset() {
-	DEBUG_PRINTLN(F("================= HARD RESET MODEM ================="));
-	if((_modem_type == SIM808_V1) || (_modem_type == SIM808_V2)) {
-		if(_rst_pin > 0) {
-			digitalWrite(_rst_pin, LOW);
-			delay(1000);
-			digitalWrite(_rst_pin, HIGH);
-		}
-		else if(_in_pwr_pin > 0) {
-			digitalWrite(_in_pwr_pin, LOW);
-			delay(1000);
-			digitalWrite(_in_pwr_pin, HIGH);
-			if(_pwr_key_pin > 0) {
-				delay(300);
-				digitalWrite(_pwr_key_pin, HIGH);
-				delay(1000);
-				digitalWrite(_pwr_key_pin, LOW);
-			}
-		}
-		else {
-			DEBUG_PRINTLN(F("HARDWARE RESET DOES NOT SUPPORT ON YOUR DEVICE"));
-			return SIM_FAILED;
-		}
-	}
-	else if(_modem_type == SIM800 ){
-		if(_in_pwr_pin > 0) {
-			digitalWrite(_in_pwr_pin, LOW);
-			delay(1000);
-			digitalWrite(_in_pwr_pin, HIGH);
-			if(_pwr_key_pin > 0) {
-				delay(300);
-				digitalWrite(_pwr_key_pin, HIGH);
-				delay(1000);
-				digitalWrite(_pwr_key_pin, LOW);
-			}
-		}
-		else {
-			DEBUG_PRINTLN(F("HARDWARE RESET DOES NOT SUPPORT ON YOUR DEVICE"));
-			return SIM_FAILED;
-		}
+bool ASIM::setSleepMode(uint8_t mode) {
+	SIM_API("setSleepMode");
+	INFO_PRINTLN(F("================= SET SLEEP MODE ================="));
+	if ((mode == SLEEP_DTR) && (_dtr_pin == 0)) {
+		ERROR_PRINTLN(F("SLEEP_DTR NEEDS THE DTR PIN"));
+		return SIM_FAILED;
 	}
-	else {
-		DEBUG_PRINTLN(F("HARDWARE RESET DOES NOT SUPPORT ON YOUR DEVICE"));
+	if (!sendCheckReply(ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL), F("AT+CSCLK="), mode)) {
 		return SIM_FAILED;
 	}
+	_sleep_mode = mode;
 	return SIM_OK;
 }
-/**********************************************************************************************************************************/
+
 /**
- * @brief Call a phone number
+ * @brief Wake the modem up and wait until it answers AT
  *
- * @param number The reciever number
- * @return bool true if success, false otherwise
+ * The time to the first answer is kept in getPowerStats(). A SLEEP_AUTO modem that was used in the
+ * last SIM_SLEEP_IDLE ms is still awake and is not probed.
+ *
+ * @return bool true if the modem is awake, false if it did not answer within SIM_WAKE_TIMEOUT
 */
-bool ASIM::makeCall(char *number) {
-	uint16_t sms_mode;
-	char _cmd[35] = "ATD+ ";
-	uint8_t last_slot = 0;
-
-	DEBUG_PRINTLN(F("================= MAKING CALL ================="));
-	// TODO: CHECK of number[0] if it was 0 changes to +98
+bool ASIM::wake() {
+	SIM_LOCK();
+	if (!_asleep) {
+		return SIM_OK;
+	}
+	uint32_t start = millis();
+	uint32_t slept = start - _power_since;
+	_asleep = false;
+	_power_since = start;
+	if (_sleep_mode == SLEEP_AUTO) {
+		if (slept < SIM_SLEEP_IDLE) {
+			_power.awake_ms += slept;
+			return SIM_OK;
+		}
+		_power.awake_ms += SIM_SLEEP_IDLE;
+		slept -= SIM_SLEEP_IDLE;
+	}
+	_power.asleep_ms += slept;
 
-	strncpy(_cmd + 5, number, min(30, (int)strlen(number))); 
-	last_slot = strlen(_cmd);
-	_cmd[last_slot] = ';';
-  	_cmd[last_slot + 1] = 0;
+	if (_dtr_pin > 0) {
+		digitalWrite(_dtr_pin, LOW);
+	}
+	// the UART is deaf until the modem is up, the first AT that gets an OK ends the wait
+	do {
+		discardInput();
+		SIM_COMMAND("AT");
+		SIM_SENT(simSerial->println(F("AT")));
+		if (readAnswer(SIM_WAKE_PROBE) && (_last_error.result == FINAL_OK)) {
+			uint16_t latency = millis() - start;
+			_power.wakes++;
+			_power.wake_last = latency;
+			_power.wake_total += latency;
+			if (latency > _power.wake_max) {
+				_power.wake_max = latency;
+			}
+			DEBUG_PRINT(F("WAKE: "));
+			DEBUG_PRINTLN(latency);
+			return SIM_OK;
+		}
+	} while ((millis() - start) < SIM_WAKE_TIMEOUT);
 
-	return sendVerifyedCommand(_cmd, ok_reply, 10000);
+	_power.wake_failures++;
+	ERROR_PRINTLN(F("MODEM DID NOT WAKE UP"));
+	return SIM_FAILED;
 }
 
 /**
- * @brief End the current call
+ * @brief Let the modem sleep, see setSleepMode()
  *
- * @return bool true if success, false otherwise
+ * Does nothing with SLEEP_OFF. The next API call wakes the modem up.
 */
-bool ASIM::hangUp() { 
-	DEBUG_PRINTLN(F("================= HANG UP ================="));
-	return sendVerifyedCommand(F("ATH0"), ok_reply); 
+void ASIM::sleep() {
+	SIM_LOCK();
+	if ((_sleep_mode == SLEEP_OFF) || (_asleep)) {
+		return;
+	}
+	if ((_sleep_mode == SLEEP_DTR) && (_dtr_pin > 0)) {
+		digitalWrite(_dtr_pin, HIGH);
+	}
+	uint32_t now = millis();
+	_power.awake_ms += now - _power_since;
+	_power_since = now;
+	_asleep = true;
 }
 
 /**
- * @brief Make missed call
+ * @brief Check if the modem was put to sleep
  *
- * @param number The reciever number
- * @param hangup_delay The delay for hangup call
- * @return bool true if success, false otherwise
+ * @return true: asleep (SLEEP_AUTO: or about to sleep), false: awake
 */
-bool ASIM::makeMissedCall(char *number, uint16_t hangup_delay) {
-	bool succeed = false;
+bool ASIM::asleep() {
+	return _asleep;
+}
 
-	DEBUG_PRINTLN(F("================= MAKING MISSED CALL ================="));
-	succeed = makeCall(number);
-	if(!succeed) {
-		return succeed;
+/**
+ * @brief Get the wake latencies and the awake and asleep times
+ *
+ * A sleep in progress is counted when the modem wakes up.
+ *
+ * @return const ASIMPowerStats& The statistics since begin() or resetPowerStats()
+*/
+const ASIMPowerStats &ASIM::getPowerStats() {
+	if (!_asleep) {
+		uint32_t now = millis();
+		_power.awake_ms += now - _power_since;
+		_power_since = now;
 	}
-	delay(hangup_delay);
-	succeed = hangUp();
-
-	return succeed;
+	return _power;
 }
 
 /**
- * @brief Make voice call with AMR file
+ * @brief Clear the sleep statistics
  *
- * @param number The reciever number
- * @param file_id The AMR file ID
- * @return bool true if success, false otherwise
 */
-bool ASIM::makeAMRVoiceCall(char *number, uint16_t file_id) {
-	char amr_cmd[40];
-	DEBUG_PRINTLN(F("================= MAKING VOICE CALL WITH AMR FILE ================="));
-	
-	sprintf(amr_cmd, "AT+CREC=4,\"C:\\User\\%d.amr\",0,90", file_id);
-	// AT+CREC=4,"C:\User\file_id.amr",0,90
-	makeCall(number);
-	// After user pick the phone on
-	// TODO: Check if user picked the phone on
-	return sendVerifyedCommand(amr_cmd, ok_reply);
+void ASIM::resetPowerStats() {
+	memset(&_power, 0, sizeof(_power));
+	_power_since = millis();
 }
 
 /**
- * @brief Get the number of the incoming call
+ * @brief Turn on the +CREG/+CGREG URCs with location (mode 2) and read the current state
  *
- * @param phone_number Pointer to a buffer to hold the incoming caller's phone number
- * @return bool true if success, false otherwise
+ * From then on the registration state, LAC and cell ID follow the URCs seen in any answer or by
+ * dispatchEvents(), see getRegistration() and registered(). begin() calls it.
+ *
+ * @return bool true if set successfully, false otherwise
 */
-bool ASIM::incomeCallNumber(char *phone_number) {
-	char *substr, *endpoint;
-	// RING+CLIP: "<incoming phone number>",145,"",0,"",0
-	// or
-	// +CLIP: "<incoming phone number>",145,"",0,"",0
-	readAnswer(); // reads incoming phone number line
-	if(strstr(replybuffer, "RING")) {
-		if(strstr(replybuffer, "+CLIP")) {
-			substr = replybuffer + 12;
+bool ASIM::trackRegistration() {
+	SIM_API("trackRegistration");
+	INFO_PRINTLN(F("================= TRACK REGISTRATION ================="));
+	if (!sendCheckReply(ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL), F("AT+CREG=2"))) {
+		return SIM_FAILED;
+	}
+	if (!sendCheckReply(ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL), F("AT+CGREG=2"))) {
+		return SIM_FAILED;
+	}
+	// +CREG: 2,<stat>,"<lac>","<ci>"
+	getReply(timeoutFor(SIM_TIMEOUT_LOCAL), F("AT+CREG?"));
+	if (_last_error.result != FINAL_OK) {
+		return SIM_FAILED;
+	}
+	getReply(timeoutFor(SIM_TIMEOUT_LOCAL), F("AT+CGREG?"));
+	return _last_error.result == FINAL_OK;
+}
+
+/**
+ * @brief Get the registration state kept by trackRegistration()
+ *
+ * @return const ASIMRegistration& The state, REG_UNTRACKED before trackRegistration()
+*/
+const ASIMRegistration &ASIM::getRegistration() {
+	return _registration;
+}
+
+/**
+ * @brief Check the kept registration state without asking the modem
+ *
+ * @param packet false: circuit switched (SMS, calls, USSD), true: packet switched (GPRS)
+ * @return true: registered, home or roaming, or not tracked, false: searching, denied, ...
+*/
+bool ASIM::registered(bool packet) {
+	uint8_t stat = packet ? _registration.ps : _registration.cs;
+	return (stat == REG_HOME) || (stat == REG_ROAMING) || (stat == REG_UNTRACKED);
+}
+
+/**
+ * @brief Take the state from a +CREG/+CGREG line, a URC or the answer to AT+CREG?
+ *
+ * @param fields The line after "+CREG: ": "<stat>[,<lac>,<ci>]" or "<n>,<stat>[,<lac>,<ci>]"
+ * @param packet true for +CGREG
+*/
+void ASIM::registrationLine(const char *fields, bool packet) {
+	uint8_t stat = atoi(fields);
+	const char *next = strchr(fields, ',');
+	if (next && isdigit(next[1])) {
+		// the answer to the query starts with the URC mode
+		stat = atoi(next + 1);
+		next = strchr(next + 1, ',');
+	}
+	uint8_t &state = packet ? _registration.ps : _registration.cs;
+	if (state != stat) {
+		state = stat;
+		_registration.changed_ms = millis();
+	}
+	if (next && (next[1] == '"')) {
+		_registration.lac = strtoul(next + 2, NULL, 16);
+		next = strchr(next + 2, ',');
+		if (next && (next[1] == '"')) {
+			_registration.ci = strtoul(next + 2, NULL, 16);
+		}
+	}
+}
+
+/**
+ * @brief Listen to the RI pin: it falls when the modem sends a URC (incoming call, SMS, registration, ...)
+ *
+ * A pin without an interrupt, or more than SIM_RI_MODEMS modems with an RI pin, leave the pin unused:
+ * pending() then checks the UART as without one.
+*/
+void ASIM::ringBegin() {
+	bool registered = false;
+
+	if (digitalPinToInterrupt(_ri_pin) == NOT_AN_INTERRUPT) {
+		ERROR_PRINTLN(F("RI PIN HAS NO INTERRUPT"));
+		_ri_pin = 0;
+		return;
+	}
+	noInterrupts();
+	for (uint8_t i = 0; i < SIM_RI_MODEMS; i++) {
+		if ((ri_modems[i] == NULL) || (ri_modems[i] == this)) {
+			ri_modems[i] = this;
+			registered = true;
+			break;
+		}
+	}
+	interrupts();
+	if (!registered) {
+		ERROR_PRINTLN(F("NO FREE RI SLOT, RAISE SIM_RI_MODEMS"));
+		_ri_pin = 0;
+		return;
+	}
+	pinMode(_ri_pin, INPUT_PULLUP);
+	attachInterrupt(digitalPinToInterrupt(_ri_pin), ringISR, FALLING);
+}
+
+/**
+ * @brief RI interrupt: flag the modems whose RI line is low, an interrupt also wakes a sleeping MCU
+ *
+*/
+void ASIM::ringISR() {
+	for (uint8_t i = 0; i < SIM_RI_MODEMS; i++) {
+		if (ri_modems[i] && (digitalRead(ri_modems[i]->_ri_pin) == LOW)) {
+			ri_modems[i]->_ri_pending = true;
+		}
+	}
+}
+
+/**
+ * @brief Check if the modem has something to tell
+ *
+ * With an RI pin it is a flag set by the interrupt and nothing is read, without one it checks the UART.
+ *
+ * @return true: call dispatchEvents(), false: nothing happened
+*/
+bool ASIM::pending() {
+	if (_ri_pin > 0) {
+		return _ri_pending;
+	}
+	return rxAvailable() > 0;
+}
+
+/**
+ * @brief Read the URCs that caused the last RI pulse and pass them to the hook of onURC()
+ *
+ * Does nothing until pending(), so the main loop (or the MCU, sleeping until the RI interrupt)
+ * stays idle while the modem has nothing. A RING or +CLIP marks an incoming call (see
+ * incomeCallNumber()), +PDP: DEACT closes GPRS (see maintainGPRS()) and CLOSED the TCP connection.
+ * Does not wake a sleeping modem: it sends its URCs with the RI pulse.
+ *
+ * @return uint8_t The number of URCs dispatched
+*/
+uint8_t ASIM::dispatchEvents() {
+	SIM_LOCK();
+	SIM_PROBE("dispatchEvents");
+	uint8_t rsp_value, count = 0;
+
+	if (!pending()) {
+		return 0;
+	}
+	noInterrupts();
+	_ri_pending = false;
+	interrupts();
+
+	SIM_COMMAND("URC");
+	// the first line may still be on its way, the next ones are read while more is waiting
+	do {
+		if (!readLine(SIM_RI_DRAIN)) {
+			break;
+		}
+		if (classifyResponse(replybuffer, &rsp_value) != RSP_URC) {
+			continue;
+		}
+		DEBUG_PRINT(F("\t"));
+		DEBUG_PRINT(replybuffer);
+		DEBUG_PRINTLN(F(" <--- "));
+		switch (rsp_value) {
+			case URC_RING:
+			case URC_CLIP:
+				_incoming_call = true;
+				break;
+			case URC_TCP_CLOSED:
+				_tcp_running = false;
+				break;
+		}
+		count++;
+		if (_urc_hook) {
+			_urc_hook(rsp_value, replybuffer, _urc_arg);
+		}
+	} while (rxAvailable());
+	return count;
+}
+
+/**
+ * @brief Set the hook that dispatchEvents() calls for every URC
+ *
+ * @param hook The hook, NULL to remove it
+ * @param arg Passed to the hook
+*/
+void ASIM::onURC(ASIMURCHook hook, void *arg) {
+	_urc_hook = hook;
+	_urc_arg = arg;
+}
+
+ASIMAwake::ASIMAwake(ASIM &sim) : _sim(sim) {
+	if ((_sim._api_depth++ == 0) && (_sim._asleep)) {
+		_sim.wake();
+	}
+}
+
+ASIMAwake::~ASIMAwake() {
+	if (--_sim._api_depth == 0) {
+		_sim.sleep();
+	}
+}
+
+/**
+ * @brief Reset the modem by software
+ *
+ * @return bool true if set successfully, false otherwise
+*/
+bool ASIM::softReset() {
+	SIM_API("softReset");
+	INFO_PRINTLN(F("================= SOFT RESET MODEM ================="));
+	return sendVerifyedCommand(F("AT+CFUN=1,1"), ok_reply);
+
+}
+
+/**
+ * @brief Reset the modem by hardware
+ *
+ * @return bool true if set successfully, false otherwise
+*/
+bool ASIM::hardReset() {
+	SIM_API("hardReset");
+	INFO_PRINTLN(F("================= HARD RESET MODEM ================="));
+	if((_modem_type == SIM808_V1) || (_modem_type == SIM808_V2)) {
+		if(_rst_pin > 0) {
+			digitalWrite(_rst_pin, LOW);
+			delay(1000);
+			digitalWrite(_rst_pin, HIGH);
+		}
+		else if(_in_pwr_pin > 0) {
+			digitalWrite(_in_pwr_pin, LOW);
+			delay(1000);
+			digitalWrite(_in_pwr_pin, HIGH);
+			if(_pwr_key_pin > 0) {
+				delay(300);
+				digitalWrite(_pwr_key_pin, HIGH);
+				delay(1000);
+				digitalWrite(_pwr_key_pin, LOW);
+			}
 		}
 		else {
-			DEBUG_PRINTLN("CALLER ID NOTIFICATION IS DISABELD");
+			ERROR_PRINTLN(F("HARDWARE RESET DOES NOT SUPPORT ON YOUR DEVICE"));
 			return SIM_FAILED;
 		}
 	}
-	else {
-		if(strstr(replybuffer, "+CLIP")) {
-			substr = replybuffer + 8;
+	else if(_modem_type == SIM800 ){
+		if(_in_pwr_pin > 0) {
+			digitalWrite(_in_pwr_pin, LOW);
+			delay(1000);
+			digitalWrite(_in_pwr_pin, HIGH);
+			if(_pwr_key_pin > 0) {
+				delay(300);
+				digitalWrite(_pwr_key_pin, HIGH);
+				delay(1000);
+				digitalWrite(_pwr_key_pin, LOW);
+			}
 		}
 		else {
-			DEBUG_PRINTLN("NO INCOMING CALL DETECTED");
-			return SIM_FAILED;			
+			ERROR_PRINTLN(F("HARDWARE RESET DOES NOT SUPPORT ON YOUR DEVICE"));
+			return SIM_FAILED;
 		}
 	}
-
-	endpoint = strstr(substr, "\"");
-	if(!endpoint) {
-		DEBUG_PRINTLN("CAN NOT PARSE INCOME PHONE NUMBER");
+	else {
+		ERROR_PRINTLN(F("HARDWARE RESET DOES NOT SUPPORT ON YOUR DEVICE"));
+		return SIM_FAILED;
+	}
+	return SIM_OK;
+}
+/**********************************************************************************************************************************/
+/**
+ * @brief Call a phone number
+ *
+ * @param number The reciever number
+ * @return bool true if success, false otherwise
+*/
+bool ASIM::makeCall(char *number) {
+	SIM_API("makeCall");
+	INFO_PRINTLN(F("================= MAKING CALL ================="));
+	if(!registered(false)) {
+		ERROR_PRINTLN(F("NOT REGISTERED"));
 		return SIM_FAILED;
 	}
-	*endpoint = NULL;
+	// TODO: CHECK of number[0] if it was 0 changes to +98
 
-	DEBUG_PRINT(F("Phone Number: "));
-	DEBUG_PRINTLN(substr);
-	strcpy(phone_number, substr);
+	return sendCheckReply(ok_reply, timeoutFor(SIM_TIMEOUT_NETWORK), F("ATD+ "), number, ';');
+}
 
-	_incoming_call = false;
-	return SIM_OK;
+/**
+ * @brief End the current call
+ *
+ * @return bool true if success, false otherwise
+*/
+bool ASIM::hangUp() { 
+	SIM_API("hangUp");
+	INFO_PRINTLN(F("================= HANG UP ================="));
+	return sendVerifyedCommand(F("ATH0"), ok_reply); 
+}
+
+/**
+ * @brief Make missed call
+ *
+ * @param number The reciever number
+ * @param hangup_delay The delay for hangup call
+ * @return bool true if success, false otherwise
+*/
+bool ASIM::makeMissedCall(char *number, uint16_t hangup_delay) {
+	SIM_API("makeMissedCall");
+	bool succeed = false;
+
+	INFO_PRINTLN(F("================= MAKING MISSED CALL ================="));
+	succeed = makeCall(number);
+	if(!succeed) {
+		return succeed;
+	}
+	delay(hangup_delay);
+	succeed = hangUp();
+
+	return succeed;
+}
+
+/**
+ * @brief Make voice call with AMR file
+ *
+ * @param number The reciever number
+ * @param file_id The AMR file ID
+ * @return bool true if success, false otherwise
+*/
+bool ASIM::makeAMRVoiceCall(char *number, uint16_t file_id) {
+	SIM_API("makeAMRVoiceCall");
+	INFO_PRINTLN(F("================= MAKING VOICE CALL WITH AMR FILE ================="));
+	
+	makeCall(number);
+	// After user pick the phone on
+	// TODO: Check if user picked the phone on
+	// AT+CREC=4,"C:\User\file_id.amr",0,90
+	return sendCheckReply(ok_reply, DEFAULT_TIMOUT, F("AT+CREC=4,\"C:\\User\\"), file_id, F(".amr\",0,90"));
+}
+
+/**
+ * @brief Get the number of the incoming call
+ *
+ * @param phone_number Pointer to a buffer to hold the incoming caller's phone number
+ * @return bool true if success, false otherwise
+*/
+bool ASIM::incomeCallNumber(char *phone_number) {
+	SIM_API("incomeCallNumber");
+	char *substr, *endpoint;
+	uint8_t rsp_value, rsp_len;
+	bool ringing = false;
+	// RING
+	// +CLIP: "<incoming phone number>",145,"",0,"",0
+	// or
+	// +CLIP: "<incoming phone number>",145,"",0,"",0
+	SIM_COMMAND("+CLIP");
+	while (readLine()) { // reads incoming phone number line
+		if(classifyResponse(replybuffer, &rsp_value, &rsp_len) != RSP_URC) {
+			continue;
+		}
+		if(rsp_value == URC_RING) {
+			ringing = true;
+			continue;
+		}
+		if(rsp_value != URC_CLIP) {
+			continue;
+		}
+
+		substr = replybuffer + rsp_len;
+		if(*substr == '"') {
+			substr++;
+		}
+		endpoint = strchr(substr, '"');
+		if(!endpoint) {
+			ERROR_PRINTLN(F("CAN NOT PARSE INCOME PHONE NUMBER"));
+			return SIM_FAILED;
+		}
+		*endpoint = 0;
+
+		INFO_PRINT(F("Phone Number: "));
+		INFO_PRINTLN(substr);
+		strcpy(phone_number, substr);
+
+		_incoming_call = false;
+		return SIM_OK;
+	}
+
+	if(ringing) {
+		ERROR_PRINTLN(F("CALLER ID NOTIFICATION IS DISABELD"));
+	}
+	else {
+		ERROR_PRINTLN(F("NO INCOMING CALL DETECTED"));
+	}
+	return SIM_FAILED;
 }
 
 /**********************************************************************************************************************************/
@@ -1194,9 +2107,10 @@ bool ASIM::incomeCallNumber(char *phone_number) {
  * @return bool true if set successfully, false otherwise
 */
 bool ASIM::clearInbox() {
-	DEBUG_PRINTLN(F("================= DELETE ALL SMS ================="));
-	return sendVerifyedCommand(F("AT+CMGDA=\"DEL ALL\""), ok_reply, 1000);
-	//return sendVerifyedCommandQuoted(F("AT+CMGDA="), F("DEL ALL"), ok_reply, 500);
+	SIM_API("clearInbox");
+	INFO_PRINTLN(F("================= DELETE ALL SMS ================="));
+	return sendVerifyedCommand(F("AT+CMGDA=\"DEL ALL\""), ok_reply, timeoutFor(SIM_TIMEOUT_STORAGE));
+	//return sendCheckReply(ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL), F("AT+CMGDA="), quoted(F("DEL ALL")));
 }
 
 /**
@@ -1206,21 +2120,15 @@ bool ASIM::clearInbox() {
  * @return bool true if success, false otherwise
 */
 bool ASIM::deleteSMS(uint8_t message_index) {
+	SIM_API("deleteSMS");
 	uint16_t sms_mode;
 	sendParseReply(F("AT+CMGF?"), F("+CMGF:"), &sms_mode);
 	if(sms_mode != TEXT_MODE) {
-		DEBUG_PRINTLN("SMS MODE IS NOT ACCEPTABLE");
+		ERROR_PRINTLN(F("SMS MODE IS NOT ACCEPTABLE"));
 		return SIM_FAILED;
 	}
-	// read an sms
-	char sendbuff[12] = "AT+CMGD=000";
-	sendbuff[8] = (message_index / 100) + '0';
-	message_index %= 100;
-	sendbuff[9] = (message_index / 10) + '0';
-	message_index %= 10;
-	sendbuff[10] = message_index + '0';
-
-	return sendVerifyedCommand(sendbuff, ok_reply, 5000);
+	// delete an sms
+	return sendCheckReply(ok_reply, timeoutFor(SIM_TIMEOUT_STORAGE), F("AT+CMGD="), padded(message_index, 3));
 }
 
 /**
@@ -1231,15 +2139,18 @@ bool ASIM::deleteSMS(uint8_t message_index) {
  * @return bool true if send SMS successfully, false otherwise
 */
 bool ASIM::sendSMS(char *receiver_number, char *msg, bool hex) {
+	SIM_API("sendSMS");
 	uint16_t sms_mode;
-	uint16_t wait_to_send = 10000;
-	char sendcmd[30] = "AT+CMGS=\"";
+	uint16_t wait_to_send;
 
-	DEBUG_PRINTLN(F("================= SENDING SMS ================="));
+	INFO_PRINTLN(F("================= SENDING SMS ================="));
+	if(!registered(false)) {
+		ERROR_PRINTLN(F("NOT REGISTERED"));
+		return SIM_FAILED;
+	}
 	if(hex) {
 		setCharSet(HEX_CHARSET);
 		setSMSParameters(49, 167, 0, 8);
-		wait_to_send = 15000;
 	}
 	else {
 		setCharSet(DEFUALT_CHARSET);
@@ -1248,35 +2159,36 @@ bool ASIM::sendSMS(char *receiver_number, char *msg, bool hex) {
 
 	sendParseReply(F("AT+CMGF?"), F("+CMGF:"), &sms_mode);
 	if(sms_mode != TEXT_MODE) {
-		DEBUG_PRINTLN("SMS MODE IS NOT ACCEPTABLE");
+		ERROR_PRINTLN(F("SMS MODE IS NOT ACCEPTABLE"));
 		return SIM_FAILED;
 	}
 	
 
-	strncpy(sendcmd + 9, receiver_number, 30 - 9 - 2); 
-	// 9 bytes for AT+CMGS=", 2 bytes for close quote + null
-	sendcmd[strlen(sendcmd)] = '\"';
-
-	if (!sendVerifyedCommand(sendcmd, F("> "))) {
-		DEBUG_PRINTLN("SMS BODY INDICATOR ('>') DOES NOT SHOWN");
+	if (!sendCheckReply(F("> "), DEFAULT_TIMOUT, F("AT+CMGS="), quoted(receiver_number))) {
+		ERROR_PRINTLN(F("SMS BODY INDICATOR ('>') DOES NOT SHOWN"));
 		delay(1000);
 		setCharSet(DEFUALT_CHARSET);
 		setSMSParameters(49, 167, 0, 0);
 		return SIM_FAILED;
 	}
 
-	simSerial->print(msg);
-	simSerial->write(0x1A);
+	SIM_COMMAND("AT+CMGS>");
+	SIM_SENT(simSerial->print(msg));
+	SIM_SENT(simSerial->write(0x1A));
 
 	DEBUG_PRINT(msg);
-	DEBUG_PRINTLN(" ^Z");
+	DEBUG_PRINTLN(F(" ^Z"));
 
-	// read the +CMGS reply, wait up to 10 seconds!
+	// read the +CMGS reply, HEX messages are longer
+	wait_to_send = timeoutFor(SIM_TIMEOUT_NETWORK);
+	if(hex) {
+		wait_to_send += wait_to_send / 2;
+	}
 	readAnswer(wait_to_send);
 	DEBUG_PRINTLN(replybuffer);
 
 	if ((!strstr(replybuffer, "+CMGS")) || (!strstr(replybuffer, "OK"))) {
-		DEBUG_PRINTLN("SMS DID NOT SEND PROPERLY");
+		ERROR_PRINTLN(F("SMS DID NOT SEND PROPERLY"));
 		delay(1000);
 		setCharSet(DEFUALT_CHARSET);
 		setSMSParameters(49, 167, 0, 0);
@@ -1300,27 +2212,23 @@ bool ASIM::sendSMS(char *receiver_number, char *msg, bool hex) {
  * @return bool true if success, false otherwise
 */
 bool ASIM::readSMS(uint8_t message_index, char *sender, char *body, uint16_t *sms_len, uint16_t maxlen) {
+	SIM_API("readSMS");
 	uint16_t sms_mode;
-	uint16_t thesmslen = 0;
-	char *endpoint, *substr;
-	char temp[maxlen];
-	char datetime[25];
-	char div[256];
-	char sendcmd[30] = "AT+CMGS=\"";
-
-	DEBUG_PRINTLN(F("================= READING SMS ================="));
+	char *endpoint;
+
+	INFO_PRINTLN(F("================= READING SMS ================="));
 	setCharSet(DEFUALT_CHARSET);
 	setSMSParameters(49, 167, 0, 0);
 
 	sendParseReply(F("AT+CMGF?"), F("+CMGF:"), &sms_mode);
 	if(sms_mode != TEXT_MODE) {
-		DEBUG_PRINTLN("SMS MODE IS NOT ACCEPTABLE");
+		ERROR_PRINTLN(F("SMS MODE IS NOT ACCEPTABLE"));
 		return SIM_FAILED;
 	}
 
 	// show all text mode parameters
 	if (!sendVerifyedCommand(F("AT+CSDH=1"), ok_reply)) {
-		DEBUG_PRINTLN("CAN NOT SHOW ALL SMS PARAMETERS");
+		ERROR_PRINTLN(F("CAN NOT SHOW ALL SMS PARAMETERS"));
 		return SIM_FAILED;
 	}
 
@@ -1328,15 +2236,16 @@ bool ASIM::readSMS(uint8_t message_index, char *sender, char *body, uint16_t *sm
 	DEBUG_PRINT(F("AT+CMGR="));
 	DEBUG_PRINTLN(message_index);
 
-	simSerial->print(F("AT+CMGR="));
-	simSerial->println(message_index);
+	SIM_COMMAND("AT+CMGR");
+	SIM_SENT(simSerial->print(F("AT+CMGR=")));
+	SIM_SENT(simSerial->println(message_index));
 	readAnswerLn(1000);
 	flushInput();
 	// parse it out...
 	uint16_t full_reply_len = min(maxlen, (uint16_t)strlen(replybuffer));
 	endpoint = strstr(replybuffer, "OK");
 	if(!endpoint) {
-		DEBUG_PRINTLN("THERE IS NO SMS WITH REQUESTED INDEX");
+		DEBUG_PRINTLN(F("THERE IS NO SMS WITH REQUESTED INDEX"));
 		*sms_len = 0;
 		return SIM_FAILED;
 	}
@@ -1365,24 +2274,22 @@ bool ASIM::readSMS(uint8_t message_index, char *sender, char *body, uint16_t *sm
  * @return bool true if success, false otherwise
 */
 bool ASIM::readSMS(uint8_t message_index, char *sender, char *body, char *date, char *tyme, char *type, uint16_t *sms_len, uint16_t maxlen) {
+	SIM_API("readSMS");
 	uint16_t sms_mode;
-	uint16_t thesmslen = 0;
-	char *endpoint, *substr;
-	char temp[256];
+	char *endpoint;
 	bool parse_result = false;
-	char sendcmd[30] = "AT+CMGS=\"";
 
-	DEBUG_PRINTLN(F("================= READING SMS ================="));
+	INFO_PRINTLN(F("================= READING SMS ================="));
 
 	sendParseReply(F("AT+CMGF?"), F("+CMGF:"), &sms_mode);
 	if(sms_mode != TEXT_MODE) {
-		DEBUG_PRINTLN("SMS MODE IS NOT ACCEPTABLE");
+		ERROR_PRINTLN(F("SMS MODE IS NOT ACCEPTABLE"));
 		return SIM_FAILED;
 	}
 
 	// show all text mode parameters
 	if (!sendVerifyedCommand(F("AT+CSDH=1"), ok_reply)) {
-		DEBUG_PRINTLN("CAN NOT SHOW ALL SMS PARAMETERS");
+		ERROR_PRINTLN(F("CAN NOT SHOW ALL SMS PARAMETERS"));
 		return SIM_FAILED;
 	}
 
@@ -1390,8 +2297,9 @@ bool ASIM::readSMS(uint8_t message_index, char *sender, char *body, char *date,
 	DEBUG_PRINT(F("AT+CMGR="));
 	DEBUG_PRINTLN(message_index);
 
-	simSerial->print(F("AT+CMGR="));
-	simSerial->println(message_index);
+	SIM_COMMAND("AT+CMGR");
+	SIM_SENT(simSerial->print(F("AT+CMGR=")));
+	SIM_SENT(simSerial->println(message_index));
 	readAnswerLn(1000);
 	flushInput();
 	// parse it out...
@@ -1399,7 +2307,7 @@ bool ASIM::readSMS(uint8_t message_index, char *sender, char *body, char *date,
 	uint16_t full_reply_len = min(maxlen, (uint16_t)strlen(replybuffer));
 	endpoint = strstr(replybuffer, "OK");
 	if(!endpoint) {
-		DEBUG_PRINTLN("THERE IS NO SMS WITH REQUESTED INDEX");
+		DEBUG_PRINTLN(F("THERE IS NO SMS WITH REQUESTED INDEX"));
 		*sms_len = 0;
 		return SIM_FAILED;
 	}
@@ -1425,14 +2333,15 @@ bool ASIM::readSMS(uint8_t message_index, char *sender, char *body, char *date,
  * @return int8_t The SMS count. -1 on error
 */
 int8_t ASIM::getNumSMS() {
+	SIM_API("getNumSMS");
   	uint16_t numsms;
 	uint16_t sms_mode;
 
-	DEBUG_PRINTLN(F("================= READING NUMBER SMS IN INBOX ================="));
+	INFO_PRINTLN(F("================= READING NUMBER SMS IN INBOX ================="));
 
 	sendParseReply(F("AT+CMGF?"), F("+CMGF:"), &sms_mode);
 	if(sms_mode != TEXT_MODE) {
-		DEBUG_PRINTLN("SMS MODE IS NOT ACCEPTABLE");
+		ERROR_PRINTLN(F("SMS MODE IS NOT ACCEPTABLE"));
 		return -1;
 	}
 
@@ -1450,32 +2359,33 @@ int8_t ASIM::getNumSMS() {
  * @brief Send USSD
  *
  * @param ussd_code The USSD message buffer
- * @param ussd_response The USSD response bufer
+ * @param ussd_response The USSD response bufer, NULL to discard the response
  * @param response_len The length actually read
  * @param max_len The maximum read length 
  * @return bool true if success, false otherwise
 */
 bool ASIM::sendUSSD(char *ussd_code, char *ussd_response, uint16_t *response_len, uint16_t max_len) {
-	char _cmd[35] = "AT+CUSD=1,\"";
-
-	DEBUG_PRINTLN(F("================= SENDING USSD ================="));
-
-	if (!sendVerifyedCommand(F("AT+CUSD=1"), ok_reply, 500)) {
+	SIM_API("sendUSSD");
+	INFO_PRINTLN(F("================= SENDING USSD ================="));
+	if(!registered(false)) {
+		ERROR_PRINTLN(F("NOT REGISTERED"));
 		return SIM_FAILED;
 	}
 
-  	// make command
-	strncpy(_cmd + 11, ussd_code, 35 - 11 - 2); 
-	// 11 bytes (AT+CUSD=1,"), 2 bytes for close quote + null
-  	_cmd[strlen(_cmd)] = '\"';
+	if (!sendVerifyedCommand(F("AT+CUSD=1"), ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL))) {
+		return SIM_FAILED;
+	}
 
-	if (!sendVerifyedCommand(_cmd, ok_reply, 500)) {
+	if (!sendCheckReply(ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL), F("AT+CUSD=1,"), quoted(ussd_code))) {
 		*response_len = 0;
 		return SIM_FAILED;
 	} 
 	else {
-		readAnswer(10000); // read the +CUSD reply, wait up to 10 seconds!!!
-		DEBUG_PRINT("* "); DEBUG_PRINTLN(replybuffer);
+		// the reply is the +CUSD URC, after the OK
+		if (!waitURC(URC_CUSD, timeoutFor(SIM_TIMEOUT_NETWORK))) {
+			*response_len = 0;
+			return SIM_FAILED;
+		}
 		char *p = prog_char_strstr(replybuffer, PSTR("+CUSD: "));
 		if (p == 0) {
 			*response_len = 0;
@@ -1492,6 +2402,10 @@ bool ASIM::sendUSSD(char *ussd_code, char *ussd_response, uint16_t *response_len
 		// Find " to get end of ussd message.
 		char *strend = strchr(p, '\"');
 
+		if (!ussd_response) {
+			*response_len = 0;
+			return SIM_OK;
+		}
 		uint16_t lentocopy = min(max_len - 1, strend - p);
 		strncpy(ussd_response, p, lentocopy + 1);
 		ussd_response[lentocopy] = 0;
@@ -1500,133 +2414,261 @@ bool ASIM::sendUSSD(char *ussd_code, char *ussd_response, uint16_t *response_len
   return SIM_OK;
 }
 /**********************************************************************************************************************************/
+// an empty command part, in RAM or in flash
+static bool partEmpty(const ASIMQuoted &part) {
+	return !(part.flash ? pgm_read_byte(part.text) : *part.text);
+}
+
 /**
  * @brief Enable GPRS
  *
+ * An active context is reused as is: the bearer of AT+SAPBR (HTTP, location) and the context of AT+CIICR
+ * (TCP) are checked first and only the missing one is brought up. The time taken is kept, see getBearerStats().
+ *
  * @return bool true if success, false otherwise
 */
 bool ASIM::enableGPRS() {
-	char network_apn[15];
-	char *endpoint;
+	SIM_API("enableGPRS");
+	uint32_t start = millis();
+	bool reused = false;
 
-	DEBUG_PRINTLN(F("================= ENABLING GPRS ================="));
-	// Check if sim registerd in GPRS network
-	if(!sendVerifyedCommand(F("AT+CGATT?"), F("+CGATT: 1OK"), 1000)) {
-		if(!sendVerifyedCommand(F("AT+CGATT=1"), ok_reply, 7000)) {
-			DEBUG_PRINTLN("SIMCARD DOES NOT REGISTERD ON GPRS NETWORK");
-			_gprs_on = false;
-			_tcp_running = false;
-			return SIM_FAILED;
-		}
-	}
-	// close all old connections
-	if (!sendVerifyedCommand(F("AT+CIPSHUT"), F("SHUT OK"), 4000)) {
-		DEBUG_PRINTLN("CAN NOT SHUTDOWN PREVIOUS CONNECTION!");
+	INFO_PRINTLN(F("================= ENABLING GPRS ================="));
+	if(!openBearer(&reused)) {
 		_gprs_on = false;
 		_tcp_running = false;
-		return SIM_FAILED;
-	}
-	if (!sendVerifyedCommand(F("AT+CIPMUX=0"), ok_reply)) {
-		DEBUG_PRINTLN("CAN NOT SET UP IP CONNECTION");
+		_bearer.failures++;
 		return SIM_FAILED;
 	}
 
-	switch (_sim_type)
-	{
-		case IRANCELL:
-			strcpy(network_apn, "mtnirancell");
-			break;
-		case MCI:
-			strcpy(network_apn, "mcinet");
-			break;
-		case RITEL:
-			strcpy(network_apn, "RighTel");
-			break;		
-		default:
-			DEBUG_PRINTLN("UNKNOWN APN");
-			return SIM_FAILED;
-			break;
+	INFO_PRINT(reused ? F("REUSED, MODEM IP IS ") : F("MODEM IP IS "));
+	INFO_PRINTLN(_modem_ip);
+	DEBUG_PRINTLN();
+
+	uint32_t elapsed = millis() - start;
+	if(reused) {
+		_bearer.reuses++;
 	}
-    if (!sendVerifyedCommand(F("AT+SAPBR=3,1,\"CONTYPE\",\"GPRS\""), ok_reply, 2000)) {
-		DEBUG_PRINTLN("CAN NOT ASIGN GPRS BEARER PROFILE");
-		_gprs_on = false;
-		return false;
+	else {
+		_bearer.bringups++;
 	}
-
-	if(!sendVerifyedCommandQuoted(F("AT+SAPBR=3,1,\"APN\","), F(network_apn), ok_reply, 1000)) {
-		DEBUG_PRINTLN("CAN NOT BEARER PROFILE ACCESS POIN NAME");
-		_gprs_on = false;
-		_tcp_running = false;
-		return SIM_FAILED;
+	_bearer.up_last = elapsed;
+	_bearer.up_total += elapsed;
+	if(elapsed > _bearer.up_max) {
+		_bearer.up_max = elapsed;
 	}
+	_gprs_on = true;
+	_gprs_wanted = true;
+	_bearer_backoff = SIM_BEARER_BACKOFF;
+	return SIM_OK;
+}
 
-	if(!sendVerifyedCommandQuoted(F("AT+CSTT="), F(network_apn), ok_reply, 1000)) {
-		DEBUG_PRINTLN("APN DOES NOT RECOGNIZED");
-		_gprs_on = false;
-		_tcp_running = false;
+/**
+ * @brief Bring up what is missing of the bearer and the context
+ *
+ * @param reused Set to true if both were active
+ * @return bool true if both are active, false otherwise
+*/
+bool ASIM::openBearer(bool *reused) {
+	if(!registered(true)) {
+		ERROR_PRINTLN(F("NOT REGISTERED"));
 		return SIM_FAILED;
 	}
-
-	// Turn on GPRS
-	sendVerifyedCommand(F("AT+SAPBR=1,1"), ok_reply, 20000);
-	if(!sendVerifyedCommand(F("AT+CIICR"), ok_reply, 20000)) {
-		DEBUG_PRINTLN("CAN NOT CONNECT TO APN");
-		_gprs_on = false;
-		_tcp_running = false;
-		return SIM_FAILED;
+	bool bearer = bearerOpen();
+	uint8_t state = getTCPStatus();
+	// from AT+CIICR to a closed connection the context stays active
+	bool context = (state >= IP_GPRSACT) && (state <= TCP_CLOSED);
+	*reused = bearer && context;
+	if(*reused) {
+		return SIM_OK;
 	}
 
-	sendVerifyedCommand(F("AT+SAPBR=2,1"), ok_reply, 2000);
-	parseReplyQuoted(replybuffer, F("+SAPBR: "), _modem_ip, 15, ',', 2);
-	endpoint = strstr(_modem_ip, "OK");
-	if(endpoint) {
-		*endpoint = NULL;
+	// Check if sim registerd in GPRS network
+	if(!sendVerifyedCommand(F("AT+CGATT?"), F("+CGATT: 1OK"), timeoutFor(SIM_TIMEOUT_GPRS))) {
+		if(!sendVerifyedCommand(F("AT+CGATT=1"), ok_reply, timeoutFor(SIM_TIMEOUT_ATTACH))) {
+			ERROR_PRINTLN(F("SIMCARD DOES NOT REGISTERD ON GPRS NETWORK"));
+			return SIM_FAILED;
+		}
 	}
 
-	if(!_modem_ip) {
-		DEBUG_PRINTLN("CAN NOT ASIGN IP");
-		_gprs_on = false;
-		_tcp_running = false;
+	if(!_apn.apn) {
+		ERROR_PRINTLN(F("UNKNOWN APN"));
+		return SIM_FAILED;
+	}
+	ASIMQuoted apn = { _apn.apn, _apn.flash };
+	ASIMQuoted user = { _apn.user, _apn.flash };
+	ASIMQuoted password = { _apn.password, _apn.flash };
+
+	if(!context) {
+		// close all old connections, AT+CIPMUX is only accepted in IP INITIAL
+		if(state != IP_INITIAL) {
+			if (!sendVerifyedCommand(F("AT+CIPSHUT"), F("SHUT OK"), timeoutFor(SIM_TIMEOUT_GPRS))) {
+				ERROR_PRINTLN(F("CAN NOT SHUTDOWN PREVIOUS CONNECTION!"));
+				return SIM_FAILED;
+			}
+			// the shut down may have taken the bearer along
+			bearer = false;
+			_tcp_ssl = 255;
+		}
+		if (!sendVerifyedCommand(F("AT+CIPMUX=0"), ok_reply)) {
+			ERROR_PRINTLN(F("CAN NOT SET UP IP CONNECTION"));
+			return SIM_FAILED;
+		}
+		if(!sendCheckReply(ok_reply, timeoutFor(SIM_TIMEOUT_GPRS), F("AT+CSTT="), apn, ',', user, ',', password)) {
+			ERROR_PRINTLN(F("APN DOES NOT RECOGNIZED"));
+			return SIM_FAILED;
+		}
+		bool active = sendVerifyedCommand(F("AT+CIICR"), ok_reply, timeoutFor(SIM_TIMEOUT_ATTACH));
+		if(!active && (_apn.quirks & APN_QUIRK_SLOW_ATTACH)) {
+			active = sendVerifyedCommand(F("AT+CIICR"), ok_reply, timeoutFor(SIM_TIMEOUT_ATTACH));
+		}
+		if(!active) {
+			ERROR_PRINTLN(F("CAN NOT CONNECT TO APN"));
+			return SIM_FAILED;
+		}
+		if(_apn.quirks & APN_QUIRK_DNS) {
+			sendVerifyedCommand(F("AT+CDNSCFG=" SIM_APN_DNS), ok_reply, timeoutFor(SIM_TIMEOUT_GPRS));
+		}
 	}
 
-	DEBUG_PRINT("MODEM IP IS ");
-	DEBUG_PRINTLN(_modem_ip);
-	DEBUG_PRINTLN();
-	
-	_gprs_on = true;
+	if(!bearer) {
+		if (!sendVerifyedCommand(F("AT+SAPBR=3,1,\"CONTYPE\",\"GPRS\""), ok_reply, timeoutFor(SIM_TIMEOUT_GPRS))) {
+			ERROR_PRINTLN(F("CAN NOT ASIGN GPRS BEARER PROFILE"));
+			return SIM_FAILED;
+		}
+		if(!sendCheckReply(ok_reply, timeoutFor(SIM_TIMEOUT_GPRS), F("AT+SAPBR=3,1,\"APN\","), apn)) {
+			ERROR_PRINTLN(F("CAN NOT BEARER PROFILE ACCESS POIN NAME"));
+			return SIM_FAILED;
+		}
+		if(!partEmpty(user)) {
+			sendCheckReply(ok_reply, timeoutFor(SIM_TIMEOUT_GPRS), F("AT+SAPBR=3,1,\"USER\","), user);
+			sendCheckReply(ok_reply, timeoutFor(SIM_TIMEOUT_GPRS), F("AT+SAPBR=3,1,\"PWD\","), password);
+		}
+		// fails if the bearer survived the shut down, the query tells
+		sendVerifyedCommand(F("AT+SAPBR=1,1"), ok_reply, timeoutFor(SIM_TIMEOUT_ATTACH));
+		if(!bearerOpen()) {
+			ERROR_PRINTLN(F("CAN NOT ASIGN IP"));
+			return SIM_FAILED;
+		}
+	}
 	return SIM_OK;
 }
 
+/**
+ * @brief Query the bearer with AT+SAPBR=2,1, its IP address goes to _modem_ip
+ *
+ * @return bool true if it is open: +SAPBR: 1,1,"<ip>"
+*/
+bool ASIM::bearerOpen() {
+	char *endpoint;
+	_modem_ip[0] = 0;
+	getReply(timeoutFor(SIM_TIMEOUT_GPRS), F("AT+SAPBR=2,1"));
+	if(_last_error.result != FINAL_OK) {
+		return false;
+	}
+	bool open = (strstr_P(replybuffer, PSTR("+SAPBR: 1,1,")) != NULL);
+	parseReplyQuoted(replybuffer, F("+SAPBR: "), _modem_ip, sizeof(_modem_ip) - 1, ',', 2);
+	endpoint = strstr(_modem_ip, "OK");
+	if(endpoint) {
+		*endpoint = '\0';
+	}
+	return open && _modem_ip[0] && strcmp(_modem_ip, "0.0.0.0");
+}
+
 /**
  * @brief Disable GPRS
  *
  * @return bool true if success, false otherwise
 */
 bool ASIM::disableGPRS() {
-	DEBUG_PRINTLN(F("================= DISABLING GPRS ================="));
+	SIM_API("disableGPRS");
+	INFO_PRINTLN(F("================= DISABLING GPRS ================="));
 	// close all connections
-	if (!sendVerifyedCommand(F("AT+CIPSHUT"), F("SHUT OK"), 4000)) {
-		DEBUG_PRINTLN("CAN NOT SHUTDOWN PREVIOUS CONNECTION!");
+	if (!sendVerifyedCommand(F("AT+CIPSHUT"), F("SHUT OK"), timeoutFor(SIM_TIMEOUT_GPRS))) {
+		ERROR_PRINTLN(F("CAN NOT SHUTDOWN PREVIOUS CONNECTION!"));
 		return SIM_FAILED;
 	}
+	// AT+CIPSSL is sent again with the next connection
+	_tcp_ssl = 255;
 
 	// close GPRS context
-	if(!sendVerifyedCommand(F("AT+SAPBR=0,1"), ok_reply, 3000)) {
-		DEBUG_PRINTLN("CAN NOT CLOSE GPRS CONTEXT");
+	if(!sendVerifyedCommand(F("AT+SAPBR=0,1"), ok_reply, timeoutFor(SIM_TIMEOUT_GPRS))) {
+		ERROR_PRINTLN(F("CAN NOT CLOSE GPRS CONTEXT"));
 		return SIM_FAILED;
 	}
 
 	// Remove modem from network
-	if(!sendVerifyedCommand(F("AT+CGATT=0"), ok_reply, 3000)) {
-		DEBUG_PRINTLN("CAN NOT REMOVE MODEM FROM NETWORK");
+	if(!sendVerifyedCommand(F("AT+CGATT=0"), ok_reply, timeoutFor(SIM_TIMEOUT_ATTACH))) {
+		ERROR_PRINTLN(F("CAN NOT REMOVE MODEM FROM NETWORK"));
 		return SIM_FAILED;
 	}
 	
 	_gprs_on = false;
+	_gprs_wanted = false;
 	_tcp_running = false;
 	return SIM_OK;
 }
 
+/**
+ * @brief Keep GPRS up, call it from the main loop
+ *
+ * Once enableGPRS() succeeded, a context dropped by the network (+PDP: DEACT) is brought up again: at once,
+ * then after SIM_BEARER_BACKOFF, doubled after every failed try up to SIM_BEARER_BACKOFF_MAX.
+ * Between the tries it only dispatches the pending URCs. Does nothing after disableGPRS().
+ *
+ * @return bool true if GPRS is up, false otherwise
+*/
+bool ASIM::maintainGPRS() {
+	SIM_LOCK();
+	SIM_PROBE("maintainGPRS");
+	if(pending()) {
+		dispatchEvents();
+	}
+	if(_gprs_on || !_gprs_wanted) {
+		return _gprs_on;
+	}
+	if((int32_t)(millis() - _bearer_retry_ms) < 0) {
+		return SIM_FAILED;
+	}
+	uint32_t backoff = _bearer_backoff;
+	if(enableGPRS()) {
+		_bearer.reconnects++;
+		return SIM_OK;
+	}
+	INFO_PRINT(F("GPRS RECONNECT IN "));
+	INFO_PRINTLN(backoff);
+	_bearer_retry_ms = millis() + backoff;
+	_bearer_backoff = (backoff < SIM_BEARER_BACKOFF_MAX / 2) ? backoff * 2 : SIM_BEARER_BACKOFF_MAX;
+	return SIM_FAILED;
+}
+
+/**
+ * @brief Mark the context lost after +PDP: DEACT, maintainGPRS() tries again at once
+ *
+*/
+void ASIM::bearerLost() {
+	_gprs_on = false;
+	_tcp_running = false;
+	_bearer.deacts++;
+	_bearer_retry_ms = millis();
+}
+
+/**
+ * @brief Get the bring-ups, reuses and reconnects of the GPRS context
+ *
+ * @return const ASIMBearerStats& The counters since the last resetBearerStats()
+*/
+const ASIMBearerStats &ASIM::getBearerStats() {
+	return _bearer;
+}
+
+/**
+ * @brief Clear the GPRS context counters
+ *
+*/
+void ASIM::resetBearerStats() {
+	memset(&_bearer, 0, sizeof(_bearer));
+}
+
 /**
  * @brief Get GSM location from GPRS
  *
@@ -1635,31 +2677,30 @@ bool ASIM::disableGPRS() {
  * @return bool true if success, false otherwise
 */
 bool ASIM::getGPRSLocation(uint16_t *error, float *lat, float *lon) {
-	uint16_t returncode;
-	char error_code[120];
-  	char gps_buffer[120];
-	DEBUG_PRINTLN(F("================= GET GPRS LOCATION ================="));
-	getReply(F("AT+CIPGSMLOC=1,1"), (uint16_t)10000);
+	SIM_API("getGPRSLocation");
+	INFO_PRINTLN(F("================= GET GPRS LOCATION ================="));
+	getReply(timeoutFor(SIM_TIMEOUT_NETWORK), F("AT+CIPGSMLOC=1,1"));
 	if (!parseReply(F("+CIPGSMLOC: "), error)) {
-		DEBUG_PRINTLN("CAN NOT GET LOCATION DUE TO ERROR");
+		ERROR_PRINTLN(F("CAN NOT GET LOCATION DUE TO ERROR"));
 		return SIM_FAILED;
 	}
-	char *p = replybuffer + 14;
-  	uint16_t lentocopy = (int)strlen(p);
-  	strncpy(gps_buffer, p, lentocopy + 1);
-  	readAnswer(); // eat OK
 
 	// +CIPGSMLOC: 0,-74.007729,40.730160,2015/10/15,19:24:55
-	// tokenize the gps buffer to locate the lat & long
-	char *longp = strtok(gps_buffer, ",");
+	// tokenize the reply in place to locate the lat & long
+	char *p = strchr(replybuffer, ',');
+	if (!p) {
+		ERROR_PRINTLN(F("CAN NOT CALCULATE LONGITUDE"));
+		return SIM_FAILED;
+	}
+	char *longp = strtok(p + 1, ",");
 	if (!longp) {
-		DEBUG_PRINTLN("CAN NOT CALCULATE LONGITUDE");
+		ERROR_PRINTLN(F("CAN NOT CALCULATE LONGITUDE"));
 		return SIM_FAILED;
 	}
 
 	char *latp = strtok(NULL, ",");
 	if (!latp) {
-		DEBUG_PRINTLN("CAN NOT CALCULATE LATITUDE");
+		ERROR_PRINTLN(F("CAN NOT CALCULATE LATITUDE"));
 		return SIM_FAILED;
 	}
 
@@ -1668,6 +2709,143 @@ bool ASIM::getGPRSLocation(uint16_t *error, float *lat, float *lon) {
 
     return SIM_OK;
 }
+
+/**
+ * @brief Get GSM location from GPRS in fixed point, without floats
+ *
+ * @param error Pointer to a buffer to hold the location code, 0 on success
+ * @param lat Pointer to a buffer to hold the latitude in millionths of a degree
+ * @param lon Pointer to a buffer to hold the longitude in millionths of a degree
+ * @return bool true if success, false otherwise
+*/
+bool ASIM::getGPRSLocation(uint16_t *error, int32_t *lat, int32_t *lon) {
+	SIM_API("getGPRSLocation");
+	INFO_PRINTLN(F("================= GET GPRS LOCATION ================="));
+	getReply(timeoutFor(SIM_TIMEOUT_NETWORK), F("AT+CIPGSMLOC=1,1"));
+	if (!parseReply(F("+CIPGSMLOC: "), error)) {
+		ERROR_PRINTLN(F("CAN NOT GET LOCATION DUE TO ERROR"));
+		return SIM_FAILED;
+	}
+
+	// +CIPGSMLOC: 0,-74.007729,40.730160,2015/10/15,19:24:55
+	const char *p = strchr(replybuffer, ',');
+	const char *q = p ? strchr(p + 1, ',') : NULL;
+	if ((*error != 0) || (!q)) {
+		ERROR_PRINTLN(F("CAN NOT CALCULATE LOCATION"));
+		return SIM_FAILED;
+	}
+	*lon = microDegrees(p + 1);
+	*lat = microDegrees(q + 1);
+	return SIM_OK;
+}
+
+/**
+ * @brief Convert a decimal angle to fixed point
+ *
+ * @param text The angle, e.g. "-74.007729", the digits after the sixth decimal are dropped
+ * @return int32_t The angle in millionths of a degree, -74007729
+*/
+int32_t ASIM::microDegrees(const char *text) {
+	bool negative = (*text == '-');
+	if ((*text == '-') || (*text == '+')) {
+		text++;
+	}
+	int32_t degrees = 0;
+	while (isdigit(*text)) {
+		degrees = degrees * 10 + (*text++ - '0');
+	}
+	int32_t fraction = 0;
+	int32_t scale = 1000000;
+	if (*text == '.') {
+		text++;
+		while (isdigit(*text) && (scale > 1)) {
+			scale /= 10;
+			fraction += (*text++ - '0') * scale;
+		}
+	}
+	degrees = degrees * 1000000 + fraction;
+	return negative ? -degrees : degrees;
+}
+
+/**
+ * @brief Power the GNSS engine of a SIM808 on or off
+ *
+ * @param on true: start it, the first fix takes from a few seconds (hot) to a minute (cold). false: stop it
+ * @return bool true if success, false otherwise (a SIM800 has no GNSS)
+*/
+bool ASIM::setGNSSPower(bool on) {
+	SIM_API("setGNSSPower");
+	INFO_PRINTLN(F("================= SET GNSS POWER ================="));
+	if (_modem_type == SIM800) {
+		ERROR_PRINTLN(F("THE MODEM HAS NO GNSS"));
+		return SIM_FAILED;
+	}
+	return sendCheckReply(ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL), F("AT+CGNSPWR="), on ? 1 : 0);
+}
+
+/**
+ * @brief Read the GNSS state with AT+CGNSINF into a parser
+ *
+ * A local command that answers at once, poll it up to once a second for 1 Hz fixes.
+ *
+ * @param gnss The parser, its fix() is updated (valid is false while the engine has no fix)
+ * @return bool true if the modem answered the state, false otherwise
+*/
+bool ASIM::getGNSSInfo(ASIMGNSS &gnss) {
+	SIM_API("getGNSSInfo");
+	INFO_PRINTLN(F("================= GET GNSS INFO ================="));
+	getReply(timeoutFor(SIM_TIMEOUT_LOCAL), F("AT+CGNSINF"));
+	const char *p = strstr_P(replybuffer, PSTR("+CGNSINF: "));
+	if (!p) {
+		ERROR_PRINTLN(F("CAN NOT GET GNSS INFO"));
+		return SIM_FAILED;
+	}
+	for (; (*p) && (*p != '\r') && (*p != '\n'); p++) {
+		gnss.feed(*p);
+	}
+	return gnss.feed('\n');
+}
+
+/**
+ * @brief Start or stop the NMEA output of the GNSS engine on the UART (AT+CGNSTST)
+ *
+ * While it runs the modem sends RMC, GGA and the other sentences every second between the answers,
+ * read them with readGNSS(). Stop it before other commands, their answers would be mixed with it.
+ *
+ * @param on true: start, false: stop
+ * @return bool true if success, false otherwise
+*/
+bool ASIM::setGNSSStream(bool on) {
+	SIM_API("setGNSSStream");
+	INFO_PRINTLN(F("================= SET GNSS STREAM ================="));
+	// sentences may come before the OK, the final result tells
+	getReply(timeoutFor(SIM_TIMEOUT_LOCAL), F("AT+CGNSTST="), on ? 1 : 0);
+	if (!on) {
+		flushInput();
+	}
+	return _last_error.result == FINAL_OK;
+}
+
+/**
+ * @brief Feed what the modem sent to a parser, without waiting and without a line buffer
+ *
+ * Call it from the main loop while the NMEA output of setGNSSStream() runs.
+ *
+ * @param gnss The parser
+ * @return bool true if a sentence updated its fix(), false otherwise
+*/
+bool ASIM::readGNSS(ASIMGNSS &gnss) {
+	SIM_LOCK();
+	SIM_PROBE("readGNSS");
+	bool updated = false;
+	while (rxAvailable()) {
+		SIM_RX();
+		if (gnss.feed(rxRead())) {
+			updated = true;
+		}
+	}
+	return updated;
+}
 /**********************************************************************************************************************************/
 /**
  * @brief Initialize HTTP
@@ -1675,8 +2853,11 @@ bool ASIM::getGPRSLocation(uint16_t *error, float *lat, float *lon) {
  * @return bool true if success, false otherwise
 */
 bool ASIM::initHttp() {
-	DEBUG_PRINTLN(F("================= INIT HTTP ================="));
-	return sendVerifyedCommand(F("AT+HTTPINIT"), ok_reply);
+	SIM_API("initHttp");
+	INFO_PRINTLN(F("================= INIT HTTP ================="));
+	_http_open = sendVerifyedCommand(F("AT+HTTPINIT"), ok_reply);
+	_http_ssl = false;
+	return _http_open;
 }
 
 /**
@@ -1685,7 +2866,10 @@ bool ASIM::initHttp() {
  * @return bool true if success, false otherwise
 */
 bool ASIM::termHttp() {
-	DEBUG_PRINTLN(F("================= TERMINATE HTTP ================="));
+	SIM_API("termHttp");
+	INFO_PRINTLN(F("================= TERMINATE HTTP ================="));
+	_http_open = false;
+	_http_ssl = false;
   	return sendVerifyedCommand(F("AT+HTTPTERM"), ok_reply);
 }
 
@@ -1697,24 +2881,9 @@ bool ASIM::termHttp() {
  * @return bool true if success, false otherwise
 */
 bool ASIM::setHttpParameter(ASIMFlashString parameter, const char *value) {
-	char param_cmd[50];
-	DEBUG_PRINTLN(F("================= SET HTTP PARAMETER ================="));
-	flushInput();
-
-	sprintf(param_cmd, "AT+HTTPPARA=\"%s\",\"%s\"", parameter, value);
-	return sendVerifyedCommand(param_cmd, ok_reply);
-
-	// DEBUG_PRINT(F("\t---> "));
-	// DEBUG_PRINT(F("AT+HTTPPARA=\""));
-	// DEBUG_PRINT(parameter);
-	// DEBUG_PRINTLN('"');
-
-	// simSerial->print(F("AT+HTTPPARA=\""));
-	// simSerial->print(parameter);
-	// simSerial->print(F("\",\""));
-	// simSerial->print(value);
-	// simSerial->println('"');
-
+	SIM_API("setHttpParameter");
+	INFO_PRINTLN(F("================= SET HTTP PARAMETER ================="));
+	return sendCheckReply(ok_reply, DEFAULT_TIMOUT, F("AT+HTTPPARA="), quoted(parameter), ',', quoted(value));
 }
 
 /**
@@ -1725,12 +2894,9 @@ bool ASIM::setHttpParameter(ASIMFlashString parameter, const char *value) {
  * @return bool true if success, false otherwise
 */
 bool ASIM::setHttpParameter(ASIMFlashString parameter, ASIMFlashString value) {
-	char param_cmd[50];
-	DEBUG_PRINTLN(F("================= SET HTTP PARAMETER ================="));
-	flushInput();
-
-	sprintf(param_cmd, "AT+HTTPPARA=\"%s\",\"%s\"", parameter, value);
-	return sendVerifyedCommand(param_cmd, ok_reply);
+	SIM_API("setHttpParameter");
+	INFO_PRINTLN(F("================= SET HTTP PARAMETER ================="));
+	return sendCheckReply(ok_reply, DEFAULT_TIMOUT, F("AT+HTTPPARA="), quoted(parameter), ',', quoted(value));
 }
 
 /**
@@ -1741,13 +2907,9 @@ bool ASIM::setHttpParameter(ASIMFlashString parameter, ASIMFlashString value) {
  * @return bool true if success, false otherwise
 */
 bool ASIM::setHttpParameter(ASIMFlashString parameter, int32_t value) {
-	char param_cmd[50];
-	DEBUG_PRINTLN(F("================= SET HTTP PARAMETER ================="));
-	sprintf(param_cmd, "AT+HTTPPARA=\"%s\",\"%u\"", parameter, value);
-
-	flushInput();
-
-	return sendVerifyedCommand(param_cmd, ok_reply);
+	SIM_API("setHttpParameter");
+	INFO_PRINTLN(F("================= SET HTTP PARAMETER ================="));
+	return sendCheckReply(ok_reply, DEFAULT_TIMOUT, F("AT+HTTPPARA="), quoted(parameter), F(",\""), value, '"');
 }
 
 /**
@@ -1758,26 +2920,9 @@ bool ASIM::setHttpParameter(ASIMFlashString parameter, int32_t value) {
  * @return bool true if success, false otherwise
 */
 bool ASIM::setHttpDataParameter(uint32_t size, uint32_t max_wait) {
-	char param_data_cmd[50];
-	DEBUG_PRINTLN(F("================= SET HTTP DATA PARAMETER ================="));
-	sprintf(param_data_cmd, "AT+HTTPDATA=%u,%u", size, max_wait);
-	
-	flushInput();
-
-	return sendVerifyedCommand(param_data_cmd, F("DOWNLOAD"));
-
-	// DEBUG_PRINT(F("\t---> "));
-	// DEBUG_PRINT(F("AT+HTTPDATA="));
-	// DEBUG_PRINT(size);
-	// DEBUG_PRINT(',');
-	// DEBUG_PRINTLN(max_wait);
-
-	// simSerial->print(F("AT+HTTPDATA="));
-	// simSerial->print(size);
-	// simSerial->print(",");
-	// simSerial->println(max_wait);
-
-	// return expectReply(F("DOWNLOAD"));
+	SIM_API("setHttpDataParameter");
+	INFO_PRINTLN(F("================= SET HTTP DATA PARAMETER ================="));
+	return sendCheckReply(F("DOWNLOAD"), DEFAULT_TIMOUT, F("AT+HTTPDATA="), size, ',', max_wait);
 }
 
 /**
@@ -1793,18 +2938,23 @@ bool ASIM::setHttpDataParameter(uint32_t size, uint32_t max_wait) {
  * @return bool true if success, false otherwise
 */
 bool ASIM::setHttpAction(uint8_t method, uint16_t *status, uint16_t *data_len, int32_t timeout) {
-	DEBUG_PRINTLN(F("================= MAKE HTTP ACTION ================="));
-	if (!sendVerifyedCommand(F("AT+HTTPACTION="), method, ok_reply)) {
+	SIM_API("setHttpAction");
+	INFO_PRINTLN(F("================= MAKE HTTP ACTION ================="));
+	if (!sendCheckReply(ok_reply, DEFAULT_TIMOUT, F("AT+HTTPACTION="), method)) {
 		return SIM_FAILED;
 	}
 
-	readAnswer(timeout);
+	// +HTTPACTION: <method>,<status>,<datalen> comes when the server answered
+	if (!waitURC(URC_HTTPACTION, timeout)) {
+		ERROR_PRINTLN(F("NO HTTP ACTION RESULT"));
+		return SIM_FAILED;
+	}
 
 	if (!parseReply(F("+HTTPACTION:"), status, ',', 1)) {
-		SIM_FAILED;
+		return SIM_FAILED;
 	}
   	if (!parseReply(F("+HTTPACTION:"), data_len, ',', 2)) {
-		SIM_FAILED;
+		return SIM_FAILED;
 	}
 
 	return SIM_OK;
@@ -1817,264 +2967,626 @@ bool ASIM::setHttpAction(uint8_t method, uint16_t *status, uint16_t *data_len, i
  * @return bool true if success, false otherwise
 */
 bool ASIM::readHttpResponse(uint16_t *data_len) {
-	DEBUG_PRINTLN(F("================= READ HTTP RESPONSE ================="));
-	getReply(F("AT+HTTPREAD"));
+	SIM_API("readHttpResponse");
+	INFO_PRINTLN(F("================= READ HTTP RESPONSE ================="));
+	getReply(DEFAULT_TIMOUT, F("AT+HTTPREAD"));
 	if (!parseReply(F("+HTTPREAD:"), data_len, ',', 0)) {
-		SIM_FAILED;
+		return SIM_FAILED;
 	}
 
 	return SIM_OK;
 }
 
 /**
- * @brief Start an HTTP POST request
+ * @brief Send an HTTP request and wait for the answer of the server
  *
- * @param url string of the target URL to POST
- * @param auth_token string of the authorization token
- * @param data string of data that wanted to POST
- * @return bool true if success, false otherwise
+ * The HTTP session of the modem (AT+HTTPINIT) stays open between the requests, only the URL, the
+ * headers, the content type and the body of a POST are sent again. The body of the answer stays in
+ * the modem, see ASIMHttpResponse::read(). A failed command closes the session, not GPRS.
+ *
+ * @param request The request
+ * @param response Set to the status and the length of the answer
+ * @return bool true if the server answered, whatever the status, false otherwise
 */
-bool ASIM::postHttpRequest(String url, String auth_token, String data, uint16_t server_timeout, char *server_response) {
-	int result = SIM_FAILED;
-	char *endpoint;
-	String temp_cmd = "";
-	char temp_buffer[256];
-	DEBUG_PRINTLN(F("================= HTTP POST REQUEST ================="));
-	// Check if GPRS is off and try to turn it on
-	if(!_gprs_on) {
-		sendVerifyedCommand(F("AT+SAPBR=2,1"), ok_reply, 2000);
-		parseReplyQuoted(replybuffer, F("+SAPBR: "), _modem_ip, 15, ',', 2);
-		endpoint = strstr(_modem_ip, "OK");
-		if(endpoint) {
-			*endpoint = NULL;
-		}
-		DEBUG_PRINT("MODEM IP IS ");
-		DEBUG_PRINTLN(_modem_ip);
-		if(strcmp(_modem_ip, "0.0.0.0") == 0) {
-			DEBUG_PRINTLN(F("GPRS IS OFF, LET's TURN IT ON"));
-			if(!enableGPRS()) {
-				DEBUG_PRINTLN(F("CAN NOT TURN ON GPRS !!!"));
-				return SIM_FAILED;
-			}
-		}
+bool ASIM::httpRequest(const ASIMHttpRequest &request, ASIMHttpResponse &response) {
+	SIM_API("httpRequest");
+	response._sim = this;
+	response._status = 0;
+	response._length = 0;
+	response._offset = 0;
+
+	INFO_PRINTLN(F("================= HTTP REQUEST ================="));
+	if(request._overflow) {
+		ERROR_PRINTLN(F("TOO MANY HTTP HEADERS"));
+		return SIM_FAILED;
 	}
-	// Handle any pending
-	termHttp();
-	delay(2);
-
-	// Init HTTP
-	if(!initHttp()) {
-		DEBUG_PRINTLN(F("CAN NOT INIT HTTP SECTION !!!"));
-		termHttp();
-		disableGPRS();
+	// Check if GPRS is off and try to turn it on, an active bearer is reused
+	if(!_gprs_on && !enableGPRS()) {
+		ERROR_PRINTLN(F("CAN NOT TURN ON GPRS !!!"));
 		return SIM_FAILED;
 	}
-	// Specify CID
-	if (!setHttpParameter(F("CID"), 1)) {
-		DEBUG_PRINTLN(F("CAN NOT SPECIFY CID = 1"));
-		termHttp();
-		disableGPRS();
+	// a session closed behind our back (a reset of the modem) is opened again
+	bool reused = _http_open;
+	if(!httpBegin(request) && (!reused || !httpBegin(request))) {
+		httpClose();
 		return SIM_FAILED;
 	}
-
-	// Specify USERDATA
-	DEBUG_PRINTLN(F("================= SET HTTP PARAMETER ================="));
-	// temp_cmd = "AT+HTTPPARA=\"USERDATA\",\"Authorization:Token ";
-	temp_cmd = "AT+HTTPPARA=\"USERDATA\",\"Authorization:Bearer ";
-	temp_cmd += auth_token;
-	temp_cmd += "\"";
-	temp_cmd.toCharArray(temp_buffer, temp_cmd.length()+1);
-	getReply(temp_buffer, 2000);
-	if(strcmp(replybuffer, "OK") != 0) {
-		DEBUG_PRINTLN(F("CAN NOT SPECIFY TOKEN"));
-		termHttp();
-		disableGPRS();
+	// AT+HTTPSSL is a setting of the session, sent when it changes
+	bool secure = request.secure();
+	if(secure != _http_ssl) {
+		if(!sendCheckReply(ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL), F("AT+HTTPSSL="), secure ? 1 : 0)) {
+			ERROR_PRINTLN(F("CAN NOT SET HTTPS"));
+			httpClose();
+			return SIM_FAILED;
+		}
+		_http_ssl = secure;
+	}
+	// a GET through a cache asks the server for the body only if it changed
+	ASIMHttpCache *cache = (request._method == HTTPACTION_GET) ? request._cache : NULL;
+	ASIMHttpHeaders headers = { &request, NULL };
+	uint32_t key = 0;
+	if(cache) {
+		key = ASIMHttpCache::hash(request._url);
+		headers.cached = cache->lookup(key);
+		cache->_stats.lookups++;
+		if(headers.cached) {
+			cache->_stats.conditional++;
+		}
+	}
+	// sent empty as well, the lines of the previous request would stay
+	if(!sendCheckReply(ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL), F("AT+HTTPPARA=\"USERDATA\",\""), headers, '"')) {
+		ERROR_PRINTLN(F("CAN NOT SPECIFY HEADERS"));
+		httpClose();
 		return SIM_FAILED;
 	}
-	memset(temp_buffer, 0, temp_cmd.length()+1);
-	temp_cmd = "";
 
-	// Specified URL
-	DEBUG_PRINTLN(F("================= SET HTTP PARAMETER ================="));
-	temp_cmd = "AT+HTTPPARA=\"URL\",\"";
-	temp_cmd += url;
-	temp_cmd += "\"";
-	temp_cmd.toCharArray(temp_buffer, temp_cmd.length()+1);
-	getReply(temp_buffer, 2000);
-	if(strcmp(replybuffer, "OK") != 0) {
-		DEBUG_PRINTLN(F("CAN NOT SPECIFY URL"));
-		termHttp();
-		disableGPRS();
-		return SIM_FAILED;
+	if(request._method == HTTPACTION_POST) {
+		ASIMQuoted content = { request._content.text, request._content.flash };
+		if(request._content.empty()) {
+			content = quoted(F("text/plain"));
+		}
+		if(!sendCheckReply(ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL), F("AT+HTTPPARA=\"CONTENT\","), content)) {
+			ERROR_PRINTLN(F("CAN NOT SET CONTENT TYPE"));
+			httpClose();
+			return SIM_FAILED;
+		}
+		if(request._body_length) {
+			// the modem answers OK as soon as all the data arrived
+			if(!sendCheckReply(F("DOWNLOAD"), timeoutFor(SIM_TIMEOUT_LOCAL), F("AT+HTTPDATA="), request._body_length, F(",10000"))) {
+				ERROR_PRINTLN(F("CAN NOT SET DATA PARAMETERS"));
+				httpClose();
+				return SIM_FAILED;
+			}
+			DEBUG_PRINTLN(F("\t---> <data>"));
+			writeData(request._body, request._body_length);
+			readReply(timeoutFor(SIM_TIMEOUT_GPRS));
+			if(_last_error.result != FINAL_OK) {
+				ERROR_PRINTLN(F("CAN NOT SEND DATA IN HTTP REQUEST"));
+				httpClose();
+				return SIM_FAILED;
+			}
+		}
 	}
-	memset(temp_buffer, 0, temp_cmd.length()+1);
-	temp_cmd = "";
 
-	// Specified CONTENT type
-	if (!setHttpParameter(F("CONTENT"), "application/json")) {
-		DEBUG_PRINTLN(F("CAN NOT SET CONTENT TYPE"));
-		termHttp();
-		disableGPRS();
+	uint32_t start = millis();
+	if(!sendCheckReply(ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL), F("AT+HTTPACTION="), request._method)) {
+		ERROR_PRINTLN(F("CAN NOT SEND HTTP ACTION"));
+		httpClose();
 		return SIM_FAILED;
 	}
-
-	// Set data len and max wait
-	if(!setHttpDataParameter(200, 2000)) {
-		DEBUG_PRINTLN(F("CAN NOT SET DATA PARAMETERS"));
-		termHttp();
-		disableGPRS();
+	// +HTTPACTION: <method>,<status>,<length> comes when the server answered
+	if(!waitURC(URC_HTTPACTION, request._timeout)) {
+		ERROR_PRINTLN(F("NO RESPONSE FROM HTTP SERVER"));
+		if(secure) {
+			tlsDone(true, start, false);
+		}
+		httpClose();
 		return SIM_FAILED;
 	}
-	delay(10);
-
-	// Send data
-	DEBUG_PRINTLN(F("================= SEND HTTP DATA ================="));
-	data.toCharArray(temp_buffer, data.length()+1);
-	if(!sendVerifyedCommand(temp_buffer, ok_reply, 2000)) {
-		DEBUG_PRINTLN(F("CAN NOT SEND DATA IN HTTP REQUEST"));
-		termHttp();
-		disableGPRS();
+	char *p = strchr(replybuffer, ',');
+	if(!p) {
+		ERROR_PRINTLN(F("CAN NOT PARSE HTTP ACTION"));
+		httpClose();
 		return SIM_FAILED;
 	}
+	response._status = atoi(p + 1);
+	p = strchr(p + 1, ',');
+	response._length = p ? strtoul(p + 1, NULL, 10) : 0;
+	INFO_PRINT(F("HTTP STATUS "));
+	INFO_PRINTLN(response._status);
+	// 605 and 606: the TLS channel could not be set up or got a fatal alert
+	if(secure) {
+		tlsDone(true, start, (response._status != 605) && (response._status != 606));
+	}
 
-	// Set POST action
-	DEBUG_PRINTLN(F("================= SEND HTTP ACTION ================="));
-	if(!sendVerifyedCommand(F("AT+HTTPACTION="), 1, ok_reply)) {
-		DEBUG_PRINTLN(F("CAN NOT SEND POST REQUEST"));
-		termHttp();
-		disableGPRS();
+	// 6xx are the errors of the modem, 601 (network error) is often a lost bearer: checked again by the next request
+	if(response._status >= 600) {
+		ERROR_PRINTLN(F("HTTP ERROR OF THE MODEM"));
+		response._length = 0;
+		if(response._status == 601) {
+			_gprs_on = false;
+		}
 		return SIM_FAILED;
 	}
-	delay(12000);
-
-	// Read server response
-	getReply(F("AT+HTTPREAD"), server_timeout);
-	delay(200);
-	// readAnswer(server_timeout, 1);
-	DEBUG_PRINT("server response = ");
-	DEBUG_PRINTLN(replybuffer);
-	// Extract main response
-	parseReplyQuoted(replybuffer, F("+HTTPREAD"), server_response, sizeof replybuffer, ': ', 1);
-
-
+	if(!cache) {
+		return SIM_OK;
+	}
+	// 304: the body read after the last 200 is still valid, nothing to read from the modem
+	if((response._status == 304) && headers.cached) {
+		ASIMHttpCacheEntry *entry = cache->lookup(key);
+		entry->used = ++cache->_tick;
+		cache->_stats.hits++;
+		cache->_stats.saved += entry->length;
+		response._length = 0;
+	}
+	// the body stays readable after AT+HTTPHEAD, a failed read only leaves the cache as it was
+	else if(response._status == 200) {
+		httpHead(*cache, key, response._length);
+	}
 	return SIM_OK;
 }
-/**********************************************************************************************************************************/
+
 /**
- * @brief Get current status of TCP connection
+ * @brief Send a number of bytes as they are, from RAM or from flash
  *
- * @return TCP status
+ * @param data The data
+ * @param length The number of bytes
 */
-uint8_t ASIM::getTCPStatus() {
-	char con_status[256];
-	char *substr;
-
-	DEBUG_PRINTLN(F("================= READ TCP STATUS ================="));
-	DEBUG_PRINTLN("\t---> AT+CIPSTATUS");
-	simSerial->println(F("AT+CIPSTATUS"));
-	readAnswer(1000);
-
-	DEBUG_PRINT("\t");
-	DEBUG_PRINT(replybuffer);
-	DEBUG_PRINTLN(" <---");
-	substr = replybuffer + 9;
-	strcpy(con_status, substr);
-
-	if(strcmp(con_status, "IP INITIAL") == 0) {
-		_tcp_running = false;
-		return IP_INITIAL;
-	}
-	if(strcmp(con_status, "IP START") == 0) {
-		return IP_START;
-	}
-	if(strcmp(con_status, "IP CONFIG") == 0) {
-		return IP_CONFIG;
-	}
-	if(strcmp(con_status, "IP GPRSACT") == 0) {
-		return IP_GPRSACT;
-	}
-	if(strcmp(con_status, "IP STATUS") == 0) {
-		return IP_STATUS;
-	}
-	if(strcmp(con_status, "TCP CONNECTING") == 0) {
-		return TCP_CONNECTING;
-	}
-	if(strcmp(con_status, "CONNECT OK") == 0) {
-		_tcp_running = true;
-		return TCP_CONNECTED;
-	}
-	if(strcmp(con_status, "TCP CLOSING") == 0) {
-		return TCP_CLOSING;
-	}
-	if(strcmp(con_status, "TCP CLOSED") == 0) {
-		return TCP_CLOSED;
+void ASIM::writeData(ASIMText data, uint16_t length) {
+	if(data.flash) {
+		for (uint16_t i = 0; i < length; i++) {
+			SIM_SENT(simSerial->write(pgm_read_byte(data.text + i)));
+		}
 	}
-	if(strcmp(con_status, "PDP DEACT") == 0) {
-		return PDP_DEACTIVATED;
+	else {
+		SIM_SENT(simSerial->write((const uint8_t *)data.text, length));
 	}
-
-	return IP_INITIAL;
 }
 
 /**
- * @brief Establish a TCP connection
+ * @brief Open the HTTP session if needed and set the URL of a request
  *
- * @return bool true if success, false otherwise
+ * @param request The request
+ * @return bool true if success, false otherwise. A failed URL marks the session closed
 */
-bool ASIM::establishTCP() {
-	DEBUG_PRINTLN(F("================= ESTABLISH TCP CONNECTION ================="));
-
-	if(!_gprs_on) {
-		_gprs_on = enableGPRS();
-		if(!_gprs_on) { 
-			DEBUG_PRINTLN("CAN NOT TURN ON GPRS");
-			_gprs_on = false;
-			_tcp_running = false;
+bool ASIM::httpBegin(const ASIMHttpRequest &request) {
+	if(!_http_open) {
+		// a session left open before a reset of the MCU makes AT+HTTPINIT fail
+		if(!initHttp() && !(termHttp() && initHttp())) {
+			ERROR_PRINTLN(F("CAN NOT INIT HTTP SECTION !!!"));
+			return SIM_FAILED;
+		}
+		if(!sendCheckReply(ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL), F("AT+HTTPPARA=\"CID\",1"))) {
+			ERROR_PRINTLN(F("CAN NOT SPECIFY CID = 1"));
 			return SIM_FAILED;
 		}
 	}
-
-	DEBUG_PRINTLN("\t---> AT+CIFSR");
-	simSerial->println(F("AT+CIFSR"));
-	readAnswer(3000);
-	DEBUG_PRINT("\t");
-	DEBUG_PRINT(replybuffer);
-	DEBUG_PRINTLN(" <---");
-	strcpy(_modem_ip, replybuffer);
-	if(!_modem_ip) {
-		DEBUG_PRINTLN("CAN NOT ASSIGN IP ADDRESS");
-		_gprs_on = false;
-		_tcp_running = false;
+	ASIMQuoted url = { request._url.text, request._url.flash };
+	if(!sendCheckReply(ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL), F("AT+HTTPPARA=\"URL\","), url)) {
+		ERROR_PRINTLN(F("CAN NOT SPECIFY URL"));
+		_http_open = false;
 		return SIM_FAILED;
 	}
-	DEBUG_PRINT("MODEM IP IS ");
-	DEBUG_PRINTLN(_modem_ip);
-	DEBUG_PRINTLN();
-
-	_tcp_running = true;
-
 	return SIM_OK;
 }
 
 /**
- * @brief Start a TCP connection
+ * @brief Close the HTTP session kept open by httpRequest()
  *
- * @param server Pointer to a buffer with the server to connect to
- * @param port Pointer to a buffer witht the port to connect to
- * @return bool true if success, false otherwise
+ * @return bool true if success or already closed, false otherwise
 */
-bool ASIM::startTCP(char *server, uint16_t port) {
-	bool con_status = false;
-	DEBUG_PRINTLN(F("================= STARTING TCP ================="));
-	if((!_gprs_on) || (!_tcp_running)) {
-		con_status = establishTCP();
-		if(!con_status) {
-			DEBUG_PRINTLN("CAN NOT ESTABLISH A TCP CONNECTION");
+bool ASIM::httpClose() {
+	SIM_API("httpClose");
+	if(!_http_open) {
+		return SIM_OK;
+	}
+	return termHttp();
+}
+
+/**
+ * @brief Read a part of the body of the last answer, see ASIMHttpResponse::read()
+ *
+ * @param response The answer, its offset moves past the bytes read
+ * @param buffer The buffer
+ * @param size Its size
+ * @return uint16_t The number of bytes read
+*/
+uint16_t ASIM::httpRead(ASIMHttpResponse &response, char *buffer, uint16_t size) {
+	SIM_API("httpRead");
+	uint16_t got = 0;
+	if(size > response.available()) {
+		size = response.available();
+	}
+	if(!size) {
+		return 0;
+	}
+
+	DEBUG_PRINT(F("\t---> AT+HTTPREAD="));
+	DEBUG_PRINT(response._offset);
+	DEBUG_PRINT(',');
+	DEBUG_PRINTLN(size);
+	discardInput();
+	SIM_COMMAND("AT+HTTPREAD");
+	SIM_SENT(writeParts(*simSerial, F("AT+HTTPREAD="), response._offset, ',', size));
+	SIM_SENT(simSerial->println());
+
+	// +HTTPREAD: <length>, the data as it is, then OK
+	uint16_t timeout = timeoutFor(SIM_TIMEOUT_LOCAL);
+	while(readLine(timeout)) {
+		if(strncmp_P(replybuffer, PSTR("+HTTPREAD: "), 11) == 0) {
+			uint16_t length = atoi(replybuffer + 11);
+			got = readData(buffer, (length < size) ? length : size, timeout);
+			continue;
+		}
+		if(_last_error.result) {
+			break;
+		}
+	}
+	if(_last_error.result != FINAL_OK) {
+		ERROR_PRINTLN(F("CAN NOT READ HTTP RESPONSE"));
+		return 0;
+	}
+	response._offset += got;
+	return got;
+}
+
+/**
+ * @brief Keep the Last-Modified of the last answer in a cache, read with AT+HTTPHEAD
+ *
+ * @param cache The cache
+ * @param key The hash of the URL
+ * @param length The length of the body, the transfer a 304 saves later
+ * @return bool true if success, false otherwise
+*/
+bool ASIM::httpHead(ASIMHttpCache &cache, uint32_t key, uint32_t length) {
+	ASIMHttpCacheEntry entry;
+	memset(&entry, 0, sizeof(entry));
+	entry.key = key;
+	entry.length = length;
+
+	DEBUG_PRINTLN(F("\t---> AT+HTTPHEAD"));
+	discardInput();
+	SIM_COMMAND("AT+HTTPHEAD");
+	SIM_SENT(simSerial->println(F("AT+HTTPHEAD")));
+
+	// +HTTPHEAD: <length>, the header lines as they are, then OK
+	uint16_t timeout = timeoutFor(SIM_TIMEOUT_LOCAL);
+	while(readLine(timeout)) {
+		if(strncmp_P(replybuffer, PSTR("+HTTPHEAD: "), 11) == 0) {
+			readModified(entry, atoi(replybuffer + 11), timeout);
+			continue;
+		}
+		if(_last_error.result) {
+			break;
+		}
+	}
+	if(_last_error.result != FINAL_OK) {
+		ERROR_PRINTLN(F("CAN NOT READ HTTP HEADERS"));
+		return SIM_FAILED;
+	}
+	cache.store(entry);
+	return SIM_OK;
+}
+
+// true if a header line starts with a name from flash, whatever the case of its letters
+static bool headerIs(const char *line, const char *name) {
+	for (char c; (c = pgm_read_byte(name)) != 0; line++, name++) {
+		if (tolower(*line) != c) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Take Last-Modified from the header lines of an answer
+ *
+ * The lines go through the reply buffer one at a time. A date too long for the entry, or holding a '"' the
+ * modem would end USERDATA at, is left out.
+ *
+ * @param entry The entry to fill
+ * @param length The number of bytes of the header lines
+ * @param timeout The longest silence in ms
+*/
+void ASIM::readModified(ASIMHttpCacheEntry &entry, uint16_t length, uint16_t timeout) {
+	uint16_t n = 0;
+	uint32_t start = millis();
+	while(length) {
+		if(!rxAvailable()) {
+			if(!rxWait(start, timeout)) {
+				break;
+			}
+			continue;
+		}
+		char c = rxRead();
+		SIM_RX();
+		start = millis();
+		length--;
+		if((c != '\r') && (c != '\n') && (n < SIM_REPLY_SIZE - 1)) {
+			replybuffer[n++] = c;
+		}
+		// a line ends at its \n, the last one may come without
+		if((c != '\n') && length) {
+			continue;
+		}
+		replybuffer[n] = 0;
+		n = 0;
+		takeModified(entry, replybuffer);
+	}
+	replybuffer[0] = 0;
+}
+
+/**
+ * @brief Take Last-Modified from one header line
+ *
+ * @param entry The entry to fill
+ * @param line The line without its line break
+*/
+void ASIM::takeModified(ASIMHttpCacheEntry &entry, const char *line) {
+	static const char modified[] PROGMEM = "last-modified:";
+	if(!headerIs(line, modified)) {
+		return;
+	}
+	const char *value = line + strlen_P(modified);
+	while(*value == ' ') {
+		value++;
+	}
+	if((strlen(value) < sizeof(entry.modified)) && !strchr(value, '"')) {
+		strcpy(entry.modified, value);
+	}
+}
+
+/**
+ * @brief Read a number of bytes as they come, line breaks included
+ *
+ * @param buffer The buffer
+ * @param length The number of bytes to read
+ * @param timeout The longest silence in ms
+ * @return uint16_t The number of bytes read, less than length on timeout
+*/
+uint16_t ASIM::readData(char *buffer, uint16_t length, uint16_t timeout) {
+	uint16_t n = 0;
+	uint32_t start = millis();
+	do {
+		while ((n < length) && rxAvailable()) {
+			buffer[n++] = rxRead();
+			SIM_RX();
+			start = millis();
+		}
+		if (n == length) {
+			break;
+		}
+	} while (rxWait(start, timeout));
+	return n;
+}
+
+/**
+ * @brief Start an HTTP POST request
+ *
+ * A JSON POST with a bearer token through httpRequest(), kept for the sketches written for it.
+ *
+ * @param url string of the target URL to POST
+ * @param auth_token string of the authorization token
+ * @param data string of data that wanted to POST
+ * @param server_timeout The wait for the server in ms
+ * @param server_response Buffer of SIM_REPLY_SIZE bytes for the response body, zero terminated
+ * @return bool true if success, false otherwise
+*/
+bool ASIM::postHttpRequest(String url, String auth_token, String data, uint16_t server_timeout, char *server_response) {
+	SIM_API("postHttpRequest");
+	INFO_PRINTLN(F("================= HTTP POST REQUEST ================="));
+	ASIMHttpRequest request(HTTPACTION_POST, url.c_str());
+	request.header(F("Authorization: Bearer "), auth_token.c_str()).content(F("application/json"));
+	request.body(data.c_str(), data.length()).timeout(server_timeout);
+	ASIMHttpResponse response;
+	if(!httpRequest(request, response)) {
+		return SIM_FAILED;
+	}
+	uint16_t len = response.read(server_response, SIM_REPLY_SIZE - 1);
+	server_response[len] = 0;
+	DEBUG_PRINT(F("server response = "));
+	DEBUG_PRINTLN(server_response);
+	return SIM_OK;
+}
+/**
+ * @brief Set a TLS option of the modem, for HTTPS and TLS connections
+ *
+ * @param option TLS_IGNORE_INVALID_CERT or TLS_CLIENT_AUTH
+ * @param enable true to turn the option on
+ * @return bool true if success, false otherwise
+*/
+bool ASIM::setTLSOption(uint8_t option, bool enable) {
+	SIM_API("setTLSOption");
+	INFO_PRINTLN(F("================= SET TLS OPTION ================="));
+	return sendCheckReply(ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL), F("AT+SSLOPT="), option, ',', enable ? 1 : 0);
+}
+
+/**
+ * @brief Set the client certificate sent with TLS_CLIENT_AUTH
+ *
+ * The certificate is a file in the flash of the modem, written before with AT+FSCREATE and AT+FSWRITE.
+ *
+ * @param file The file name, e.g. F("C:\\USER\\client.p12")
+ * @param password The password of the file, empty if it has none
+ * @return bool true if the modem loaded the certificate (+SSLSETCERT: 0), false otherwise
+*/
+bool ASIM::setTLSCertificate(ASIMText file, ASIMText password) {
+	SIM_API("setTLSCertificate");
+	uint16_t result = 1;
+	INFO_PRINTLN(F("================= SET TLS CERTIFICATE ================="));
+	ASIMQuoted name = { file.text, file.flash };
+	bool ok = password.empty() ?
+		sendCheckReply(ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL), F("AT+SSLSETCERT="), name) :
+		sendCheckReply(ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL), F("AT+SSLSETCERT="), name, ',', ASIMQuoted{ password.text, password.flash });
+	// +SSLSETCERT: <result> follows once the file is read
+	if(!ok || !waitURC(URC_SSLSETCERT, timeoutFor(SIM_TIMEOUT_STORAGE)) || !parseReply(F("+SSLSETCERT:"), &result) || result) {
+		ERROR_PRINTLN(F("CAN NOT SET TLS CERTIFICATE"));
+		return SIM_FAILED;
+	}
+	return SIM_OK;
+}
+
+// the last, the longest and the total of a time
+static void keepTime(uint32_t elapsed, uint32_t &last, uint32_t &max, uint32_t &total) {
+	last = elapsed;
+	if(elapsed > max) {
+		max = elapsed;
+	}
+	total += elapsed;
+}
+
+/**
+ * @brief Count a TLS connection or HTTPS request and keep its time
+ *
+ * @param request true for an HTTPS request, false for a TLS connection
+ * @param start millis() when it started
+ * @param ok true if the channel was set up
+*/
+void ASIM::tlsDone(bool request, uint32_t start, bool ok) {
+	if(!ok) {
+		_tls.failures++;
+		return;
+	}
+	uint32_t elapsed = millis() - start;
+	if(request) {
+		_tls.requests++;
+		keepTime(elapsed, _tls.request_last, _tls.request_max, _tls.request_total);
+	}
+	else {
+		_tls.connects++;
+		keepTime(elapsed, _tls.connect_last, _tls.connect_max, _tls.connect_total);
+	}
+}
+
+/**
+ * @brief Get the connections, reuses, HTTPS requests and failures of TLS
+ *
+ * @return const ASIMTLSStats& The counters since the last resetTLSStats()
+*/
+const ASIMTLSStats &ASIM::getTLSStats() {
+	return _tls;
+}
+
+/**
+ * @brief Clear the TLS counters
+ *
+*/
+void ASIM::resetTLSStats() {
+	memset(&_tls, 0, sizeof(_tls));
+}
+/**********************************************************************************************************************************/
+/**
+ * @brief Get current status of TCP connection
+ *
+ * @return TCP status
+*/
+uint8_t ASIM::getTCPStatus() {
+	SIM_API("getTCPStatus");
+	uint8_t rsp_class, rsp_value;
+
+	INFO_PRINTLN(F("================= READ TCP STATUS ================="));
+	DEBUG_PRINTLN(F("\t---> AT+CIPSTATUS"));
+	flushInput();
+	SIM_COMMAND("AT+CIPSTATUS");
+	SIM_SENT(simSerial->println(F("AT+CIPSTATUS")));
+
+	// OK comes first, then STATE: <state>
+	while (readLine(getTimeout(SIM_TIMEOUT_LOCAL))) {
+		DEBUG_PRINT(F("\t"));
+		DEBUG_PRINT(replybuffer);
+		DEBUG_PRINTLN(F(" <---"));
+
+		rsp_class = classifyResponse(replybuffer, &rsp_value);
+		if(rsp_class == RSP_TCP_STATE) {
+			if(rsp_value == IP_INITIAL) {
+				_tcp_running = false;
+			}
+			else if(rsp_value == TCP_CONNECTED) {
+				_tcp_running = true;
+			}
+			return rsp_value;
+		}
+		if((rsp_class == RSP_FINAL) && (rsp_value != FINAL_OK)) {
+			break;
+		}
+	}
+
+	return IP_INITIAL;
+}
+
+/**
+ * @brief Establish a TCP connection
+ *
+ * @return bool true if success, false otherwise
+*/
+bool ASIM::establishTCP() {
+	SIM_API("establishTCP");
+	INFO_PRINTLN(F("================= ESTABLISH TCP CONNECTION ================="));
+
+	if(!_gprs_on) {
+		_gprs_on = enableGPRS();
+		if(!_gprs_on) { 
+			ERROR_PRINTLN(F("CAN NOT TURN ON GPRS"));
 			_gprs_on = false;
 			_tcp_running = false;
 			return SIM_FAILED;
 		}
 	}
+
+	DEBUG_PRINTLN(F("\t---> AT+CIFSR"));
+	SIM_COMMAND("AT+CIFSR");
+	SIM_SENT(simSerial->println(F("AT+CIFSR")));
+	// the IP address is the whole answer, there is no final result code
+	readLine(timeoutFor(SIM_TIMEOUT_GPRS));
+	DEBUG_PRINT(F("\t"));
+	DEBUG_PRINT(replybuffer);
+	DEBUG_PRINTLN(F(" <---"));
+	strncpy(_modem_ip, replybuffer, sizeof(_modem_ip) - 1);
+	_modem_ip[sizeof(_modem_ip) - 1] = 0;
+	if((!_modem_ip[0]) || (_last_error.result)) {
+		ERROR_PRINTLN(F("CAN NOT ASSIGN IP ADDRESS"));
+		_gprs_on = false;
+		_tcp_running = false;
+		return SIM_FAILED;
+	}
+	INFO_PRINT(F("MODEM IP IS "));
+	INFO_PRINTLN(_modem_ip);
+	DEBUG_PRINTLN();
+
+	_tcp_running = true;
+
+	return SIM_OK;
+}
+
+/**
+ * @brief Start a TCP connection
+ *
+ * @param server Pointer to a buffer with the server to connect to
+ * @param port Pointer to a buffer witht the port to connect to
+ * @param tls true to connect over TLS (AT+CIPSSL=1), see setTLSOption()
+ * @return bool true if success, false otherwise. A connection still open is kept ("ALREADY CONNECT")
+*/
+bool ASIM::startTCP(char *server, uint16_t port, bool tls) {
+	SIM_API("startTCP");
+	bool con_status = false;
+	INFO_PRINTLN(F("================= STARTING TCP ================="));
+	if((!_gprs_on) || (!_tcp_running)) {
+		con_status = establishTCP();
+		if(!con_status) {
+			ERROR_PRINTLN(F("CAN NOT ESTABLISH A TCP CONNECTION"));
+			_gprs_on = false;
+			_tcp_running = false;
+			return SIM_FAILED;
+		}
+	}
+	// AT+CIPSSL is a setting of the next connections, sent when it changes
+	if((uint8_t)tls != _tcp_ssl) {
+		if(!sendCheckReply(ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL), F("AT+CIPSSL="), tls ? 1 : 0)) {
+			ERROR_PRINTLN(F("CAN NOT SET TCP TLS"));
+			return SIM_FAILED;
+		}
+		_tcp_ssl = tls;
+	}
 	DEBUG_PRINT(F("\t --->"));
 	DEBUG_PRINT(F("AT+CIPSTART=\"TCP\",\""));
 	DEBUG_PRINT(server);
@@ -2082,31 +3594,46 @@ bool ASIM::startTCP(char *server, uint16_t port) {
 	DEBUG_PRINT(port);
 	DEBUG_PRINTLN(F("\""));
 
-	simSerial->print(F("AT+CIPSTART=\"TCP\",\""));
-	simSerial->print(server);
-	simSerial->print(F("\",\""));
-	simSerial->print(port);
-	simSerial->println(F("\""));
+	SIM_COMMAND("AT+CIPSTART");
+	SIM_SENT(simSerial->print(F("AT+CIPSTART=\"TCP\",\"")));
+	SIM_SENT(simSerial->print(server));
+	SIM_SENT(simSerial->print(F("\",\"")));
+	SIM_SENT(simSerial->print(port));
+	SIM_SENT(simSerial->println(F("\"")));
+	uint32_t start = millis();
 
-	readAnswer(500);
-	DEBUG_PRINT("\t");
+	readAnswer(timeoutFor(SIM_TIMEOUT_LOCAL));
+	DEBUG_PRINT(F("\t"));
 	DEBUG_PRINT(replybuffer);
-	DEBUG_PRINTLN(" <---");
+	DEBUG_PRINTLN(F(" <---"));
+	if(strcmp(replybuffer, "ALREADY CONNECT") == 0) {
+		if(tls) {
+			_tls.reuses++;
+		}
+		return SIM_OK;
+	}
 	if(strcmp(replybuffer, "OK") != 0) {
-		DEBUG_PRINTLN("CAN NOT SEND REQUEST TO TCP SERVER");
+		ERROR_PRINTLN(F("CAN NOT SEND REQUEST TO TCP SERVER"));
 		_tcp_running = false;
 		return SIM_FAILED;
 	}
 
-	readAnswer(4500);
-	DEBUG_PRINT("\t");
+	readAnswer(timeoutFor(SIM_TIMEOUT_TCP));
+	DEBUG_PRINT(F("\t"));
 	DEBUG_PRINT(replybuffer);
-	DEBUG_PRINTLN(" <---");
+	DEBUG_PRINTLN(F(" <---"));
 	if(strcmp(replybuffer, "CONNECT OK") != 0) {
-		DEBUG_PRINTLN("CAN NOT CONNECT TO TCP SERVER");
+		ERROR_PRINTLN(F("CAN NOT CONNECT TO TCP SERVER"));
+		if(tls) {
+			tlsDone(false, start, false);
+		}
 		_tcp_running = false;
 		return SIM_FAILED;
 	}
+	// with AT+CIPSSL=1 CONNECT OK comes after the handshake
+	if(tls) {
+		tlsDone(false, start, true);
+	}
 
 	return SIM_OK;
 }
@@ -2117,7 +3644,8 @@ bool ASIM::startTCP(char *server, uint16_t port) {
  * @return bool true if success, false otherwise
 */
 bool ASIM::closeTCP() {
-	DEBUG_PRINTLN(F("================= CLOSING TCP ================="));
+	SIM_API("closeTCP");
+	INFO_PRINTLN(F("================= CLOSING TCP ================="));
 	return sendVerifyedCommand(F("AT+CIPCLOSE"), F("CLOSE OK"));
 }
 
@@ -2129,33 +3657,35 @@ bool ASIM::closeTCP() {
  * @return bool true if success, false otherwise
 */
 bool ASIM::sendTCPData(char *data, char *response) {
+	SIM_API("sendTCPData");
 	char *substr;
 	bool send_result = false;
 
-	DEBUG_PRINTLN(F("================= SENDING TCP MESSAGE ================="));
+	INFO_PRINTLN(F("================= SENDING TCP MESSAGE ================="));
 	if(!_tcp_running) {
-		DEBUG_PRINTLN("CAN NOT DETECT TCP CONNECTION");
+		ERROR_PRINTLN(F("CAN NOT DETECT TCP CONNECTION"));
 		return SIM_FAILED;
 	}
 
 	send_result = sendVerifyedCommand(F("AT+CIPSEND"), F("> "));
 	if(!send_result) {
-		DEBUG_PRINTLN("CAN NOT INIT TCP MESSAGE");
+		ERROR_PRINTLN(F("CAN NOT INIT TCP MESSAGE"));
 		_tcp_running = false;
 		return SIM_FAILED;
 	}
 
-	simSerial->print(data);
-	simSerial->write(0x1A);
+	SIM_COMMAND("AT+CIPSEND>");
+	SIM_SENT(simSerial->print(data));
+	SIM_SENT(simSerial->write(0x1A));
 
 	DEBUG_PRINT(data);
-	DEBUG_PRINTLN(" ^Z");
+	DEBUG_PRINTLN(F(" ^Z"));
 	
-	readAnswer(7000);
+	readAnswer(timeoutFor(SIM_TIMEOUT_TCP));
 	DEBUG_PRINTLN(replybuffer);
 
 	if ((!strstr(replybuffer, "SEND OK"))) {
-		DEBUG_PRINTLN("FAILED TO SEND TCP DATA");
+		ERROR_PRINTLN(F("FAILED TO SEND TCP DATA"));
 		return SIM_FAILED;
 	}
 
@@ -2172,11 +3702,12 @@ bool ASIM::sendTCPData(char *data, char *response) {
  * @return bool true if success, false otherwise
 */
 bool ASIM::initRTC(uint8_t mode) {
-	DEBUG_PRINTLN(F("================= INIT LOCAL RTC ================="));
-	if (!sendVerifyedCommand(F("AT+CLTS="), mode, ok_reply, 500)) {
+	SIM_API("initRTC");
+	INFO_PRINTLN(F("================= INIT LOCAL RTC ================="));
+	if (!sendCheckReply(ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL), F("AT+CLTS="), mode)) {
 		return SIM_FAILED;
 	}
-	return sendVerifyedCommand(F("AT&W"), ok_reply, 500);
+	return sendVerifyedCommand(F("AT&W"), ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL));
 }
 
 /**
@@ -2192,11 +3723,13 @@ bool ASIM::initRTC(uint8_t mode) {
  * @return bool true if success, false otherwise
 */
 bool ASIM::setRTC(uint8_t year, uint8_t month, uint8_t day, uint8_t hr, uint8_t min, uint8_t sec, int8_t zz) {
-	char rtc_cmd[50];
-	DEBUG_PRINTLN(F("================= SET RTC ================="));
-	sprintf(rtc_cmd,"AT+CCLK=\"%02d/%02d/%02d,%02d:%02d:%02d+%d\"", year, month, day, hr, min, sec, zz);
-
-	return sendVerifyedCommand(rtc_cmd, ok_reply);
+	SIM_API("setRTC");
+	INFO_PRINTLN(F("================= SET RTC ================="));
+	// AT+CCLK="yy/MM/dd,hh:mm:ss+zz"
+	return sendCheckReply(ok_reply, DEFAULT_TIMOUT, F("AT+CCLK=\""),
+		padded(year, 2), '/', padded(month, 2), '/', padded(day, 2), ',',
+		padded(hr, 2), ':', padded(min, 2), ':', padded(sec, 2),
+		(zz < 0) ? '-' : '+', padded((zz < 0) ? -zz : zz, 2), '"');
 }
 
 /**
@@ -2211,8 +3744,9 @@ bool ASIM::setRTC(uint8_t year, uint8_t month, uint8_t day, uint8_t hr, uint8_t
  * @return bool true if success, false otherwise
 */
 bool ASIM::readRTC(uint8_t *year, uint8_t *month, uint8_t *day, uint8_t *hr, uint8_t *min, uint8_t *sec) {
-	DEBUG_PRINTLN(F("================= GET RTC ================="));
-	getReply(F("AT+CCLK?"), (uint16_t) 100); //Get RTC timeout 100 msec
+	SIM_API("readRTC");
+	INFO_PRINTLN(F("================= GET RTC ================="));
+	getReply(100, F("AT+CCLK?")); //Get RTC timeout 100 msec
 	if (strncmp(replybuffer, "+CCLK: ", 7) != 0)
 		return false;
 
@@ -2252,27 +3786,28 @@ bool ASIM::readRTC(uint8_t *year, uint8_t *month, uint8_t *day, uint8_t *hr, uin
  * @return bool true if success, false otherwise
 */
 bool ASIM::syncNTPTime(uint16_t *error_code, char *ntp_server, uint8_t region) {
-	char ntp_cmd[40];
-	DEBUG_PRINTLN(F("================= SYNC TIME WITH NTP SERVER ================="));
+	SIM_API("syncNTPTime");
+	bool ntp_set = false;
+	INFO_PRINTLN(F("================= SYNC TIME WITH NTP SERVER ================="));
 	if(!sendVerifyedCommand(F("AT+CNTPCID=1"), ok_reply)) {
-		DEBUG_PRINTLN(F("CAN NOT ENABLE NTP SERVER"));
+		ERROR_PRINTLN(F("CAN NOT ENABLE NTP SERVER"));
 		return SIM_FAILED;
 	}
 	if(strlen(ntp_server) > 1) {
-		sprintf(ntp_cmd, "AT+CNTP=\"%s\",%d", ntp_server, region);
+		ntp_set = sendCheckReply(ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL), F("AT+CNTP="), quoted(ntp_server), ',', region);
 	}
 	else {
-		sprintf(ntp_cmd, "AT+CNTP=\"pool.ntp.org\",%d", region);
+		ntp_set = sendCheckReply(ok_reply, timeoutFor(SIM_TIMEOUT_LOCAL), F("AT+CNTP="), quoted(F("pool.ntp.org")), ',', region);
 	}
 
-	if(!sendVerifyedCommand(ntp_cmd, ok_reply, 3000)) {
-		DEBUG_PRINTLN(F("CAN NOT CONNECT TO NTP SERVER"));
+	if(!ntp_set) {
+		ERROR_PRINTLN(F("CAN NOT CONNECT TO NTP SERVER"));
 		return SIM_FAILED;
 	}
 
-	sendVerifyedCommand(F("AT+CNTP"), ok_reply, 5000);
+	sendVerifyedCommand(F("AT+CNTP"), ok_reply, timeoutFor(SIM_TIMEOUT_NETWORK));
 	if (!parseReply(F("+CNTP:"), error_code)) {
-		DEBUG_PRINTLN(F("SERVER DID NOT RESPOND"));
+		ERROR_PRINTLN(F("SERVER DID NOT RESPOND"));
 		return SIM_FAILED;	
 	}
 
@@ -2287,18 +3822,682 @@ bool ASIM::syncNTPTime(uint16_t *error_code, char *ntp_server, uint8_t region) {
  * @return bool true if success, false otherwise
 */
 bool ASIM::setPWM(uint8_t channel, uint16_t period, uint8_t duty) {
-	char pwm_cmd[20];
-	DEBUG_PRINTLN(F("================= SET PWM ================="));
+	SIM_API("setPWM");
+	INFO_PRINTLN(F("================= SET PWM ================="));
 	if(period > 2000) {
-		DEBUG_PRINTLN(F("PWM PERIOD CAN NOT EXCEED 2000"));
+		ERROR_PRINTLN(F("PWM PERIOD CAN NOT EXCEED 2000"));
 		return SIM_FAILED;
 	}
 	if(duty > 100) {
-		DEBUG_PRINTLN(F("PWM DUTY CYCLE CAN NOT EXCEED 100"));
+		ERROR_PRINTLN(F("PWM DUTY CYCLE CAN NOT EXCEED 100"));
 		return SIM_FAILED;
 	}
 
-	sprintf(pwm_cmd, "AT+SPWM=%d,%d,%d", channel, period, duty);
-	return sendVerifyedCommand(pwm_cmd, ok_reply);
+	return sendCheckReply(ok_reply, DEFAULT_TIMOUT, F("AT+SPWM="), channel, ',', period, ',', duty);
+}
+
+/**********************************************************************************************************************************/
+static ASIMStackHook stack_hook = NULL;
+static uint16_t stack_high_water = 0;
+
+/**
+ * @brief Set the function called with the stack usage of every API call
+ *
+ * @param hook The hook, NULL to disable it. Only called when SIM_STACK_MONITOR is defined
+*/
+void ASIM::setStackHook(ASIMStackHook hook) {
+	stack_hook = hook;
+}
+
+/**
+ * @brief Get the worst stack usage of any API call so far
+ *
+ * @return uint16_t The used stack in bytes, 0 when SIM_STACK_MONITOR is not defined
+*/
+uint16_t ASIM::getStackHighWater() {
+	return stack_high_water;
+}
+
+#ifdef SIM_STACK_MONITOR
+#define SIM_STACK_PAINT		0xC5
+#define SIM_STACK_MARGIN	32
+
+static uint8_t stack_probe_depth = 0;
+static uintptr_t stack_probe_bottom = 0;
+
+/**
+ * @brief Start measuring the stack of an API call, only the outermost call is measured
+ *
+ * The measure starts at the top of the frame of the API function, so its locals count as used. The stack
+ * is painted from a margin below the probe down to SIM_STACK_WINDOW bytes under that top.
+ *
+ * @param api The API name
+ * @param frame The top of the frame of the API function, __builtin_dwarf_cfa() (SIM_PROBE)
+*/
+ASIMStackProbe::ASIMStackProbe(ASIMFlashString api, void *frame) {
+	volatile uint8_t marker = 0;
+
+	_api = api;
+	_top = 0;
+	if (stack_probe_depth++) {
+		return;
+	}
+
+	_top = (uintptr_t)frame;
+	stack_probe_bottom = _top - SIM_STACK_WINDOW;
+	#if defined(__AVR__)
+		// never paint over the heap
+		extern char __heap_start, *__brkval;
+		uintptr_t heap_end = (uintptr_t)(__brkval ? __brkval : &__heap_start) + SIM_STACK_MARGIN;
+		if (stack_probe_bottom < heap_end) {
+			stack_probe_bottom = heap_end;
+		}
+	#endif
+
+	// the frame of this constructor is live, the paint stops a margin below one of its locals
+	uintptr_t paint_end = (uintptr_t)&marker - SIM_STACK_MARGIN;
+	for (uintptr_t a = stack_probe_bottom; a < paint_end; a++) {
+		*(volatile uint8_t *)a = SIM_STACK_PAINT;
+	}
+}
+
+/**
+ * @brief Report the stack used by the API call
+ *
+*/
+ASIMStackProbe::~ASIMStackProbe() {
+	stack_probe_depth--;
+	if (!_top) {
+		return;
+	}
+
+	uintptr_t a = stack_probe_bottom;
+	while ((a < _top) && (*(volatile uint8_t *)a == SIM_STACK_PAINT)) {
+		a++;
+	}
+
+	uint16_t used = _top - a;
+	if (used > stack_high_water) {
+		stack_high_water = used;
+	}
+	if (stack_hook) {
+		stack_hook(_api, used);
+	}
+}
+#endif
+
+/**********************************************************************************************************************************/
+/**
+ * @brief Get an upper bound of a latency percentile from the histogram
+ *
+ * @param pct The percentile (50, 90, 99, ...)
+ * @return uint32_t The latency in ms, never above the measured maximum
+*/
+uint32_t ASIMCommandStats::percentile(uint8_t pct) const {
+	uint32_t rank = ((uint32_t)count * pct + 99) / 100;
+	uint32_t seen = 0;
+	for (uint8_t i = 0; i < SIM_STATS_BUCKETS; i++) {
+		seen += histogram[i];
+		if (seen >= rank) {
+			uint32_t bound = (uint32_t)16 << i;
+			return (bound < max_ms) ? bound : max_ms;
+		}
+	}
+	return max_ms;
+}
+
+/**
+ * @brief Get the per command statistics
+ *
+ * @param count Pointer to a uint8_t to hold the number of commands
+ * @return const ASIMCommandStats* The statistics, NULL when SIM_STATS is not defined
+*/
+const ASIMCommandStats *ASIM::getStats(uint8_t *count) {
+	#ifdef SIM_STATS
+		statsEnd();
+		*count = _stats_used;
+		return _stats;
+	#else
+		*count = 0;
+		return NULL;
+	#endif
+}
+
+/**
+ * @brief Clear the per command statistics
+ *
+*/
+void ASIM::resetStats() {
+	#ifdef SIM_STATS
+		_stats_slot = -1;
+		_stats_used = 0;
+		memset(_stats, 0, sizeof(_stats));
+	#endif
+}
+
+/**
+ * @brief Print the per command statistics as a compact table
+ *
+ * @param out The output, e.g. Serial
+*/
+void ASIM::printStats(Print &out) {
+	uint8_t count;
+	const ASIMCommandStats *stats = getStats(&count);
+
+	out.println(F("cmd\tn\tavg\tmin\tp50\tp90\tmax\tto\terr\ttx\trx\tblock"));
+	for (uint8_t i = 0; i < count; i++) {
+		const ASIMCommandStats &s = stats[i];
+		out.print(s.tag);
+		out.print('\t');
+		out.print(s.count);
+		out.print('\t');
+		out.print(s.count ? (s.total_ms / s.count) : 0);
+		out.print('\t');
+		out.print(s.min_ms);
+		out.print('\t');
+		out.print(s.percentile(50));
+		out.print('\t');
+		out.print(s.percentile(90));
+		out.print('\t');
+		out.print(s.max_ms);
+		out.print('\t');
+		out.print(s.timeouts);
+		out.print('\t');
+		out.print(s.errors);
+		out.print('\t');
+		out.print(s.tx);
+		out.print('\t');
+		out.print(s.rx);
+		out.print('\t');
+		out.println(s.longest_block_ms);
+	}
+}
+
+#ifdef SIM_STATS
+/**
+ * @brief Start the record of a command, the previous one is added to its slot
+ *
+ * @param command The command, its name up to '=', '?' or '"' selects the slot
+*/
+void ASIM::statsBegin(ASIMFlashString command) {
+	char tag[SIM_STATS_TAG];
+	PGM_P p = (PGM_P)command;
+	uint8_t i;
+
+	statsEnd();
+
+	for (i = 0; i < (SIM_STATS_TAG - 1); i++) {
+		char c = pgm_read_byte(p + i);
+		if ((c == 0) || (c == '=') || (c == '?') || (c == '"')) {
+			break;
+		}
+		tag[i] = c;
+	}
+	tag[i] = 0;
+
+	for (i = 0; i < _stats_used; i++) {
+		if (strcmp(_stats[i].tag, tag) == 0) {
+			break;
+		}
+	}
+	if (i == _stats_used) {
+		if (_stats_used < (SIM_STATS_SLOTS - 1)) {
+			_stats_used++;
+		}
+		else {
+			// out of slots, the last one collects the remaining commands
+			i = SIM_STATS_SLOTS - 1;
+			_stats_used = SIM_STATS_SLOTS;
+			strcpy_P(tag, PSTR("*"));
+		}
+		if (strcmp(_stats[i].tag, tag) != 0) {
+			memset(&_stats[i], 0, sizeof(_stats[i]));
+			strcpy(_stats[i].tag, tag);
+		}
+	}
+
+	_stats_slot = i;
+	_stats_start = millis();
+	_stats_end = _stats_start;
+	_stats_block = 0;
+	_stats_tx = 0;
+	_stats_rx = 0;
+	_stats_timeout = false;
+	_stats_error = false;
+}
+
+/**
+ * @brief Add the command in flight to its slot
+ *
+*/
+void ASIM::statsEnd() {
+	if (_stats_slot < 0) {
+		return;
+	}
+	ASIMCommandStats &s = _stats[_stats_slot];
+	uint32_t latency = _stats_end - _stats_start;
+	uint8_t bucket = 0;
+
+	_stats_slot = -1;
+	if (s.count == 0xFFFF) {
+		return;
+	}
+	if ((s.count == 0) || (latency < s.min_ms)) {
+		s.min_ms = latency;
+	}
+	if (latency > s.max_ms) {
+		s.max_ms = latency;
+	}
+	while ((bucket < (SIM_STATS_BUCKETS - 1)) && (latency >= ((uint32_t)16 << bucket))) {
+		bucket++;
+	}
+	s.histogram[bucket]++;
+	s.count++;
+	s.total_ms += latency;
+	s.timeouts += _stats_timeout;
+	s.errors += _stats_error;
+	s.tx += _stats_tx;
+	s.rx += _stats_rx;
+	if (_stats_block > s.longest_block_ms) {
+		s.longest_block_ms = _stats_block;
+	}
+}
+
+/**
+ * @brief Account one blocking read to the command in flight
+ *
+ * @param start The millis() when the read started
+ * @param reply true: the read of an answer, false: flushing stale input
+ * @param complete true: the answer ended, false: the read ran out of time
+*/
+void ASIM::statsRead(uint32_t start, bool reply, bool complete) {
+	uint32_t now = millis();
+	if ((now - start) > _stats_block) {
+		_stats_block = now - start;
+	}
+	if (!reply) {
+		return;
+	}
+	// the last read of a command decides, earlier reads may end with intermediate lines
+	_stats_end = now;
+	_stats_timeout = !complete;
+	if (_last_error.failed()) {
+		_stats_error = true;
+	}
+}
+
+#endif
+
+/**********************************************************************************************************************************/
+uint8_t ASIM::_log_level = SIM_LOG_LEVEL;
+
+/**
+ * @brief Set the log level at run time
+ *
+ * @param level SIM_LOG_NONE, SIM_LOG_ERROR, SIM_LOG_INFO or SIM_LOG_DEBUG, levels above SIM_LOG_LEVEL are not compiled in
+*/
+void ASIM::setLogLevel(uint8_t level) {
+	_log_level = level;
+}
+
+/**
+ * @brief Print the trace ring buffer, oldest event first
+ *
+ * @param out The output, e.g. Serial
+*/
+void ASIM::dumpTrace(Print &out) {
+	#ifdef SIM_TRACE
+		uint8_t index = (_trace_head + SIM_TRACE_SIZE - _trace_count) % SIM_TRACE_SIZE;
+
+		for (uint8_t i = 0; i < _trace_count; i++) {
+			const ASIMTraceEvent &e = _trace[index];
+			index = (index + 1) % SIM_TRACE_SIZE;
+
+			out.print(e.ms);
+			out.print('\t');
+			if (e.result == TRACE_SEND) {
+				out.print(F("> "));
+				out.print(e.command);
+			}
+			else {
+				out.print(F("< "));
+				if (e.result == TRACE_TIMEOUT) {
+					out.print(F("TIMEOUT"));
+				}
+				else if (e.result) {
+					out.print((ASIMFlashString)responseKey(RSP_FINAL, e.result));
+				}
+				else {
+					out.print(F("DATA"));
+				}
+			}
+			out.print('\t');
+			out.println(e.length);
+		}
+	#else
+		(void)out;
+	#endif
+}
+
+/**
+ * @brief Empty the trace ring buffer
+ *
+*/
+void ASIM::clearTrace() {
+	#ifdef SIM_TRACE
+		_trace_head = 0;
+		_trace_count = 0;
+	#endif
+}
+
+#ifdef SIM_TRACE
+/**
+ * @brief Add an event of the command in flight to the trace ring buffer
+ *
+ * @param result TRACE_SEND, TRACE_TIMEOUT or the final result code of the reply
+ * @param length The bytes sent or the reply length
+*/
+void ASIM::trace(uint8_t result, uint8_t length) {
+	ASIMTraceEvent &e = _trace[_trace_head];
+	e.ms = millis();
+	e.command = _trace_command;
+	e.result = result;
+	e.length = length;
+	_trace_head = (_trace_head + 1) % SIM_TRACE_SIZE;
+	if (_trace_count < SIM_TRACE_SIZE) {
+		_trace_count++;
+	}
+}
+#endif
+
+#ifdef SIM_INSTRUMENT
+/**
+ * @brief A command is about to be sent
+ *
+ * @param command The command, or its first part
+*/
+void ASIM::commandBegin(ASIMFlashString command) {
+	#ifdef SIM_STATS
+		statsBegin(command);
+	#endif
+	#ifdef SIM_TRACE
+		_trace_command = command;
+		trace(TRACE_SEND, 0);
+	#endif
+}
+
+/**
+ * @brief Account bytes sent for the command in flight
+ *
+ * @param n The bytes sent
+ * @return size_t n
+*/
+size_t ASIM::commandSent(size_t n) {
+	#ifdef SIM_STATS
+		_stats_tx += n;
+	#endif
+	#ifdef SIM_TRACE
+		// the send event is the newest one unless a reply was read in between
+		ASIMTraceEvent &e = _trace[(_trace_head + SIM_TRACE_SIZE - 1) % SIM_TRACE_SIZE];
+		if (_trace_count && (e.result == TRACE_SEND)) {
+			e.length = min(255, e.length + n);
+		}
+	#endif
+	return n;
+}
+
+/**
+ * @brief A blocking read has finished
+ *
+ * @param start The millis() when the read started
+ * @param reply true: the read of an answer, false: flushing stale input
+ * @param complete true: the answer ended, false: the read ran out of time
+*/
+void ASIM::readDone(uint32_t start, bool reply, bool complete) {
+	#ifdef SIM_STATS
+		statsRead(start, reply, complete);
+	#endif
+	#ifdef SIM_TRACE
+		if (reply) {
+			trace(complete ? _last_error.result : TRACE_TIMEOUT, strlen(replybuffer));
+		}
+	#endif
+}
+
+ASIMRead::ASIMRead(ASIM &sim, bool reply) : complete(false), _sim(sim), _reply(reply) {
+	_start = millis();
+}
+
+ASIMRead::~ASIMRead() {
+	_sim.readDone(_start, _reply, complete);
+}
+#endif
+
+/**********************************************************************************************************************************/
+// initial timeout, floor and ceiling in ms of every command class
+static const uint16_t timeout_defaults[SIM_TIMEOUT_CLASSES][3] PROGMEM = {
+	{ 500,		100,	2000 },		// SIM_TIMEOUT_LOCAL
+	{ 1000,		200,	10000 },	// SIM_TIMEOUT_STORAGE
+	{ 10000,	1000,	30000 },	// SIM_TIMEOUT_NETWORK
+	{ 3000,		500,	10000 },	// SIM_TIMEOUT_GPRS
+	{ 20000,	2000,	60000 },	// SIM_TIMEOUT_ATTACH
+	{ 7000,		1000,	20000 },	// SIM_TIMEOUT_TCP
+};
+
+/**
+ * @brief Forget the learned latencies, every class starts again from its initial timeout
+ *
+*/
+void ASIM::resetTimeouts() {
+	for (uint8_t i = 0; i < SIM_TIMEOUT_CLASSES; i++) {
+		_timeouts[i].srtt = 0;
+		_timeouts[i].rttvar = 0;
+		_timeouts[i].rto = pgm_read_word(&timeout_defaults[i][0]);
+		_timeouts[i].floor = pgm_read_word(&timeout_defaults[i][1]);
+		_timeouts[i].ceiling = pgm_read_word(&timeout_defaults[i][2]);
+		_timeouts[i].backoff = 0;
+	}
+	_timeout_class = SIM_TIMEOUT_NONE;
 }
 
+/**
+ * @brief Limit the adaptive timeout of a command class
+ *
+ * @param cls The command class (SIM_TIMEOUT_LOCAL, SIM_TIMEOUT_NETWORK, ...)
+ * @param floor_ms The shortest timeout, keep it above the slowest normal answer on a good link
+ * @param ceiling_ms The longest timeout, reached on poor links and after unanswered commands
+*/
+void ASIM::setTimeoutBounds(uint8_t cls, uint16_t floor_ms, uint16_t ceiling_ms) {
+	if ((cls >= SIM_TIMEOUT_CLASSES) || (floor_ms > ceiling_ms)) {
+		return;
+	}
+	_timeouts[cls].floor = floor_ms;
+	_timeouts[cls].ceiling = ceiling_ms;
+	_timeouts[cls].rto = constrain(_timeouts[cls].rto, floor_ms, ceiling_ms);
+}
+
+/**
+ * @brief Get the current timeout of a command class
+ *
+ * @param cls The command class (SIM_TIMEOUT_LOCAL, SIM_TIMEOUT_NETWORK, ...)
+ * @return uint16_t The timeout in ms
+*/
+uint16_t ASIM::getTimeout(uint8_t cls) {
+	if (cls >= SIM_TIMEOUT_CLASSES) {
+		return DEFAULT_TIMOUT;
+	}
+	ASIMTimeout &t = _timeouts[cls];
+	uint32_t rto = (uint32_t)t.rto << t.backoff;
+	return (rto > t.ceiling) ? t.ceiling : rto;
+}
+
+/**
+ * @brief Get the timeout for the next read, its latency is learned for the class
+ *
+ * @param cls The command class (SIM_TIMEOUT_LOCAL, SIM_TIMEOUT_NETWORK, ...)
+ * @return uint16_t The timeout in ms
+*/
+uint16_t ASIM::timeoutFor(uint8_t cls) {
+	_timeout_class = cls;
+	return getTimeout(cls);
+}
+
+/**
+ * @brief Learn from the read that followed timeoutFor()
+ *
+ * RTO = SRTT + 4 * RTTVAR with the gains of RFC 6298. Only complete answers are samples,
+ * a command that got no answer at all doubles the timeout until the next sample.
+ *
+ * @param elapsed The read time in ms
+ * @param complete true: the answer ended before the timeout
+ * @param answered true: at least one byte was received
+*/
+void ASIM::timeoutSample(uint16_t elapsed, bool complete, bool answered) {
+	if (_timeout_class == SIM_TIMEOUT_NONE) {
+		return;
+	}
+	ASIMTimeout &t = _timeouts[_timeout_class];
+	_timeout_class = SIM_TIMEOUT_NONE;
+
+	if (!complete) {
+		if ((!answered) && (((uint32_t)t.rto << t.backoff) < t.ceiling)) {
+			t.backoff++;
+		}
+		return;
+	}
+
+	if (elapsed == 0) {
+		elapsed = 1;
+	}
+	if (t.srtt == 0) {
+		t.srtt = elapsed;
+		t.rttvar = elapsed / 2;
+	}
+	else {
+		int32_t err = (int32_t)elapsed - t.srtt;
+		t.srtt += err / 8;
+		t.rttvar += ((err < 0 ? -err : err) - (int32_t)t.rttvar) / 4;
+	}
+	t.backoff = 0;
+	uint32_t rto = (uint32_t)t.srtt + 4 * (uint32_t)t.rttvar;
+	t.rto = constrain(rto, t.floor, t.ceiling);
+}
+
+/**********************************************************************************************************************************/
+#ifdef SIM_RTOS
+/**
+ * @brief Start the reader task, once. The mutex and the line queue come with the constructor
+ *
+*/
+void ASIM::rtosBegin() {
+	if (_reader) {
+		return;
+	}
+	xTaskCreate(readerTask, "ASIM", SIM_RTOS_STACK, this, SIM_RTOS_PRIORITY, &_reader);
+}
+
+/**
+ * @brief Entry of the reader task
+ *
+ * @param arg The modem
+*/
+void ASIM::readerTask(void *arg) {
+	((ASIM *)arg)->readerLoop();
+}
+
+/**
+ * @brief Reader task: the only reader of the UART, it queues every line
+ *
+ * A line ends at its LF. What does not end with one (the "> " prompt, an ATV0 result code)
+ * is queued when the UART stays quiet for two ticks. Once rxEvent() was called the task sleeps
+ * until the next receive event, before that it checks the UART every tick.
+ * A full queue holds the task until a call reads a line: no line is dropped, what arrives in
+ * the meantime waits in the UART buffer as it does without an RTOS.
+*/
+void ASIM::readerLoop() {
+	ASIMLine line;
+	uint8_t quiet = 0;
+	line.length = 0;
+
+	for (;;) {
+		bool received = false;
+		while (simSerial->available()) {
+			char c = simSerial->read();
+			line.data[line.length++] = c;
+			if ((c == '\n') || (line.length == SIM_RTOS_LINE)) {
+				xQueueSend(_rx_queue, &line, portMAX_DELAY);
+				line.length = 0;
+			}
+			received = true;
+		}
+		if (received) {
+			quiet = 0;
+		}
+		else if (line.length && (++quiet >= 2)) {
+			xQueueSend(_rx_queue, &line, portMAX_DELAY);
+			line.length = 0;
+		}
+		ulTaskNotifyTake(pdTRUE, (_rx_events && !line.length) ? portMAX_DELAY : 1);
+	}
+}
+
+/**
+ * @brief Wake the reader task: the UART received data. Call it from a receive callback that runs in a task,
+ * e.g. Serial2.onReceive([]() { sim.rxEvent(); }) on an ESP32
+ *
+*/
+void ASIM::rxEvent() {
+	_rx_events = true;
+	if (_reader) {
+		xTaskNotifyGive(_reader);
+	}
+}
+
+/**
+ * @brief Wake the reader task from the receive interrupt of the UART, see rxEvent()
+ *
+*/
+void ASIM::rxEventFromISR() {
+	BaseType_t woken = pdFALSE;
+	_rx_events = true;
+	if (!_reader) {
+		return;
+	}
+	vTaskNotifyGiveFromISR(_reader, &woken);
+	if (woken) {
+		#if defined(ESP32) || defined(ESP_PLATFORM)
+			portYIELD_FROM_ISR();
+		#elif defined(portEND_SWITCHING_ISR)
+			portEND_SWITCHING_ISR(woken);
+		#elif defined(portYIELD_FROM_ISR)
+			portYIELD_FROM_ISR();
+		#endif
+	}
+}
+
+/**
+ * @brief Take the modem for the calling task, other tasks wait in their API calls until unlock()
+ *
+ * Every API call does it itself, lock() keeps a sequence of calls and the reply buffer to one task.
+ * Calls can nest, every lock() needs its unlock().
+*/
+void ASIM::lock() {
+	xSemaphoreTakeRecursive(_mutex, portMAX_DELAY);
+}
+
+/**
+ * @brief Give the modem back, see lock()
+ *
+*/
+void ASIM::unlock() {
+	xSemaphoreGiveRecursive(_mutex);
+}
+
+ASIMLock::ASIMLock(ASIM &sim) : _sim(sim) {
+	_sim.lock();
+}
+
+ASIMLock::~ASIMLock() {
+	_sim.unlock();
+}
+#endif
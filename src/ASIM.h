@@ -22,38 +22,54 @@
 #endif
 
 #ifndef prog_char_strcmp
-	#define prog_char_strcmp(a, b) strcmp((a), (b))
+	#define prog_char_strcmp(a, b) strcmp_P((a), (b))
 #endif
 
 #ifndef prog_char_strstr
-	#define prog_char_strstr(a, b) strstr((a), (b))
+	#define prog_char_strstr(a, b) strstr_P((a), (b))
 #endif
 
 #ifndef prog_char_strlen
-	#define prog_char_strlen(a) strlen((a))
+	#define prog_char_strlen(a) strlen_P((a))
 #endif
 
 #ifndef prog_char_strcpy
-	#define prog_char_strcpy(to, fromprogmem) strcpy((to), (fromprogmem))
+	#define prog_char_strcpy(to, fromprogmem) strcpy_P((to), (fromprogmem))
 #endif
 
-#define SHOW_SIM_DEBUG
+#include "ASIMResponse.h"
+
+// Log output, printing at 9600 baud costs more time than most modem exchanges so it is off by default
+// #define SHOW_SIM_DEBUG
+
+// log levels, SIM_LOG_LEVEL is the highest level compiled in, ASIM::setLogLevel() lowers it at run time
+#define SIM_LOG_NONE		0
+#define SIM_LOG_ERROR		1
+#define SIM_LOG_INFO		2
+#define SIM_LOG_DEBUG		3
+#ifndef SIM_LOG_LEVEL
+	#define SIM_LOG_LEVEL		SIM_LOG_DEBUG
+#endif
 
 // for debug (only applies when SHOW_SIM_DEBUG is defined)
 #ifdef SHOW_SIM_DEBUG
 	// DebugStream	sets the Stream output to use
 	#define DebugStream 		Serial
-	// need to do some debugging...
-	#define DEBUG_PRINT(...) 	DebugStream.print(__VA_ARGS__)
-	#define DEBUG_PRINTLN(...) 	DebugStream.println(__VA_ARGS__)
+	#define SIM_LOG(level, fn, ...)	do { if (((level) <= SIM_LOG_LEVEL) && ((level) <= ASIM::_log_level)) DebugStream.fn(__VA_ARGS__); } while (0)
 #else
-	#define DEBUG_PRINT(...) 
-	#define DEBUG_PRINTLN(...)
+	#define SIM_LOG(level, fn, ...)
 #endif
+// need to do some debugging...
+#define DEBUG_PRINT(...) 	SIM_LOG(SIM_LOG_DEBUG, print, __VA_ARGS__)
+#define DEBUG_PRINTLN(...) 	SIM_LOG(SIM_LOG_DEBUG, println, __VA_ARGS__)
+#define INFO_PRINT(...) 	SIM_LOG(SIM_LOG_INFO, print, __VA_ARGS__)
+#define INFO_PRINTLN(...) 	SIM_LOG(SIM_LOG_INFO, println, __VA_ARGS__)
+#define ERROR_PRINTLN(...) 	SIM_LOG(SIM_LOG_ERROR, println, __VA_ARGS__)
 /**********************************************************************************************************************************/
 // defines to keep things readable
 #define SIM_OK				1
 #define SIM_FAILED			0
+#define SIM_PENDING			2
 
 #define SIM800				2
 #define SIM808_V1 			7
@@ -76,6 +92,26 @@
 #define TEXT_MODE			1
 #define PDU_MODE			0 
 
+#define VERBOSE_RESULTS		1
+#define NUMERIC_RESULTS		0
+
+#define SLEEP_OFF			0
+#define SLEEP_DTR			1	// sleeps while DTR is high
+#define SLEEP_AUTO			2	// sleeps after 5 s without UART activity, the first byte wakes it
+
+// <stat> of +CREG/+CGREG
+#define REG_NOT_SEARCHING	0
+#define REG_HOME			1
+#define REG_SEARCHING		2
+#define REG_DENIED			3
+#define REG_UNKNOWN			4
+#define REG_ROAMING			5
+#define REG_UNTRACKED		255	// trackRegistration() not called (yet)
+
+// APN quirks of an operator (see ASIM::setAPN)
+#define APN_QUIRK_SLOW_ATTACH	0x01	// AT+CIICR is tried twice, the first activation often times out
+#define APN_QUIRK_DNS			0x02	// the DNS servers of the operator are replaced by SIM_APN_DNS
+
 #define FARSI				27
 #define ENGLISH				37
 
@@ -89,6 +125,25 @@
 #define TCP_CLOSING			7
 #define TCP_CLOSED			8
 #define PDP_DEACTIVATED		9
+
+// methods of AT+HTTPACTION (see ASIMHttpRequest)
+#define HTTPACTION_GET		0
+#define HTTPACTION_POST		1
+#define HTTPACTION_HEAD		2
+
+// options of AT+SSLOPT (see ASIM::setTLSOption)
+#define TLS_IGNORE_INVALID_CERT	0	// accept a server certificate that does not verify
+#define TLS_CLIENT_AUTH			1	// send the client certificate of ASIM::setTLSCertificate
+
+// command classes of the adaptive timeouts (see ASIM::setTimeoutBounds)
+#define SIM_TIMEOUT_LOCAL	0	// settings and queries answered by the modem itself
+#define SIM_TIMEOUT_STORAGE	1	// SMS storage
+#define SIM_TIMEOUT_NETWORK	2	// SMS, USSD, calls, location and NTP, answered by the network
+#define SIM_TIMEOUT_GPRS	3	// bearer and PDP context settings, shut down
+#define SIM_TIMEOUT_ATTACH	4	// GPRS attach and PDP context activation
+#define SIM_TIMEOUT_TCP		5	// TCP connect and send
+#define SIM_TIMEOUT_CLASSES	6
+#define SIM_TIMEOUT_NONE	255
 // Configs, Feel free to change them according to your project
 #define FULL_CONFIG
 #define DEFAULT_TIMOUT 		100
@@ -98,17 +153,330 @@
 #define HEX_CHARSET			"HEX"
 #define SET_SMS_PARAM
 // #define SET_LANG_TO_ENG
+#define SIM_REPLY_SIZE		255
+// Numeric result codes (ATV0): "0<CR>" instead of "<CR><LF>OK<CR><LF>" (see ASIM::setResultFormat)
+// #define SIM_NUMERIC_RESULTS
+// Stack monitor, reports the stack used by every API call (see ASIM::setStackHook)
+// #define SIM_STACK_MONITOR
+#define SIM_STACK_WINDOW	1024
+// Sleep (see ASIM::setSleepMode): interval and limit of the AT probes that wake the modem, in ms
+#define SIM_WAKE_PROBE		20
+#define SIM_WAKE_TIMEOUT	1000
+// UART silence after which a SLEEP_AUTO modem sleeps, in ms
+#define SIM_SLEEP_IDLE		5000
+// Ring indicator (see ASIM::dispatchEvents): modems with an RI pin, wait for the URC after an RI pulse in ms
+#define SIM_RI_MODEMS		2
+#define SIM_RI_DRAIN		100
+// Per command statistics: latency histogram, timeouts, errors and bytes (see ASIM::getStats)
+// #define SIM_STATS
+#define SIM_STATS_SLOTS		16
+#define SIM_STATS_TAG		14
+#define SIM_STATS_BUCKETS	12
+// Trace: the last SIM_TRACE_SIZE commands and replies in a ring buffer (see ASIM::dumpTrace)
+// #define SIM_TRACE
+#define SIM_TRACE_SIZE		32
+// Async jobs (see ASIMAsync): jobs waiting per modem, how long an HTTP job waits for the server and the bytes of
+// one AT+HTTPREAD of its body
+#define SIM_ASYNC_QUEUE		4
+#define SIM_ASYNC_HTTP_TIMEOUT	30000
+#define SIM_ASYNC_HTTP_READ		256
+// Modem pool (see ASIMPool): modems, queued jobs and the age of the signal quality used to pick a modem
+#define SIM_POOL_SIZE		8
+#define SIM_POOL_QUEUE		16
+#define SIM_POOL_SIGNAL_AGE	60000
+// Link monitor (see ASIMLink): time between samples, between pings, the ping target and the samples kept
+#define SIM_LINK_PERIOD		30000
+#define SIM_LINK_PING_PERIOD	120000
+#define SIM_LINK_PING_HOST	"8.8.8.8"
+#define SIM_LINK_HISTORY	16
+#define SIM_LINK_CELLS		6
+// Transfer scheduler (see ASIMScheduler): held bulk jobs, their default deadline in ms and the link they wait for
+#define SIM_SCHED_QUEUE		8
+#define SIM_SCHED_DEADLINE	600000
+#define SIM_SCHED_MIN_RSSI	12
+#define SIM_SCHED_MAX_RTT	1500
+// DNS servers set by AT+CDNSCFG for the operators with APN_QUIRK_DNS
+#define SIM_APN_DNS			"\"8.8.8.8\",\"1.1.1.1\""
+// GPRS bearer (see ASIM::maintainGPRS): first and longest wait between two reconnects after +PDP: DEACT, in ms
+#define SIM_BEARER_BACKOFF	1000
+#define SIM_BEARER_BACKOFF_MAX	60000
+// HTTP (see ASIM::httpRequest): header lines of a request and the default wait for the server, in ms
+#define SIM_HTTP_HEADERS	4
+#define SIM_HTTP_TIMEOUT	30000
+// HTTP cache (see ASIMHttpCache): URLs kept
+#define SIM_HTTP_CACHE		4
+// Cell location (see ASIMLocation): how long a fix is served from the cache and the wait after a failed refresh, in ms
+#define SIM_LOCATION_TTL	600000
+#define SIM_LOCATION_RETRY	30000
+// RTOS (FreeRTOS, e.g. ESP32): a reader task owns the UART and queues what it receives, API calls from
+// several tasks take turns on a recursive mutex and block on the queue instead of polling (see ASIM::lock)
+// #define SIM_RTOS
+#define SIM_RTOS_LINE		64
+#define SIM_RTOS_QUEUE		16
+#define SIM_RTOS_STACK		2048	// bytes on ESP32, words on other FreeRTOS ports
+#define SIM_RTOS_PRIORITY	5
+
+// adaptive timeout of one command class, like the TCP retransmission timeout (RFC 6298)
+struct ASIMTimeout {
+	uint16_t srtt;			// smoothed latency in ms, 0 before the first sample
+	uint16_t rttvar;		// latency variation in ms
+	uint16_t rto;			// current timeout in ms
+	uint16_t floor;
+	uint16_t ceiling;
+	uint8_t backoff;		// doublings after unanswered commands
+};
+
+// network registration, kept up to date by the +CREG/+CGREG URCs (see ASIM::trackRegistration)
+struct ASIMRegistration {
+	uint8_t cs;				// circuit switched (calls, SMS, USSD): REG_HOME, REG_ROAMING, REG_SEARCHING, ...
+	uint8_t ps;				// packet switched (GPRS)
+	uint16_t lac;			// location area code
+	uint16_t ci;			// cell ID
+	uint32_t changed_ms;	// millis() of the last change of cs or ps
+};
+
+// sleep statistics, times in ms
+struct ASIMPowerStats {
+	uint32_t wakes;
+	uint32_t wake_failures;	// wakes without an answer to AT
+	uint16_t wake_last;		// from wake() to the first answered AT
+	uint16_t wake_max;
+	uint32_t wake_total;
+	uint32_t awake_ms;
+	uint32_t asleep_ms;
+};
+
+// TLS statistics, times in ms. The modem reports no handshake on its own, the times hold it and the rest of the exchange
+struct ASIMTLSStats {
+	uint32_t connects;			// TLS connections set up: AT+CIPSTART after AT+CIPSSL=1
+	uint32_t reuses;			// TLS connections still open (ALREADY CONNECT), no handshake
+	uint32_t requests;			// HTTPS requests answered, the modem does a full handshake for each one
+	uint32_t failures;			// CONNECT FAIL, no answer or status 605 and 606 to an HTTPS request
+	uint32_t connect_last;		// AT+CIPSTART to CONNECT OK: DNS, TCP connect and handshake
+	uint32_t connect_max;
+	uint32_t connect_total;
+	uint32_t request_last;		// AT+HTTPACTION to +HTTPACTION: the whole HTTPS request, handshake included
+	uint32_t request_max;
+	uint32_t request_total;
+};
+
+// GPRS bearer statistics, times in ms
+struct ASIMBearerStats {
+	uint32_t bringups;		// enableGPRS() that activated the context
+	uint32_t reuses;		// enableGPRS() that found it active
+	uint32_t reconnects;	// contexts restored by maintainGPRS()
+	uint32_t failures;
+	uint32_t deacts;		// +PDP: DEACT received
+	uint32_t up_last;		// duration of the last successful enableGPRS()
+	uint32_t up_max;
+	uint32_t up_total;
+};
+
+// APN and login of the operator, from the operator table (strings in flash) or ASIM::setAPN() (strings in RAM)
+struct ASIMAPN {
+	const char *apn;			// NULL: unknown operator
+	const char *user;
+	const char *password;
+	uint8_t quirks;				// APN_QUIRK_*
+	uint8_t type;				// MCI, IRANCELL, ... UNKNOWN_SIM
+	bool flash;
+};
+
+// final result of the last command, see ASIM::getLastError()
+struct ASIMError {
+	uint8_t result;			// the FINAL_* code that ended the command, 0 if the command timed out
+	uint16_t code;			// the <n> of +CME ERROR: <n> or +CMS ERROR: <n>, 0 otherwise
+	bool failed() const;	// the modem rejected the command (ERROR, +CME/+CMS ERROR, SEND FAIL, ...)
+};
 
 // a few typedefs to keep things portable
 typedef Stream ASIMStreamType;
 typedef const __FlashStringHelper *ASIMFlashString;
 
-// public buffer to store replies
+// command builder parts (see ASIM::quoted() and ASIM::padded())
+struct ASIMQuoted {
+	const char *text;
+	bool flash;
+};
+
+struct ASIMPadded {
+	uint32_t value;
+	uint8_t width;
+};
+
+// text in RAM or in flash, written as it is
+struct ASIMText {
+	const char *text;
+	bool flash;
+	ASIMText() : text(""), flash(false) {}
+	ASIMText(const char *value) : text(value ? value : ""), flash(false) {}
+	ASIMText(ASIMFlashString value) : text((const char *)value), flash(true) {}
+	bool empty() const;
+	uint16_t length() const;
+};
+
+#ifdef SHOW_SIM_DEBUG
+// copies every command byte to the debug stream
+class ASIMTee : public Print {
+	public:
+		ASIMTee(Print &out, Print &copy) : _out(out), _copy(copy) {}
+		size_t write(uint8_t x) {
+			_copy.write(x);
+			return _out.write(x);
+		}
+	private:
+		Print &_out;
+		Print &_copy;
+};
+#endif
+
+// statistics of one command (AT+CSQ, AT+HTTPACTION, ...), latencies are in ms
+// histogram[i] counts the latencies below 16 << i ms, the last bucket also holds the slower ones
+struct ASIMCommandStats {
+	char tag[SIM_STATS_TAG];
+	uint16_t count;
+	uint16_t timeouts;
+	uint16_t errors;
+	uint32_t tx;
+	uint32_t rx;
+	uint32_t min_ms;
+	uint32_t max_ms;
+	uint32_t total_ms;
+	uint32_t longest_block_ms;
+	uint16_t histogram[SIM_STATS_BUCKETS];
+	uint32_t percentile(uint8_t pct) const;
+};
+
+// one trace event: a command sent (result TRACE_SEND) or the reply read for it
+#define TRACE_SEND			0xFE
+#define TRACE_TIMEOUT		0xFF
+struct ASIMTraceEvent {
+	uint32_t ms;
+	ASIMFlashString command;
+	uint8_t result;			// TRACE_SEND, TRACE_TIMEOUT, a FINAL_* code or 0 for a reply without one
+	uint8_t length;			// bytes sent or reply length
+};
+
+class ASIM;
+
+#if defined(SIM_STATS) || defined(SIM_TRACE)
+	#define SIM_INSTRUMENT
+// measures one blocking read of the modem answer
+class ASIMRead {
+	public:
+		ASIMRead(ASIM &sim, bool reply);
+		~ASIMRead();
+		bool complete;
+	private:
+		ASIM &_sim;
+		uint32_t _start;
+		bool _reply;
+};
+	#define SIM_COMMAND(tag)		commandBegin(F(tag))
+	#define SIM_SENT(x)				commandSent(x)
+	#define SIM_READ(reply)			ASIMRead _sim_read(*this, reply)
+	#define SIM_READ_DONE()			_sim_read.complete = true
+#else
+	#define SIM_COMMAND(tag)
+	#define SIM_SENT(x)				(x)
+	#define SIM_READ(reply)
+	#define SIM_READ_DONE()
+#endif
+#ifdef SIM_STATS
+	#define SIM_RX()				_stats_rx++
+#else
+	#define SIM_RX()
+#endif
+
+// stack monitor hook, called with the API name and the stack bytes used by the call
+typedef void (*ASIMStackHook)(ASIMFlashString api, uint16_t used);
+
+// URC hook of dispatchEvents(), called with the URC_* code and the line (e.g. "+CMTI: \"SM\",3")
+typedef void (*ASIMURCHook)(uint8_t urc, const char *line, void *arg);
+
+class ASIMGNSS;
+class ASIMHttpRequest;
+class ASIMHttpResponse;
+class ASIMHttpCache;
+struct ASIMHttpCacheEntry;
+
+// command part of AT+HTTPPARA="USERDATA": the header lines of a request and the Last-Modified of its cached answer
+struct ASIMHttpHeaders {
+	const ASIMHttpRequest *request;
+	const ASIMHttpCacheEntry *cached;
+};
+
+#ifdef SIM_STACK_MONITOR
+// paints the free stack below the outermost API call and measures it from the top of the frame of the call (its
+// canonical frame address, the stack pointer of the caller) when it returns
+class ASIMStackProbe {
+	public:
+		ASIMStackProbe(ASIMFlashString api, void *frame);
+		~ASIMStackProbe();
+	private:
+		ASIMFlashString _api;
+		uintptr_t _top;
+};
+	#define SIM_PROBE(name)		ASIMStackProbe _sim_stack_probe(F(name), __builtin_dwarf_cfa())
+#else
+	#define SIM_PROBE(name)
+#endif
+
+#ifdef SIM_RTOS
+	#if defined(ESP32) || defined(ESP_PLATFORM)
+		#include <freertos/FreeRTOS.h>
+		#include <freertos/queue.h>
+		#include <freertos/semphr.h>
+		#include <freertos/task.h>
+	#elif defined(ARDUINO_ARCH_STM32)
+		#include <STM32FreeRTOS.h>
+	#else
+		#include <Arduino_FreeRTOS.h>
+		#include <queue.h>
+		#include <semphr.h>
+	#endif
+
+// a line, or the part of one the UART received before it went quiet, passed from the reader task
+struct ASIMLine {
+	uint8_t length;
+	char data[SIM_RTOS_LINE];
+};
+
+// holds the command mutex of a modem for one API call
+class ASIMLock {
+	public:
+		ASIMLock(ASIM &sim);
+		~ASIMLock();
+	private:
+		ASIM &_sim;
+};
+	#define SIM_LOCK()			ASIMLock _sim_lock(*this)
+	// a non-blocking command holds the mutex from its start to its answer
+	#define SIM_HOLD()			if (!_polling) lock()
+	#define SIM_RELEASE()		unlock()
+#else
+	#define SIM_LOCK()
+	#define SIM_HOLD()
+	#define SIM_RELEASE()
+#endif
+
+// wakes a sleeping modem for the outermost API call and lets it sleep again afterwards
+class ASIMAwake {
+	public:
+		ASIMAwake(ASIM &sim);
+		~ASIMAwake();
+	private:
+		ASIM &_sim;
+};
+
+// every public API call: one task at a time, modem awake, stack monitor
+#define SIM_API(name)			SIM_LOCK(); ASIMAwake _sim_awake(*this); SIM_PROBE(name)
 /**********************************************************************************************************************************/
 class ASIM {
 	public:
 		// Basic
-		ASIM(byte in_pwr, byte pwr_key, byte rst);
+		ASIM(byte in_pwr, byte pwr_key, byte rst, byte dtr = 0, byte ri = 0);
+		~ASIM();
 		bool begin(ASIMStreamType &port, int setup_wait);
 		// Stream
 		int available(void);
@@ -118,13 +486,66 @@ class ASIM {
 		int peek(void);
 		void flush();
 		// Send command and verify reply
-		bool sendVerifyedCommand(char *send, char *reply, uint16_t timeout = DEFAULT_TIMOUT);
-		bool sendVerifyedCommand(ASIMFlashString send, ASIMFlashString reply, uint16_t timeout = DEFAULT_TIMOUT);
-  		bool sendVerifyedCommand(char *send, ASIMFlashString reply, uint16_t timeout = DEFAULT_TIMOUT);
+		template<typename Send, typename Reply>
+		bool sendVerifyedCommand(const Send &send, const Reply &reply, uint16_t timeout = DEFAULT_TIMOUT) {
+			return sendCheckReply(reply, timeout, send);
+		}
+		// Command builder: every part is streamed straight to the modem
+		template<typename Reply, typename... Parts>
+		bool sendCheckReply(const Reply &reply, uint16_t timeout, const Parts &... parts) {
+			if (!getReply(timeout, parts...)) {
+				return false;
+			}
+			return replyIs(reply);
+		}
+		template<typename... Parts>
+		uint8_t getReply(uint16_t timeout, const Parts &... parts) {
+			#ifdef SIM_INSTRUMENT
+				commandParts(parts...);
+			#endif
+			flushInput();
+			DEBUG_PRINT(F("\t ---> "));
+			#if defined(SHOW_SIM_DEBUG) && (SIM_LOG_LEVEL >= SIM_LOG_DEBUG)
+				ASIMTee tee(*simSerial, DebugStream);
+				Print &out = (_log_level >= SIM_LOG_DEBUG) ? (Print &)tee : (Print &)*simSerial;
+			#else
+				Print &out = *simSerial;
+			#endif
+			SIM_SENT(writeParts(out, parts...));
+			SIM_SENT(out.println());
+			return readReply(timeout);
+		}
+		// Non-blocking commands: start one, then call pollAnswer() until it is not SIM_PENDING
+		template<typename... Parts>
+		void startCommand(uint8_t cls, const Parts &... parts) {
+			SIM_HOLD();
+			if (_asleep) {
+				wake();
+			}
+			#ifdef SIM_INSTRUMENT
+				commandParts(parts...);
+			#endif
+			discardInput();
+			SIM_SENT(writeParts(*simSerial, parts...));
+			SIM_SENT(simSerial->println());
+			startAnswer(timeoutFor(cls), 0);
+		}
+		void startData(const char *data, bool ctrl_z, uint8_t cls);
+		void startData(ASIMText data, uint16_t length, uint8_t cls);
+		void startResult(uint8_t cls);
+		void startURC(uint8_t urc, uint16_t timeout);
+		uint8_t pollAnswer();
+		bool busy();
+		static ASIMQuoted quoted(const char *text);
+		static ASIMQuoted quoted(ASIMFlashString text);
+		static ASIMPadded padded(uint32_t value, uint8_t width);
 		bool parseReplyQuoted(char *buffer, ASIMFlashString toreply, char *v, int maxlen, char divider, uint8_t index);
 		// Modem information
 		uint8_t getModemType();
 		int8_t getSimType();
+		const char *getOperator();
+		bool setAPN(const char *apn, const char *user = "", const char *password = "", uint8_t quirks = 0);
+		const ASIMAPN &getAPN();
 		uint8_t getIMEI();
 		// Modem status
 		bool checkregistration();
@@ -140,6 +561,22 @@ class ASIM {
 		bool setCallerIdNotification();
 		bool setSMSParameters(uint8_t fo, uint16_t vp, uint8_t pid, uint8_t dcs);
 		bool setSIMLanguage(uint8_t lang);
+		bool setResultFormat(uint8_t format);
+		// Sleep
+		bool setSleepMode(uint8_t mode);
+		bool wake();
+		void sleep();
+		bool asleep();
+		const ASIMPowerStats &getPowerStats();
+		void resetPowerStats();
+		// Network registration
+		bool trackRegistration();
+		const ASIMRegistration &getRegistration();
+		bool registered(bool packet = false);
+		// Events (RI pin)
+		bool pending();
+		uint8_t dispatchEvents();
+		void onURC(ASIMURCHook hook, void *arg = NULL);
 		bool softReset();
 		bool hardReset();
 		// Calls
@@ -161,7 +598,17 @@ class ASIM {
 		// GPRS handling
 		bool enableGPRS();
 		bool disableGPRS();
+		bool maintainGPRS();
+		const ASIMBearerStats &getBearerStats();
+		void resetBearerStats();
 		bool getGPRSLocation(uint16_t *error, float *lat, float *lon);
+		bool getGPRSLocation(uint16_t *error, int32_t *lat, int32_t *lon);
+		static int32_t microDegrees(const char *text);
+		// GNSS (SIM808)
+		bool setGNSSPower(bool on);
+		bool getGNSSInfo(ASIMGNSS &gnss);
+		bool setGNSSStream(bool on);
+		bool readGNSS(ASIMGNSS &gnss);
 		// HTTP
 		bool initHttp();
 		bool termHttp();
@@ -172,10 +619,17 @@ class ASIM {
 		bool setHttpAction(uint8_t method, uint16_t *status, uint16_t *data_len, int32_t timeout);
 		bool readHttpResponse(uint16_t *data_len);
 		bool postHttpRequest(String url, String auth_token, String data, uint16_t server_timeout, char *server_response);
+		bool httpRequest(const ASIMHttpRequest &request, ASIMHttpResponse &response);
+		bool httpClose();
+		// TLS
+		bool setTLSOption(uint8_t option, bool enable);
+		bool setTLSCertificate(ASIMText file, ASIMText password = ASIMText());
+		const ASIMTLSStats &getTLSStats();
+		void resetTLSStats();
 		// TCP/IP connection
 		uint8_t getTCPStatus();
 		bool establishTCP();
-		bool startTCP(char *server, uint16_t port);
+		bool startTCP(char *server, uint16_t port, bool tls = false);
 		bool closeTCP();
 		bool sendTCPData(char *data, char *response);
 		// RTC
@@ -185,27 +639,77 @@ class ASIM {
   		bool syncNTPTime(uint16_t *error_code, char *ntp_server, uint8_t region);
 		// PWM
 		bool setPWM(uint8_t channel, uint16_t period, uint8_t duty);
+		// Stack monitor
+		static void setStackHook(ASIMStackHook hook);
+		static uint16_t getStackHighWater();
+		// Statistics
+		const ASIMCommandStats *getStats(uint8_t *count);
+		void resetStats();
+		void printStats(Print &out);
+		// Adaptive timeouts
+		void setTimeoutBounds(uint8_t cls, uint16_t floor_ms, uint16_t ceiling_ms);
+		uint16_t getTimeout(uint8_t cls);
+		void resetTimeouts();
+		// Final result of the last command
+		const ASIMError &getLastError();
+		// Log and trace
+		static void setLogLevel(uint8_t level);
+		void dumpTrace(Print &out);
+		void clearTrace();
+		static uint8_t _log_level;
+		#ifdef SIM_RTOS
+			// RTOS: hold the modem across several calls, wake the reader task when the UART receives
+			void lock();
+			void unlock();
+			void rxEvent();
+			void rxEventFromISR();
+		#endif
 		// Vars
 		ASIMStreamType *simSerial;
+		// public buffer to store replies, also the scratch space of every API call
+		char replybuffer[SIM_REPLY_SIZE];
 		uint8_t _sim_type = UNKNOWN_SIM;
-		char _modem_ip[15];
+		char _modem_ip[16];
 	private:
 		// Stream
 		void flushInput();
-		uint8_t readAnswer(uint16_t timeout = DEFAULT_TIMOUT, bool multiline = false);
-		uint8_t readAnswerLn(uint16_t timeout = DEFAULT_TIMOUT, bool multiline = false);
-		// Send command and verify reply
-		bool sendVerifyedCommand(ASIMFlashString prefix, char *suffix, ASIMFlashString reply, uint16_t timeout = DEFAULT_TIMOUT);
-		bool sendVerifyedCommand(ASIMFlashString prefix, int32_t suffix, ASIMFlashString reply, uint16_t timeout = DEFAULT_TIMOUT);
-		bool sendVerifyedCommand(ASIMFlashString prefix, int32_t suffix, int32_t suffix2, ASIMFlashString reply, uint16_t timeout = DEFAULT_TIMOUT);
-		bool sendVerifyedCommandQuoted(ASIMFlashString prefix, ASIMFlashString suffix, ASIMFlashString reply, uint16_t timeout = DEFAULT_TIMOUT);
+		uint8_t readAnswer(uint16_t timeout = DEFAULT_TIMOUT);
+		uint8_t readAnswerLn(uint16_t timeout = DEFAULT_TIMOUT);
+		uint8_t readLine(uint16_t timeout = DEFAULT_TIMOUT);
+		bool finalResult(const char *line);
+		void answerBegin(uint8_t urc);
+		bool answerFeed(char c);
+		void startAnswer(uint16_t timeout, uint8_t urc);
+		void expectData(const char *prefix, char *buffer, uint16_t size);
+		void discardInput();
+		// Receive: the UART, or the queue of the reader task in RTOS mode
+		bool rxAvailable();
+		int rxRead();
+		bool rxWait(uint32_t start, uint16_t timeout);
+		uint8_t numericResult(uint16_t line_start, uint16_t *replyidx);
+		bool waitURC(uint8_t urc, uint16_t timeout);
+		// Command builder
+		static size_t writeParts(Print &) { return 0; }
+		template<typename Part, typename... Rest>
+		static size_t writeParts(Print &out, const Part &part, const Rest &... rest) {
+			size_t n = writePart(out, part);
+			return n + writeParts(out, rest...);
+		}
+		template<typename Part>
+		static size_t writePart(Print &out, const Part &part) {
+			return out.print(part);
+		}
+		static size_t writePart(Print &out, const ASIMQuoted &part);
+		static size_t writePart(Print &out, const ASIMPadded &part);
+		static size_t writePart(Print &out, const ASIMText &part);
+		static size_t writePart(Print &out, const ASIMHttpHeaders &part);
+		// Adaptive timeouts
+		uint16_t timeoutFor(uint8_t cls);
+		void timeoutSample(uint16_t elapsed, bool complete, bool answered);
 		// Get and parse reply from GSM
-		uint8_t getReply(char *send, uint16_t timeout = DEFAULT_TIMOUT);
-		uint8_t getReply(ASIMFlashString send, uint16_t timeout = DEFAULT_TIMOUT);
-		uint8_t getReply(ASIMFlashString prefix, char *suffix, uint16_t timeout = DEFAULT_TIMOUT);
-		uint8_t getReply(ASIMFlashString prefix, int32_t suffix, uint16_t timeout = DEFAULT_TIMOUT);
-		uint8_t getReply(ASIMFlashString prefix, int32_t suffix1, int32_t suffix2,uint16_t timeout); 
-		uint8_t getReplyQuoted(ASIMFlashString prefix, ASIMFlashString suffix,uint16_t timeout = DEFAULT_TIMOUT);
+		uint8_t readReply(uint16_t timeout);
+		bool replyIs(const char *reply);
+		bool replyIs(ASIMFlashString reply);
 		bool sendParseReply(ASIMFlashString tosend, ASIMFlashString toreply, uint16_t *v, char divider = ',', uint8_t index = 0);
 		bool parseReply(ASIMFlashString toreply, uint16_t *v, char divider = ',', uint8_t index = 0);
   		bool parseReply(ASIMFlashString toreply, char *v, char divider = ',', uint8_t index = 0);
@@ -216,10 +720,123 @@ class ASIM {
 		byte _in_pwr_pin;
 		byte _pwr_key_pin;
 		byte _rst_pin;
+		byte _dtr_pin;
+		byte _ri_pin;
 		char _imei[20];
+		char _operator[7] = "";
+		ASIMAPN _apn = { NULL, NULL, NULL, 0, UNKNOWN_SIM, false };
+		bool _apn_set = false;
 		bool _incoming_call = false;
 		bool _gprs_on = false;
+		// bearer
+		bool openBearer(bool *reused);
+		bool bearerOpen();
+		void bearerLost();
+		bool _gprs_wanted = false;
+		uint32_t _bearer_retry_ms = 0;
+		uint32_t _bearer_backoff = SIM_BEARER_BACKOFF;
+		ASIMBearerStats _bearer = { 0, 0, 0, 0, 0, 0, 0, 0 };
+		// HTTP session, kept open between the requests and shared with the HTTP jobs of ASIMAsync
+		friend class ASIMHttpResponse;
+		friend class ASIMAsync;
+		bool httpBegin(const ASIMHttpRequest &request);
+		uint16_t httpRead(ASIMHttpResponse &response, char *buffer, uint16_t size);
+		uint16_t readData(char *buffer, uint16_t length, uint16_t timeout);
+		bool httpHead(ASIMHttpCache &cache, uint32_t key, uint32_t length);
+		void readModified(ASIMHttpCacheEntry &entry, uint16_t length, uint16_t timeout);
+		static void takeModified(ASIMHttpCacheEntry &entry, const char *line);
+		void writeData(ASIMText data, uint16_t length);
+		bool _http_open = false;
+		bool _http_ssl = false;
+		// TLS
+		void tlsDone(bool request, uint32_t start, bool ok);
+		uint8_t _tcp_ssl = 255;		// the last AT+CIPSSL, 255 before the first one
+		ASIMTLSStats _tls = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
 		bool _tcp_running = false;
+		ASIMTimeout _timeouts[SIM_TIMEOUT_CLASSES];
+		uint8_t _timeout_class = SIM_TIMEOUT_NONE;
+		ASIMError _last_error = { 0, 0 };
+		bool _numeric_results = false;
+		// sleep
+		friend class ASIMAwake;
+		uint8_t _sleep_mode = SLEEP_OFF;
+		bool _asleep = false;
+		uint8_t _api_depth = 0;
+		uint32_t _power_since = 0;
+		ASIMPowerStats _power;
+		// registration
+		void registrationLine(const char *fields, bool packet);
+		ASIMRegistration _registration = { REG_UNTRACKED, REG_UNTRACKED, 0, 0, 0 };
+		// ring indicator
+		static void ringISR();
+		void ringBegin();
+		volatile bool _ri_pending = false;
+		ASIMURCHook _urc_hook = NULL;
+		void *_urc_arg = NULL;
+		// answer in progress
+		uint16_t _reply_idx = 0;
+		uint16_t _line_start = 0;
+		uint8_t _wait_urc = 0;
+		bool _polling = false;
+		uint8_t _poll_class = SIM_TIMEOUT_NONE;
+		uint16_t _poll_timeout = 0;
+		uint32_t _poll_start = 0;
+		// data announced by a line of the answer, see expectData()
+		const char *_data_prefix = NULL;
+		char *_data_buffer = NULL;
+		uint16_t _data_size = 0;
+		uint16_t _data_got = 0;
+		uint16_t _data_left = 0;
+		#ifdef SIM_RTOS
+			// reader task and command mutex
+			void rtosBegin();
+			static void readerTask(void *arg);
+			void readerLoop();
+			SemaphoreHandle_t _mutex = NULL;
+			QueueHandle_t _rx_queue = NULL;
+			TaskHandle_t _reader = NULL;
+			volatile bool _rx_events = false;
+			ASIMLine _rx_line;
+			uint8_t _rx_pos = 0;
+		#endif
+		#ifdef SIM_INSTRUMENT
+			// Statistics and trace of the command in flight
+			friend class ASIMRead;
+			template<typename Part, typename... Rest>
+			void commandParts(const Part &part, const Rest &... rest) {
+				commandBegin(F("DATA"));
+			}
+			template<typename... Rest>
+			void commandParts(const ASIMFlashString &part, const Rest &... rest) {
+				commandBegin(part);
+			}
+			void commandBegin(ASIMFlashString command);
+			size_t commandSent(size_t n);
+			void readDone(uint32_t start, bool reply, bool complete);
+		#endif
+		#ifdef SIM_TRACE
+			void trace(uint8_t result, uint8_t length);
+			ASIMFlashString _trace_command;
+			ASIMTraceEvent _trace[SIM_TRACE_SIZE];
+			uint8_t _trace_head = 0;
+			uint8_t _trace_count = 0;
+		#endif
+		#ifdef SIM_STATS
+			// Statistics, the command in flight is added to its slot when the next one starts
+			void statsBegin(ASIMFlashString command);
+			void statsEnd();
+			void statsRead(uint32_t start, bool reply, bool complete);
+			ASIMCommandStats _stats[SIM_STATS_SLOTS];
+			uint8_t _stats_used = 0;
+			int8_t _stats_slot = -1;
+			uint32_t _stats_start;
+			uint32_t _stats_end;
+			uint32_t _stats_block;
+			uint32_t _stats_tx;
+			uint32_t _stats_rx;
+			bool _stats_timeout;
+			bool _stats_error;
+		#endif
 };
 /**********************************************************************************************************************************/		  
 #endif
\ No newline at end of file
@@ -0,0 +1,814 @@
+/**********************************************************************************************************************************/
+#include "ASIMAsync.h"
+
+// Job steps, every step is one command in flight on the modem
+#define STEP_NONE			255
+#define STEP_SMS_START		0	// AT+CMGS="<number>", answered by the "> " prompt
+#define STEP_SMS_BODY		1	// <text>^Z, answered by +CMGS: <mr> and OK
+#define STEP_BEARER_QUERY	2	// AT+SAPBR=2,1
+#define STEP_BEARER_OPEN	3	// AT+SAPBR=1,1, only if the bearer is closed
+#define STEP_HTTP_TERM		4	// AT+HTTPTERM, a session left open before a reset of the MCU makes AT+HTTPINIT fail
+#define STEP_HTTP_INIT		5	// only if the HTTP session of the modem is closed, see ASIM::httpRequest()
+#define STEP_HTTP_CID		6
+#define STEP_HTTP_URL		7
+#define STEP_HTTP_SSL		8	// AT+HTTPSSL=<0|1>, only if it changes
+#define STEP_HTTP_HEADERS	9	// AT+HTTPPARA="USERDATA", the headers and the If-Modified-Since of the cache
+#define STEP_HTTP_CONTENT	10	// AT+HTTPPARA="CONTENT" of a POST
+#define STEP_HTTP_DATA		11	// AT+HTTPDATA=<length>,<time>, answered by DOWNLOAD
+#define STEP_HTTP_BODY		12
+#define STEP_HTTP_ACTION	13
+#define STEP_HTTP_RESULT	14	// +HTTPACTION: <method>,<status>,<length>
+#define STEP_HTTP_HEAD		15	// AT+HTTPHEAD, the Last-Modified of a 200 for the cache
+#define STEP_HTTP_READ		16	// AT+HTTPREAD=<offset>,<size>, until the body is read or the buffer is full
+#define STEP_COMMAND		17
+#define STEP_TCP_START		18	// AT+CIPSTART="TCP","<server>",<port>, answered by OK or ALREADY CONNECT
+#define STEP_TCP_CONNECT	19	// CONNECT OK or CONNECT FAIL
+#define STEP_TCP_SEND		20	// AT+CIPSEND, answered by the "> " prompt
+#define STEP_TCP_DATA		21	// <data>^Z, answered by SEND OK
+#define STEP_TCP_CLOSE		22	// AT+CIPCLOSE, answered by CLOSE OK once the network closed the connection
+#define STEP_LOCATION		23	// AT+CIPGSMLOC=1,1, answered by +CIPGSMLOC: <code>,<lon>,<lat>,<date>,<time>
+
+/**********************************************************************************************************************************/
+/**
+ * @brief Check if the job ended
+ *
+ * @return true: JOB_DONE or JOB_FAILED, false: queued or running
+*/
+bool ASIMJob::done() {
+	return (status == JOB_DONE) || (status == JOB_FAILED);
+}
+
+/**
+ * @brief Check if the job ended without an error
+ *
+ * @return true: JOB_DONE, false: otherwise
+*/
+bool ASIMJob::ok() {
+	return status == JOB_DONE;
+}
+
+/**
+ * @brief Set the function called when the job ends, at once if it already ended
+ *
+ * @param cb The callback, it gets the job and arg. The reply of the last command is still in the reply buffer of the modem
+ * @param arg Passed to the callback
+ * @return ASIMJob& The job
+*/
+ASIMJob &ASIMJob::then(ASIMJobCallback cb, void *arg) {
+	callback = cb;
+	callback_arg = arg;
+	if (done() && cb) {
+		cb(*this, arg);
+	}
+	return *this;
+}
+
+/**********************************************************************************************************************************/
+/**
+ * @brief Construct a runner without a modem, see begin()
+ *
+*/
+ASIMAsync::ASIMAsync() {
+	sim = NULL;
+	_step = STEP_NONE;
+}
+
+/**
+ * @brief Construct a runner for a modem, begin() must have been called on it
+ *
+ * @param sim The modem
+*/
+ASIMAsync::ASIMAsync(ASIM &sim) {
+	begin(sim);
+}
+
+/**
+ * @brief Attach the modem
+ *
+ * @param sim The modem, begin() must have been called on it
+*/
+void ASIMAsync::begin(ASIM &sim) {
+	this->sim = &sim;
+	_job = NULL;
+	_step = STEP_NONE;
+	_queue_head = 0;
+	_queue_count = 0;
+}
+
+/**
+ * @brief Queue any AT command answered by a final result code
+ *
+ * @param job The job to fill, it must stay valid until it ends
+ * @param command The command, e.g. F("AT+CSQ"). The reply is in the reply buffer when the job ends
+ * @param cls The timeout class of the command
+ * @return ASIMJob& The job
+*/
+ASIMJob &ASIMAsync::commandAsync(ASIMJob &job, ASIMFlashString command, uint8_t cls) {
+	job.type = JOB_COMMAND;
+	job.command = command;
+	job.timeout_class = cls;
+	job.response = NULL;
+	job.response_size = 0;
+	return submit(job);
+}
+
+/**
+ * @brief Queue an SMS
+ *
+ * @param job The job to fill, it must stay valid until it ends
+ * @param number The receiver number
+ * @param text The message, the modem must be in text mode (see ASIM::setMessageFormat)
+ * @return ASIMJob& The job
+*/
+ASIMJob &ASIMAsync::sendSMSAsync(ASIMJob &job, const char *number, const char *text) {
+	job.type = JOB_SMS;
+	job.target = number;
+	job.data = text;
+	job.response = NULL;
+	job.response_size = 0;
+	return submit(job);
+}
+
+/**
+ * @brief Queue an HTTP request, the modem opens its GPRS bearer if needed
+ *
+ * The job runs like ASIM::httpRequest(): on the HTTP session the modem keeps open, with the headers, content type,
+ * HTTPS and cache of the request. The body is read with AT+HTTPREAD=<offset>,<size> in pieces of
+ * SIM_ASYNC_HTTP_READ bytes. A 200 through a cache reads its header lines into the buffer first to keep
+ * Last-Modified, a job without a buffer leaves the cache as it was.
+ *
+ * @param job The job to fill, it must stay valid until it ends
+ * @param request The request, it must stay valid until the job ends
+ * @param response Buffer for the response body, NULL to drop it. A longer body than response_size - 1 bytes fails the
+ * job once the buffer is full: received tells what is in it, length what the body needs
+ * @param response_size The size of the buffer
+ * @return ASIMJob& The job, http_status, length and received hold the answer of the server
+*/
+ASIMJob &ASIMAsync::httpAsync(ASIMJob &job, const ASIMHttpRequest &request, char *response, uint16_t response_size) {
+	job.type = JOB_HTTP;
+	job.request = &request;
+	job.response = response;
+	job.response_size = response_size;
+	return submit(job);
+}
+
+/**
+ * @brief Queue an HTTP GET request, the modem opens its GPRS bearer if needed
+ *
+ * @param job The job to fill, it must stay valid until it ends
+ * @param url The URL
+ * @param response Buffer for the response body, NULL to drop it, see httpAsync()
+ * @param response_size The size of the buffer
+ * @return ASIMJob& The job, http_status, length and received hold the answer of the server
+*/
+ASIMJob &ASIMAsync::httpGetAsync(ASIMJob &job, const char *url, char *response, uint16_t response_size) {
+	job.type = JOB_HTTP_GET;
+	job.target = url;
+	job.data = NULL;
+	job.response = response;
+	job.response_size = response_size;
+	return submit(job);
+}
+
+/**
+ * @brief Queue an HTTP POST request, the modem opens its GPRS bearer if needed
+ *
+ * @param job The job to fill, it must stay valid until it ends
+ * @param url The URL
+ * @param body The request body, sent as text/plain
+ * @param response Buffer for the response body, NULL to drop it, see httpAsync()
+ * @param response_size The size of the buffer
+ * @return ASIMJob& The job, http_status, length and received hold the answer of the server
+*/
+ASIMJob &ASIMAsync::postHttpAsync(ASIMJob &job, const char *url, const char *body, char *response, uint16_t response_size) {
+	job.type = JOB_HTTP_POST;
+	job.target = url;
+	job.data = body;
+	job.response = response;
+	job.response_size = response_size;
+	return submit(job);
+}
+
+/**
+ * @brief Queue a TCP connection, the IP connection must be up (see ASIM::establishTCP)
+ *
+ * @param job The job to fill, it must stay valid until it ends
+ * @param server The server name or IP
+ * @param port The port
+ * @return ASIMJob& The job
+*/
+ASIMJob &ASIMAsync::startTCPAsync(ASIMJob &job, const char *server, uint16_t port) {
+	job.type = JOB_TCP_START;
+	job.target = server;
+	job.port = port;
+	job.response = NULL;
+	job.response_size = 0;
+	return submit(job);
+}
+
+/**
+ * @brief Queue data for the open TCP connection
+ *
+ * @param job The job to fill, it must stay valid until it ends
+ * @param data The data, the answer of the server arrives later as unsolicited data
+ * @return ASIMJob& The job
+*/
+ASIMJob &ASIMAsync::sendTCPDataAsync(ASIMJob &job, const char *data) {
+	job.type = JOB_TCP_SEND;
+	job.data = data;
+	job.response = NULL;
+	job.response_size = 0;
+	return submit(job);
+}
+
+/**
+ * @brief Queue closing the TCP connection
+ *
+ * @param job The job to fill, it must stay valid until it ends
+ * @return ASIMJob& The job
+*/
+ASIMJob &ASIMAsync::closeTCPAsync(ASIMJob &job) {
+	job.type = JOB_TCP_CLOSE;
+	job.response = NULL;
+	job.response_size = 0;
+	return submit(job);
+}
+
+/**
+ * @brief Queue a cell location request, the modem opens its GPRS bearer if needed
+ *
+ * @param job The job to fill, it must stay valid until it ends
+ * @return ASIMJob& The job. When it is done the +CIPGSMLOC line is in the reply buffer, see ASIM::microDegrees()
+*/
+ASIMJob &ASIMAsync::locationAsync(ASIMJob &job) {
+	job.type = JOB_LOCATION;
+	job.response = NULL;
+	job.response_size = 0;
+	return submit(job);
+}
+
+/**
+ * @brief Queue a filled job, a full queue fails it at once
+ *
+ * @param job The job
+ * @return ASIMJob& The job
+*/
+ASIMJob &ASIMAsync::submit(ASIMJob &job) {
+	prepare(job);
+	if (!enqueue(job)) {
+		job.status = JOB_FAILED;
+		job.finished_ms = job.queued_ms;
+	}
+	return job;
+}
+
+/**
+ * @brief Clear the result and the completion of a filled job and mark it queued
+ *
+ * @param job The job
+*/
+void ASIMAsync::prepare(ASIMJob &job) {
+	job.status = JOB_QUEUED;
+	job.modem = -1;
+	job.http_status = 0;
+	job.length = 0;
+	job.received = 0;
+	job.error.result = 0;
+	job.error.code = 0;
+	job.queued_ms = millis();
+	job.started_ms = 0;
+	job.finished_ms = 0;
+	job.step = STEP_NONE;
+	job.callback = NULL;
+	job.callback_arg = NULL;
+	job.waiter = NULL;
+}
+
+/**
+ * @brief Put a prepared job at the end of the queue
+ *
+ * @param job The job
+ * @return true: queued, false: the queue is full
+*/
+bool ASIMAsync::enqueue(ASIMJob &job) {
+	if (_queue_count >= SIM_ASYNC_QUEUE) {
+		return false;
+	}
+	_queue[(_queue_head + _queue_count) % SIM_ASYNC_QUEUE] = &job;
+	_queue_count++;
+	return true;
+}
+
+/**
+ * @brief Run the jobs: collect the answer that arrived, start the next command or the next job
+ *
+ * Never waits, call it from the main loop as often as possible. Callbacks and coroutines waiting
+ * for a job run from here.
+*/
+void ASIMAsync::poll() {
+	if (_job) {
+		uint8_t result = sim->pollAnswer();
+		if (result == SIM_PENDING) {
+			return;
+		}
+		if (step(result)) {
+			issue();
+			return;
+		}
+	}
+
+	if ((!_job) && _queue_count) {
+		// URCs between two jobs, e.g. +CREG when the network is lost or back
+		if (sim->pending()) {
+			sim->dispatchEvents();
+		}
+		ASIMJob *job = _queue[_queue_head];
+		// a network job waits for the registration
+		if ((job->type != JOB_COMMAND) && !sim->registered(job->type != JOB_SMS)) {
+			return;
+		}
+		_queue_head = (_queue_head + 1) % SIM_ASYNC_QUEUE;
+		_queue_count--;
+		start(*job);
+	}
+}
+
+/**
+ * @brief Check if all the jobs ended
+ *
+ * @return true: nothing queued or running, false: otherwise
+*/
+bool ASIMAsync::idle() {
+	return (!_job) && (!_queue_count);
+}
+
+/**
+ * @brief Get the number of jobs waiting for the modem
+ *
+ * @return uint8_t The number of queued jobs
+*/
+uint8_t ASIMAsync::queued() {
+	return _queue_count;
+}
+
+/**
+ * @brief Set a function called for every job that ends, before the callback of the job
+ *
+ * @param hook The function, NULL to remove it
+ * @param arg Passed to the function
+*/
+void ASIMAsync::onFinish(ASIMJobCallback hook, void *arg) {
+	_hook = hook;
+	_hook_arg = arg;
+}
+
+/**
+ * @brief Start a job
+ *
+ * @param job The job
+*/
+void ASIMAsync::start(ASIMJob &job) {
+	_job = &job;
+	_http = NULL;
+	if ((job.type == JOB_HTTP_GET) || (job.type == JOB_HTTP_POST)) {
+		// the URL and the body of the job, no header
+		_request = ASIMHttpRequest((job.type == JOB_HTTP_POST) ? HTTPACTION_POST : HTTPACTION_GET, job.target);
+		_request.timeout(SIM_ASYNC_HTTP_TIMEOUT);
+		if (job.data) {
+			_request.body(job.data);
+		}
+		_http = &_request;
+	}
+	else if (job.type == JOB_HTTP) {
+		_http = job.request;
+	}
+	switch (job.type) {
+		case JOB_SMS:
+			_step = STEP_SMS_START;
+			break;
+		case JOB_COMMAND:
+			_step = STEP_COMMAND;
+			break;
+		case JOB_TCP_START:
+			_step = STEP_TCP_START;
+			break;
+		case JOB_TCP_SEND:
+			_step = STEP_TCP_SEND;
+			break;
+		case JOB_TCP_CLOSE:
+			_step = STEP_TCP_CLOSE;
+			break;
+		default:
+			_step = STEP_BEARER_QUERY;
+			break;
+	}
+	job.status = JOB_RUNNING;
+	job.started_ms = millis();
+	if (_http && _http->_overflow) {
+		// too many headers, see ASIMHttpRequest::header()
+		finish(false);
+		return;
+	}
+	issue();
+}
+
+/**
+ * @brief Choose the step after the bearer: the HTTP session an earlier request left open is used again
+ *
+ * @return uint8_t The step
+*/
+uint8_t ASIMAsync::afterBearer() {
+	if (_job->type == JOB_LOCATION) {
+		return STEP_LOCATION;
+	}
+	_http_reused = sim->_http_open;
+	_http_retried = false;
+	return _http_reused ? STEP_HTTP_URL : STEP_HTTP_INIT;
+}
+
+/**
+ * @brief Start the command of the current step
+ *
+*/
+void ASIMAsync::issue() {
+	ASIMJob *job = _job;
+	uint16_t size;
+
+	switch (_step) {
+		case STEP_SMS_START:
+			sim->startCommand(SIM_TIMEOUT_LOCAL, F("AT+CMGS="), ASIM::quoted(job->target));
+			break;
+		case STEP_SMS_BODY:
+			sim->startData(job->data, true, SIM_TIMEOUT_NETWORK);
+			break;
+		case STEP_BEARER_QUERY:
+			sim->startCommand(SIM_TIMEOUT_GPRS, F("AT+SAPBR=2,1"));
+			break;
+		case STEP_BEARER_OPEN:
+			sim->startCommand(SIM_TIMEOUT_ATTACH, F("AT+SAPBR=1,1"));
+			break;
+		case STEP_HTTP_TERM:
+			sim->startCommand(SIM_TIMEOUT_LOCAL, F("AT+HTTPTERM"));
+			break;
+		case STEP_HTTP_INIT:
+			sim->startCommand(SIM_TIMEOUT_LOCAL, F("AT+HTTPINIT"));
+			break;
+		case STEP_HTTP_CID:
+			sim->startCommand(SIM_TIMEOUT_LOCAL, F("AT+HTTPPARA=\"CID\",1"));
+			break;
+		case STEP_HTTP_URL: {
+			ASIMQuoted url = { _http->_url.text, _http->_url.flash };
+			sim->startCommand(SIM_TIMEOUT_LOCAL, F("AT+HTTPPARA=\"URL\","), url);
+			break;
+		}
+		case STEP_HTTP_SSL:
+			sim->startCommand(SIM_TIMEOUT_LOCAL, F("AT+HTTPSSL="), _http->secure() ? 1 : 0);
+			break;
+		case STEP_HTTP_HEADERS: {
+			// a GET through a cache asks the server for the body only if it changed
+			ASIMHttpCache *cache = (_http->_method == HTTPACTION_GET) ? _http->_cache : NULL;
+			_cached = NULL;
+			if (cache) {
+				_cache_key = ASIMHttpCache::hash(_http->_url);
+				_cached = cache->lookup(_cache_key);
+				cache->_stats.lookups++;
+				if (_cached) {
+					cache->_stats.conditional++;
+				}
+			}
+			// sent empty as well, the lines of the previous request would stay
+			ASIMHttpHeaders headers = { _http, _cached };
+			sim->startCommand(SIM_TIMEOUT_LOCAL, F("AT+HTTPPARA=\"USERDATA\",\""), headers, '"');
+			break;
+		}
+		case STEP_HTTP_CONTENT: {
+			ASIMQuoted content = { _http->_content.text, _http->_content.flash };
+			if (_http->_content.empty()) {
+				content = ASIM::quoted(F("text/plain"));
+			}
+			sim->startCommand(SIM_TIMEOUT_LOCAL, F("AT+HTTPPARA=\"CONTENT\","), content);
+			break;
+		}
+		case STEP_HTTP_DATA:
+			sim->startCommand(SIM_TIMEOUT_LOCAL, F("AT+HTTPDATA="), _http->_body_length, F(",10000"));
+			break;
+		case STEP_HTTP_BODY:
+			sim->startData(_http->_body, _http->_body_length, SIM_TIMEOUT_GPRS);
+			break;
+		case STEP_HTTP_ACTION:
+			_action_ms = millis();
+			sim->startCommand(SIM_TIMEOUT_LOCAL, F("AT+HTTPACTION="), _http->_method);
+			break;
+		case STEP_HTTP_RESULT:
+			sim->startURC(URC_HTTPACTION, _http->_timeout);
+			break;
+		case STEP_HTTP_HEAD:
+			sim->startCommand(SIM_TIMEOUT_LOCAL, F("AT+HTTPHEAD"));
+			sim->expectData(PSTR("+HTTPHEAD: "), job->response, job->response_size - 1);
+			break;
+		case STEP_HTTP_READ:
+			// what the body and the buffer still have room for, at most one piece
+			size = job->response_size - 1 - job->received;
+			if (size > SIM_ASYNC_HTTP_READ) {
+				size = SIM_ASYNC_HTTP_READ;
+			}
+			if (size > job->length - job->received) {
+				size = job->length - job->received;
+			}
+			sim->startCommand(SIM_TIMEOUT_LOCAL, F("AT+HTTPREAD="), job->received, ',', size);
+			sim->expectData(PSTR("+HTTPREAD: "), job->response + job->received, size);
+			break;
+		case STEP_COMMAND:
+			sim->startCommand(job->timeout_class, job->command);
+			break;
+		case STEP_TCP_START:
+			sim->startCommand(SIM_TIMEOUT_LOCAL, F("AT+CIPSTART=\"TCP\","), ASIM::quoted(job->target), F(",\""), job->port, '"');
+			break;
+		case STEP_TCP_CONNECT:
+			sim->startResult(SIM_TIMEOUT_TCP);
+			break;
+		case STEP_TCP_SEND:
+			sim->startCommand(SIM_TIMEOUT_LOCAL, F("AT+CIPSEND"));
+			break;
+		case STEP_TCP_DATA:
+			sim->startData(job->data, true, SIM_TIMEOUT_TCP);
+			break;
+		case STEP_TCP_CLOSE:
+			sim->startCommand(SIM_TIMEOUT_TCP, F("AT+CIPCLOSE"));
+			break;
+		case STEP_LOCATION:
+			sim->startCommand(SIM_TIMEOUT_NETWORK, F("AT+CIPGSMLOC=1,1"));
+			break;
+	}
+}
+
+/**
+ * @brief Handle the answer of the current step and choose the next one
+ *
+ * @param result The result of pollAnswer()
+ * @return true: a next command must be issued, false: the job ended
+*/
+bool ASIMAsync::step(uint8_t result) {
+	uint8_t final = sim->getLastError().result;
+	char *p;
+
+	if ((_step >= STEP_HTTP_TERM) && (_step <= STEP_HTTP_READ)) {
+		return httpStep(result);
+	}
+	if (result != SIM_OK) {
+		finish(false);
+		return false;
+	}
+
+	switch (_step) {
+		case STEP_SMS_START:
+		case STEP_TCP_SEND:
+			if (final != FINAL_PROMPT) {
+				finish(false);
+				return false;
+			}
+			_step++;
+			return true;
+		case STEP_SMS_BODY:
+			finish(strstr_P(sim->replybuffer, PSTR("+CMGS:")) != NULL);
+			return false;
+		case STEP_BEARER_QUERY:
+			// +SAPBR: 1,1,"<ip>" when the bearer is open
+			if (!strstr_P(sim->replybuffer, PSTR("+SAPBR: 1,1"))) {
+				_step = STEP_BEARER_OPEN;
+			}
+			else {
+				_step = afterBearer();
+			}
+			return true;
+		case STEP_BEARER_OPEN:
+			_step = afterBearer();
+			return true;
+		case STEP_LOCATION:
+			// <code> 0 is a location, 601 and up are errors of the network or the server
+			p = strstr_P(sim->replybuffer, PSTR("+CIPGSMLOC: "));
+			finish(p && (atoi(p + 12) == 0) && strchr(p, ','));
+			return false;
+		case STEP_TCP_START:
+			if (final == FINAL_ALREADY_CON) {
+				finish(true);
+				return false;
+			}
+			_step = STEP_TCP_CONNECT;
+			return true;
+		case STEP_COMMAND:
+		case STEP_TCP_CONNECT:
+		case STEP_TCP_DATA:
+		case STEP_TCP_CLOSE:
+			finish(true);
+			return false;
+	}
+	return false;
+}
+
+/**
+ * @brief Handle the answer of an HTTP step and choose the next one, see step()
+ *
+ * @param result The result of pollAnswer()
+ * @return true: a next command must be issued, false: the job ended
+*/
+bool ASIMAsync::httpStep(uint8_t result) {
+	ASIMJob *job = _job;
+	ASIMHttpCache *cache = (_http->_method == HTTPACTION_GET) ? _http->_cache : NULL;
+	ASIMHttpCacheEntry entry;
+	char *p;
+
+	if (result != SIM_OK) {
+		return httpFailed();
+	}
+	switch (_step) {
+		case STEP_HTTP_TERM:
+			_step = STEP_HTTP_INIT;
+			return true;
+		case STEP_HTTP_INIT:
+			sim->_http_open = true;
+			sim->_http_ssl = false;
+			_step = STEP_HTTP_CID;
+			return true;
+		case STEP_HTTP_CID:
+			_step = STEP_HTTP_URL;
+			return true;
+		case STEP_HTTP_URL:
+			// AT+HTTPSSL is a setting of the session, sent when it changes
+			_step = (_http->secure() != sim->_http_ssl) ? STEP_HTTP_SSL : STEP_HTTP_HEADERS;
+			return true;
+		case STEP_HTTP_SSL:
+			sim->_http_ssl = _http->secure();
+			_step = STEP_HTTP_HEADERS;
+			return true;
+		case STEP_HTTP_HEADERS:
+			_step = (_http->_method == HTTPACTION_POST) ? STEP_HTTP_CONTENT : STEP_HTTP_ACTION;
+			return true;
+		case STEP_HTTP_CONTENT:
+			_step = _http->_body_length ? STEP_HTTP_DATA : STEP_HTTP_ACTION;
+			return true;
+		case STEP_HTTP_DATA:
+			if (sim->getLastError().result != FINAL_DOWNLOAD) {
+				return httpFailed();
+			}
+			_step = STEP_HTTP_BODY;
+			return true;
+		case STEP_HTTP_BODY:
+			_step = STEP_HTTP_ACTION;
+			return true;
+		case STEP_HTTP_ACTION:
+			_step = STEP_HTTP_RESULT;
+			return true;
+		case STEP_HTTP_RESULT:
+			// +HTTPACTION: <method>,<status>,<length>
+			p = strchr(sim->replybuffer, ',');
+			if (!p) {
+				return httpFailed();
+			}
+			job->http_status = atoi(p + 1);
+			p = strchr(p + 1, ',');
+			job->length = p ? strtoul(p + 1, NULL, 10) : 0;
+			// 605 and 606: the TLS channel could not be set up or got a fatal alert
+			if (_http->secure()) {
+				sim->tlsDone(true, _action_ms, (job->http_status != 605) && (job->http_status != 606));
+			}
+			// 6xx are the errors of the modem, 601 (network error) is often a lost bearer. The session stays open
+			if (job->http_status >= 600) {
+				job->length = 0;
+				if (job->http_status == 601) {
+					sim->_gprs_on = false;
+				}
+				finish(false);
+				return false;
+			}
+			// 304: the body read after the last 200 is still valid, nothing to read from the modem
+			if (cache && (job->http_status == 304) && _cached) {
+				_cached->used = ++cache->_tick;
+				cache->_stats.hits++;
+				cache->_stats.saved += _cached->length;
+				job->length = 0;
+			}
+			else if (cache && (job->http_status == 200) && job->response && (job->response_size > 1)) {
+				_step = STEP_HTTP_HEAD;
+				return true;
+			}
+			return httpRead();
+		case STEP_HTTP_HEAD:
+			// the header lines as they are, a line cut by the end of the buffer is left out
+			job->response[sim->_data_got] = 0;
+			if (sim->_data_got == job->response_size - 1) {
+				p = strrchr(job->response, '\n');
+				*(p ? p : job->response) = 0;
+			}
+			memset(&entry, 0, sizeof(entry));
+			entry.key = _cache_key;
+			entry.length = job->length;
+			for (p = strtok(job->response, "\r\n"); p; p = strtok(NULL, "\r\n")) {
+				ASIM::takeModified(entry, p);
+			}
+			cache->store(entry);
+			job->response[0] = 0;
+			return httpRead();
+		case STEP_HTTP_READ:
+			if (!sim->_data_got) {
+				finish(false);
+				return false;
+			}
+			job->received += sim->_data_got;
+			job->response[job->received] = 0;
+			return httpRead();
+	}
+	return false;
+}
+
+/**
+ * @brief Read the next piece of the body or end the job
+ *
+ * @return true: a next AT+HTTPREAD must be issued, false: the job ended
+*/
+bool ASIMAsync::httpRead() {
+	ASIMJob *job = _job;
+	if ((!job->response) || (job->received >= job->length)) {
+		finish(true);
+		return false;
+	}
+	// the body does not fit: the buffer holds its start, length tells the size it needs
+	if (job->received + 1 >= job->response_size) {
+		finish(false);
+		return false;
+	}
+	_step = STEP_HTTP_READ;
+	return true;
+}
+
+/**
+ * @brief Handle a failed HTTP command: the session is opened again once if that can help, else the job fails
+ *
+ * @return true: a next command must be issued, false: the job ended
+*/
+bool ASIMAsync::httpFailed() {
+	switch (_step) {
+		case STEP_HTTP_TERM:
+			// closing a session that is not open fails, that is fine
+			_step = STEP_HTTP_INIT;
+			return true;
+		case STEP_HTTP_INIT:
+			// a session left open before a reset of the MCU makes AT+HTTPINIT fail, it is closed once
+			if (!_http_retried) {
+				_http_retried = true;
+				_step = STEP_HTTP_TERM;
+				return true;
+			}
+			break;
+		case STEP_HTTP_URL:
+			// a session closed behind our back (a reset of the modem) is opened again
+			if (_http_reused) {
+				_http_reused = false;
+				sim->_http_open = false;
+				_step = STEP_HTTP_INIT;
+				return true;
+			}
+			break;
+		case STEP_HTTP_RESULT:
+			if (_http->secure()) {
+				sim->tlsDone(true, _action_ms, false);
+			}
+			break;
+	}
+	// the next request closes and opens the session again, see ASIM::httpBegin()
+	sim->_http_open = false;
+	finish(false);
+	return false;
+}
+
+/**
+ * @brief End the running job, then tell the hook, the callback and the waiting coroutine
+ *
+ * @param ok true: the job succeeded, false: it failed (the error of the last command is kept in the job)
+*/
+void ASIMAsync::finish(bool ok) {
+	ASIMJob &job = *_job;
+	job.finished_ms = millis();
+	job.status = ok ? JOB_DONE : JOB_FAILED;
+	if (!ok) {
+		job.error = sim->getLastError();
+		job.step = _step;
+	}
+	_job = NULL;
+	_step = STEP_NONE;
+
+	if (_hook) {
+		_hook(job, _hook_arg);
+	}
+	if (job.callback) {
+		job.callback(job, job.callback_arg);
+	}
+	#if defined(__cpp_impl_coroutine)
+		// the coroutine may end and free the job, it is not touched afterwards
+		if (job.waiter) {
+			void *waiter = job.waiter;
+			job.waiter = NULL;
+			std::coroutine_handle<>::from_address(waiter).resume();
+		}
+	#endif
+}
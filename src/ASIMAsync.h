@@ -0,0 +1,162 @@
+/**********************************************************************************************************************************/
+#ifndef ASIM_ASYNC_H
+#define ASIM_ASYNC_H
+
+#include "ASIM.h"
+#include "ASIMHttp.h"
+
+#if defined(__cpp_impl_coroutine)
+	#include <coroutine>
+#endif
+
+/**********************************************************************************************************************************/
+// Job types
+#define JOB_SMS				0
+#define JOB_HTTP_GET		1
+#define JOB_HTTP_POST		2
+#define JOB_COMMAND			3
+#define JOB_TCP_START		4
+#define JOB_TCP_SEND		5
+#define JOB_TCP_CLOSE		6
+#define JOB_LOCATION		7
+#define JOB_HTTP			8
+
+// Job status
+#define JOB_IDLE			0
+#define JOB_QUEUED			1
+#define JOB_RUNNING			2
+#define JOB_DONE			3
+#define JOB_FAILED			4
+
+struct ASIMJob;
+
+// called once when a job is done or failed
+typedef void (*ASIMJobCallback)(ASIMJob &job, void *arg);
+
+// One modem operation. The caller owns the job and its buffers until the status is JOB_DONE or JOB_FAILED,
+// the job is also the handle to wait for it: poll done(), give it a callback with then() or co_await it.
+struct ASIMJob {
+	// request
+	uint8_t type;
+	const char *target;			// phone number, URL or TCP server
+	const char *data;			// SMS text, POST body or TCP data
+	const ASIMHttpRequest *request;	// request of a JOB_HTTP: method, URL, headers, body and cache
+	ASIMFlashString command;	// AT command of a JOB_COMMAND
+	char *response;				// HTTP response body, NULL to drop it
+	uint16_t response_size;
+	uint16_t port;				// TCP port
+	uint8_t timeout_class;		// timeout class of a JOB_COMMAND
+	// result
+	uint8_t status;
+	int8_t modem;				// index of the modem that ran the job in a pool, -1 before
+	uint16_t http_status;
+	uint32_t length;			// HTTP response length, from +HTTPACTION
+	uint16_t received;			// bytes of the body in response
+	ASIMError error;			// final result of the failed command
+	uint32_t queued_ms;
+	uint32_t started_ms;
+	uint32_t finished_ms;
+	// progress, the step that failed
+	uint8_t step;
+	// completion
+	ASIMJobCallback callback;
+	void *callback_arg;
+	void *waiter;				// suspended coroutine
+
+	bool done();
+	bool ok();
+	ASIMJob &then(ASIMJobCallback cb, void *arg = NULL);
+	#if defined(__cpp_impl_coroutine)
+		// co_await job: resumed by ASIMAsync::poll() when the job ends, true if it is done
+		struct Awaiter {
+			ASIMJob *job;
+			bool await_ready() {
+				return job->done();
+			}
+			void await_suspend(std::coroutine_handle<> handle) {
+				job->waiter = handle.address();
+			}
+			bool await_resume() {
+				return job->status == JOB_DONE;
+			}
+		};
+		Awaiter operator co_await() {
+			return Awaiter{ this };
+		}
+	#endif
+};
+
+#if defined(__cpp_impl_coroutine)
+// return type of a coroutine that co_awaits jobs, it starts at once and nobody waits for its end
+struct ASIMTask {
+	struct promise_type {
+		ASIMTask get_return_object() {
+			return ASIMTask();
+		}
+		std::suspend_never initial_suspend() {
+			return std::suspend_never();
+		}
+		std::suspend_never final_suspend() noexcept {
+			return std::suspend_never();
+		}
+		void return_void() {}
+		void unhandled_exception() {}
+	};
+};
+#endif
+
+/**********************************************************************************************************************************/
+// Runs the jobs of one modem one after the other without blocking, see poll()
+class ASIMAsync {
+	public:
+		ASIMAsync();
+		ASIMAsync(ASIM &sim);
+		void begin(ASIM &sim);
+		// Jobs, every call returns its job
+		ASIMJob &commandAsync(ASIMJob &job, ASIMFlashString command, uint8_t cls = SIM_TIMEOUT_LOCAL);
+		ASIMJob &sendSMSAsync(ASIMJob &job, const char *number, const char *text);
+		ASIMJob &httpAsync(ASIMJob &job, const ASIMHttpRequest &request, char *response, uint16_t response_size);
+		ASIMJob &httpGetAsync(ASIMJob &job, const char *url, char *response, uint16_t response_size);
+		ASIMJob &postHttpAsync(ASIMJob &job, const char *url, const char *body, char *response, uint16_t response_size);
+		ASIMJob &startTCPAsync(ASIMJob &job, const char *server, uint16_t port);
+		ASIMJob &sendTCPDataAsync(ASIMJob &job, const char *data);
+		ASIMJob &closeTCPAsync(ASIMJob &job);
+		ASIMJob &locationAsync(ASIMJob &job);
+		ASIMJob &submit(ASIMJob &job);
+		static void prepare(ASIMJob &job);
+		// Run
+		void poll();
+		bool idle();
+		uint8_t queued();
+		void onFinish(ASIMJobCallback hook, void *arg);
+		ASIM *sim;
+	private:
+		friend class ASIMPool;
+		friend class ASIMScheduler;
+		bool enqueue(ASIMJob &job);
+		void start(ASIMJob &job);
+		void issue();
+		bool step(uint8_t result);
+		void finish(bool ok);
+		uint8_t afterBearer();
+		bool httpStep(uint8_t result);
+		bool httpRead();
+		bool httpFailed();
+		ASIMJob *_job = NULL;
+		uint8_t _step;
+		// HTTP job: its request (a GET or POST job is turned into _request), the session and the cache
+		ASIMHttpRequest _request = ASIMHttpRequest(HTTPACTION_GET, ASIMText());
+		const ASIMHttpRequest *_http = NULL;
+		bool _http_reused = false;
+		bool _http_retried = false;
+		uint32_t _action_ms = 0;
+		uint32_t _cache_key = 0;
+		ASIMHttpCacheEntry *_cached = NULL;
+		ASIMJob *_queue[SIM_ASYNC_QUEUE];
+		uint8_t _queue_head = 0;
+		uint8_t _queue_count = 0;
+		ASIMJobCallback _hook = NULL;
+		void *_hook_arg = NULL;
+};
+/**********************************************************************************************************************************/
+#endif
@@ -0,0 +1,373 @@
+/**********************************************************************************************************************************/
+#include "ASIMGNSS.h"
+
+// Parser states
+#define GNSS_IDLE			0	// waiting for '$' or '+'
+#define GNSS_NAME			1	// sentence name, up to ',' or ':'
+#define GNSS_FIELDS			2
+#define GNSS_CHECKSUM		3	// the two hex digits after '*'
+#define GNSS_SKIP			4	// not a known sentence, up to the line end
+
+// Sentences
+#define GNSS_NONE			0
+#define GNSS_CGNSINF		1
+#define GNSS_RMC			2
+#define GNSS_GGA			3
+
+// more digits would not fit the accumulator, they are dropped
+#define NUM_LIMIT			429496729UL
+
+/**********************************************************************************************************************************/
+/**
+ * @brief Construct a parser without a fix
+ *
+*/
+ASIMGNSS::ASIMGNSS() {
+	clear();
+}
+
+/**
+ * @brief Forget the fix and the counters
+ *
+*/
+void ASIMGNSS::clear() {
+	memset(&_fix, 0, sizeof(_fix));
+	_work = _fix;
+	_state = GNSS_IDLE;
+	_sentences = 0;
+	_errors = 0;
+}
+
+/**
+ * @brief Parse one received character
+ *
+ * The fields of a sentence go to a working copy of the fix, which becomes the fix at the end of the line
+ * when the NMEA checksum matches. A sentence with a wrong checksum is counted in errors() and dropped.
+ *
+ * @param c The character
+ * @return true: it completed a sentence and fix() was updated, false: otherwise
+*/
+bool ASIMGNSS::feed(char c) {
+	if ((c == '$') || ((c == '+') && (_state == GNSS_IDLE))) {
+		_state = GNSS_NAME;
+		_nmea = (c == '$');
+		_kind = GNSS_NONE;
+		_id[0] = _id[1] = _id[2] = 0;
+		_sum = 0;
+		return false;
+	}
+	if ((c == '\r') || (c == '\n')) {
+		bool done = false;
+		if ((_state == GNSS_FIELDS) && (!_nmea)) {
+			fieldEnd();
+			done = true;
+		}
+		else if (_state == GNSS_CHECKSUM) {
+			done = (_check == _sum);
+			if (!done) {
+				_errors++;
+			}
+		}
+		else if ((_state == GNSS_FIELDS) && _nmea) {
+			// cut short before its checksum
+			_errors++;
+		}
+		if (done) {
+			_work.updated_ms = millis();
+			_fix = _work;
+			_sentences++;
+		}
+		else {
+			_work = _fix;
+		}
+		_state = GNSS_IDLE;
+		return done;
+	}
+
+	switch (_state) {
+		case GNSS_NAME:
+			if ((c == ',') || (c == ':')) {
+				if ((c == ',') && _nmea && (strncmp(_id, "RMC", 3) == 0)) {
+					_kind = GNSS_RMC;
+				}
+				else if ((c == ',') && _nmea && (strncmp(_id, "GGA", 3) == 0)) {
+					_kind = GNSS_GGA;
+				}
+				else if ((c == ':') && (!_nmea) && (strncmp(_id, "INF", 3) == 0)) {
+					_kind = GNSS_CGNSINF;
+				}
+				if (_kind == GNSS_NONE) {
+					_state = GNSS_SKIP;
+					return false;
+				}
+				_sum ^= c;
+				_field = 0;
+				fieldBegin();
+				_state = GNSS_FIELDS;
+				return false;
+			}
+			_sum ^= c;
+			_id[0] = _id[1];
+			_id[1] = _id[2];
+			_id[2] = c;
+			return false;
+		case GNSS_FIELDS:
+			if (c == '*') {
+				fieldEnd();
+				_check = 0;
+				_state = _nmea ? GNSS_CHECKSUM : GNSS_SKIP;
+				return false;
+			}
+			_sum ^= c;
+			if (c == ',') {
+				fieldEnd();
+				_field++;
+				fieldBegin();
+			}
+			else if ((c >= '0') && (c <= '9')) {
+				uint8_t d = c - '0';
+				if (!_dot) {
+					if (_digits < 14) {
+						_pairs[_digits / 2] = _pairs[_digits / 2] * 10 + d;
+					}
+					_digits++;
+				}
+				if (_num < NUM_LIMIT) {
+					_num = _num * 10 + d;
+					if (_dot) {
+						_frac++;
+					}
+				}
+			}
+			else if (c == '.') {
+				_dot = true;
+			}
+			else if (c == '-') {
+				_neg = true;
+			}
+			else if ((c != ' ') && (!_letter)) {
+				_letter = c;
+			}
+			return false;
+		case GNSS_CHECKSUM:
+			_check <<= 4;
+			if ((c >= '0') && (c <= '9')) {
+				_check |= c - '0';
+			}
+			else if ((c >= 'A') && (c <= 'F')) {
+				_check |= c - 'A' + 10;
+			}
+			return false;
+	}
+	return false;
+}
+
+/**
+ * @brief Get the last complete fix
+ *
+ * @return const ASIMGNSSFix& The fix, valid is false until the receiver has one
+*/
+const ASIMGNSSFix &ASIMGNSS::fix() {
+	return _fix;
+}
+
+/**
+ * @brief Get the number of parsed sentences
+ *
+ * @return uint16_t The sentences that updated the fix
+*/
+uint16_t ASIMGNSS::sentences() {
+	return _sentences;
+}
+
+/**
+ * @brief Get the number of dropped sentences
+ *
+ * @return uint16_t The NMEA sentences with a wrong checksum or cut short
+*/
+uint16_t ASIMGNSS::errors() {
+	return _errors;
+}
+
+void ASIMGNSS::fieldBegin() {
+	_num = 0;
+	_frac = 0;
+	_digits = 0;
+	_dot = false;
+	_neg = false;
+	_letter = 0;
+	memset(_pairs, 0, sizeof(_pairs));
+}
+
+/**
+ * @brief Store the field that ended in the working fix, an empty field leaves it as it is
+ *
+*/
+void ASIMGNSS::fieldEnd() {
+	bool number = (_digits > 0) || (_frac > 0);
+
+	if (_kind == GNSS_CGNSINF) {
+		// <run>,<fix>,<UTC yyyyMMddhhmmss.sss>,<lat>,<lon>,<alt>,<speed km/h>,<course>,<mode>,,<HDOP>,<PDOP>,<VDOP>,,
+		// <sats in view>,<sats used>,<GLONASS sats used>,...
+		if (!number) {
+			return;
+		}
+		switch (_field) {
+			case 1:
+				_work.valid = (_num == 1);
+				break;
+			case 2:
+				if (_digits >= 14) {
+					_work.year = _pairs[1];
+					_work.month = _pairs[2];
+					_work.day = _pairs[3];
+					_work.hour = _pairs[4];
+					_work.minute = _pairs[5];
+					_work.second = _pairs[6];
+				}
+				break;
+			case 3:
+				_work.lat = signedScaled(6);
+				break;
+			case 4:
+				_work.lon = signedScaled(6);
+				break;
+			case 5:
+				_work.alt = signedScaled(2);
+				break;
+			case 6:
+				_work.speed = scaled(1);
+				break;
+			case 7:
+				_work.course = scaled(2);
+				break;
+			case 10:
+				_work.hdop = scaled(2);
+				break;
+			case 14:
+				_work.sats_view = _num;
+				break;
+			case 15:
+				_work.sats_used = _num;
+				break;
+		}
+		return;
+	}
+
+	// RMC: <time>,<A|V>,<lat>,<N|S>,<lon>,<E|W>,<speed knots>,<course>,<date ddmmyy>,...
+	// GGA: <time>,<lat>,<N|S>,<lon>,<E|W>,<quality>,<sats used>,<HDOP>,<alt>,M,...
+	uint8_t field = _field;
+	if ((_kind == GNSS_GGA) && (field >= 1) && (field <= 4)) {
+		// the same position fields as RMC, one place earlier
+		field++;
+	}
+	if (field == 0) {
+		if (_digits >= 6) {
+			_work.hour = _pairs[0];
+			_work.minute = _pairs[1];
+			_work.second = _pairs[2];
+		}
+		return;
+	}
+	switch (field) {
+		case 2:
+			if (number) {
+				_work.lat = nmeaDegrees();
+			}
+			return;
+		case 3:
+			if ((_letter == 'S') && (_work.lat > 0)) {
+				_work.lat = -_work.lat;
+			}
+			return;
+		case 4:
+			if (number) {
+				_work.lon = nmeaDegrees();
+			}
+			return;
+		case 5:
+			if ((_letter == 'W') && (_work.lon > 0)) {
+				_work.lon = -_work.lon;
+			}
+			return;
+	}
+	if (_kind == GNSS_RMC) {
+		switch (field) {
+			case 1:
+				_work.valid = (_letter == 'A');
+				break;
+			case 6:
+				if (number) {
+					// knots to 0.1 km/h
+					_work.speed = scaled(2) * 1852UL / 10000;
+				}
+				break;
+			case 7:
+				if (number) {
+					_work.course = scaled(2);
+				}
+				break;
+			case 8:
+				if (_digits >= 6) {
+					_work.day = _pairs[0];
+					_work.month = _pairs[1];
+					_work.year = _pairs[2];
+				}
+				break;
+		}
+		return;
+	}
+	if (!number) {
+		return;
+	}
+	switch (_field) {
+		case 5:
+			_work.valid = (_num > 0);
+			break;
+		case 6:
+			_work.sats_used = _num;
+			break;
+		case 7:
+			_work.hdop = scaled(2);
+			break;
+		case 8:
+			_work.alt = signedScaled(2);
+			break;
+	}
+}
+
+/**
+ * @brief Get the number of the field with a given number of decimals
+ *
+ * @param decimals The decimals, 2 returns 1200.5 as 120050
+ * @return uint32_t The number without sign, cut or padded
+*/
+uint32_t ASIMGNSS::scaled(uint8_t decimals) {
+	uint32_t v = _num;
+	uint8_t frac = _frac;
+	for (; frac < decimals; frac++) {
+		v *= 10;
+	}
+	for (; frac > decimals; frac--) {
+		v /= 10;
+	}
+	return v;
+}
+
+int32_t ASIMGNSS::signedScaled(uint8_t decimals) {
+	int32_t v = scaled(decimals);
+	return _neg ? -v : v;
+}
+
+/**
+ * @brief Convert the NMEA angle of the field, (d)ddmm.mmmmm, to millionths of a degree
+ *
+ * @return int32_t The angle without its hemisphere
+*/
+int32_t ASIMGNSS::nmeaDegrees() {
+	uint32_t v = scaled(5);
+	uint32_t degrees = v / 10000000UL;
+	// minutes in 1/100000, a millionth of a degree is 6/100000 of a minute
+	uint32_t minutes = v % 10000000UL;
+	return degrees * 1000000L + minutes / 6;
+}
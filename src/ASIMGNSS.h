@@ -0,0 +1,68 @@
+/**********************************************************************************************************************************/
+#ifndef ASIM_GNSS_H
+#define ASIM_GNSS_H
+
+#include <Arduino.h>
+
+/**********************************************************************************************************************************/
+// a GNSS position in fixed point, angles in millionths of a degree
+struct ASIMGNSSFix {
+	bool valid;					// the receiver has a fix, the position is the last one otherwise
+	int32_t lat;				// north positive, 35689197 = 35.689197
+	int32_t lon;				// east positive
+	int32_t alt;				// altitude above sea level in cm
+	uint16_t speed;				// ground speed in 0.1 km/h
+	uint16_t course;			// course over ground in 0.01 degree
+	uint16_t hdop;				// horizontal dilution of precision in 0.01
+	uint8_t sats_used;
+	uint8_t sats_view;			// satellites in view, AT+CGNSINF only
+	uint8_t year;				// UTC, year - 2000
+	uint8_t month;
+	uint8_t day;
+	uint8_t hour;
+	uint8_t minute;
+	uint8_t second;
+	uint32_t updated_ms;		// millis() of the last parsed sentence, 0 before the first one
+};
+
+/**********************************************************************************************************************************/
+// Streaming parser of the +CGNSINF line and the NMEA RMC and GGA sentences of the SIM808 GNSS engine. It takes one
+// character at a time and keeps no line buffer, so the NMEA output of AT+CGNSTST or of the GPS UART can be fed as it arrives.
+class ASIMGNSS {
+	public:
+		ASIMGNSS();
+		bool feed(char c);
+		const ASIMGNSSFix &fix();
+		uint16_t sentences();
+		uint16_t errors();
+		void clear();
+	private:
+		void fieldBegin();
+		void fieldEnd();
+		uint32_t scaled(uint8_t decimals);
+		int32_t signedScaled(uint8_t decimals);
+		int32_t nmeaDegrees();
+		// sentence
+		uint8_t _state;
+		uint8_t _kind;
+		bool _nmea;
+		char _id[3];				// the last 3 characters of the sentence name
+		uint8_t _field;
+		uint8_t _sum;
+		uint8_t _check;
+		// field
+		uint32_t _num;
+		uint8_t _frac;
+		uint8_t _digits;
+		bool _dot;
+		bool _neg;
+		char _letter;
+		uint8_t _pairs[7];			// the digits of a time or date field by two
+		// the fix being parsed and the last complete one
+		ASIMGNSSFix _work;
+		ASIMGNSSFix _fix;
+		uint16_t _sentences;
+		uint16_t _errors;
+};
+/**********************************************************************************************************************************/
+#endif
@@ -0,0 +1,341 @@
+/**********************************************************************************************************************************/
+#include "ASIMHttp.h"
+
+/**********************************************************************************************************************************/
+/**
+ * @brief Construct a request without headers or body
+ *
+ * @param method HTTPACTION_GET, HTTPACTION_POST or HTTPACTION_HEAD
+ * @param url The URL, "http://" can be left out
+*/
+ASIMHttpRequest::ASIMHttpRequest(uint8_t method, ASIMText url) {
+	_method = method;
+	_url = url;
+}
+
+/**
+ * @brief Add a header line, sent with AT+HTTPPARA="USERDATA"
+ *
+ * The line is name followed by value, so a value in RAM can follow a name in flash without a copy:
+ * header(F("Authorization: Bearer "), token). Neither may hold a '"', the modem ends the parameter there.
+ *
+ * @param name The start of the line, e.g. F("X-Device: ")
+ * @param value The rest of the line
+ * @return ASIMHttpRequest& The request. With more than SIM_HTTP_HEADERS lines the request fails when it is sent
+*/
+ASIMHttpRequest &ASIMHttpRequest::header(ASIMText name, ASIMText value) {
+	if (_header_count >= SIM_HTTP_HEADERS) {
+		_overflow = true;
+		return *this;
+	}
+	_names[_header_count] = name;
+	_values[_header_count] = value;
+	_header_count++;
+	return *this;
+}
+
+/**
+ * @brief Set the content type of the body
+ *
+ * @param type The type, e.g. F("application/json"). A POST without it is sent as text/plain
+ * @return ASIMHttpRequest& The request
+*/
+ASIMHttpRequest &ASIMHttpRequest::content(ASIMText type) {
+	_content = type;
+	return *this;
+}
+
+/**
+ * @brief Set the body of a POST
+ *
+ * @param data The body, sent after AT+HTTPDATA as it is
+ * @param length Its length, 0 up to the terminating zero. A RAM body with a length may hold any byte
+ * @return ASIMHttpRequest& The request
+*/
+ASIMHttpRequest &ASIMHttpRequest::body(ASIMText data, uint16_t length) {
+	_body = data;
+	_body_length = length ? length : data.length();
+	return *this;
+}
+
+/**
+ * @brief Set how long the modem waits for the server
+ *
+ * @param ms The wait for +HTTPACTION in ms, SIM_HTTP_TIMEOUT by default
+ * @return ASIMHttpRequest& The request
+*/
+ASIMHttpRequest &ASIMHttpRequest::timeout(uint16_t ms) {
+	_timeout = ms;
+	return *this;
+}
+
+/**
+ * @brief Send a GET through a cache, with the Last-Modified of the last answer to its URL
+ *
+ * @param cache The cache, it must stay valid until the request is sent
+ * @return ASIMHttpRequest& The request
+*/
+ASIMHttpRequest &ASIMHttpRequest::cache(ASIMHttpCache &cache) {
+	_cache = &cache;
+	return *this;
+}
+
+/**
+ * @brief Remove the header lines, to send the request again with others
+ *
+*/
+void ASIMHttpRequest::clearHeaders() {
+	_header_count = 0;
+	_overflow = false;
+}
+
+/**
+ * @brief Check if the request goes over TLS
+ *
+ * @return true: the URL starts with "https://", false: otherwise
+*/
+bool ASIMHttpRequest::secure() const {
+	static const char scheme[] PROGMEM = "https://";
+	for (uint8_t i = 0; i < sizeof(scheme) - 1; i++) {
+		char c = _url.flash ? pgm_read_byte(_url.text + i) : _url.text[i];
+		if (tolower(c) != pgm_read_byte(scheme + i)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**********************************************************************************************************************************/
+/**
+ * @brief Get the status of the answer
+ *
+ * @return uint16_t The HTTP status (200, 404, ...), 6xx for the errors of the modem, 0 if the server did not answer
+*/
+uint16_t ASIMHttpResponse::status() {
+	return _status;
+}
+
+/**
+ * @brief Check if the server accepted the request
+ *
+ * @return true: 2xx status, false: otherwise
+*/
+bool ASIMHttpResponse::ok() {
+	return (_status >= 200) && (_status < 300);
+}
+
+/**
+ * @brief Check if the cached answer is still valid
+ *
+ * @return true: 304, the body read after the last 200 is still the current one, false: otherwise
+*/
+bool ASIMHttpResponse::notModified() {
+	return _status == 304;
+}
+
+/**
+ * @brief Get the length of the body
+ *
+ * @return uint32_t The length given by the modem, 0 without a body
+*/
+uint32_t ASIMHttpResponse::length() {
+	return _length;
+}
+
+/**
+ * @brief Get the part of the body not read yet
+ *
+ * @return uint32_t The number of bytes
+*/
+uint32_t ASIMHttpResponse::available() {
+	return _length - _offset;
+}
+
+/**
+ * @brief Read the next part of the body with AT+HTTPREAD=<offset>,<size>
+ *
+ * The bytes are copied as they are, the buffer is not zero terminated. The next request of the modem replaces the body.
+ *
+ * @param buffer The buffer
+ * @param size Its size
+ * @return uint16_t The number of bytes read, 0 at the end of the body or on error
+*/
+uint16_t ASIMHttpResponse::read(char *buffer, uint16_t size) {
+	if ((!_sim) || (!available())) {
+		return 0;
+	}
+	return _sim->httpRead(*this, buffer, size);
+}
+
+/**********************************************************************************************************************************/
+/**
+ * @brief Construct an empty cache in RAM
+ *
+*/
+ASIMHttpCache::ASIMHttpCache() {
+	memset(_entries, 0, sizeof(_entries));
+	memset(&_stats, 0, sizeof(_stats));
+}
+
+/**
+ * @brief Keep the entries in a persistent storage and load them from it at once
+ *
+ * An entry is saved when its Last-Modified changes, not on every hit, to spare the writes of an EEPROM.
+ *
+ * @param storage The hook that saves and loads a slot, NULL for RAM only
+ * @param arg Passed to the hook
+*/
+void ASIMHttpCache::setStorage(ASIMHttpCacheStorage storage, void *arg) {
+	_storage = storage;
+	_storage_arg = arg;
+	if (!_storage) {
+		return;
+	}
+	_tick = 0;
+	for (uint8_t i = 0; i < SIM_HTTP_CACHE; i++) {
+		ASIMHttpCacheEntry &entry = _entries[i];
+		if (!_storage(i, entry, false, _storage_arg)) {
+			memset(&entry, 0, sizeof(entry));
+			continue;
+		}
+		// a slot written by an older build may miss its terminating zero
+		entry.modified[HTTP_DATE_SIZE - 1] = 0;
+		if (entry.used > _tick) {
+			_tick = entry.used;
+		}
+	}
+}
+
+/**
+ * @brief Get the Last-Modified kept for a URL
+ *
+ * @param url The URL, as given to the request
+ * @return const ASIMHttpCacheEntry* The entry, NULL if the URL is not cached
+*/
+const ASIMHttpCacheEntry *ASIMHttpCache::find(ASIMText url) {
+	return lookup(hash(url));
+}
+
+/**
+ * @brief Drop the Last-Modified of a URL, its next GET downloads the body
+ *
+ * @param url The URL, as given to the request
+*/
+void ASIMHttpCache::forget(ASIMText url) {
+	remove(hash(url));
+}
+
+/**
+ * @brief Drop all the entries
+ *
+*/
+void ASIMHttpCache::clear() {
+	for (uint8_t i = 0; i < SIM_HTTP_CACHE; i++) {
+		if (_entries[i].key) {
+			memset(&_entries[i], 0, sizeof(_entries[i]));
+			save(_entries[i]);
+		}
+	}
+}
+
+/**
+ * @brief Get the lookups, hits and saved bytes of the cache
+ *
+ * @return const ASIMHttpCacheStats& The counters since the last resetStats()
+*/
+const ASIMHttpCacheStats &ASIMHttpCache::getStats() {
+	return _stats;
+}
+
+/**
+ * @brief Clear the cache counters, the entries stay
+ *
+*/
+void ASIMHttpCache::resetStats() {
+	memset(&_stats, 0, sizeof(_stats));
+}
+
+/**
+ * @brief Hash a URL (32 bit FNV-1a), the key of its entry
+ *
+ * Only the hash is kept: two URLs with the same hash share an entry, the server then answers 200 to the
+ * Last-Modified of the other one.
+ *
+ * @param url The URL
+ * @return uint32_t The hash, never 0
+*/
+uint32_t ASIMHttpCache::hash(ASIMText url) {
+	uint32_t h = 2166136261UL;
+	for (const char *p = url.text; ; p++) {
+		char c = url.flash ? pgm_read_byte(p) : *p;
+		if (!c) {
+			break;
+		}
+		h = (h ^ (uint8_t)c) * 16777619UL;
+	}
+	return h ? h : 1;
+}
+
+/**
+ * @brief Find the entry of a key
+ *
+ * @param key The hash of the URL
+ * @return ASIMHttpCacheEntry* The entry, NULL if none
+*/
+ASIMHttpCacheEntry *ASIMHttpCache::lookup(uint32_t key) {
+	for (uint8_t i = 0; i < SIM_HTTP_CACHE; i++) {
+		if (_entries[i].key == key) {
+			return &_entries[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief Keep the Last-Modified of an answer, in place of the least recently used entry if the cache is full
+ *
+ * @param entry The key, length and Last-Modified. Without Last-Modified the URL is dropped
+*/
+void ASIMHttpCache::store(const ASIMHttpCacheEntry &entry) {
+	if (!entry.modified[0]) {
+		remove(entry.key);
+		return;
+	}
+	ASIMHttpCacheEntry *slot = lookup(entry.key);
+	if (!slot) {
+		slot = &_entries[0];
+		for (uint8_t i = 1; (i < SIM_HTTP_CACHE) && slot->key; i++) {
+			if ((!_entries[i].key) || (_entries[i].used < slot->used)) {
+				slot = &_entries[i];
+			}
+		}
+	}
+	*slot = entry;
+	slot->used = ++_tick;
+	_stats.stores++;
+	save(*slot);
+}
+
+/**
+ * @brief Drop the entry of a key
+ *
+ * @param key The hash of the URL
+*/
+void ASIMHttpCache::remove(uint32_t key) {
+	ASIMHttpCacheEntry *entry = lookup(key);
+	if (entry) {
+		memset(entry, 0, sizeof(*entry));
+		save(*entry);
+	}
+}
+
+/**
+ * @brief Write an entry to the persistent storage, if any
+ *
+ * @param entry The entry, one of the cache
+*/
+void ASIMHttpCache::save(ASIMHttpCacheEntry &entry) {
+	if (_storage) {
+		_storage(&entry - _entries, entry, true, _storage_arg);
+	}
+}
@@ -0,0 +1,115 @@
+/**********************************************************************************************************************************/
+#ifndef ASIM_HTTP_H
+#define ASIM_HTTP_H
+
+#include "ASIM.h"
+
+// length of an HTTP date (IMF-fixdate, "Sun, 06 Nov 1994 08:49:37 GMT") and its terminating zero
+#define HTTP_DATE_SIZE		30
+
+/**********************************************************************************************************************************/
+// An HTTP request of ASIM::httpRequest(). It only points to the URL, headers and body, in RAM or in flash, so they must
+// stay valid until the request is sent. Nothing is copied or allocated:
+//
+//	ASIMHttpRequest request(HTTPACTION_POST, F("http://example.com/api"));
+//	request.header(F("Authorization: Bearer "), token).content(F("application/json")).body(json);
+class ASIMHttpRequest {
+	public:
+		ASIMHttpRequest(uint8_t method, ASIMText url);
+		ASIMHttpRequest &header(ASIMText name, ASIMText value = ASIMText());
+		ASIMHttpRequest &content(ASIMText type);
+		ASIMHttpRequest &body(ASIMText data, uint16_t length = 0);
+		ASIMHttpRequest &timeout(uint16_t ms);
+		ASIMHttpRequest &cache(ASIMHttpCache &cache);
+		void clearHeaders();
+		bool secure() const;
+	private:
+		friend class ASIM;
+		friend class ASIMAsync;
+		uint8_t _method;
+		ASIMText _url;
+		ASIMText _names[SIM_HTTP_HEADERS];
+		ASIMText _values[SIM_HTTP_HEADERS];
+		uint8_t _header_count = 0;
+		bool _overflow = false;
+		ASIMText _content;
+		ASIMText _body;
+		uint16_t _body_length = 0;
+		uint16_t _timeout = SIM_HTTP_TIMEOUT;
+		ASIMHttpCache *_cache = NULL;
+};
+
+/**********************************************************************************************************************************/
+// The answer to an ASIMHttpRequest. The body stays in the modem until read(), in as many pieces as the caller has room for.
+class ASIMHttpResponse {
+	public:
+		uint16_t status();
+		bool ok();
+		bool notModified();
+		uint32_t length();
+		uint32_t available();
+		uint16_t read(char *buffer, uint16_t size);
+	private:
+		friend class ASIM;
+		ASIM *_sim = NULL;
+		uint16_t _status = 0;
+		uint32_t _length = 0;
+		uint32_t _offset = 0;
+};
+
+/**********************************************************************************************************************************/
+// The Last-Modified of a cached answer. The body itself is not kept, the caller still has it from the last 200
+struct ASIMHttpCacheEntry {
+	uint32_t key;						// hash of the URL, 0 for a free entry
+	uint32_t length;					// body length of the last 200, the transfer a 304 saves
+	uint32_t used;						// order of use, the least recently used entry is replaced
+	char modified[HTTP_DATE_SIZE];		// Last-Modified as sent
+};
+
+// HTTP cache statistics
+struct ASIMHttpCacheStats {
+	uint32_t lookups;		// GET requests through the cache
+	uint32_t conditional;	// sent with If-Modified-Since
+	uint32_t hits;			// answered 304, no AT+HTTPREAD needed
+	uint32_t stores;		// Last-Modified read with AT+HTTPHEAD and kept
+	uint32_t saved;			// body bytes not transferred thanks to the hits
+};
+
+// persistent storage of the entries (EEPROM, a file, ...): save the entry of a slot, or load it and return
+// false if the slot was never saved
+typedef bool (*ASIMHttpCacheStorage)(uint8_t slot, ASIMHttpCacheEntry &entry, bool save, void *arg);
+
+// Last-Modified of up to SIM_HTTP_CACHE URLs. A GET through the cache (ASIMHttpRequest::cache()) sends it as
+// If-Modified-Since, the server answers 304 without a body while the resource is unchanged. ETags are not used:
+// they are quoted and the modem ends the USERDATA parameter at a '"', so If-None-Match can not be sent.
+// A URL answered without Last-Modified is not cached:
+//
+//	ASIMHttpRequest request(HTTPACTION_GET, F("http://example.com/config"));
+//	request.cache(cache);
+//	if (sim.httpRequest(request, response) && response.ok()) { read the new body }
+//	else if (response.notModified()) { keep the old one }
+class ASIMHttpCache {
+	public:
+		ASIMHttpCache();
+		void setStorage(ASIMHttpCacheStorage storage, void *arg = NULL);
+		const ASIMHttpCacheEntry *find(ASIMText url);
+		void forget(ASIMText url);
+		void clear();
+		const ASIMHttpCacheStats &getStats();
+		void resetStats();
+	private:
+		friend class ASIM;
+		friend class ASIMAsync;
+		static uint32_t hash(ASIMText url);
+		ASIMHttpCacheEntry *lookup(uint32_t key);
+		void store(const ASIMHttpCacheEntry &entry);
+		void remove(uint32_t key);
+		void save(ASIMHttpCacheEntry &entry);
+		ASIMHttpCacheEntry _entries[SIM_HTTP_CACHE];
+		uint32_t _tick = 0;
+		ASIMHttpCacheStats _stats;
+		ASIMHttpCacheStorage _storage = NULL;
+		void *_storage_arg = NULL;
+};
+/**********************************************************************************************************************************/
+#endif
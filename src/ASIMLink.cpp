@@ -0,0 +1,386 @@
+/**********************************************************************************************************************************/
+#include "ASIMLink.h"
+
+// Steps of a sampling round
+#define LINK_IDLE			0
+#define LINK_CENG_ON		1
+#define LINK_CSQ			2
+#define LINK_CENG			3
+#define LINK_PING			4
+
+#define RSSI_UNKNOWN		99
+// AT+CIPPING timeout in 100 ms, a reply time of it or more is a lost ping
+#define PING_TIMEOUT		20
+
+/**********************************************************************************************************************************/
+/**
+ * @brief Construct a monitor without a modem, see begin()
+ *
+*/
+ASIMLink::ASIMLink() {
+	memset(&_quality, 0, sizeof(_quality));
+	_quality.rssi = _quality.ber = RSSI_UNKNOWN;
+	_quality.rssi_avg = _quality.ber_avg = RSSI_UNKNOWN;
+	_step = LINK_IDLE;
+}
+
+/**
+ * @brief Construct a monitor for the modem run by async
+ *
+ * @param async The runner of the modem, begin() must have been called on its modem
+*/
+ASIMLink::ASIMLink(ASIMAsync &async) : ASIMLink() {
+	begin(async);
+}
+
+/**
+ * @brief Monitor the modem run by async, the first round starts at the next poll()
+ *
+ * @param async The runner of the modem. The monitor queues its commands there, between the other jobs
+*/
+void ASIMLink::begin(ASIMAsync &async) {
+	_async = &async;
+	_next_ms = millis();
+}
+
+/**
+ * @brief Set how often the link is sampled
+ *
+ * @param sample_ms Time between two rounds of AT+CSQ and AT+CENG?
+ * @param ping_ms Time between two AT+CIPPING, done in the next round. Pings need the GPRS context (AT+CIICR)
+*/
+void ASIMLink::setPeriod(uint32_t sample_ms, uint32_t ping_ms) {
+	_period = sample_ms;
+	_ping_period = ping_ms;
+}
+
+/**
+ * @brief Start a round at the next poll(), with a ping
+ *
+*/
+void ASIMLink::sample() {
+	_next_ms = millis();
+	_pinged = false;
+}
+
+/**
+ * @brief Start a sampling round when it is due
+ *
+ * Never waits: the commands run as jobs of the ASIMAsync, which must be polled as well.
+*/
+void ASIMLink::poll() {
+	if ((!_async) || (_step != LINK_IDLE) || ((int32_t)(millis() - _next_ms) < 0)) {
+		return;
+	}
+	_ping_round = (!_pinged) || ((millis() - _ping_ms) >= _ping_period);
+	if (_ping_round) {
+		_pinged = true;
+		_ping_ms = millis();
+	}
+	_round_rtt = 0;
+	_next_ms = millis() + _period;
+	if (_ceng_on) {
+		_step = LINK_CSQ;
+		queue(F("AT+CSQ"), SIM_TIMEOUT_LOCAL);
+	}
+	else {
+		// engineering mode: AT+CENG? lists the serving and the neighbour cells
+		_step = LINK_CENG_ON;
+		queue(F("AT+CENG=1,0"), SIM_TIMEOUT_LOCAL);
+	}
+}
+
+/**
+ * @brief Get the link state
+ *
+ * @return const ASIMLinkQuality& The state of the last rounds, kept in memory
+*/
+const ASIMLinkQuality &ASIMLink::quality() {
+	return _quality;
+}
+
+/**
+ * @brief Get the link quality score
+ *
+ * Up to 60 points for the average RSSI (full at 25, about -63 dBm), 20 for the average BER and 20 for
+ * the average ping round trip (full up to 300 ms, none from 3 s). An unknown BER or round trip gives 10.
+ *
+ * @return uint8_t 0 (no signal) to 100
+*/
+uint8_t ASIMLink::score() {
+	return _quality.score;
+}
+
+/**
+ * @brief Get the number of rounds in the history
+ *
+ * @return uint8_t Up to SIM_LINK_HISTORY
+*/
+uint8_t ASIMLink::historyCount() {
+	return _history_count;
+}
+
+/**
+ * @brief Get a round of the history
+ *
+ * @param age 0 for the last round, historyCount() - 1 for the oldest
+ * @return const ASIMLinkSample& The round
+*/
+const ASIMLinkSample &ASIMLink::history(uint8_t age) {
+	uint8_t index = (_history_head + SIM_LINK_HISTORY - 1 - (age % SIM_LINK_HISTORY)) % SIM_LINK_HISTORY;
+	return _history[index];
+}
+
+/**
+ * @brief Queue the command of the current step
+ *
+ * @param command The command
+ * @param cls Its timeout class
+ * @return bool true if queued, false if the queue of the runner is full (the step fails)
+*/
+bool ASIMLink::queue(ASIMFlashString command, uint8_t cls) {
+	_async->commandAsync(_job, command, cls).then(stepDone, this);
+	return _job.status != JOB_FAILED;
+}
+
+void ASIMLink::stepDone(ASIMJob &job, void *arg) {
+	((ASIMLink *)arg)->next(job.ok());
+}
+
+/**
+ * @brief Take the answer of the step that ended and queue the next one
+ *
+ * @param ok true if the command of the step succeeded
+*/
+void ASIMLink::next(bool ok) {
+	switch (_step) {
+		case LINK_CENG_ON:
+			_ceng_on = ok;
+			_step = LINK_CSQ;
+			queue(F("AT+CSQ"), SIM_TIMEOUT_LOCAL);
+			return;
+		case LINK_CSQ:
+			if (!ok) {
+				// no sample in this round
+				_step = LINK_IDLE;
+				return;
+			}
+			parseCSQ();
+			if (_ceng_on) {
+				_step = LINK_CENG;
+				queue(F("AT+CENG?"), SIM_TIMEOUT_LOCAL);
+				return;
+			}
+			break;
+		case LINK_CENG:
+			if (ok) {
+				parseCENG();
+			}
+			break;
+		case LINK_PING:
+			_quality.pings++;
+			if (ok) {
+				parsePing();
+			}
+			if (!_round_rtt) {
+				// a lost ping is a slow one for the average, else it would keep the last good round trip
+				_quality.ping_failures++;
+				if (_quality.ping_lost < 255) {
+					_quality.ping_lost++;
+				}
+				addRtt(PING_TIMEOUT * 100);
+			}
+			endRound();
+			return;
+	}
+
+	if (_ping_round) {
+		_step = LINK_PING;
+		queue(F("AT+CIPPING=\"" SIM_LINK_PING_HOST "\",1,32,20"), SIM_TIMEOUT_TCP);
+		return;
+	}
+	endRound();
+}
+
+/**
+ * @brief Take RSSI and BER from "+CSQ: <rssi>,<ber>"
+ *
+*/
+void ASIMLink::parseCSQ() {
+	char *p = strstr_P(_async->sim->replybuffer, PSTR("+CSQ: "));
+	if (!p) {
+		return;
+	}
+	p += 6;
+	_quality.rssi = atoi(p);
+	p = strchr(p, ',');
+	_quality.ber = p ? atoi(p + 1) : RSSI_UNKNOWN;
+
+	// moving averages over about 4 rounds, unknown values are left out
+	if (_quality.rssi != RSSI_UNKNOWN) {
+		if (_quality.rssi_avg == RSSI_UNKNOWN) {
+			_rssi16 = _quality.rssi * 16;
+		}
+		else {
+			_rssi16 += ((int16_t)(_quality.rssi * 16) - (int16_t)_rssi16) / 4;
+		}
+		_quality.rssi_avg = (_rssi16 + 8) / 16;
+	}
+	if (_quality.ber != RSSI_UNKNOWN) {
+		if (_quality.ber_avg == RSSI_UNKNOWN) {
+			_ber16 = _quality.ber * 16;
+		}
+		else {
+			_ber16 += ((int16_t)(_quality.ber * 16) - (int16_t)_ber16) / 4;
+		}
+		_quality.ber_avg = (_ber16 + 8) / 16;
+	}
+}
+
+// the field after n commas, an empty one if the line is cut short
+static const char *field(const char *p, uint8_t n) {
+	while (n--) {
+		p = strchr(p, ',');
+		if (!p) {
+			return "";
+		}
+		p++;
+	}
+	return p;
+}
+
+/**
+ * @brief Take the cells from the answer to AT+CENG? in engineering mode 1
+ *
+ * Serving cell: +CENG: 0,"<arfcn>,<rxl>,<rxq>,<mcc>,<mnc>,<bsic>,<cellid>,<rla>,<txp>,<lac>,<TA>"
+ * Neighbour cells: +CENG: <n>,"<arfcn>,<rxl>,<bsic>,<cellid>,<mcc>,<mnc>,<lac>"
+ * The lines that do not fit the reply buffer are lost.
+*/
+void ASIMLink::parseCENG() {
+	const char *p = _async->sim->replybuffer;
+	_quality.neighbour_count = 0;
+	while ((p = strstr_P(p, PSTR("+CENG: "))) != NULL) {
+		p += 7;
+		uint8_t cell = atoi(p);
+		const char *f = strchr(p, ',');
+		// the first line is "+CENG: <mode>,<Ncell>"
+		if ((!f) || (f[1] != '"')) {
+			continue;
+		}
+		f += 2;
+		ASIMCell c;
+		c.arfcn = atoi(f);
+		c.rxl = atoi(field(f, 1));
+		if (cell == 0) {
+			c.bsic = atoi(field(f, 5));
+			c.ci = strtoul(field(f, 6), NULL, 16);
+			c.lac = strtoul(field(f, 9), NULL, 16);
+			_quality.serving = c;
+		}
+		else if (_quality.neighbour_count < SIM_LINK_CELLS) {
+			c.bsic = atoi(field(f, 2));
+			c.ci = strtoul(field(f, 3), NULL, 16);
+			c.lac = strtoul(field(f, 6), NULL, 16);
+			// an empty neighbour slot is all zeros
+			if (c.arfcn || c.ci) {
+				_quality.neighbours[_quality.neighbour_count++] = c;
+			}
+		}
+	}
+}
+
+/**
+ * @brief Take the round trip from "+CIPPING: <id>,<ip>,<time in 100 ms>,<ttl>"
+ *
+*/
+void ASIMLink::parsePing() {
+	const char *p = strstr_P(_async->sim->replybuffer, PSTR("+CIPPING: "));
+	if (!p) {
+		return;
+	}
+	p = strchr(p, '"');
+	p = p ? strchr(p + 1, '"') : NULL;
+	if ((!p) || (p[1] != ',')) {
+		return;
+	}
+	uint16_t time = atoi(p + 2);
+	if (time >= PING_TIMEOUT) {
+		return;
+	}
+	// the modem counts in 100 ms, a faster answer reads 0
+	uint16_t rtt = time ? time * 100 : 50;
+	_round_rtt = rtt;
+	_quality.rtt = rtt;
+	_quality.ping_lost = 0;
+	addRtt(rtt);
+}
+
+/**
+ * @brief Add a round trip to the average (gain 1/8) and the mean deviation (gain 1/4)
+ *
+ * @param rtt The round trip in ms
+*/
+void ASIMLink::addRtt(uint16_t rtt) {
+	if (_quality.rtt_avg == 0) {
+		_quality.rtt_avg = rtt;
+		_quality.rtt_var = rtt / 2;
+	}
+	else {
+		int32_t err = (int32_t)rtt - _quality.rtt_avg;
+		_quality.rtt_avg += err / 8;
+		_quality.rtt_var += ((err < 0 ? -err : err) - (int32_t)_quality.rtt_var) / 4;
+	}
+}
+
+/**
+ * @brief Keep the round in the history and update the score
+ *
+*/
+void ASIMLink::endRound() {
+	_step = LINK_IDLE;
+	updateScore();
+	_quality.samples++;
+	_quality.updated_ms = millis();
+
+	ASIMLinkSample &s = _history[_history_head];
+	s.ms = _quality.updated_ms;
+	s.rssi = _quality.rssi;
+	s.ber = _quality.ber;
+	s.rtt = _round_rtt;
+	s.score = _quality.score;
+	_history_head = (_history_head + 1) % SIM_LINK_HISTORY;
+	if (_history_count < SIM_LINK_HISTORY) {
+		_history_count++;
+	}
+}
+
+/**
+ * @brief Compute the score from the averages, see score()
+ *
+*/
+void ASIMLink::updateScore() {
+	if (_quality.rssi_avg == RSSI_UNKNOWN) {
+		_quality.score = 0;
+		return;
+	}
+	uint8_t rssi = (_quality.rssi_avg > 25) ? 25 : _quality.rssi_avg;
+	uint8_t points = rssi * 60 / 25;
+
+	if (_quality.ber_avg == RSSI_UNKNOWN) {
+		points += 10;
+	}
+	else if (_quality.ber_avg < 7) {
+		points += (7 - _quality.ber_avg) * 20 / 7;
+	}
+
+	if (_quality.rtt_avg == 0) {
+		points += 10;
+	}
+	else if (_quality.rtt_avg <= 300) {
+		points += 20;
+	}
+	else if (_quality.rtt_avg < 3000) {
+		points += (uint32_t)(3000 - _quality.rtt_avg) * 20 / 2700;
+	}
+	_quality.score = points;
+}
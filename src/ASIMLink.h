@@ -0,0 +1,91 @@
+/**********************************************************************************************************************************/
+#ifndef ASIM_LINK_H
+#define ASIM_LINK_H
+
+#include "ASIMAsync.h"
+
+/**********************************************************************************************************************************/
+// a cell from AT+CENG?
+struct ASIMCell {
+	uint16_t arfcn;
+	uint8_t rxl;				// received level, dBm + 110
+	uint8_t bsic;
+	uint16_t lac;
+	uint16_t ci;
+};
+
+// one sampling round
+struct ASIMLinkSample {
+	uint32_t ms;				// millis() at the end of the round
+	uint8_t rssi;				// +CSQ <rssi> 0-31, 99 unknown
+	uint8_t ber;				// +CSQ <ber> 0-7, 99 unknown
+	uint16_t rtt;				// ping round trip in ms, 0 if not pinged in this round
+	uint8_t score;
+};
+
+// the kept state of the link, averages are moving averages over the last rounds
+struct ASIMLinkQuality {
+	uint8_t rssi;				// last sample
+	uint8_t ber;
+	uint8_t rssi_avg;
+	uint8_t ber_avg;			// 99 until a BER was reported
+	uint16_t rtt;				// last ping round trip in ms, 0 before the first answered ping
+	uint16_t rtt_avg;			// a lost ping counts as a round trip of the ping timeout (2 s)
+	uint16_t rtt_var;
+	uint8_t score;				// 0 (no link) to 100, see ASIMLink::score()
+	ASIMCell serving;
+	ASIMCell neighbours[SIM_LINK_CELLS];
+	uint8_t neighbour_count;
+	uint16_t samples;
+	uint16_t pings;
+	uint16_t ping_failures;
+	uint8_t ping_lost;			// pings lost in a row since the last answered one
+	uint32_t updated_ms;		// millis() of the last round, 0 before the first one
+};
+
+/**********************************************************************************************************************************/
+// Samples signal, cells and round trip time of one modem in the background, through its ASIMAsync
+class ASIMLink {
+	public:
+		ASIMLink();
+		ASIMLink(ASIMAsync &async);
+		void begin(ASIMAsync &async);
+		void setPeriod(uint32_t sample_ms, uint32_t ping_ms);
+		void sample();
+		void poll();
+		// No modem round trip
+		const ASIMLinkQuality &quality();
+		uint8_t score();
+		uint8_t historyCount();
+		const ASIMLinkSample &history(uint8_t age);
+	private:
+		static void stepDone(ASIMJob &job, void *arg);
+		void next(bool ok);
+		bool queue(ASIMFlashString command, uint8_t cls);
+		void parseCSQ();
+		void parseCENG();
+		void parsePing();
+		void addRtt(uint16_t rtt);
+		void endRound();
+		void updateScore();
+		ASIMAsync *_async = NULL;
+		ASIMJob _job;
+		uint8_t _step;
+		bool _ceng_on = false;
+		bool _ping_round = false;
+		uint16_t _round_rtt = 0;
+		uint32_t _period = SIM_LINK_PERIOD;
+		uint32_t _ping_period = SIM_LINK_PING_PERIOD;
+		uint32_t _next_ms = 0;
+		uint32_t _ping_ms = 0;
+		bool _pinged = false;
+		// moving averages in 1/16
+		uint16_t _rssi16 = 0;
+		uint16_t _ber16 = 0;
+		ASIMLinkQuality _quality;
+		ASIMLinkSample _history[SIM_LINK_HISTORY];
+		uint8_t _history_head = 0;
+		uint8_t _history_count = 0;
+};
+/**********************************************************************************************************************************/
+#endif
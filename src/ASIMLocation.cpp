@@ -0,0 +1,189 @@
+/**********************************************************************************************************************************/
+#include "ASIMLocation.h"
+
+/**********************************************************************************************************************************/
+/**
+ * @brief Construct a service without a modem, see begin()
+ *
+*/
+ASIMLocation::ASIMLocation() {
+	memset(&_location, 0, sizeof(_location));
+	_job.status = JOB_IDLE;
+	resetStats();
+}
+
+/**
+ * @brief Construct a service for the modem run by async
+ *
+ * @param async The runner of the modem, begin() must have been called on its modem
+*/
+ASIMLocation::ASIMLocation(ASIMAsync &async) : ASIMLocation() {
+	begin(async);
+}
+
+/**
+ * @brief Locate the modem run by async, the first request starts at the next poll()
+ *
+ * @param async The runner of the modem. The service queues its requests there, between the other jobs
+*/
+void ASIMLocation::begin(ASIMAsync &async) {
+	_async = &async;
+	_force = true;
+}
+
+/**
+ * @brief Set how long a location is served from the cache
+ *
+ * @param ttl_ms The age in ms from which poll() refreshes the location
+*/
+void ASIMLocation::setTTL(uint32_t ttl_ms) {
+	_ttl = ttl_ms;
+}
+
+/**
+ * @brief Request a new location at the next poll(), even if the cached one is fresh
+ *
+*/
+void ASIMLocation::refresh() {
+	_force = true;
+}
+
+/**
+ * @brief Start a refresh when the location expired, the serving cell changed or refresh() was called
+ *
+ * Never waits: the request runs as a job of the ASIMAsync, which must be polled as well. A failed
+ * request is retried after SIM_LOCATION_RETRY ms.
+*/
+void ASIMLocation::poll() {
+	if ((!_async) || (_job.status == JOB_QUEUED) || (_job.status == JOB_RUNNING)) {
+		return;
+	}
+	// the serving cell comes with the +CREG URCs
+	if (_async->idle() && _async->sim->pending()) {
+		_async->sim->dispatchEvents();
+	}
+	if (_failed && ((millis() - _failed_ms) < SIM_LOCATION_RETRY)) {
+		return;
+	}
+	bool changed = _location.valid && cellChanged();
+	if ((!_force) && (!changed) && fresh()) {
+		return;
+	}
+	if (changed) {
+		_stats.cell_changes++;
+	}
+	const ASIMRegistration &reg = _async->sim->getRegistration();
+	_lac = reg.lac;
+	_ci = reg.ci;
+	_force = false;
+	_async->locationAsync(_job).then(refreshed, this);
+}
+
+/**
+ * @brief Get the cached location
+ *
+ * @param lat Pointer to a buffer to hold the latitude in millionths of a degree, left as it is without a location
+ * @param lon Pointer to a buffer to hold the longitude in millionths of a degree
+ * @return bool true if the location is fresh, false if it is stale (its value is still given) or missing
+*/
+bool ASIMLocation::get(int32_t *lat, int32_t *lon) {
+	if (_location.valid) {
+		*lat = _location.lat;
+		*lon = _location.lon;
+	}
+	if (fresh()) {
+		_stats.hits++;
+		return true;
+	}
+	_stats.misses++;
+	return false;
+}
+
+/**
+ * @brief Check if the cached location can be used
+ *
+ * @return true: received within the TTL in the current serving cell, false: otherwise
+*/
+bool ASIMLocation::fresh() {
+	return _location.valid && ((millis() - _location.fixed_ms) < _ttl) && !cellChanged();
+}
+
+/**
+ * @brief Check if a request is queued or running
+ *
+ * @return true: a new location is on its way, false: otherwise
+*/
+bool ASIMLocation::refreshing() {
+	return (_job.status == JOB_QUEUED) || (_job.status == JOB_RUNNING);
+}
+
+/**
+ * @brief Get the cached location and the cell it was requested in
+ *
+ * @return const ASIMCellLocation& The location, valid is false before the first one
+*/
+const ASIMCellLocation &ASIMLocation::location() {
+	return _location;
+}
+
+/**
+ * @brief Check the serving cell against the one of the location
+ *
+ * @return true: the registration tracker reports another cell, false: the same one or none
+*/
+bool ASIMLocation::cellChanged() {
+	if (!_async) {
+		return false;
+	}
+	const ASIMRegistration &reg = _async->sim->getRegistration();
+	if ((reg.lac == 0) && (reg.ci == 0)) {
+		return false;
+	}
+	return (reg.lac != _location.lac) || (reg.ci != _location.ci);
+}
+
+void ASIMLocation::refreshed(ASIMJob &job, void *arg) {
+	((ASIMLocation *)arg)->parse(job.ok());
+}
+
+/**
+ * @brief Take the location from "+CIPGSMLOC: 0,<lon>,<lat>,<date>,<time>"
+ *
+ * @param ok true if the request succeeded
+*/
+void ASIMLocation::parse(bool ok) {
+	const char *p = ok ? strstr_P(_async->sim->replybuffer, PSTR("+CIPGSMLOC: ")) : NULL;
+	p = p ? strchr(p, ',') : NULL;
+	const char *q = p ? strchr(p + 1, ',') : NULL;
+	if (!q) {
+		_failed = true;
+		_failed_ms = millis();
+		_stats.failures++;
+		return;
+	}
+	_failed = false;
+	_location.lon = ASIM::microDegrees(p + 1);
+	_location.lat = ASIM::microDegrees(q + 1);
+	_location.lac = _lac;
+	_location.ci = _ci;
+	_location.fixed_ms = millis();
+	_location.valid = true;
+	_stats.refreshes++;
+}
+
+/**
+ * @brief Get the totals of the service
+ *
+ * @return const ASIMLocationStats& The totals since the last resetStats()
+*/
+const ASIMLocationStats &ASIMLocation::getStats() {
+	return _stats;
+}
+
+/**
+ * @brief Clear the totals
+ *
+*/
+void ASIMLocation::resetStats() {
+	memset(&_stats, 0, sizeof(_stats));
+}
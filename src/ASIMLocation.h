@@ -0,0 +1,61 @@
+/**********************************************************************************************************************************/
+#ifndef ASIM_LOCATION_H
+#define ASIM_LOCATION_H
+
+#include "ASIMAsync.h"
+
+/**********************************************************************************************************************************/
+// the cached cell location, angles in millionths of a degree
+struct ASIMCellLocation {
+	bool valid;					// a location was received, it may be stale
+	int32_t lat;
+	int32_t lon;
+	uint16_t lac;				// serving cell when it was requested
+	uint16_t ci;
+	uint32_t fixed_ms;			// millis() of the location
+};
+
+// totals of the location service
+struct ASIMLocationStats {
+	uint32_t hits;				// reads served by a fresh location
+	uint32_t misses;			// reads of a stale or missing location
+	uint32_t refreshes;			// AT+CIPGSMLOC that returned a location
+	uint32_t failures;
+	uint32_t cell_changes;		// refreshes started because the serving cell changed
+};
+
+/**********************************************************************************************************************************/
+// Keeps the last AT+CIPGSMLOC location of one modem and refreshes it in the background, through its ASIMAsync,
+// when it is older than the TTL or the serving cell changed
+class ASIMLocation {
+	public:
+		ASIMLocation();
+		ASIMLocation(ASIMAsync &async);
+		void begin(ASIMAsync &async);
+		void setTTL(uint32_t ttl_ms);
+		void refresh();
+		void poll();
+		// No modem round trip
+		bool get(int32_t *lat, int32_t *lon);
+		bool fresh();
+		bool refreshing();
+		const ASIMCellLocation &location();
+		const ASIMLocationStats &getStats();
+		void resetStats();
+	private:
+		static void refreshed(ASIMJob &job, void *arg);
+		void parse(bool ok);
+		bool cellChanged();
+		ASIMAsync *_async = NULL;
+		ASIMJob _job;
+		uint32_t _ttl = SIM_LOCATION_TTL;
+		uint32_t _failed_ms = 0;
+		bool _failed = false;
+		bool _force = true;
+		uint16_t _lac = 0;
+		uint16_t _ci = 0;
+		ASIMCellLocation _location;
+		ASIMLocationStats _stats;
+};
+/**********************************************************************************************************************************/
+#endif
@@ -0,0 +1,88 @@
+/**********************************************************************************************************************************/
+#include "ASIMOperator.h"
+
+// The operators with their APN settings, keyed by MCC and MNC. Keep the entries sorted by code (plain byte order),
+// findOperator() does a binary search and the static_assert below rejects an unsorted table.
+// Add your network here or set it at run time with ASIM::setAPN(). The quirks column takes the APN_QUIRK_* flags.
+//
+//	 code		apn						user		password	quirks		type
+#define SIM_OPERATORS(X) \
+	X(20404,	"live.vodafone.com",	"vodafone",	"vodafone",	0,			VODAFONE) \
+	X(20408,	"internet",				"",			"",			0,			UNKNOWN_SIM) \
+	X(23410,	"mobile.o2.co.uk",		"o2web",	"password",	0,			UNKNOWN_SIM) \
+	X(23415,	"internet",				"web",		"web",		0,			VODAFONE) \
+	X(26201,	"internet.telekom",		"telekom",	"tm",		0,			UNKNOWN_SIM) \
+	X(26202,	"web.vodafone.de",		"",			"",			0,			VODAFONE) \
+	X(310260,	"fast.t-mobile.com",	"",			"",			0,			UNKNOWN_SIM) \
+	X(310410,	"broadband",			"",			"",			0,			ATandT) \
+	X(42402,	"etisalat.ae",			"",			"",			0,			ETISALAT) \
+	X(43211,	"mcinet",				"",			"",			0,			MCI) \
+	X(43220,	"RighTel",				"",			"",			0,			RITEL) \
+	X(43235,	"mtnirancell",			"",			"",			0,			IRANCELL)
+
+struct ASIMOperatorEntry {
+	PGM_P code;
+	PGM_P apn;
+	PGM_P user;
+	PGM_P password;
+	uint8_t quirks;
+	uint8_t type;
+};
+
+#define SIM_OP_STRINGS(code, apn, user, password, quirks, type) \
+	static const char op_code_##code[] PROGMEM = #code; \
+	static const char op_apn_##code[] PROGMEM = apn; \
+	static const char op_user_##code[] PROGMEM = user; \
+	static const char op_password_##code[] PROGMEM = password;
+SIM_OPERATORS(SIM_OP_STRINGS)
+
+#define SIM_OP_ENTRY(code, apn, user, password, quirks, type) \
+	{ op_code_##code, op_apn_##code, op_user_##code, op_password_##code, quirks, type },
+static const ASIMOperatorEntry op_table[] PROGMEM = { SIM_OPERATORS(SIM_OP_ENTRY) };
+
+#define SIM_OP_COUNT (sizeof(op_table) / sizeof(op_table[0]))
+
+// The same codes as plain literals, only used by the compiler to check the table order
+#define SIM_OP_LITERAL(code, apn, user, password, quirks, type) #code,
+static constexpr const char *op_sorted_codes[] = { SIM_OPERATORS(SIM_OP_LITERAL) };
+
+static constexpr bool opCodeBefore(const char *a, const char *b) {
+	return (*a == *b) ? ((*a != 0) && opCodeBefore(a + 1, b + 1)) : ((uint8_t)*a < (uint8_t)*b);
+}
+
+static constexpr bool opTableSorted(size_t i) {
+	return ((i + 1) >= SIM_OP_COUNT) || (opCodeBefore(op_sorted_codes[i], op_sorted_codes[i + 1]) && opTableSorted(i + 1));
+}
+
+static_assert(opTableSorted(0), "ASIM operator table must be sorted by code");
+/**********************************************************************************************************************************/
+/**
+ * @brief Find an operator in the table of known networks
+ *
+ * @param code The numeric MCC and MNC of AT+COPS=3,2, e.g. "43235"
+ * @param apn Pointer to hold the APN, the login and the quirks of the operator, its strings point to flash
+ * @return bool true if found, false otherwise (apn is left as it is)
+*/
+bool findOperator(const char *code, ASIMAPN *apn) {
+	uint8_t lo = 0, hi = SIM_OP_COUNT;
+	while (lo < hi) {
+		uint8_t mid = (lo + hi) / 2;
+		int cmp = strcmp_P(code, (PGM_P)pgm_read_ptr(&op_table[mid].code));
+		if (cmp == 0) {
+			apn->apn = (PGM_P)pgm_read_ptr(&op_table[mid].apn);
+			apn->user = (PGM_P)pgm_read_ptr(&op_table[mid].user);
+			apn->password = (PGM_P)pgm_read_ptr(&op_table[mid].password);
+			apn->quirks = pgm_read_byte(&op_table[mid].quirks);
+			apn->type = pgm_read_byte(&op_table[mid].type);
+			apn->flash = true;
+			return true;
+		}
+		if (cmp < 0) {
+			hi = mid;
+		}
+		else {
+			lo = mid + 1;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,17 @@
+/**********************************************************************************************************************************/
+#ifndef ASIM_OPERATOR_H
+#define ASIM_OPERATOR_H
+
+#include "ASIM.h"
+
+/**********************************************************************************************************************************/
+/**
+ * @brief Find an operator in the table of known networks
+ *
+ * @param code The numeric MCC and MNC of AT+COPS=3,2, e.g. "43235"
+ * @param apn Pointer to hold the APN, the login and the quirks of the operator, its strings point to flash
+ * @return bool true if found, false otherwise (apn is left as it is)
+*/
+bool findOperator(const char *code, ASIMAPN *apn);
+/**********************************************************************************************************************************/
+#endif
@@ -0,0 +1,348 @@
+/**********************************************************************************************************************************/
+#include "ASIMPool.h"
+
+#define RSSI_UNKNOWN		99
+
+/**********************************************************************************************************************************/
+/**
+ * @brief Construct a new, empty pool
+ *
+*/
+ASIMPool::ASIMPool() {
+	resetStats();
+}
+
+/**
+ * @brief Add a modem, begin() must have been called on it
+ *
+ * @param sim The modem
+ * @return bool true if added, false if the pool is full
+*/
+bool ASIMPool::add(ASIM &sim) {
+	if (_count >= SIM_POOL_SIZE) {
+		return SIM_FAILED;
+	}
+	ASIMPoolModem &m = _modems[_count++];
+	m.sim = &sim;
+	m.async.begin(sim);
+	m.async.onFinish(finished, this);
+	m.job = NULL;
+	m.signal.status = JOB_IDLE;
+	m.rssi = RSSI_UNKNOWN;
+	m.signal_ms = 0;
+	m.busy_ms = 0;
+	m.done = 0;
+	m.failed = 0;
+	return SIM_OK;
+}
+
+/**
+ * @brief Select how a queued job picks its modem
+ *
+ * @param policy POOL_LEAST_LOADED: the idle modem with the least busy time.
+ * POOL_BEST_SIGNAL: the idle modem with the best signal, modems with an unknown signal come last
+*/
+void ASIMPool::setPolicy(uint8_t policy) {
+	_policy = policy;
+}
+
+/**
+ * @brief Queue an SMS
+ *
+ * @param job The job to fill, it must stay valid until it is done
+ * @param number The receiver number
+ * @param text The message, the modems must be in text mode (see ASIM::setMessageFormat)
+ * @return bool true if queued, false if the queue is full
+*/
+bool ASIMPool::sendSMS(ASIMJob &job, const char *number, const char *text) {
+	job.type = JOB_SMS;
+	job.target = number;
+	job.data = text;
+	job.response = NULL;
+	job.response_size = 0;
+	return submit(job);
+}
+
+/**
+ * @brief Queue an HTTP GET request, the modem opens its GPRS bearer if needed
+ *
+ * @param job The job to fill, it must stay valid until it is done
+ * @param url The URL
+ * @param response Buffer for the response body, NULL to drop it
+ * @param response_size The size of the buffer
+ * @return bool true if queued, false if the queue is full
+*/
+bool ASIMPool::httpGet(ASIMJob &job, const char *url, char *response, uint16_t response_size) {
+	job.type = JOB_HTTP_GET;
+	job.target = url;
+	job.data = NULL;
+	job.response = response;
+	job.response_size = response_size;
+	return submit(job);
+}
+
+/**
+ * @brief Queue an HTTP POST request, the modem opens its GPRS bearer if needed
+ *
+ * @param job The job to fill, it must stay valid until it is done
+ * @param url The URL
+ * @param body The request body
+ * @param response Buffer for the response body, NULL to drop it
+ * @param response_size The size of the buffer
+ * @return bool true if queued, false if the queue is full
+*/
+bool ASIMPool::httpPost(ASIMJob &job, const char *url, const char *body, char *response, uint16_t response_size) {
+	job.type = JOB_HTTP_POST;
+	job.target = url;
+	job.data = body;
+	job.response = response;
+	job.response_size = response_size;
+	return submit(job);
+}
+
+/**
+ * @brief Queue a filled job
+ *
+ * @param job The job
+ * @return bool true if queued, false if the queue is full
+*/
+bool ASIMPool::submit(ASIMJob &job) {
+	if (_queue_count >= SIM_POOL_QUEUE) {
+		return SIM_FAILED;
+	}
+	ASIMAsync::prepare(job);
+	_queue[(_queue_head + _queue_count) % SIM_POOL_QUEUE] = &job;
+	_queue_count++;
+	_stats.submitted++;
+	return SIM_OK;
+}
+
+/**
+ * @brief Run the pool: collect the answers that arrived, start the next commands and dispatch queued jobs
+ *
+ * Never waits, call it from the main loop as often as possible.
+*/
+void ASIMPool::poll() {
+	for (uint8_t i = 0; i < _count; i++) {
+		_modems[i].async.poll();
+	}
+
+	while (_queue_count) {
+		int8_t index = pick();
+		if (index < 0) {
+			break;
+		}
+		ASIMJob *job = _queue[_queue_head];
+		_queue_head = (_queue_head + 1) % SIM_POOL_QUEUE;
+		_queue_count--;
+		ASIMPoolModem &m = _modems[index];
+		m.job = job;
+		job->modem = index;
+		m.async.enqueue(*job);
+		m.async.poll();
+	}
+
+	// the modems left idle refresh their signal quality
+	for (uint8_t i = 0; i < _count; i++) {
+		ASIMPoolModem &m = _modems[i];
+		if ((m.job) || (!m.async.idle())) {
+			continue;
+		}
+		// the registration comes back with a +CREG URC
+		if ((!m.sim->registered()) && m.sim->pending()) {
+			m.sim->dispatchEvents();
+		}
+		if ((m.rssi == RSSI_UNKNOWN) || ((millis() - m.signal_ms) > SIM_POOL_SIGNAL_AGE)) {
+			m.async.commandAsync(m.signal, F("AT+CSQ"));
+			m.signal.modem = i;
+			m.async.poll();
+		}
+	}
+}
+
+/**
+ * @brief Check if all the jobs are finished
+ *
+ * @return true: nothing queued or running, false: otherwise
+*/
+bool ASIMPool::idle() {
+	if (_queue_count) {
+		return false;
+	}
+	for (uint8_t i = 0; i < _count; i++) {
+		if (_modems[i].job) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Get the number of jobs waiting for a modem
+ *
+ * @return uint8_t The number of queued jobs
+*/
+uint8_t ASIMPool::queued() {
+	return _queue_count;
+}
+
+/**
+ * @brief Pick the modem for the next job
+ *
+ * @return int8_t The index of an idle modem, -1 if all are busy
+*/
+int8_t ASIMPool::pick() {
+	int8_t best = -1;
+	for (uint8_t i = 0; i < _count; i++) {
+		ASIMPoolModem &m = _modems[i];
+		// a modem checking its signal is taken when the check ends, an unregistered one when it is back
+		if ((m.job) || (!m.async.idle()) || (!m.sim->registered())) {
+			continue;
+		}
+		if (best < 0) {
+			best = i;
+			continue;
+		}
+		ASIMPoolModem &b = _modems[best];
+		if (_policy == POOL_BEST_SIGNAL) {
+			int8_t rssi = (m.rssi == RSSI_UNKNOWN) ? -1 : m.rssi;
+			int8_t best_rssi = (b.rssi == RSSI_UNKNOWN) ? -1 : b.rssi;
+			if (rssi != best_rssi) {
+				if (rssi > best_rssi) {
+					best = i;
+				}
+				continue;
+			}
+		}
+		if (m.busy_ms < b.busy_ms) {
+			best = i;
+		}
+	}
+	return best;
+}
+
+/**
+ * @brief Called by the runner of a modem when one of its jobs ended
+ *
+ * @param job The job
+ * @param arg The pool
+*/
+void ASIMPool::finished(ASIMJob &job, void *arg) {
+	((ASIMPool *)arg)->finish(job);
+}
+
+/**
+ * @brief Count an ended job and free its modem
+ *
+ * @param job The job or the signal check of the modem
+*/
+void ASIMPool::finish(ASIMJob &job) {
+	// a job queued on the runner by someone else, e.g. an ASIMLink
+	if (job.modem < 0) {
+		return;
+	}
+	ASIMPoolModem &m = _modems[job.modem];
+
+	if (&job == &m.signal) {
+		char *p = strstr_P(m.sim->replybuffer, PSTR("+CSQ: "));
+		if (job.ok() && p) {
+			m.rssi = atoi(p + 6);
+		}
+		m.signal_ms = millis();
+		return;
+	}
+
+	m.busy_ms += job.finished_ms - job.started_ms;
+	if (job.ok()) {
+		m.done++;
+		_stats.done++;
+	}
+	else {
+		m.failed++;
+		_stats.failed++;
+	}
+	_stats.wait_ms += job.started_ms - job.queued_ms;
+	_stats.run_ms += job.finished_ms - job.started_ms;
+	m.job = NULL;
+}
+
+/**
+ * @brief Get the totals of the pool
+ *
+ * @return const ASIMPoolStats& The totals since the last resetStats()
+*/
+const ASIMPoolStats &ASIMPool::getStats() {
+	return _stats;
+}
+
+/**
+ * @brief Get one modem of the pool, its signal and counters
+ *
+ * @param index The modem, 0 to count() - 1
+ * @return const ASIMPoolModem& The modem
+*/
+const ASIMPoolModem &ASIMPool::getModem(uint8_t index) {
+	return _modems[index];
+}
+
+/**
+ * @brief Get the number of modems in the pool
+ *
+ * @return uint8_t The number of modems
+*/
+uint8_t ASIMPool::count() {
+	return _count;
+}
+
+/**
+ * @brief Clear the totals and the per modem counters
+ *
+*/
+void ASIMPool::resetStats() {
+	memset(&_stats, 0, sizeof(_stats));
+	_stats.since_ms = millis();
+	for (uint8_t i = 0; i < _count; i++) {
+		_modems[i].busy_ms = 0;
+		_modems[i].done = 0;
+		_modems[i].failed = 0;
+	}
+}
+
+/**
+ * @brief Print the per modem counters and the throughput of the pool
+ *
+ * @param out The output, e.g. Serial
+*/
+void ASIMPool::printStats(Print &out) {
+	uint32_t elapsed = millis() - _stats.since_ms;
+	uint32_t finished = _stats.done + _stats.failed;
+
+	out.println(F("modem\tdone\tfailed\tbusy\tload%\trssi"));
+	for (uint8_t i = 0; i < _count; i++) {
+		const ASIMPoolModem &m = _modems[i];
+		out.print(i);
+		out.print('\t');
+		out.print(m.done);
+		out.print('\t');
+		out.print(m.failed);
+		out.print('\t');
+		out.print(m.busy_ms);
+		out.print('\t');
+		out.print(elapsed ? (100UL * m.busy_ms / elapsed) : 0UL);
+		out.print('\t');
+		out.println(m.rssi);
+	}
+	out.print(F("jobs "));
+	out.print(finished);
+	out.print('/');
+	out.print(_stats.submitted);
+	out.print(F(" in "));
+	out.print(elapsed);
+	out.print(F(" ms, "));
+	out.print(elapsed ? (60000.0 * _stats.done / elapsed) : 0.0, 1);
+	out.print(F(" jobs/min, avg wait "));
+	out.print(finished ? (_stats.wait_ms / finished) : 0UL);
+	out.print(F(" ms, avg run "));
+	out.print(finished ? (_stats.run_ms / finished) : 0UL);
+	out.println(F(" ms"));
+}
@@ -0,0 +1,68 @@
+/**********************************************************************************************************************************/
+#ifndef ASIM_POOL_H
+#define ASIM_POOL_H
+
+#include "ASIMAsync.h"
+
+/**********************************************************************************************************************************/
+// How a queued job picks its modem
+#define POOL_LEAST_LOADED	0
+#define POOL_BEST_SIGNAL	1
+
+// one modem of the pool
+struct ASIMPoolModem {
+	ASIM *sim;
+	ASIMAsync async;			// runs the jobs of the modem
+	ASIMJob *job;				// running job, NULL when idle
+	ASIMJob signal;				// AT+CSQ of an idle modem
+	uint8_t rssi;				// last +CSQ value, 99 unknown
+	uint32_t signal_ms;
+	uint32_t busy_ms;
+	uint16_t done;
+	uint16_t failed;
+};
+
+// totals of the pool, times in ms
+struct ASIMPoolStats {
+	uint32_t submitted;
+	uint32_t done;
+	uint32_t failed;
+	uint32_t wait_ms;			// time in the queue of the finished jobs
+	uint32_t run_ms;			// time on a modem of the finished jobs
+	uint32_t since_ms;
+};
+
+/**********************************************************************************************************************************/
+class ASIMPool {
+	public:
+		ASIMPool();
+		bool add(ASIM &sim);
+		void setPolicy(uint8_t policy);
+		// Jobs
+		bool sendSMS(ASIMJob &job, const char *number, const char *text);
+		bool httpGet(ASIMJob &job, const char *url, char *response, uint16_t response_size);
+		bool httpPost(ASIMJob &job, const char *url, const char *body, char *response, uint16_t response_size);
+		bool submit(ASIMJob &job);
+		void poll();
+		bool idle();
+		uint8_t queued();
+		// Statistics
+		const ASIMPoolStats &getStats();
+		const ASIMPoolModem &getModem(uint8_t index);
+		uint8_t count();
+		void resetStats();
+		void printStats(Print &out);
+	private:
+		int8_t pick();
+		static void finished(ASIMJob &job, void *arg);
+		void finish(ASIMJob &job);
+		ASIMPoolModem _modems[SIM_POOL_SIZE];
+		uint8_t _count = 0;
+		ASIMJob *_queue[SIM_POOL_QUEUE];
+		uint8_t _queue_head = 0;
+		uint8_t _queue_count = 0;
+		uint8_t _policy = POOL_LEAST_LOADED;
+		ASIMPoolStats _stats;
+};
+/**********************************************************************************************************************************/
+#endif
@@ -0,0 +1,209 @@
+/**********************************************************************************************************************************/
+#include "ASIM.h"
+
+// Every response string the library knows about. Keep the entries sorted by key (plain byte order),
+// classifyResponse() walks the table like a prefix trie and the static_assert below rejects an unsorted table.
+// exact: the key must be the whole line, otherwise it is matched as a prefix (the longest prefix wins)
+//
+//	 id				key							class			value				exact
+#define SIM_RESPONSES(X) \
+	X(CGREG,		"+CGREG: ",					RSP_URC,		URC_CGREG,			false) \
+	X(CLIP,			"+CLIP: ",					RSP_URC,		URC_CLIP,			false) \
+	X(CME_ERROR,	"+CME ERROR: ",				RSP_FINAL,		FINAL_CME_ERROR,	false) \
+	X(CMS_ERROR,	"+CMS ERROR: ",				RSP_FINAL,		FINAL_CMS_ERROR,	false) \
+	X(CMTI,			"+CMTI: ",					RSP_URC,		URC_CMTI,			false) \
+	X(CPIN,			"+CPIN: ",					RSP_URC,		URC_CPIN,			false) \
+	X(CREG,			"+CREG: ",					RSP_URC,		URC_CREG,			false) \
+	X(CUSD,			"+CUSD: ",					RSP_URC,		URC_CUSD,			false) \
+	X(HTTPACTION,	"+HTTPACTION: ",			RSP_URC,		URC_HTTPACTION,		false) \
+	X(PDP_DEACT,	"+PDP: DEACT",				RSP_URC,		URC_PDP_DEACT,		true) \
+	X(SSLSETCERT,	"+SSLSETCERT: ",			RSP_URC,		URC_SSLSETCERT,		false) \
+	X(PROMPT,		"> ",						RSP_FINAL,		FINAL_PROMPT,		true) \
+	X(ALREADY_CON,	"ALREADY CONNECT",			RSP_FINAL,		FINAL_ALREADY_CON,	true) \
+	X(BUSY,			"BUSY",						RSP_FINAL,		FINAL_BUSY,			true) \
+	X(CLOSE_OK,		"CLOSE OK",					RSP_FINAL,		FINAL_CLOSE_OK,		true) \
+	X(CLOSED,		"CLOSED",					RSP_URC,		URC_TCP_CLOSED,		true) \
+	X(CONNECT_FAIL,	"CONNECT FAIL",				RSP_FINAL,		FINAL_CONNECT_FAIL,	true) \
+	X(CONNECT_OK,	"CONNECT OK",				RSP_FINAL,		FINAL_CONNECT_OK,	true) \
+	X(CALL_READY,	"Call Ready",				RSP_URC,		URC_CALL_READY,		true) \
+	X(DOWNLOAD,		"DOWNLOAD",					RSP_FINAL,		FINAL_DOWNLOAD,		true) \
+	X(ERROR,		"ERROR",					RSP_FINAL,		FINAL_ERROR,		true) \
+	X(NO_ANSWER,	"NO ANSWER",				RSP_FINAL,		FINAL_NO_ANSWER,	true) \
+	X(NO_CARRIER,	"NO CARRIER",				RSP_FINAL,		FINAL_NO_CARRIER,	true) \
+	X(NO_DIALTONE,	"NO DIALTONE",				RSP_FINAL,		FINAL_NO_DIALTONE,	true) \
+	X(POWER_DOWN,	"NORMAL POWER DOWN",		RSP_URC,		URC_POWER_DOWN,		true) \
+	X(OK,			"OK",						RSP_FINAL,		FINAL_OK,			true) \
+	X(RDY,			"RDY",						RSP_URC,		URC_RDY,			true) \
+	X(RING,			"RING",						RSP_URC,		URC_RING,			true) \
+	X(SEND_FAIL,	"SEND FAIL",				RSP_FINAL,		FINAL_SEND_FAIL,	true) \
+	X(SEND_OK,		"SEND OK",					RSP_FINAL,		FINAL_SEND_OK,		true) \
+	X(SHUT_OK,		"SHUT OK",					RSP_FINAL,		FINAL_SHUT_OK,		true) \
+	X(SIM800,		"SIM800",					RSP_MODEM,		SIM800,				false) \
+	X(SIM808_R13,	"SIM808 R13",				RSP_MODEM,		SIM808_V1,			false) \
+	X(SIM808_R14,	"SIM808 R14",				RSP_MODEM,		SIM808_V2,			false) \
+	X(SMS_READY,	"SMS Ready",				RSP_URC,		URC_SMS_READY,		true) \
+	X(ST_CONNECTED,	"STATE: CONNECT OK",		RSP_TCP_STATE,	TCP_CONNECTED,		true) \
+	X(ST_CONFIG,	"STATE: IP CONFIG",			RSP_TCP_STATE,	IP_CONFIG,			true) \
+	X(ST_GPRSACT,	"STATE: IP GPRSACT",		RSP_TCP_STATE,	IP_GPRSACT,			true) \
+	X(ST_INITIAL,	"STATE: IP INITIAL",		RSP_TCP_STATE,	IP_INITIAL,			true) \
+	X(ST_START,		"STATE: IP START",			RSP_TCP_STATE,	IP_START,			true) \
+	X(ST_STATUS,	"STATE: IP STATUS",			RSP_TCP_STATE,	IP_STATUS,			true) \
+	X(ST_PDP_DEACT,	"STATE: PDP DEACT",			RSP_TCP_STATE,	PDP_DEACTIVATED,	true) \
+	X(ST_CLOSED,	"STATE: TCP CLOSED",		RSP_TCP_STATE,	TCP_CLOSED,			true) \
+	X(ST_CLOSING,	"STATE: TCP CLOSING",		RSP_TCP_STATE,	TCP_CLOSING,		true) \
+	X(ST_CONNECTING,"STATE: TCP CONNECTING",	RSP_TCP_STATE,	TCP_CONNECTING,		true)
+
+struct ASIMResponseEntry {
+	PGM_P key;
+	uint8_t cls;
+	uint8_t value;
+	bool exact;
+};
+
+#define SIM_RSP_KEY(id, key, cls, value, exact) static const char rsp_key_##id[] PROGMEM = key;
+SIM_RESPONSES(SIM_RSP_KEY)
+
+#define SIM_RSP_ENTRY(id, key, cls, value, exact) { rsp_key_##id, cls, value, exact },
+static const ASIMResponseEntry rsp_table[] PROGMEM = { SIM_RESPONSES(SIM_RSP_ENTRY) };
+
+#define SIM_RSP_COUNT (sizeof(rsp_table) / sizeof(rsp_table[0]))
+
+// The same keys as plain literals, only used by the compiler to check the table order
+#define SIM_RSP_LITERAL(id, key, cls, value, exact) key,
+static constexpr const char *rsp_sorted_keys[] = { SIM_RESPONSES(SIM_RSP_LITERAL) };
+
+static constexpr bool rspKeyBefore(const char *a, const char *b) {
+	return (*a == *b) ? ((*a != 0) && rspKeyBefore(a + 1, b + 1)) : ((uint8_t)*a < (uint8_t)*b);
+}
+
+static constexpr bool rspTableSorted(size_t i) {
+	return ((i + 1) >= SIM_RSP_COUNT) || (rspKeyBefore(rsp_sorted_keys[i], rsp_sorted_keys[i + 1]) && rspTableSorted(i + 1));
+}
+
+static_assert(rspTableSorted(0), "ASIM response table must be sorted by key");
+static_assert(SIM_RSP_COUNT < 255, "ASIM response table is too large");
+/**********************************************************************************************************************************/
+/**
+ * @brief Read a character of a table key from flash
+ *
+ * @param index The table entry
+ * @param pos The character position in the key
+ * @return uint8_t The character, 0 at the end of the key
+*/
+static inline uint8_t rspKeyChar(uint8_t index, uint8_t pos) {
+	PGM_P key = (PGM_P)pgm_read_ptr(&rsp_table[index].key);
+	return pgm_read_byte(key + pos);
+}
+
+/**
+ * @brief Classify one received line against the table of known modem responses
+ *
+ * The table is sorted, so all keys sharing the first n characters of the line form one
+ * contiguous range. Every character of the line narrows that range with two binary
+ * searches, and the line is consumed exactly once.
+ *
+ * @param line Pointer to a null (or CR/LF) terminated line
+ * @param value Pointer to a uint8_t to hold the value of the match (TCP_CONNECTED, FINAL_OK, URC_RING, ...)
+ * @param length Optional pointer to a uint8_t to hold the length of the matched text
+ * @return uint8_t The class of the response (RSP_FINAL, RSP_URC, ...), RSP_UNKNOWN if nothing matched
+*/
+uint8_t classifyResponse(const char *line, uint8_t *value, uint8_t *length) {
+	uint8_t lo = 0, hi = SIM_RSP_COUNT;
+	uint8_t best = 255, best_len = 0;
+
+	for (uint8_t pos = 0; pos < 255; pos++) {
+		uint8_t c = line[pos];
+		if ((c == '\r') || (c == '\n')) c = 0;
+
+		// A key ending at this position sorts before the longer keys of the range
+		if ((lo < hi) && (rspKeyChar(lo, pos) == 0)) {
+			if ((c == 0) || (!pgm_read_byte(&rsp_table[lo].exact))) {
+				best = lo;
+				best_len = pos;
+			}
+			lo++;
+		}
+
+		if ((c == 0) || (lo >= hi)) break;
+
+		// Keep only the keys continuing with c
+		uint8_t l = lo, h = hi, m;
+		while (l < h) {
+			m = (l + h) / 2;
+			if (rspKeyChar(m, pos) < c) l = m + 1;
+			else h = m;
+		}
+		lo = l;
+		h = hi;
+		while (l < h) {
+			m = (l + h) / 2;
+			if (rspKeyChar(m, pos) <= c) l = m + 1;
+			else h = m;
+		}
+		hi = l;
+	}
+
+	if (best == 255) {
+		*value = 0;
+		if (length) *length = 0;
+		return RSP_UNKNOWN;
+	}
+
+	*value = pgm_read_byte(&rsp_table[best].value);
+	if (length) *length = best_len;
+	return pgm_read_byte(&rsp_table[best].cls);
+}
+
+/**
+ * @brief Find the text of a response, e.g. for printing a final result code
+ *
+ * @param cls The class of the response (RSP_FINAL, RSP_URC, ...)
+ * @param value The value of the response (FINAL_OK, URC_RING, ...)
+ * @return PGM_P The key in flash, an empty string if there is no such response
+*/
+PGM_P responseKey(uint8_t cls, uint8_t value) {
+	for (uint8_t i = 0; i < SIM_RSP_COUNT; i++) {
+		if ((pgm_read_byte(&rsp_table[i].cls) == cls) && (pgm_read_byte(&rsp_table[i].value) == value)) {
+			return (PGM_P)pgm_read_ptr(&rsp_table[i].key);
+		}
+	}
+	return PSTR("");
+}
+
+// Numeric result codes (ATV0), the code is the index
+struct ASIMNumericEntry {
+	PGM_P key;
+	uint8_t cls;
+	uint8_t value;
+};
+
+static const ASIMNumericEntry numeric_table[] PROGMEM = {
+	{ rsp_key_OK,			RSP_FINAL,		FINAL_OK },				// 0
+	{ NULL,					RSP_UNKNOWN,	0 },					// 1 CONNECT, data calls only
+	{ rsp_key_RING,			RSP_URC,		URC_RING },				// 2
+	{ rsp_key_NO_CARRIER,	RSP_FINAL,		FINAL_NO_CARRIER },		// 3
+	{ rsp_key_ERROR,		RSP_FINAL,		FINAL_ERROR },			// 4
+	{ NULL,					RSP_UNKNOWN,	0 },					// 5 not used
+	{ rsp_key_NO_DIALTONE,	RSP_FINAL,		FINAL_NO_DIALTONE },	// 6
+	{ rsp_key_BUSY,			RSP_FINAL,		FINAL_BUSY },			// 7
+	{ rsp_key_NO_ANSWER,	RSP_FINAL,		FINAL_NO_ANSWER },		// 8
+};
+
+/**
+ * @brief Classify a numeric result code (ATV0)
+ *
+ * @param code The digit sent by the modem ('0' for OK, '4' for ERROR, ...)
+ * @param value Pointer to a uint8_t to hold the value of the code (FINAL_OK, URC_RING, ...)
+ * @param text Optional pointer to hold the text of the code in flash ("OK", "ERROR", ...)
+ * @return uint8_t The class of the code (RSP_FINAL or RSP_URC), RSP_UNKNOWN for other characters
+*/
+uint8_t classifyNumeric(char code, uint8_t *value, PGM_P *text) {
+	uint8_t index = code - '0';
+	if (index >= sizeof(numeric_table) / sizeof(numeric_table[0])) {
+		*value = 0;
+		return RSP_UNKNOWN;
+	}
+	*value = pgm_read_byte(&numeric_table[index].value);
+	if (text) *text = (PGM_P)pgm_read_ptr(&numeric_table[index].key);
+	return pgm_read_byte(&numeric_table[index].cls);
+}
@@ -0,0 +1,82 @@
+/**********************************************************************************************************************************/
+#ifndef ASIM_RESPONSE_H
+#define ASIM_RESPONSE_H
+
+#include <Arduino.h>
+
+/**********************************************************************************************************************************/
+// Response classes returned by classifyResponse()
+#define RSP_UNKNOWN			0
+#define RSP_FINAL			1
+#define RSP_TCP_STATE		2
+#define RSP_MODEM			3
+#define RSP_OPERATOR		4
+#define RSP_URC				5
+
+// Final result codes (RSP_FINAL)
+#define FINAL_OK			1
+#define FINAL_ERROR			2
+#define FINAL_CME_ERROR		3
+#define FINAL_CMS_ERROR		4
+#define FINAL_SHUT_OK		5
+#define FINAL_SEND_OK		6
+#define FINAL_SEND_FAIL		7
+#define FINAL_CONNECT_OK	8
+#define FINAL_CONNECT_FAIL	9
+#define FINAL_ALREADY_CON	10
+#define FINAL_CLOSE_OK		11
+#define FINAL_DOWNLOAD		12
+#define FINAL_PROMPT		13
+#define FINAL_NO_CARRIER	14
+#define FINAL_BUSY			15
+#define FINAL_NO_ANSWER		16
+#define FINAL_NO_DIALTONE	17
+
+// Unsolicited result codes (RSP_URC)
+#define URC_RING			1
+#define URC_CLIP			2
+#define URC_CMTI			3
+#define URC_CREG			4
+#define URC_CGREG			5
+#define URC_PDP_DEACT		6
+#define URC_HTTPACTION		7
+#define URC_CUSD			8
+#define URC_TCP_CLOSED		9
+#define URC_CALL_READY		10
+#define URC_SMS_READY		11
+#define URC_POWER_DOWN		12
+#define URC_RDY				13
+#define URC_CPIN			14
+#define URC_SSLSETCERT		15
+
+/**********************************************************************************************************************************/
+/**
+ * @brief Classify one received line against the table of known modem responses
+ *
+ * @param line Pointer to a null (or CR/LF) terminated line
+ * @param value Pointer to a uint8_t to hold the value of the match (TCP_CONNECTED, FINAL_OK, URC_RING, ...)
+ * @param length Optional pointer to a uint8_t to hold the length of the matched text
+ * @return uint8_t The class of the response (RSP_FINAL, RSP_URC, ...), RSP_UNKNOWN if nothing matched
+*/
+uint8_t classifyResponse(const char *line, uint8_t *value, uint8_t *length = NULL);
+
+/**
+ * @brief Find the text of a response, e.g. for printing a final result code
+ *
+ * @param cls The class of the response (RSP_FINAL, RSP_URC, ...)
+ * @param value The value of the response (FINAL_OK, URC_RING, ...)
+ * @return PGM_P The key in flash, an empty string if there is no such response
+*/
+PGM_P responseKey(uint8_t cls, uint8_t value);
+
+/**
+ * @brief Classify a numeric result code (ATV0)
+ *
+ * @param code The digit sent by the modem ('0' for OK, '4' for ERROR, ...)
+ * @param value Pointer to a uint8_t to hold the value of the code (FINAL_OK, URC_RING, ...)
+ * @param text Optional pointer to hold the text of the code in flash ("OK", "ERROR", ...)
+ * @return uint8_t The class of the code (RSP_FINAL or RSP_URC), RSP_UNKNOWN for other characters
+*/
+uint8_t classifyNumeric(char code, uint8_t *value, PGM_P *text = NULL);
+/**********************************************************************************************************************************/
+#endif
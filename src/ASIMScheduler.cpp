@@ -0,0 +1,215 @@
+/**********************************************************************************************************************************/
+#include "ASIMScheduler.h"
+
+#define RSSI_UNKNOWN		99
+
+/**********************************************************************************************************************************/
+/**
+ * @brief Construct a scheduler for the modem run by async
+ *
+ * @param async The runner of the modem
+ * @param link The monitor of the same modem, polled by the scheduler
+*/
+ASIMScheduler::ASIMScheduler(ASIMAsync &async, ASIMLink &link) : _async(async), _link(link) {
+	resetStats();
+}
+
+/**
+ * @brief Set the link a bulk transfer waits for
+ *
+ * @param min_rssi The lowest average RSSI of the link monitor, 0 to 31
+ * @param max_rtt The highest average ping round trip in ms, not checked until a ping succeeded
+*/
+void ASIMScheduler::setThresholds(uint8_t min_rssi, uint16_t max_rtt) {
+	_min_rssi = min_rssi;
+	_max_rtt = max_rtt;
+}
+
+/**
+ * @brief Schedule an HTTP GET request, the modem opens its GPRS bearer if needed
+ *
+ * @param job The job to fill, it must stay valid until it ends
+ * @param url The URL
+ * @param response Buffer for the response body, NULL to drop it
+ * @param response_size The size of the buffer
+ * @param cls TRANSFER_URGENT or TRANSFER_BULK
+ * @param deadline Longest time in ms a bulk transfer waits for a good link
+ * @return ASIMJob& The job
+*/
+ASIMJob &ASIMScheduler::httpGet(ASIMJob &job, const char *url, char *response, uint16_t response_size, uint8_t cls,
+	uint32_t deadline) {
+	job.type = JOB_HTTP_GET;
+	job.target = url;
+	job.data = NULL;
+	job.response = response;
+	job.response_size = response_size;
+	return submit(job, cls, deadline);
+}
+
+/**
+ * @brief Schedule an HTTP POST request, the modem opens its GPRS bearer if needed
+ *
+ * @param job The job to fill, it must stay valid until it ends
+ * @param url The URL
+ * @param body The request body
+ * @param response Buffer for the response body, NULL to drop it
+ * @param response_size The size of the buffer
+ * @param cls TRANSFER_URGENT or TRANSFER_BULK
+ * @param deadline Longest time in ms a bulk transfer waits for a good link
+ * @return ASIMJob& The job
+*/
+ASIMJob &ASIMScheduler::httpPost(ASIMJob &job, const char *url, const char *body, char *response, uint16_t response_size,
+	uint8_t cls, uint32_t deadline) {
+	job.type = JOB_HTTP_POST;
+	job.target = url;
+	job.data = body;
+	job.response = response;
+	job.response_size = response_size;
+	return submit(job, cls, deadline);
+}
+
+/**
+ * @brief Schedule sending data on the TCP connection
+ *
+ * The connection must still be open when a held transfer is released.
+ *
+ * @param job The job to fill, it must stay valid until it ends
+ * @param data The data
+ * @param cls TRANSFER_URGENT or TRANSFER_BULK
+ * @param deadline Longest time in ms a bulk transfer waits for a good link
+ * @return ASIMJob& The job
+*/
+ASIMJob &ASIMScheduler::sendTCPData(ASIMJob &job, const char *data, uint8_t cls, uint32_t deadline) {
+	job.type = JOB_TCP_SEND;
+	job.data = data;
+	job.response = NULL;
+	job.response_size = 0;
+	return submit(job, cls, deadline);
+}
+
+/**
+ * @brief Schedule a filled job
+ *
+ * An urgent job goes to the runner at once. A bulk job is held until poll() finds the link good or
+ * its deadline passed, it stays JOB_QUEUED meanwhile and its queued_ms counts the hold time too.
+ *
+ * @param job The job
+ * @param cls TRANSFER_URGENT or TRANSFER_BULK
+ * @param deadline Longest time in ms a bulk transfer waits for a good link
+ * @return ASIMJob& The job, JOB_FAILED if the queue is full
+*/
+ASIMJob &ASIMScheduler::submit(ASIMJob &job, uint8_t cls, uint32_t deadline) {
+	if (cls == TRANSFER_URGENT) {
+		_stats.urgent++;
+		return _async.submit(job);
+	}
+
+	ASIMAsync::prepare(job);
+	if (_held_count >= SIM_SCHED_QUEUE) {
+		_stats.rejected++;
+		job.status = JOB_FAILED;
+		job.finished_ms = job.queued_ms;
+		return job;
+	}
+	Held &h = _held[_held_count++];
+	h.job = &job;
+	h.since_ms = job.queued_ms;
+	h.deadline = deadline;
+	_stats.bulk++;
+	if (!linkGood()) {
+		_stats.deferred++;
+	}
+	return job;
+}
+
+/**
+ * @brief Run the link monitor and the runner and release the held transfers that may go
+ *
+ * Never waits, call it from the main loop as often as possible. Transfers past their deadline go first,
+ * then the others in order while the link is good. They only fill the free places of the runner queue.
+*/
+void ASIMScheduler::poll() {
+	_link.poll();
+	_async.poll();
+
+	for (uint8_t i = 0; (i < _held_count) && (_async.queued() < SIM_ASYNC_QUEUE);) {
+		if ((millis() - _held[i].since_ms) >= _held[i].deadline) {
+			release(i, true);
+		}
+		else {
+			i++;
+		}
+	}
+	if (linkGood()) {
+		while (_held_count && (_async.queued() < SIM_ASYNC_QUEUE)) {
+			release(0, false);
+		}
+	}
+}
+
+/**
+ * @brief Check the link against the thresholds
+ *
+ * A link is good once a ping was answered, the last ping was not lost and the averages are within the
+ * thresholds. Without a measured round trip the bulk transfers wait for their deadline.
+ *
+ * @return true: the monitor sampled the link and its averages are good enough for a bulk transfer
+*/
+bool ASIMScheduler::linkGood() {
+	const ASIMLinkQuality &q = _link.quality();
+	if ((!q.updated_ms) || (q.rssi_avg == RSSI_UNKNOWN) || (q.rssi_avg < _min_rssi)) {
+		return false;
+	}
+	return q.rtt && (!q.ping_lost) && (q.rtt_avg <= _max_rtt);
+}
+
+/**
+ * @brief Get the queue depth
+ *
+ * @return uint8_t The number of held bulk transfers
+*/
+uint8_t ASIMScheduler::held() {
+	return _held_count;
+}
+
+/**
+ * @brief Hand a held transfer to the runner, the queue has a free place
+ *
+ * @param index The transfer in the held list
+ * @param forced true if its deadline passed, false if the link is good
+*/
+void ASIMScheduler::release(uint8_t index, bool forced) {
+	Held h = _held[index];
+	_held_count--;
+	memmove(&_held[index], &_held[index + 1], (_held_count - index) * sizeof(Held));
+
+	uint32_t waited = millis() - h.since_ms;
+	_stats.defer_ms += waited;
+	if (waited > _stats.defer_max) {
+		_stats.defer_max = waited;
+	}
+	if (forced) {
+		_stats.forced++;
+	}
+	else {
+		_stats.released++;
+	}
+	_async.enqueue(*h.job);
+}
+
+/**
+ * @brief Get the totals of the scheduler
+ *
+ * @return const ASIMSchedulerStats& The totals since the last resetStats()
+*/
+const ASIMSchedulerStats &ASIMScheduler::getStats() {
+	return _stats;
+}
+
+/**
+ * @brief Clear the totals
+ *
+*/
+void ASIMScheduler::resetStats() {
+	memset(&_stats, 0, sizeof(_stats));
+}
@@ -0,0 +1,60 @@
+/**********************************************************************************************************************************/
+#ifndef ASIM_SCHEDULER_H
+#define ASIM_SCHEDULER_H
+
+#include "ASIMLink.h"
+
+/**********************************************************************************************************************************/
+// Transfer classes
+#define TRANSFER_URGENT		0	// runs at once
+#define TRANSFER_BULK		1	// waits for a good link or its deadline
+
+// totals of the scheduler, times in ms
+struct ASIMSchedulerStats {
+	uint32_t urgent;
+	uint32_t bulk;
+	uint32_t released;			// bulk jobs released on a good link
+	uint32_t forced;			// bulk jobs released by their deadline on a poor link
+	uint32_t deferred;			// bulk jobs that had to wait for the link
+	uint32_t rejected;			// bulk jobs refused by a full queue
+	uint32_t defer_ms;			// hold time of the released bulk jobs
+	uint32_t defer_max;
+};
+
+/**********************************************************************************************************************************/
+// Holds bulk HTTP and TCP transfers of one modem until ASIMLink measures a good link, urgent ones pass at once
+class ASIMScheduler {
+	public:
+		ASIMScheduler(ASIMAsync &async, ASIMLink &link);
+		void setThresholds(uint8_t min_rssi, uint16_t max_rtt);
+		// Transfers, every call returns its job
+		ASIMJob &httpGet(ASIMJob &job, const char *url, char *response, uint16_t response_size,
+			uint8_t cls = TRANSFER_BULK, uint32_t deadline = SIM_SCHED_DEADLINE);
+		ASIMJob &httpPost(ASIMJob &job, const char *url, const char *body, char *response, uint16_t response_size,
+			uint8_t cls = TRANSFER_BULK, uint32_t deadline = SIM_SCHED_DEADLINE);
+		ASIMJob &sendTCPData(ASIMJob &job, const char *data, uint8_t cls = TRANSFER_BULK, uint32_t deadline = SIM_SCHED_DEADLINE);
+		ASIMJob &submit(ASIMJob &job, uint8_t cls, uint32_t deadline = SIM_SCHED_DEADLINE);
+		// Run
+		void poll();
+		bool linkGood();
+		uint8_t held();
+		// Statistics
+		const ASIMSchedulerStats &getStats();
+		void resetStats();
+	private:
+		struct Held {
+			ASIMJob *job;
+			uint32_t since_ms;
+			uint32_t deadline;
+		};
+		void release(uint8_t index, bool forced);
+		ASIMAsync &_async;
+		ASIMLink &_link;
+		uint8_t _min_rssi = SIM_SCHED_MIN_RSSI;
+		uint16_t _max_rtt = SIM_SCHED_MAX_RTT;
+		Held _held[SIM_SCHED_QUEUE];
+		uint8_t _held_count = 0;
+		ASIMSchedulerStats _stats;
+};
+/**********************************************************************************************************************************/
+#endif